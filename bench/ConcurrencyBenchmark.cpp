@@ -0,0 +1,237 @@
+#include <chrono>
+#include <thread>
+#include "WitcherTracker.h"
+
+using namespace std;
+
+/**
+ * @brief Concurrency benchmark for the thread-safe WitcherTracker
+ *
+ * Runs the same mixed workload (loots, brews, encounters, learns and queries)
+ * against a single-threaded tracker guarded by one global mutex and against a
+ * concurrent tracker with per-subsystem locks, for an increasing number of
+ * threads, and prints the throughput of each.
+ */
+
+static const int OPS_PER_THREAD = 20000;
+
+/**
+ * @brief Builds the command mix executed by one benchmark thread
+ * @param threadId Index of the thread; selects its private item names
+ * @return Command lines to execute in order
+ *
+ * Each thread mostly touches its own ingredients, the way separate player
+ * sessions sharing one tracker would, with a share of shared-knowledge reads.
+ */
+static vector<string> buildWorkload(int threadId)
+{
+    string suffix(1, static_cast<char>('a' + threadId % 26));
+    string herb = "Herb" + suffix;
+    string root = "Root" + suffix;
+
+    vector<string> lines;
+    for (int i = 0; i < OPS_PER_THREAD; ++i)
+    {
+        switch (i % 10)
+        {
+        case 0:
+        case 1:
+            lines.push_back("Geralt loots 2 " + herb + ", 1 " + root);
+            break;
+        case 2:
+            lines.push_back("Geralt brews Elixir" + suffix);
+            break;
+        case 3:
+            lines.push_back("Geralt encounters a Griffin");
+            break;
+        case 4:
+        case 5:
+            lines.push_back("Total ingredient " + herb + " ?");
+            break;
+        case 6:
+            lines.push_back("What is effective against Griffin ?");
+            break;
+        case 7:
+            lines.push_back("What is in Elixir" + suffix + " ?");
+            break;
+        case 8:
+            lines.push_back("Total potion Elixir" + suffix + " ?");
+            break;
+        default:
+            lines.push_back("Geralt learns Igni sign is effective against Griffin");
+            break;
+        }
+    }
+    return lines;
+}
+
+/**
+ * @brief Teaches the formulas and effectiveness every workload relies on
+ * @param tracker Tracker to prepare
+ * @param threads Number of threads that will run
+ */
+static void prepareTracker(WitcherTracker &tracker, int threads)
+{
+    ostringstream sink;
+    for (int t = 0; t < threads; ++t)
+    {
+        string suffix(1, static_cast<char>('a' + t % 26));
+        tracker.executeLine("Geralt learns Elixir" + suffix + " potion consists of 2 Herb" + suffix + ", 1 Root" + suffix, sink);
+    }
+    tracker.executeLine("Geralt learns Igni sign is effective against Griffin", sink);
+}
+
+/**
+ * @brief Runs the workload on the given number of threads
+ * @param threads Thread count
+ * @param concurrent true for the fine-grained tracker, false for a global mutex
+ * @return Throughput in commands per second
+ */
+static double runBenchmark(int threads, bool concurrent)
+{
+    WitcherTracker tracker(concurrent);
+    mutex globalMutex;
+    prepareTracker(tracker, threads);
+
+    vector<vector<string>> workloads;
+    for (int t = 0; t < threads; ++t)
+    {
+        workloads.push_back(buildWorkload(t));
+    }
+
+    auto start = chrono::steady_clock::now();
+
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&, t]
+                             {
+                                 ostringstream out;
+                                 for (const auto &line : workloads[t])
+                                 {
+                                     if (concurrent)
+                                     {
+                                         tracker.executeLine(line, out);
+                                     }
+                                     else
+                                     {
+                                         lock_guard<mutex> guard(globalMutex);
+                                         tracker.executeLine(line, out);
+                                     }
+                                     out.str("");
+                                 } });
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    return threads * OPS_PER_THREAD / elapsed.count();
+}
+
+/**
+ * @brief Runs shared-stash traffic against a locked Inventory or a SharedStash
+ * @param threads Thread count
+ * @param lockFree true for SharedStash, false for Inventory behind one mutex
+ * @return Throughput in operations per second
+ * 
+ * Every session loots into the same few ingredients and brews from them,
+ * which is the worst case for a single inventory lock.
+ */
+static double runStashBenchmark(int threads, bool lockFree)
+{
+    Inventory inventory;
+    mutex inventoryMutex;
+    SharedStash stash;
+
+    Potion elixir("Elixir");
+    elixir.addIngredient("Herb", 2);
+    elixir.addIngredient("Root", 1);
+
+    auto start = chrono::steady_clock::now();
+
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&]
+                             {
+                                 for (int i = 0; i < OPS_PER_THREAD; ++i)
+                                 {
+                                     if (lockFree)
+                                     {
+                                         switch (i % 4)
+                                         {
+                                         case 0:
+                                             stash.addIngredient("Herb", 2);
+                                             stash.addIngredient("Root", 1);
+                                             break;
+                                         case 1:
+                                             stash.brew(elixir);
+                                             break;
+                                         default:
+                                             stash.getIngredientQuantity("Herb");
+                                             break;
+                                         }
+                                         continue;
+                                     }
+
+                                     lock_guard<mutex> guard(inventoryMutex);
+                                     switch (i % 4)
+                                     {
+                                     case 0:
+                                         inventory.addIngredient("Herb", 2);
+                                         inventory.addIngredient("Root", 1);
+                                         break;
+                                     case 1:
+                                         if (inventory.getIngredientQuantity("Herb") >= 2 && inventory.getIngredientQuantity("Root") >= 1)
+                                         {
+                                             inventory.removeIngredient("Herb", 2);
+                                             inventory.removeIngredient("Root", 1);
+                                             inventory.addPotion("Elixir", 1);
+                                         }
+                                         break;
+                                     default:
+                                         inventory.getIngredientQuantity("Herb");
+                                         break;
+                                     }
+                                 } });
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    return threads * OPS_PER_THREAD / elapsed.count();
+}
+
+/**
+ * @brief Benchmark entry point
+ * @return 0 on completion
+ */
+int main()
+{
+    int maxThreads = static_cast<int>(thread::hardware_concurrency());
+    if (maxThreads < 1)
+        maxThreads = 1;
+
+    cout << "threads  global-mutex ops/s  fine-grained ops/s  speedup\n";
+    for (int threads = 1; threads <= max(maxThreads, 8); threads *= 2)
+    {
+        double global = runBenchmark(threads, false);
+        double fine = runBenchmark(threads, true);
+        cout << threads << "  " << static_cast<long>(global) << "  "
+             << static_cast<long>(fine) << "  " << fine / global << "\n";
+    }
+
+    cout << "\nthreads  locked-inventory ops/s  shared-stash ops/s  speedup\n";
+    for (int threads = 1; threads <= max(maxThreads, 8); threads *= 2)
+    {
+        double locked = runStashBenchmark(threads, false);
+        double lockFree = runStashBenchmark(threads, true);
+        cout << threads << "  " << static_cast<long>(locked) << "  "
+             << static_cast<long>(lockFree) << "  " << lockFree / locked << "\n";
+    }
+    return 0;
+}
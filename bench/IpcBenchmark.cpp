@@ -0,0 +1,104 @@
+#include <chrono>
+#include <thread>
+#include <unistd.h>
+#include "WitcherTracker.h"
+
+using namespace std;
+
+/**
+ * @brief Shared-memory IPC benchmark
+ *
+ * Executes the same cheap query directly, then through an IpcChannel
+ * served by another thread, as command lines and as prepared executions,
+ * sending requests in batches so both rings stay busy. The difference to
+ * the direct time is the per-command cost of the transport. With a single
+ * core the two sides take turns through the futex and the numbers mostly
+ * measure context switches.
+ */
+
+static const int COMMANDS = 200000;
+static const int BATCH = 64;
+
+/**
+ * @brief Nanoseconds per command of a timed loop
+ */
+template <class Body>
+static double nanosPerCommand(Body body)
+{
+    auto start = chrono::steady_clock::now();
+    body();
+    chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+    return elapsed.count() / COMMANDS;
+}
+
+/**
+ * @brief Benchmark entry point
+ * @return 0 on completion, 1 if the shared-memory segment cannot be created
+ */
+int main()
+{
+    const string query = "Total ingredient Rebis ?";
+    string segment = "/witchertracker-bench-" + to_string(getpid());
+
+    WitcherTracker tracker;
+    ostringstream sink;
+    tracker.executeLine("Geralt loots 5 Rebis", sink);
+    int handle = tracker.prepare("Total ingredient Rebis ?");
+
+    double direct = nanosPerCommand([&]
+                                    {
+                                        for (int i = 0; i < COMMANDS; ++i)
+                                        {
+                                            sink.str("");
+                                            tracker.executeLine(query, sink);
+                                        } });
+
+    IpcChannel server;
+    IpcChannel client;
+    if (!server.create(segment) || !client.attach(segment))
+    {
+        cerr << "Cannot create shared-memory segment " << segment << "\n";
+        return 1;
+    }
+
+    atomic<bool> done(false);
+    thread serving([&]
+                   {
+                       while (!done.load())
+                           server.serveOne(tracker, 10);
+                   });
+
+    int status;
+    string output;
+    double lines = nanosPerCommand([&]
+                                   {
+                                       for (int i = 0; i < COMMANDS; i += BATCH)
+                                       {
+                                           for (int j = 0; j < BATCH; ++j)
+                                               client.sendLine(query);
+                                           for (int j = 0; j < BATCH; ++j)
+                                               client.receive(status, output);
+                                       } });
+
+    vector<int> noParams;
+    double prepared = nanosPerCommand([&]
+                                      {
+                                          for (int i = 0; i < COMMANDS; i += BATCH)
+                                          {
+                                              for (int j = 0; j < BATCH; ++j)
+                                                  client.sendExecute(handle, noParams);
+                                              for (int j = 0; j < BATCH; ++j)
+                                                  client.receive(status, output);
+                                          } });
+
+    done.store(true);
+    serving.join();
+
+    cout << fixed << setprecision(1);
+    cout << "path                 ns/command  transport ns/command\n";
+    cout << "direct executeLine   " << direct << "\n";
+    cout << "ipc command lines    " << lines << "  " << lines - direct << "\n";
+    cout << "ipc prepared         " << prepared << "  " << prepared - direct << "\n";
+    cout << "last response: " << output;
+    return 0;
+}
@@ -0,0 +1,452 @@
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "WitcherTracker.h"
+
+using namespace std;
+
+/**
+ * @brief Open-loop load generator for a tracker started with --serve
+ *
+ * Sends commands from many sessions (one TCP connection each) at a fixed
+ * arrival rate, whether or not earlier commands have been answered, and
+ * measures each latency from the time the command was scheduled to be
+ * sent, not from when it actually went out. A closed-loop client waits
+ * for each response before sending the next command, so a stalled server
+ * also stalls the load and the stall shows up as one slow request instead
+ * of as every request that should have arrived meanwhile (coordinated
+ * omission). Here a stall delays every command scheduled during it, and
+ * the histogram shows it.
+ *
+ * Usage: witchertracker_load PORT [--host ADDR] [--sessions N] [--threads N]
+ *        [--rates R1,R2,...] [--seconds S] [--mix FILE]
+ *
+ * For every rate (commands per second over all sessions) the percentile
+ * distribution is printed in HdrHistogram's text layout; a final table
+ * gives achieved throughput against latency for all rates. --mix replays
+ * the command lines of a log (cycled, one offset per session) instead of
+ * the built-in mix of loots, brews, encounters, learns and queries.
+ */
+
+/**
+ * @struct LoadOptions
+ * @brief Command-line configuration
+ */
+struct LoadOptions
+{
+    string host;
+    int port;
+    int sessions;
+    int threads;
+    vector<double> rates;
+    double seconds;
+    string mixFile;
+
+    LoadOptions() : host("127.0.0.1"), port(0), sessions(16), threads(2), rates{1000, 5000, 10000, 20000}, seconds(5) {}
+};
+
+/**
+ * @struct Session
+ * @brief One connection and the scheduled send times of its unanswered commands
+ */
+struct Session
+{
+    int fd;
+    vector<string> lines;       ///< Commands cycled by this session
+    size_t nextLine;            ///< Index of the next command to send
+    deque<uint64_t> pending;    ///< Intended send times, oldest first (answers arrive in order)
+    string input;               ///< Received bytes not yet split into lines
+};
+
+/**
+ * @brief Builds the built-in command mix of one session
+ * @param session Index of the session; selects its private item names
+ * @return Command lines cycled by the session
+ *
+ * Roughly the shape of a play log: mostly loots and inventory queries,
+ * some brews and encounters, occasional knowledge updates.
+ */
+static vector<string> builtinMix(int session)
+{
+    string suffix = to_string(session);
+    string herb = "Herb" + suffix;
+    string root = "Root" + suffix;
+    string elixir = "Elixir" + suffix;
+
+    return {"Geralt loots 2 " + herb + ", 1 " + root,
+            "Total ingredient " + herb + " ?",
+            "Geralt brews " + elixir,
+            "Geralt loots 3 " + herb + ", 2 " + root,
+            "What is effective against Griffin ?",
+            "Geralt encounters a Griffin",
+            "Total potion " + elixir + " ?",
+            "Geralt loots 1 " + root,
+            "What is in " + elixir + " ?",
+            "Total ingredient ?",
+            "Geralt brews " + elixir,
+            "Geralt learns Igni sign is effective against Griffin"};
+}
+
+/**
+ * @brief Commands a session sends once before measuring
+ * @param session Index of the session
+ * @return Setup lines for the built-in mix
+ */
+static vector<string> builtinSetup(int session)
+{
+    string suffix = to_string(session);
+    return {"Geralt learns Elixir" + suffix + " potion consists of 2 Herb" + suffix + ", 1 Root" + suffix,
+            "Geralt learns Quen sign is effective against Griffin"};
+}
+
+/**
+ * @brief Reads the command lines of a log, skipping "Exit" and blank lines
+ * @param path Log file
+ * @return Commands in file order
+ */
+static vector<string> readMix(const string &path)
+{
+    vector<string> lines;
+    ifstream in(path);
+    string line;
+    while (getline(in, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!line.empty() && line != "Exit")
+            lines.push_back(line);
+    }
+    return lines;
+}
+
+/**
+ * @brief Opens a TCP connection with Nagle disabled
+ * @return Socket descriptor, -1 on failure
+ */
+static int connectTo(const string &host, int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1 ||
+        connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+    {
+        ::close(fd);
+        return -1;
+    }
+
+    int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    return fd;
+}
+
+/**
+ * @brief Sends a whole command line
+ * @return false if the connection failed
+ */
+static bool sendLine(int fd, const string &line)
+{
+    string request = line + "\n";
+    for (size_t sent = 0; sent < request.size();)
+    {
+        ssize_t n = send(fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/**
+ * @brief Reads what a session has received and records a latency per answer
+ * @param session Session whose socket is readable
+ * @param latency Histogram receiving one value per answered command
+ * @param completed Incremented per answered command
+ * @return false if the connection was closed
+ */
+static bool receiveAnswers(Session &session, LatencyHistogram &latency, uint64_t &completed)
+{
+    char buffer[65536];
+    ssize_t received = recv(session.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (received == 0)
+        return false;
+    if (received < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+
+    uint64_t now = nowNanos();
+    session.input.append(buffer, static_cast<size_t>(received));
+    size_t start = 0;
+    for (size_t end; (end = session.input.find('\n', start)) != string::npos; start = end + 1)
+    {
+        if (session.pending.empty())
+            continue;
+        latency.record(now - session.pending.front());
+        session.pending.pop_front();
+        completed++;
+    }
+    session.input.erase(0, start);
+    return true;
+}
+
+/**
+ * @struct StepResult
+ * @brief Outcome of one thread at one rate
+ */
+struct StepResult
+{
+    LatencyHistogram latency;
+    uint64_t completed;
+    uint64_t lastAnswer;    ///< Time of the last answer received
+
+    StepResult() : completed(0), lastAnswer(0) {}
+};
+
+/**
+ * @brief Drives one thread's sessions at its share of the rate
+ * @param sessions Sessions owned by this thread
+ * @param intervalNanos Time between consecutive sends of this thread
+ * @param start Time of the first scheduled send
+ * @param end Time after which nothing more is scheduled
+ * @param result Receives latencies and counts
+ * @return void
+ *
+ * The send schedule is fixed up front: command k is due at
+ * start + k * intervalNanos and goes to session k mod sessions. A thread
+ * that falls behind sends the overdue commands back to back, and their
+ * latency still counts from when they were due. After the end, answers to
+ * commands still in flight are collected for up to two seconds.
+ */
+static void driveSessions(vector<Session *> &sessions, uint64_t intervalNanos, uint64_t start, uint64_t end,
+                          StepResult &result)
+{
+    vector<pollfd> polls(sessions.size());
+    for (size_t i = 0; i < sessions.size(); ++i)
+    {
+        polls[i].fd = sessions[i]->fd;
+        polls[i].events = POLLIN;
+    }
+
+    uint64_t scheduled = 0;
+    uint64_t drainDeadline = end + 2000000000ULL;
+    while (true)
+    {
+        uint64_t now = nowNanos();
+        uint64_t due = start + scheduled * intervalNanos;
+        for (; due <= now && due < end; due = start + ++scheduled * intervalNanos)
+        {
+            Session &session = *sessions[scheduled % sessions.size()];
+            session.pending.push_back(due);
+            if (!sendLine(session.fd, session.lines[session.nextLine]))
+                return;
+            session.nextLine = (session.nextLine + 1) % session.lines.size();
+        }
+
+        bool waiting = false;
+        for (auto session : sessions)
+        {
+            waiting = waiting || !session->pending.empty();
+        }
+        if (due >= end && (!waiting || now >= drainDeadline))
+            return;
+
+        // Wait for answers until the next send is due (ppoll sleeps below a millisecond)
+        uint64_t wait = due < end ? due - now : 1000000;
+        timespec timeout;
+        timeout.tv_sec = static_cast<time_t>(wait / 1000000000);
+        timeout.tv_nsec = static_cast<long>(wait % 1000000000);
+        if (ppoll(polls.data(), polls.size(), &timeout, nullptr) <= 0)
+            continue;
+
+        for (size_t i = 0; i < polls.size(); ++i)
+        {
+            if (polls[i].revents == 0)
+                continue;
+            uint64_t before = result.completed;
+            if (!receiveAnswers(*sessions[i], result.latency, result.completed))
+                return;
+            if (result.completed != before)
+                result.lastAnswer = nowNanos();
+        }
+    }
+}
+
+/**
+ * @brief Parses "R1,R2,..." into rates
+ */
+static vector<double> parseRates(const string &list)
+{
+    vector<double> rates;
+    stringstream items(list);
+    string item;
+    while (getline(items, item, ','))
+    {
+        if (!item.empty())
+            rates.push_back(atof(item.c_str()));
+    }
+    return rates;
+}
+
+/**
+ * @brief Load generator entry point
+ * @return 0 on completion, 1 on bad arguments or connection failure
+ */
+int main(int argc, char *argv[])
+{
+    LoadOptions options;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--host" && i + 1 < argc)
+            options.host = argv[++i];
+        else if (arg == "--sessions" && i + 1 < argc)
+            options.sessions = atoi(argv[++i]);
+        else if (arg == "--threads" && i + 1 < argc)
+            options.threads = atoi(argv[++i]);
+        else if (arg == "--rates" && i + 1 < argc)
+            options.rates = parseRates(argv[++i]);
+        else if (arg == "--seconds" && i + 1 < argc)
+            options.seconds = atof(argv[++i]);
+        else if (arg == "--mix" && i + 1 < argc)
+            options.mixFile = argv[++i];
+        else
+            options.port = atoi(arg.c_str());
+    }
+    options.threads = max(1, min(options.threads, options.sessions));
+    if (options.port <= 0 || options.sessions < 1 || options.rates.empty() || options.seconds <= 0)
+    {
+        cerr << "usage: witchertracker_load PORT [--host ADDR] [--sessions N] [--threads N] "
+                "[--rates R1,R2,...] [--seconds S] [--mix FILE]\n";
+        return 1;
+    }
+
+    vector<string> logLines;
+    if (!options.mixFile.empty())
+    {
+        logLines = readMix(options.mixFile);
+        if (logLines.empty())
+        {
+            cerr << "No commands in " << options.mixFile << "\n";
+            return 1;
+        }
+    }
+
+    // Connect every session and run its setup synchronously
+    vector<Session> sessions(options.sessions);
+    for (int s = 0; s < options.sessions; ++s)
+    {
+        Session &session = sessions[s];
+        session.fd = connectTo(options.host, options.port);
+        if (session.fd < 0)
+        {
+            cerr << "Cannot connect to " << options.host << ":" << options.port << ": " << strerror(errno) << "\n";
+            return 1;
+        }
+        session.lines = logLines.empty() ? builtinMix(s) : logLines;
+        session.nextLine = logLines.empty() ? 0 : s * logLines.size() / options.sessions;
+
+        LatencyHistogram ignored;
+        uint64_t answered = 0;
+        vector<string> setup = logLines.empty() ? builtinSetup(s) : vector<string>();
+        for (const auto &line : setup)
+        {
+            session.pending.push_back(nowNanos());
+            sendLine(session.fd, line);
+            while (!session.pending.empty() && receiveAnswers(session, ignored, answered))
+            {
+            }
+        }
+    }
+
+    ostringstream curve;
+    curve << fixed << setprecision(1);
+    curve << "target/s  achieved/s    p50 us    p90 us    p99 us  p99.9 us    max us\n";
+
+    for (double rate : options.rates)
+    {
+        vector<vector<Session *>> owned(options.threads);
+        for (int s = 0; s < options.sessions; ++s)
+        {
+            owned[s % options.threads].push_back(&sessions[s]);
+        }
+
+        // Threads send in turn: thread t's schedule is offset by t sends
+        uint64_t interval = static_cast<uint64_t>(1e9 * options.threads / rate);
+        uint64_t start = nowNanos() + 10000000;
+        uint64_t end = start + static_cast<uint64_t>(options.seconds * 1e9);
+
+        vector<StepResult> results(options.threads);
+        vector<thread> drivers;
+        for (int t = 0; t < options.threads; ++t)
+        {
+            uint64_t offset = interval * t / options.threads;
+            drivers.emplace_back([&, t, offset]
+                                 { driveSessions(owned[t], interval, start + offset, end, results[t]); });
+        }
+        for (auto &driver : drivers)
+        {
+            driver.join();
+        }
+
+        LatencyHistogram all;
+        uint64_t completed = 0;
+        uint64_t lastAnswer = start;
+        uint64_t unanswered = 0;
+        for (const auto &result : results)
+        {
+            all.merge(result.latency);
+            completed += result.completed;
+            lastAnswer = max(lastAnswer, result.lastAnswer);
+        }
+        // Commands still unanswered after the drain are given up on. Their
+        // answers may yet arrive and would be matched to the next rate's
+        // send times, so those sessions start the next rate on a new connection
+        for (auto &session : sessions)
+        {
+            unanswered += session.pending.size();
+            if (!session.pending.empty())
+            {
+                ::close(session.fd);
+                session.fd = connectTo(options.host, options.port);
+                if (session.fd < 0)
+                {
+                    cerr << "Cannot reconnect to " << options.host << ":" << options.port << ": "
+                         << strerror(errno) << "\n";
+                    return 1;
+                }
+            }
+            session.pending.clear();
+            session.input.clear();
+        }
+        double achieved = completed / max(1e-9, (lastAnswer - start) / 1e9);
+
+        cout << "rate " << rate << "/s over " << options.sessions << " sessions: " << completed << " answered, "
+             << unanswered << " unanswered\n";
+        all.writeDistribution(cout);
+        cout << "\n";
+
+        curve << setw(8) << rate << "  " << setw(10) << achieved << "  " << setw(8) << all.percentile(0.5) / 1000.0
+              << "  " << setw(8) << all.percentile(0.9) / 1000.0 << "  " << setw(8) << all.percentile(0.99) / 1000.0
+              << "  " << setw(8) << all.percentile(0.999) / 1000.0 << "  " << setw(8) << all.max() / 1000.0 << "\n";
+    }
+
+    cout << curve.str();
+    for (auto &session : sessions)
+    {
+        sendLine(session.fd, "Exit");
+        ::close(session.fd);
+    }
+    return 0;
+}
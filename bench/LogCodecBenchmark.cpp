@@ -0,0 +1,184 @@
+#include <chrono>
+#include <random>
+#include "WitcherTracker.h"
+
+using namespace std;
+
+/**
+ * @brief Command log compression benchmark
+ *
+ * Builds a random command log over a fixed set of names, then for the log
+ * and for its compacted form reports the compressed size, the compression
+ * speed, the decompression speed and the time to restore a tracker from
+ * the plain text against decoding and replaying the compressed frame.
+ * Decompression runs at several times the replay speed, so a compressed
+ * log restores in about the same time as a plain one while taking a
+ * fraction of the bytes to store or ship.
+ */
+
+static const int LOG_LINES = 200000;
+static const int NAMES = 400;
+static const int REPEATS = 20;
+
+/**
+ * @brief Seconds elapsed since a point
+ */
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+/**
+ * @brief Distinct letters-only name for an index
+ */
+static string nameOf(const string &prefix, int index)
+{
+    string name = prefix;
+    for (int i = 0; i < 3; ++i, index /= 26)
+    {
+        name += static_cast<char>('a' + index % 26);
+    }
+    return name;
+}
+
+/**
+ * @brief Builds a random mix of loots, learns, brews, encounters and queries
+ * @return Log text, one command per line
+ */
+static string buildLog()
+{
+    mt19937 random(7);
+    auto pick = [&random](int count) { return static_cast<int>(random() % count); };
+
+    string log;
+    for (int i = 0; i < LOG_LINES; ++i)
+    {
+        string herb = nameOf("Herb", pick(NAMES));
+        string potion = nameOf("Elixir", pick(NAMES / 4));
+        string beast = nameOf("Beast", pick(NAMES / 4));
+        switch (pick(8))
+        {
+        case 0:
+        case 1:
+            log += "Geralt loots " + to_string(1 + pick(5)) + " " + herb + ", " + to_string(1 + pick(5)) + " " +
+                   nameOf("Herb", pick(NAMES)) + "\n";
+            break;
+        case 2:
+            log += "Geralt learns " + potion + " potion consists of 1 " + herb + ", 2 " + nameOf("Herb", pick(NAMES)) +
+                   "\n";
+            break;
+        case 3:
+            log += "Geralt learns " + potion + " potion is effective against " + beast + "\n";
+            break;
+        case 4:
+            log += "Geralt brews " + potion + "\n";
+            break;
+        case 5:
+            log += "Geralt encounters a " + beast + "\n";
+            break;
+        case 6:
+            log += "Total ingredient " + herb + " ?\n";
+            break;
+        default:
+            log += "What is effective against " + beast + " ?\n";
+            break;
+        }
+    }
+    return log;
+}
+
+/**
+ * @brief Replays a log into a fresh tracker
+ * @return Digest of the resulting state
+ */
+static StateDigest replay(const string &log)
+{
+    WitcherTracker tracker;
+    istringstream in(log);
+    ostringstream sink;
+    string line;
+    while (getline(in, line))
+    {
+        tracker.executeLine(line, sink);
+        sink.str("");
+    }
+    return tracker.getStateDigest();
+}
+
+/**
+ * @brief Measures one log
+ * @param label Name printed for the log
+ * @param log Log text
+ * @param names Names seeding the codec
+ * @return false if the log does not survive the round trip
+ */
+static bool measure(const string &label, const string &log, const vector<string> &names)
+{
+    LogCodec codec(names);
+    string frame;
+    auto start = chrono::steady_clock::now();
+    codec.compress(log, frame);
+    double compressSeconds = secondsSince(start);
+
+    string decoded;
+    double decompressSeconds = 1e9;
+    for (int i = 0; i < REPEATS; ++i)
+    {
+        start = chrono::steady_clock::now();
+        bool ok = LogCodec::decompress(frame, decoded);
+        decompressSeconds = min(decompressSeconds, secondsSince(start));
+        if (!ok || decoded != log)
+        {
+            cerr << label << ": round trip failed\n";
+            return false;
+        }
+    }
+
+    start = chrono::steady_clock::now();
+    StateDigest plain = replay(log);
+    double plainRestore = secondsSince(start);
+
+    start = chrono::steady_clock::now();
+    LogCodec::decompress(frame, decoded);
+    StateDigest restored = replay(decoded);
+    double compressedRestore = secondsSince(start);
+    if (!(plain == restored))
+    {
+        cerr << label << ": restored state differs\n";
+        return false;
+    }
+
+    cout << fixed << setprecision(1);
+    cout << label << ": " << log.size() << " -> " << frame.size() << " bytes ("
+         << 100.0 * frame.size() / log.size() << "%), compress " << log.size() / compressSeconds / 1e6
+         << " MB/s, decompress " << setprecision(2) << log.size() / decompressSeconds / 1e9 << " GB/s, restore "
+         << plainRestore * 1e3 << " ms plain, " << compressedRestore * 1e3 << " ms compressed\n";
+    return true;
+}
+
+/**
+ * @brief Benchmark entry point
+ * @return 0 on completion, 1 if a round trip fails
+ */
+int main()
+{
+    string log = buildLog();
+
+    WitcherTracker tracker;
+    istringstream in(log);
+    ostringstream sink;
+    string line;
+    while (getline(in, line))
+    {
+        tracker.executeLine(line, sink);
+    }
+    vector<string> names;
+    tracker.collectKnownNames(names);
+    ostringstream compacted;
+    tracker.writeEquivalentLog(compacted);
+
+    bool ok = measure("command log", log, names);
+    ok = measure("compacted log", compacted.str(), names) && ok;
+    return ok ? 0 : 1;
+}
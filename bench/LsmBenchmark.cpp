@@ -0,0 +1,145 @@
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <unistd.h>
+#include "WitcherTracker.h"
+
+using namespace std;
+
+/**
+ * @brief Out-of-core inventory benchmark
+ *
+ * Loads the same ingredients into an inventory kept in memory and into one
+ * kept in an LsmItemStore, then reports for each the resident memory the
+ * items added, the load speed, the speed of point lookups of held and of
+ * unknown items and the time to list every ingredient. The directory for
+ * run files is the first argument, the current directory by default.
+ */
+
+static const int ITEMS = 2000000;
+static const int LOOKUPS = 200000;
+
+/**
+ * @brief Seconds elapsed since a point
+ */
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+/**
+ * @brief Resident set size of this process
+ * @return Bytes, 0 if /proc is unavailable
+ */
+static size_t residentBytes()
+{
+    ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    if (!(statm >> pages >> resident))
+        return 0;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+/**
+ * @brief Distinct letters-only name for an index
+ */
+static string nameOf(const string &prefix, int index)
+{
+    string name = prefix;
+    for (int i = 0; i < 5; ++i, index /= 26)
+    {
+        name += static_cast<char>('a' + index % 26);
+    }
+    return name;
+}
+
+/**
+ * @brief Loads, probes and lists one inventory
+ * @param label Name printed for the inventory
+ * @param inventory Empty inventory, possibly attached to a store
+ * @param store Store the inventory is attached to, or nullptr
+ * @return Listing of every ingredient, for comparison
+ */
+static string measure(const string &label, Inventory &inventory, LsmItemStore *store)
+{
+    mt19937 random(11);
+    size_t residentBefore = residentBytes();
+
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < ITEMS; ++i)
+    {
+        inventory.addIngredient(nameOf("Herb", static_cast<int>(random() % ITEMS)), 1 + static_cast<int>(random() % 5));
+    }
+    if (store)
+        store->waitForMerges();
+    double loadSeconds = secondsSince(start);
+    size_t resident = residentBytes() - residentBefore;
+
+    vector<string> held, unknown;
+    for (int i = 0; i < LOOKUPS; ++i)
+    {
+        held.push_back(nameOf("Herb", static_cast<int>(random() % ITEMS)));
+        unknown.push_back(nameOf("Root", static_cast<int>(random() % ITEMS)));
+    }
+    long total = 0;
+    start = chrono::steady_clock::now();
+    for (const string &name : held)
+    {
+        total += inventory.getIngredientQuantity(name);
+    }
+    double heldSeconds = secondsSince(start);
+    start = chrono::steady_clock::now();
+    for (const string &name : unknown)
+    {
+        total += inventory.getIngredientQuantity(name);
+    }
+    double unknownSeconds = secondsSince(start);
+
+    start = chrono::steady_clock::now();
+    string listing = inventory.getAllIngredients();
+    double listSeconds = secondsSince(start);
+
+    cout << fixed << setprecision(1);
+    cout << label << ": " << resident / 1e6 << " MB resident, load " << ITEMS / loadSeconds / 1e6
+         << " M items/s, lookups " << LOOKUPS / heldSeconds / 1e6 << " M/s held, " << LOOKUPS / unknownSeconds / 1e6
+         << " M/s unknown, listing " << listSeconds * 1e3 << " ms (checksum " << total << ")\n";
+    if (store)
+    {
+        LsmStats stats = store->stats();
+        cout << "  " << stats.runs << " runs, " << stats.runBytes / 1e6 << " MB on disk, " << stats.merges
+             << " merges, " << stats.bytesWritten / 1e6 << " MB written, " << stats.blockReads << " block reads\n";
+    }
+    return listing;
+}
+
+/**
+ * @brief Benchmark entry point
+ * @param argc Argument count
+ * @param argv Optional directory for run files
+ * @return 0 on completion, 1 if the store cannot be opened or the listings differ
+ */
+int main(int argc, char *argv[])
+{
+    LsmItemStore store;
+    if (!store.open(argc > 1 ? argv[1] : "."))
+    {
+        cerr << "Cannot create run files\n";
+        return 1;
+    }
+
+    // The out-of-core inventory goes first so the in-memory one cannot reuse its freed pages
+    Inventory outOfCore;
+    outOfCore.attachLsm(&store);
+    string lsmListing = measure("lsm", outOfCore, &store);
+
+    Inventory inMemory;
+    string memoryListing = measure("memory", inMemory, nullptr);
+
+    if (lsmListing != memoryListing)
+    {
+        cerr << "listings differ\n";
+        return 1;
+    }
+    return 0;
+}
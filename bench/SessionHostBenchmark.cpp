@@ -0,0 +1,169 @@
+#include <chrono>
+#include "WitcherTracker.h"
+
+using namespace std;
+
+/**
+ * @brief Multi-session aggregate benchmark
+ *
+ * Fills every session of a SessionHost, then times a cross-session total
+ * three ways: one thread walking all sessions, the fan-out aggregate on an
+ * idle host, and the fan-out aggregate while a client keeps commands
+ * flowing to one session. The last run also reports the slowest command,
+ * which stays close to the cost of one aggregate slice instead of a whole
+ * shard's sessions.
+ *
+ * Finally one session lists a large inventory while another session on the
+ * same worker sends a small query right behind it, once with the default
+ * command budget and once with an unlimited one; with the budget the
+ * small query waits for one slice of the listing, not all of it.
+ */
+
+static const int SESSIONS = 4096;
+static const int SHARDS = 4;
+static const int QUERIES = 50;
+static const int LARGE_INVENTORY = 50000;
+static const int LISTINGS = 20;
+
+/**
+ * @brief Microseconds elapsed since a point
+ */
+static double microsSince(chrono::steady_clock::time_point start)
+{
+    chrono::duration<double, micro> elapsed = chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+/**
+ * @brief Distinct letters-only ingredient name for an index
+ */
+static string herbName(int index)
+{
+    string name = "Herb";
+    for (int i = 0; i < 4; ++i, index /= 26)
+    {
+        name += static_cast<char>('a' + index % 26);
+    }
+    return name;
+}
+
+/**
+ * @brief Slowest small query on a worker that is also listing a large inventory
+ * @param budget Command budget of the host
+ * @return Microseconds of the slowest small query
+ */
+static double slowestBesideListing(CommandBudget budget)
+{
+    SessionHost host(1, budget);
+    int small = host.addSession();
+    int large = host.addSession();
+
+    string loot = "Geralt loots";
+    for (int i = 0; i < LARGE_INVENTORY; ++i)
+    {
+        loot += (i > 0 ? ", 1 " : " 1 ") + herbName(i);
+    }
+    host.execute(large, loot).get();
+
+    double slowest = 0;
+    for (int i = 0; i < LISTINGS; ++i)
+    {
+        future<string> listing = host.execute(large, "Total ingredient ?");
+        auto sent = chrono::steady_clock::now();
+        host.execute(small, "Total ingredient Rebis ?").get();
+        slowest = max(slowest, microsSince(sent));
+        listing.get();
+    }
+    return slowest;
+}
+
+/**
+ * @brief Benchmark entry point
+ * @return 0 on completion, 1 if an aggregate disagrees with the serial total
+ */
+int main()
+{
+    const string loot = "Geralt loots 3 Rebis, 2 Vitriol";
+    NameHash rebis = hashName("Rebis");
+
+    // Serial baseline: the same sessions owned and walked by one thread
+    vector<unique_ptr<WitcherTracker>> serial;
+    ostringstream sink;
+    for (int i = 0; i < SESSIONS; ++i)
+    {
+        serial.emplace_back(new WitcherTracker());
+        serial.back()->executeLine(loot, sink);
+    }
+
+    int64_t expected = 0;
+    auto start = chrono::steady_clock::now();
+    for (int q = 0; q < QUERIES; ++q)
+    {
+        expected = 0;
+        for (const auto &session : serial)
+        {
+            expected += session->getItemQuantity(ItemCategory::INGREDIENT, "Rebis", rebis);
+        }
+    }
+    double serialMicros = microsSince(start) / QUERIES;
+
+    SessionHost host(SHARDS);
+    vector<future<string>> pending;
+    for (int i = 0; i < SESSIONS; ++i)
+    {
+        pending.push_back(host.execute(host.addSession(), loot));
+    }
+    for (auto &reply : pending)
+    {
+        reply.get();
+    }
+
+    int64_t total = 0;
+    start = chrono::steady_clock::now();
+    for (int q = 0; q < QUERIES; ++q)
+    {
+        total = host.totalQuantity(ItemCategory::INGREDIENT, "Rebis");
+    }
+    double idleMicros = microsSince(start) / QUERIES;
+    if (total != expected)
+    {
+        cerr << "aggregate " << total << " != serial " << expected << "\n";
+        return 1;
+    }
+
+    // Commands to session 0 while aggregates run; session 0 only reads
+    atomic<bool> querying(true);
+    double slowestCommand = 0;
+    int commands = 0;
+    thread client([&]
+                  {
+                      while (querying.load())
+                      {
+                          auto sent = chrono::steady_clock::now();
+                          host.execute(0, "Total ingredient Rebis ?").get();
+                          slowestCommand = max(slowestCommand, microsSince(sent));
+                          ++commands;
+                      } });
+
+    start = chrono::steady_clock::now();
+    for (int q = 0; q < QUERIES; ++q)
+    {
+        host.totalQuantity(ItemCategory::INGREDIENT, "Rebis");
+    }
+    double busyMicros = microsSince(start) / QUERIES;
+    querying.store(false);
+    client.join();
+
+    cout << fixed << setprecision(1);
+    cout << SESSIONS << " sessions, " << SHARDS << " shards, " << QUERIES << " queries\n";
+    cout << "serial walk:        " << serialMicros << " us/query\n";
+    cout << "fan-out, idle:      " << idleMicros << " us/query\n";
+    cout << "fan-out, commands:  " << busyMicros << " us/query, " << commands << " commands, slowest "
+         << slowestCommand << " us\n";
+
+    double budgeted = slowestBesideListing(CommandBudget{COMMAND_WORK_BUDGET, COMMAND_TIME_BUDGET_NANOS});
+    double unlimited = slowestBesideListing(CommandBudget{SIZE_MAX, 3600000000000ULL});
+    cout << "beside a " << LARGE_INVENTORY << "-item listing, slowest query: " << budgeted
+         << " us budgeted, " << unlimited << " us unlimited\n";
+    return 0;
+}
@@ -7,88 +7,462 @@ using namespace std;
  * 
  * This class handles the storage and retrieval of alchemical knowledge including
  * potion recipes with ingredients/quantities and magical signs available to witchers.
+ * 
+ * Recipes live either in the frozen FrozenRelation or in the small mutable
+ * delta table, which is consulted first. A freeze in progress adds the
+ * sealed delta between the two.
+ */
+
+/**
+ * @struct AlchemyKnowledge::Freeze
+ * @brief Progress of a freeze spread over several slices
+ */
+struct AlchemyKnowledge::Freeze
+{
+    FrozenRelation::Builder builder;    ///< Relation replacing the frozen recipes
+    FrontCodedNames::Cursor row;        ///< Next frozen recipe to copy
+    size_t sealedCopied;                ///< Sealed recipes copied so far
+    bool installed;                     ///< The new relation has replaced the old one
+    NameTable<Potion> retired;          ///< Sealed recipes left to release after the swap
+
+    Freeze() : sealedCopied(0), installed(false) {}
+};
+
+/**
+ * @brief Computes the digest value of a recipe
+ * @param hashes hashName of each ingredient
+ * @param quantities Quantity of each ingredient
+ * @return Value depending on the ingredients, their quantities and order
+ */
+static uint64_t recipeValue(const vector<NameHash> &hashes, const vector<int> &quantities)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < hashes.size(); ++i)
+    {
+        value = StateDigest::combine(StateDigest::combine(value, hashes[i]), quantities[i]);
+    }
+    return value;
+}
+
+/**
+ * @brief Constructs an empty knowledge base
+ */
+AlchemyKnowledge::AlchemyKnowledge() : store(nullptr)
+{
+}
+
+/**
+ * @brief Destructor; defined where Freeze is complete
  */
+AlchemyKnowledge::~AlchemyKnowledge()
+{
+}
+
+/**
+ * @brief Finds a recipe in the delta, then in the sealed delta
+ * @param name The name of the potion
+ * @param hash hashName(name)
+ * @return The newest unfrozen copy, or nullptr
+ */
+const Potion *AlchemyKnowledge::findRecent(const string &name, NameHash hash) const
+{
+    const Potion *potion = potions.find(name, hash);
+    return potion ? potion : sealedPotions.find(name, hash);
+}
+
+/**
+ * @brief Keeps all recipes and signs in a state file from now on
+ * @param stateStore Open store, or nullptr to return to in-memory tables
+ * @return void
+ * @side_effects Replaces the digest with one over the recipes and signs in the file
+ */
+void AlchemyKnowledge::attachStore(MappedStateStore *stateStore)
+{
+    store = stateStore;
+    digest = StateDigest();
+    if (!store)
+        return;
+
+    vector<string> names;
+    store->collectNames(StoredKind::RECIPE, names);
+    for (const auto &name : names)
+    {
+        NameHash hash = hashName(name);
+        vector<string> ingredients;
+        vector<NameHash> ingredientHashes;
+        vector<int> quantities;
+        store->getLinks(StoredKind::RECIPE, name, hash, ingredients, ingredientHashes, quantities);
+        digest.add(StateDigest::key(StoredKind::RECIPE, hash), recipeValue(ingredientHashes, quantities));
+    }
+
+    names.clear();
+    store->collectNames(StoredKind::SIGN, names);
+    for (const auto &name : names)
+    {
+        digest.add(StateDigest::key(StoredKind::SIGN, hashName(name)), 0);
+    }
+}
 
 /**
  * @brief Adds a new potion formula to the knowledge base
  * @param potionName The name of the potion to add
+ * @param potionHash hashName(potionName)
  * @param ingredients Vector of ingredient names required for the potion
  * @param quantities Vector of quantities corresponding to each ingredient
+ * @param ingredientHashes Vector of hashName values for each ingredient
  * @return void
- * @side_effects Creates or updates a potion entry in the potions map
+ * @side_effects Creates or updates a potion entry in the potions table
  */
-void AlchemyKnowledge::addPotionFormula(const string &potionName, const vector<string> &ingredients, const vector<int> &quantities)
+void AlchemyKnowledge::addPotionFormula(const string &potionName, NameHash potionHash, const vector<string> &ingredients,
+                                        const vector<int> &quantities, const vector<NameHash> &ingredientHashes)
 {
+    // A replaced recipe leaves the digest before the new one enters it
+    uint64_t digestKey = StateDigest::key(StoredKind::RECIPE, potionHash);
+    Potion previous;
+    if (getPotion(potionName, potionHash, previous))
+    {
+        digest.remove(digestKey, recipeValue(previous.ingredientHashes, previous.ingredientQuantities));
+    }
+    digest.add(digestKey, recipeValue(ingredientHashes, quantities));
+
+    if (store)
+    {
+        store->setLinks(StoredKind::RECIPE, potionName, potionHash, ingredients, ingredientHashes, quantities);
+        return;
+    }
+
+    bool isNew = !potions.find(potionName, potionHash);
+
+    // Fold a grown delta into the frozen representation before adding to it
+    if (isNew && potions.size() >= max(static_cast<size_t>(KNOWLEDGE_DELTA_LIMIT), frozenPotions.size() / 4))
+    {
+        freeze();
+    }
+
     // Create or retrieve potion reference and populate with formula data
-    Potion &potion = potions[potionName];
+    bool wasIndexed = potions.indexed();
+    Potion &potion = potions.findOrInsert(potionName, potionHash);
+    switches.record(wasIndexed, potions.indexed());
     potion.name = potionName;
     potion.ingredientNames = ingredients;
     potion.ingredientQuantities = quantities;
+    potion.ingredientHashes = ingredientHashes;
+
+    if (isNew)
+    {
+        CommandExplain::countInsert(ExplainSubsystem::ALCHEMY);
+        potionFilter.insert(potionHash);
+        if (potionFilter.full())
+            rebuildFilter();
+    }
+}
+
+/**
+ * @brief Adds a new potion formula, hashing every name
+ * @param potionName The name of the potion to add
+ * @param ingredients Vector of ingredient names required for the potion
+ * @param quantities Vector of quantities corresponding to each ingredient
+ * @return void
+ */
+void AlchemyKnowledge::addPotionFormula(const string &potionName, const vector<string> &ingredients, const vector<int> &quantities)
+{
+    vector<NameHash> ingredientHashes;
+    for (const auto &ingredient : ingredients)
+    {
+        ingredientHashes.push_back(hashName(ingredient));
+    }
+    addPotionFormula(potionName, hashName(potionName), ingredients, quantities, ingredientHashes);
 }
 
 /**
  * @brief Adds a new sign to the knowledge base
  * @param signName The name of the sign to add
+ * @param signHash hashName(signName)
  * @return void
- * @side_effects Creates a new Sign entry in the signs map
+ * @side_effects Creates a new Sign entry in the signs table
  */
-void AlchemyKnowledge::addSign(const string &signName)
+void AlchemyKnowledge::addSign(const string &signName, NameHash signHash)
 {
+    bool isNew = !hasSign(signName, signHash);
+    if (isNew)
+    {
+        digest.add(StateDigest::key(StoredKind::SIGN, signHash), 0);
+    }
+
+    if (store)
+    {
+        store->addName(StoredKind::SIGN, signName, signHash);
+        return;
+    }
+
     // Create new Sign object and store in signs collection
-    signs[signName] = Sign(signName);
+    if (isNew)
+        CommandExplain::countInsert(ExplainSubsystem::ALCHEMY);
+    bool wasIndexed = signs.indexed();
+    signs.findOrInsert(signName, signHash) = Sign(signName);
+    switches.record(wasIndexed, signs.indexed());
 }
 
 /**
- * @brief Retrieves a pointer to a specific potion
+ * @brief Retrieves a copy of a specific potion recipe
  * @param name The name of the potion to find
- * @return Pointer to the Potion object if found, nullptr otherwise
+ * @param hash hashName(name)
+ * @param potion Receives the recipe
+ * @return true if the potion is known, false otherwise
+ */
+bool AlchemyKnowledge::getPotion(const string &name, NameHash hash, Potion &potion) const
+{
+    CommandExplain::countLookup(ExplainSubsystem::ALCHEMY);
+    if (store)
+    {
+        vector<string> ingredients;
+        vector<NameHash> ingredientHashes;
+        vector<int> quantities;
+        if (!store->getLinks(StoredKind::RECIPE, name, hash, ingredients, ingredientHashes, quantities))
+        {
+            return false;
+        }
+
+        potion = Potion(name);
+        for (size_t i = 0; i < ingredients.size(); ++i)
+        {
+            potion.addIngredient(ingredients[i], ingredientHashes[i], quantities[i]);
+        }
+        return true;
+    }
+
+    // Most unknown potions are rejected here without searching either part
+    if (!potionFilter.mayContain(hash))
+    {
+        return false;
+    }
+
+    const Potion *recent = findRecent(name, hash);
+    if (recent)
+    {
+        potion = *recent;
+        return true;
+    }
+
+    size_t row = frozenPotions.find(name);
+    if (row == string::npos)
+    {
+        potionFilter.recordFalsePositive();
+        return false;
+    }
+
+    potion = Potion(name);
+    for (size_t link = frozenPotions.linksBegin(row); link < frozenPotions.linksEnd(row); ++link)
+    {
+        potion.addIngredient(frozenPotions.linkName(link), frozenPotions.linkHash(link),
+                             static_cast<int>(frozenPotions.linkValue(link)));
+    }
+    return true;
+}
+
+/**
+ * @brief Moves every recipe into the frozen representation
+ * @return void
+ * @side_effects Finishes a freeze in progress, then folds in the delta
+ */
+void AlchemyKnowledge::freeze()
+{
+    SliceMeter unlimited;
+    freezeStep(unlimited);
+    freezeStep(unlimited);
+}
+
+/**
+ * @brief Runs one slice of a freeze
+ * @param meter Budget of the slice
+ * @return true once the recipes learned before the freeze began are all frozen
+ * @side_effects The first slice seals the delta; the last one replaces the
+ *               frozen relation and has released the sealed recipes
+ */
+bool AlchemyKnowledge::freezeStep(SliceMeter &meter)
+{
+    if (!freezing)
+    {
+        // A state file is already compact, and an empty delta has nothing to fold in
+        if (store || potions.size() == 0)
+            return true;
+
+        // Formulas from now on go to a fresh delta, which shadows the sealed one
+        switches.record(potions.indexed(), false);
+        sealedPotions = move(potions);
+        potions = NameTable<Potion>();
+        freezing.reset(new Freeze());
+
+        // Sized from the frozen part, so the builder's buffers do not grow mid-slice
+        size_t rows = frozenPotions.size() + sealedPotions.size();
+        size_t perRow = frozenPotions.size() > 0 ? frozenPotions.linkCount() / frozenPotions.size() + 1 : 4;
+        freezing->builder.reserve(rows, rows * perRow, frozenPotions.targetCount() + sealedPotions.size());
+    }
+    Freeze &state = *freezing;
+
+    // Frozen recipes that are not shadowed by a sealed copy
+    while (!state.installed && state.row.index < frozenPotions.size() && meter.take())
+    {
+        frozenPotions.nextKey(state.row);
+        const string &name = state.row.name;
+        if (sealedPotions.find(name, hashName(name)))
+            continue;
+
+        size_t row = state.row.index - 1;
+        state.builder.addRow(name);
+        for (size_t link = frozenPotions.linksBegin(row); link < frozenPotions.linksEnd(row); ++link)
+        {
+            state.builder.addLink(frozenPotions.linkName(link), frozenPotions.linkHash(link),
+                                  frozenPotions.linkValue(link));
+        }
+        meter.take(frozenPotions.linksEnd(row) - frozenPotions.linksBegin(row));
+    }
+
+    while (!state.installed && state.sealedCopied < sealedPotions.size() && meter.take())
+    {
+        const Potion &potion = (sealedPotions.begin() + state.sealedCopied++)->value;
+        state.builder.addRow(potion.name);
+        for (size_t i = 0; i < potion.ingredientNames.size(); ++i)
+        {
+            state.builder.addLink(potion.ingredientNames[i], potion.ingredientHashes[i],
+                                  static_cast<uint64_t>(potion.ingredientQuantities[i]));
+        }
+        meter.take(potion.ingredientNames.size());
+    }
+
+    if (!state.installed)
+    {
+        if (state.row.index < frozenPotions.size() || state.sealedCopied < sealedPotions.size() ||
+            !state.builder.step(meter))
+            return false;
+
+        // Every sealed recipe is now frozen; the swap is all a reader can see
+        state.builder.install(frozenPotions);
+        state.retired = move(sealedPotions);
+        sealedPotions = NameTable<Potion>();
+        state.installed = true;
+    }
+
+    while (state.retired.size() > 0 && meter.take())
+    {
+        state.retired.popBack();
+    }
+    if (state.retired.size() > 0)
+        return false;
+
+    freezing.reset();
+    return true;
+}
+
+/**
+ * @brief Refills the potion filter from the delta, the sealed delta and the frozen recipes
+ * @return void
+ * @side_effects Sizes the filter for twice the number of known potions
  */
-Potion *AlchemyKnowledge::getPotion(const string &name)
+void AlchemyKnowledge::rebuildFilter()
 {
-    auto it = potions.find(name);
-    // Return pointer to potion if exists, otherwise return null
-    return (it != potions.end()) ? &it->second : nullptr;
+    potionFilter.reset(2 * (potions.size() + sealedPotions.size() + frozenPotions.size()));
+    for (const auto &entry : potions)
+    {
+        potionFilter.insert(entry.hash);
+    }
+    for (const auto &entry : sealedPotions)
+    {
+        potionFilter.insert(entry.hash);
+    }
+    frozenPotions.forEachKey([this](size_t, const string &name)
+    {
+        potionFilter.insert(hashName(name));
+    });
 }
 
 /**
  * @brief Checks if a potion exists in the knowledge base
  * @param name The name of the potion to check
+ * @param hash hashName(name)
  * @return true if potion exists, false otherwise
  */
-bool AlchemyKnowledge::hasPotion(const string &name) const
+bool AlchemyKnowledge::hasPotion(const string &name, NameHash hash) const
 {
-    return potions.find(name) != potions.end();
+    CommandExplain::countLookup(ExplainSubsystem::ALCHEMY);
+    if (store)
+    {
+        return store->contains(StoredKind::RECIPE, name, hash);
+    }
+
+    if (!potionFilter.mayContain(hash))
+    {
+        return false;
+    }
+
+    if (findRecent(name, hash) != nullptr || frozenPotions.find(name) != string::npos)
+    {
+        return true;
+    }
+
+    potionFilter.recordFalsePositive();
+    return false;
 }
 
 /**
  * @brief Checks if a sign exists in the knowledge base
  * @param name The name of the sign to check
+ * @param hash hashName(name)
  * @return true if sign exists, false otherwise
  */
-bool AlchemyKnowledge::hasSign(const string &name) const
+bool AlchemyKnowledge::hasSign(const string &name, NameHash hash) const
 {
-    return signs.find(name) != signs.end();
+    CommandExplain::countLookup(ExplainSubsystem::ALCHEMY);
+    if (store)
+    {
+        return store->contains(StoredKind::SIGN, name, hash);
+    }
+    return signs.find(name, hash) != nullptr;
 }
 
 /**
  * @brief Retrieves formatted ingredient list for a specific potion
  * @param potionName The name of the potion to get ingredients for
+ * @param potionHash hashName(potionName)
  * @return Formatted string of ingredients sorted by quantity (desc) then name (asc), empty string if not found
  * 
  * Format: "quantity ingredient, quantity ingredient, ..."
  * Sorting: Primary by quantity (highest first), secondary by name (alphabetical)
  */
-string AlchemyKnowledge::getPotionIngredients(const string &potionName) const
+string AlchemyKnowledge::getPotionIngredients(const string &potionName, NameHash potionHash) const
 {
-    auto it = potions.find(potionName);
+    vector<pair<string, int>> ingredientPairs;
     // Return empty string if potion doesn't exist or lacks formula
-    if (it == potions.end() || !it->second.hasFormula())
+    if (!collectPotionIngredients(potionName, potionHash, ingredientPairs))
     {
         return "";
     }
 
-    const Potion &potion = it->second;
-    vector<pair<string, int>> ingredientPairs;
+    // Build formatted result string
+    string result;
+    appendItemList(ingredientPairs, 0, ingredientPairs.size(), result);
+    return result;
+}
+
+/**
+ * @brief Collects the recipe of a potion in listing order
+ * @param potionName The name of the potion to get ingredients for
+ * @param potionHash hashName(potionName)
+ * @param ingredientPairs Receives (ingredient, quantity) pairs
+ * @return false if the potion doesn't exist or lacks a formula
+ * 
+ * Sorting: Primary by quantity (highest first), secondary by name (alphabetical)
+ */
+bool AlchemyKnowledge::collectPotionIngredients(const string &potionName, NameHash potionHash,
+                                                vector<pair<string, int>> &ingredientPairs) const
+{
+    ingredientPairs.clear();
+
+    Potion potion;
+    if (!getPotion(potionName, potionHash, potion) || !potion.hasFormula())
+    {
+        return false;
+    }
 
     // Create ingredient-quantity pairs for sorting
     for (size_t i = 0; i < potion.ingredientNames.size(); ++i)
@@ -106,14 +480,38 @@ string AlchemyKnowledge::getPotionIngredients(const string &potionName) const
              return a.first < b.first; // If quantities are equal, sort by ingredient name alphabetically
          });
 
-    // Build formatted result string
-    string result;
-    for (size_t i = 0; i < ingredientPairs.size(); ++i)
+    return true;
+}
+
+/**
+ * @brief Collects the names of every potion with a known recipe
+ * @param names Receives the names, sorted
+ * @return void
+ */
+void AlchemyKnowledge::collectPotionNames(vector<string> &names) const
+{
+    names.clear();
+    if (store)
     {
-        if (i > 0)
-            result += ", "; // Add comma separator between ingredients
-        result += to_string(ingredientPairs[i].second) + " " + ingredientPairs[i].first;
+        store->collectNames(StoredKind::RECIPE, names);
     }
-
-    return result;
-}
\ No newline at end of file
+    else
+    {
+        // A recipe in the delta may also still be in the sealed or frozen part
+        for (const auto &entry : potions)
+        {
+            names.push_back(entry.name);
+        }
+        for (const auto &entry : sealedPotions)
+        {
+            if (!potions.find(entry.name, entry.hash))
+                names.push_back(entry.name);
+        }
+        frozenPotions.forEachKey([&](size_t, const string &name)
+        {
+            if (!findRecent(name, hashName(name)))
+                names.push_back(name);
+        });
+    }
+    sort(names.begin(), names.end());
+}
@@ -0,0 +1,41 @@
+#include "WitcherTracker.h"
+
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+/**
+ * @brief AllocationCounter - replacement operator new reporting to EXPLAIN
+ *
+ * Linked only into the tracker program, so libraries and benchmarks
+ * built from the other sources keep the standard allocator. The array
+ * and nothrow forms of the standard library call this operator new, so
+ * one hook sees every C++ allocation.
+ */
+
+static const bool installed = CommandExplain::countAllocations();
+
+/**
+ * @brief Allocates through malloc, counting the allocation for EXPLAIN
+ * @param bytes Requested size
+ * @return Allocated block
+ */
+void *operator new(size_t bytes)
+{
+    CommandExplain::countAllocation(bytes);
+    void *block = malloc(bytes ? bytes : 1);
+    if (!block)
+        throw bad_alloc();
+    return block;
+}
+
+/**
+ * @brief Releases a block from operator new
+ * @param block Block to release
+ * @return void
+ */
+void operator delete(void *block) noexcept
+{
+    free(block);
+}
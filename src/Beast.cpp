@@ -5,34 +5,160 @@
  * 
  * This class handles the storage of effective signs and potions that can be used
  * against specific beasts, preventing duplicate entries in the collections.
+ * Name hashes are kept alongside the names so duplicate checks compare
+ * hashes first and only compare strings on a hash match. A list longer
+ * than ADAPTIVE_INDEX_ABOVE also gets an open-addressing index of
+ * positions, so beasts with thousands of counters do not pay a scan per
+ * lookup; the lists never shrink, so the index is never dropped.
  */
 
+/**
+ * @brief Searches a name list using its parallel hash list
+ * @param names Names to search
+ * @param hashes hashName of each entry in names
+ * @param index Position + 1 of each entry by hash, empty while the list is scanned
+ * @param name Name to find
+ * @param hash hashName(name)
+ * @return true if name is present
+ */
+static bool containsName(const std::vector<std::string> &names, const std::vector<NameHash> &hashes,
+                         const std::vector<uint32_t> &index, const std::string &name, NameHash hash)
+{
+    if (index.empty())
+    {
+        for (size_t i = 0; i < hashes.size(); ++i)
+        {
+            if (hashes[i] == hash && names[i] == name)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t mask = index.size() - 1;
+    for (size_t pos = static_cast<size_t>(hash) & mask;; pos = (pos + 1) & mask)
+    {
+        uint32_t slot = index[pos];
+        if (slot == 0)
+            return false;
+        if (hashes[slot - 1] == hash && names[slot - 1] == name)
+            return true;
+    }
+}
+
+/**
+ * @brief Rebuilds the index of a name list
+ * @param hashes hashName of each entry
+ * @param index Receives slots for every entry, at a load factor of at most one half
+ * @return void
+ */
+static void buildIndex(const std::vector<NameHash> &hashes, std::vector<uint32_t> &index)
+{
+    size_t capacity = 32;
+    while (capacity < hashes.size() * 2)
+        capacity *= 2;
+
+    std::vector<uint32_t> rebuilt(capacity, 0);
+    for (size_t i = 0; i < hashes.size(); ++i)
+    {
+        size_t pos = static_cast<size_t>(hashes[i]) & (capacity - 1);
+        while (rebuilt[pos] != 0)
+            pos = (pos + 1) & (capacity - 1);
+        rebuilt[pos] = static_cast<uint32_t>(i + 1);
+    }
+    index.swap(rebuilt);
+}
+
+/**
+ * @brief Adds the newest entry of a name list to its index
+ * @param hashes hashName of each entry, the new one last
+ * @param index Index of the list; built once the list outgrows a scan
+ * @return void
+ */
+static void indexNewest(const std::vector<NameHash> &hashes, std::vector<uint32_t> &index)
+{
+    if (index.empty() ? hashes.size() > ADAPTIVE_INDEX_ABOVE : hashes.size() * 2 > index.size())
+    {
+        buildIndex(hashes, index);
+        return;
+    }
+    if (index.empty())
+        return;
+
+    size_t mask = index.size() - 1;
+    size_t pos = static_cast<size_t>(hashes.back()) & mask;
+    while (index[pos] != 0)
+        pos = (pos + 1) & mask;
+    index[pos] = static_cast<uint32_t>(hashes.size());
+}
+
 /**
  * @brief Adds an effective sign to the beast's weakness list
  * @param signName The name of the sign effective against this beast
+ * @param signHash hashName(signName)
  * @return void
  * @side_effects Adds signName to effectiveSigns vector if not already present
  */
-void Beast::addEffectiveSign(const std::string &signName)
+void Beast::addEffectiveSign(const std::string &signName, NameHash signHash)
 {
     // Check if sign already exists in the list to prevent duplicates
-    if (std::find(effectiveSigns.begin(), effectiveSigns.end(), signName) == effectiveSigns.end())
+    if (!containsName(effectiveSigns, signHashes, signIndex, signName, signHash))
     {
         effectiveSigns.push_back(signName);
+        signHashes.push_back(signHash);
+        indexNewest(signHashes, signIndex);
     }
 }
 
 /**
  * @brief Adds an effective potion to the beast's combat strategy list
  * @param potionName The name of the potion effective against this beast
+ * @param potionHash hashName(potionName)
  * @return void
  * @side_effects Adds potionName to effectivePotions vector if not already present
  */
-void Beast::addEffectivePotion(const std::string &potionName)
+void Beast::addEffectivePotion(const std::string &potionName, NameHash potionHash)
 {
     // Check if potion already exists in the list to prevent duplicates
-    if (std::find(effectivePotions.begin(), effectivePotions.end(), potionName) == effectivePotions.end())
+    if (!containsName(effectivePotions, potionHashes, potionIndex, potionName, potionHash))
     {
         effectivePotions.push_back(potionName);
+        potionHashes.push_back(potionHash);
+        indexNewest(potionHashes, potionIndex);
     }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Checks whether a sign is known to be effective
+ * @param signName The name of the sign
+ * @param signHash hashName(signName)
+ * @return true if the sign is in effectiveSigns
+ */
+bool Beast::hasEffectiveSign(const std::string &signName, NameHash signHash) const
+{
+    return containsName(effectiveSigns, signHashes, signIndex, signName, signHash);
+}
+
+/**
+ * @brief Checks whether a potion is known to be effective
+ * @param potionName The name of the potion
+ * @param potionHash hashName(potionName)
+ * @return true if the potion is in effectivePotions
+ */
+bool Beast::hasEffectivePotion(const std::string &potionName, NameHash potionHash) const
+{
+    return containsName(effectivePotions, potionHashes, potionIndex, potionName, potionHash);
+}
+
+/**
+ * @brief Indexes counter lists filled directly, once they outgrow a scan
+ * @return void
+ */
+void Beast::indexCounters()
+{
+    if (signHashes.size() > ADAPTIVE_INDEX_ABOVE)
+        buildIndex(signHashes, signIndex);
+    if (potionHashes.size() > ADAPTIVE_INDEX_ABOVE)
+        buildIndex(potionHashes, potionIndex);
+}
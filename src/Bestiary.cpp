@@ -8,72 +8,401 @@ using namespace std;
  * This class serves as a comprehensive database of creatures, storing information about
  * effective signs and potions for each beast. Provides methods for adding beasts,
  * managing effectiveness data, and retrieving formatted counter lists.
+ * 
+ * Beasts live either in the frozen FrozenRelation or in the small mutable
+ * delta table. The delta is consulted first; a frozen beast that learns a
+ * new counter is copied into the delta, which then shadows its frozen row.
+ * A freeze in progress adds the sealed delta between the two.
+ */
+
+/**
+ * @struct Bestiary::Freeze
+ * @brief Progress of a freeze spread over several slices
+ */
+struct Bestiary::Freeze
+{
+    FrozenRelation::Builder builder;    ///< Relation replacing the frozen part
+    FrontCodedNames::Cursor row;        ///< Next frozen row to copy
+    size_t sealedCopied;                ///< Sealed beasts copied so far
+    bool installed;                     ///< The new relation has replaced the old one
+    NameTable<Beast> retired;           ///< Sealed beasts left to release after the swap
+
+    Freeze() : sealedCopied(0), installed(false) {}
+};
+
+/**
+ * @brief Constructs an empty bestiary
  */
+Bestiary::Bestiary() : store(nullptr)
+{
+}
+
+/**
+ * @brief Destructor; defined where Freeze is complete
+ */
+Bestiary::~Bestiary()
+{
+}
+
+/**
+ * @brief Decodes a frozen row into a Beast
+ * @param row Row index in the frozen relation
+ * @param beast Receives the counters (appended in stored order)
+ * @return void
+ */
+void Bestiary::thaw(size_t row, Beast &beast) const
+{
+    for (size_t link = frozen.linksBegin(row); link < frozen.linksEnd(row); ++link)
+    {
+        if (frozen.linkValue(link))
+        {
+            beast.effectiveSigns.push_back(frozen.linkName(link));
+            beast.signHashes.push_back(frozen.linkHash(link));
+        }
+        else
+        {
+            beast.effectivePotions.push_back(frozen.linkName(link));
+            beast.potionHashes.push_back(frozen.linkHash(link));
+        }
+    }
+}
+
+/**
+ * @brief Finds a beast in the delta, then in the sealed delta
+ * @param name The name of the beast
+ * @param hash hashName(name)
+ * @return The newest unfrozen copy, or nullptr
+ */
+const Beast *Bestiary::findRecent(const string &name, NameHash hash) const
+{
+    const Beast *beast = beasts.find(name, hash);
+    return beast ? beast : sealed.find(name, hash);
+}
+
+/**
+ * @brief Keeps all beasts in a state file from now on
+ * @param stateStore Open store, or nullptr to return to in-memory tables
+ * @return void
+ * @side_effects Replaces the digest with one over the beasts in the file
+ */
+void Bestiary::attachStore(MappedStateStore *stateStore)
+{
+    store = stateStore;
+    digest = StateDigest();
+    if (!store)
+        return;
+
+    vector<string> names;
+    store->collectNames(StoredKind::BEAST, names);
+    for (const auto &name : names)
+    {
+        NameHash hash = hashName(name);
+        vector<string> counters;
+        vector<NameHash> counterHashes;
+        vector<int> isSign;
+        store->getLinks(StoredKind::BEAST, name, hash, counters, counterHashes, isSign);
+        for (size_t i = 0; i < counters.size(); ++i)
+        {
+            digest.add(StateDigest::key(StoredKind::BEAST, hash), StateDigest::combine(counterHashes[i], isSign[i]));
+        }
+    }
+}
 
 /**
  * @brief Adds a new beast to the bestiary if it doesn't already exist
  * @param name The name of the beast to add
+ * @param hash hashName(name)
+ * @return void
+ * @side_effects Creates a new Beast entry if not present
+ */
+void Bestiary::addBeast(const string &name, NameHash hash)
+{
+    CommandExplain::countLookup(ExplainSubsystem::BESTIARY);
+    if (store)
+        store->addName(StoredKind::BEAST, name, hash);
+    else
+        deltaBeast(name, hash);
+}
+
+/**
+ * @brief Returns the delta copy of a beast, creating it if needed
+ * @param name The name of the beast
+ * @param hash hashName(name)
+ * @return Reference to the beast in the delta table
+ * @side_effects May freeze the delta; copies a frozen beast into the delta
+ */
+Beast &Bestiary::deltaBeast(const string &name, NameHash hash)
+{
+    Beast *existing = beasts.find(name, hash);
+    if (existing)
+    {
+        return *existing;
+    }
+
+    // Fold a grown delta into the frozen representation before adding to it
+    if (beasts.size() >= max(static_cast<size_t>(KNOWLEDGE_DELTA_LIMIT), frozen.size() / 4))
+    {
+        freeze();
+    }
+
+    // A freshly inserted entry starts from the sealed or frozen data, if any
+    CommandExplain::countInsert(ExplainSubsystem::BESTIARY);
+    bool wasIndexed = beasts.indexed();
+    Beast &beast = beasts.findOrInsert(name, hash);
+    switches.record(wasIndexed, beasts.indexed());
+    beast.name = name;
+    const Beast *sealedCopy = sealed.find(name, hash);
+    size_t row = sealedCopy ? string::npos : frozen.find(name);
+    if (sealedCopy)
+    {
+        beast = *sealedCopy;
+    }
+    else if (row != string::npos)
+    {
+        thaw(row, beast);
+        beast.indexCounters();
+    }
+    else
+    {
+        filter.insert(hash);
+        if (filter.full())
+            rebuildFilter();
+    }
+    return beast;
+}
+
+/**
+ * @brief Refills the filter from the delta, the sealed delta and the frozen beasts
  * @return void
- * @side_effects Creates a new Beast entry in the beasts map if not present
+ * @side_effects Sizes the filter for twice the number of known beasts
  */
-void Bestiary::addBeast(const string &name)
+void Bestiary::rebuildFilter()
 {
-    // Only create new beast if it doesn't already exist to avoid overwriting data
-    if (beasts.find(name) == beasts.end())
+    filter.reset(2 * (beasts.size() + sealed.size() + frozen.size()));
+    for (const auto &entry : beasts)
+    {
+        filter.insert(entry.hash);
+    }
+    for (const auto &entry : sealed)
     {
-        beasts[name] = Beast(name);
+        filter.insert(entry.hash);
     }
+    frozen.forEachKey([this](size_t, const string &name)
+    {
+        filter.insert(hashName(name));
+    });
 }
 
 /**
  * @brief Adds effectiveness information for a specific beast
  * @param beastName The name of the beast to add effectiveness data for
+ * @param beastHash hashName(beastName)
  * @param counter The name of the sign or potion effective against the beast
+ * @param counterHash hashName(counter)
  * @param isSign true if counter is a sign, false if it's a potion
  * @return void
  * @side_effects Ensures beast exists and adds the counter to appropriate effectiveness list
  */
-void Bestiary::addEffectiveness(const string &beastName, const string &counter, bool isSign)
+void Bestiary::addEffectiveness(const string &beastName, NameHash beastHash, const string &counter, NameHash counterHash, bool isSign)
 {
-    // Ensure beast exists in bestiary before adding effectiveness data
-    addBeast(beastName);
-    
-    // Add counter to appropriate list based on type
-    if (isSign)
+    CommandExplain::countLookup(ExplainSubsystem::BESTIARY);
+    bool added;
+    if (store)
     {
-        beasts[beastName].addEffectiveSign(counter);
+        added = store->addLink(StoredKind::BEAST, beastName, beastHash, counter, counterHash, isSign ? 1 : 0);
     }
     else
     {
-        beasts[beastName].addEffectivePotion(counter);
+        // Ensure beast exists in bestiary before adding effectiveness data
+        Beast &beast = deltaBeast(beastName, beastHash);
+        size_t before = beast.effectiveSigns.size() + beast.effectivePotions.size();
+        bool wasIndexed = beast.indexed();
+
+        // Add counter to appropriate list based on type
+        if (isSign)
+        {
+            beast.addEffectiveSign(counter, counterHash);
+        }
+        else
+        {
+            beast.addEffectivePotion(counter, counterHash);
+        }
+        added = beast.effectiveSigns.size() + beast.effectivePotions.size() != before;
+        switches.record(wasIndexed, beast.indexed());
+    }
+
+    // Each beast-counter pair enters the digest once
+    if (added)
+    {
+        digest.add(StateDigest::key(StoredKind::BEAST, beastHash), StateDigest::combine(counterHash, isSign ? 1 : 0));
     }
 }
 
 /**
- * @brief Retrieves a pointer to a specific beast
+ * @brief Retrieves a copy of a specific beast
  * @param name The name of the beast to find
- * @return Pointer to the Beast object if found, nullptr otherwise
+ * @param hash hashName(name)
+ * @param beast Receives the beast data
+ * @return true if the beast is known, false otherwise
+ */
+bool Bestiary::getBeast(const string &name, NameHash hash, Beast &beast) const
+{
+    CommandExplain::countLookup(ExplainSubsystem::BESTIARY);
+    if (store)
+    {
+        vector<string> counters;
+        vector<NameHash> counterHashes;
+        vector<int> isSign;
+        if (!store->getLinks(StoredKind::BEAST, name, hash, counters, counterHashes, isSign))
+        {
+            return false;
+        }
+
+        beast = Beast(name);
+        for (size_t i = 0; i < counters.size(); ++i)
+        {
+            if (isSign[i])
+                beast.addEffectiveSign(counters[i], counterHashes[i]);
+            else
+                beast.addEffectivePotion(counters[i], counterHashes[i]);
+        }
+        return true;
+    }
+
+    // Most unknown beasts are rejected here without searching either part
+    if (!filter.mayContain(hash))
+    {
+        return false;
+    }
+
+    const Beast *recent = findRecent(name, hash);
+    if (recent)
+    {
+        beast = *recent;
+        return true;
+    }
+
+    size_t row = frozen.find(name);
+    if (row == string::npos)
+    {
+        filter.recordFalsePositive();
+        return false;
+    }
+
+    beast = Beast(name);
+    thaw(row, beast);
+    return true;
+}
+
+/**
+ * @brief Moves every beast into the frozen representation
+ * @return void
+ * @side_effects Finishes a freeze in progress, then folds in the delta
  */
-Beast *Bestiary::getBeast(const string &name)
+void Bestiary::freeze()
 {
-    auto it = beasts.find(name);
-    // Return pointer to beast if exists, otherwise return null
-    return (it != beasts.end()) ? &it->second : nullptr;
+    SliceMeter unlimited;
+    freezeStep(unlimited);
+    freezeStep(unlimited);
+}
+
+/**
+ * @brief Runs one slice of a freeze
+ * @param meter Budget of the slice
+ * @return true once the beasts learned before the freeze began are all frozen
+ * @side_effects The first slice seals the delta; the last one replaces the
+ *               frozen relation and has released the sealed beasts
+ */
+bool Bestiary::freezeStep(SliceMeter &meter)
+{
+    if (!freezing)
+    {
+        // A state file is already compact, and an empty delta has nothing to fold in
+        if (store || beasts.size() == 0)
+            return true;
+
+        // Learns from now on go to a fresh delta, which shadows the sealed one
+        switches.record(beasts.indexed(), false);
+        sealed = move(beasts);
+        beasts = NameTable<Beast>();
+        freezing.reset(new Freeze());
+
+        // Sized from the frozen part, so the builder's buffers do not grow mid-slice
+        size_t rows = frozen.size() + sealed.size();
+        size_t perRow = frozen.size() > 0 ? frozen.linkCount() / frozen.size() + 1 : 4;
+        freezing->builder.reserve(rows, rows * perRow, frozen.targetCount() + sealed.size());
+    }
+    Freeze &state = *freezing;
+
+    // Frozen beasts that are not shadowed by a sealed copy
+    while (!state.installed && state.row.index < frozen.size() && meter.take())
+    {
+        frozen.nextKey(state.row);
+        const string &name = state.row.name;
+        if (sealed.find(name, hashName(name)))
+            continue;
+
+        size_t row = state.row.index - 1;
+        state.builder.addRow(name);
+        for (size_t link = frozen.linksBegin(row); link < frozen.linksEnd(row); ++link)
+        {
+            state.builder.addLink(frozen.linkName(link), frozen.linkHash(link), frozen.linkValue(link));
+        }
+        meter.take(frozen.linksEnd(row) - frozen.linksBegin(row));
+    }
+
+    while (!state.installed && state.sealedCopied < sealed.size() && meter.take())
+    {
+        const Beast &beast = (sealed.begin() + state.sealedCopied++)->value;
+        state.builder.addRow(beast.name);
+        for (size_t i = 0; i < beast.effectiveSigns.size(); ++i)
+        {
+            state.builder.addLink(beast.effectiveSigns[i], beast.signHashes[i], 1);
+        }
+        for (size_t i = 0; i < beast.effectivePotions.size(); ++i)
+        {
+            state.builder.addLink(beast.effectivePotions[i], beast.potionHashes[i], 0);
+        }
+        meter.take(beast.effectiveSigns.size() + beast.effectivePotions.size());
+    }
+
+    if (!state.installed)
+    {
+        if (state.row.index < frozen.size() || state.sealedCopied < sealed.size() || !state.builder.step(meter))
+            return false;
+
+        // Every sealed beast is now frozen; the swap is all a reader can see
+        state.builder.install(frozen);
+        state.retired = move(sealed);
+        sealed = NameTable<Beast>();
+        state.installed = true;
+    }
+
+    while (state.retired.size() > 0 && meter.take())
+    {
+        state.retired.popBack();
+    }
+    if (state.retired.size() > 0)
+        return false;
+
+    freezing.reset();
+    return true;
 }
 
 /**
  * @brief Retrieves all effective counters for a beast in alphabetical order
  * @param beastName The name of the beast to get counters for
+ * @param beastHash hashName(beastName)
  * @return Comma-separated string of all effective signs and potions, sorted alphabetically
  *         Returns empty string if beast not found
  * 
  * Combines both potions and signs into a single sorted list for comprehensive combat reference
  */
-string Bestiary::getEffectiveCounters(const string &beastName) const
+string Bestiary::getEffectiveCounters(const string &beastName, NameHash beastHash) const
 {
-    auto it = beasts.find(beastName);
+    Beast beast;
     // Return empty string if beast doesn't exist
-    if (it == beasts.end())
+    if (!getBeast(beastName, beastHash, beast))
     {
         return "";
     }
@@ -81,13 +410,13 @@ string Bestiary::getEffectiveCounters(const string &beastName) const
     vector<string> allCounters;
 
     // Collect all effective potions
-    for (const auto &potion : it->second.effectivePotions)
+    for (const auto &potion : beast.effectivePotions)
     {
         allCounters.push_back(potion);
     }
 
     // Collect all effective signs
-    for (const auto &sign : it->second.effectiveSigns)
+    for (const auto &sign : beast.effectiveSigns)
     {
         allCounters.push_back(sign);
     }
@@ -105,4 +434,74 @@ string Bestiary::getEffectiveCounters(const string &beastName) const
     }
 
     return result;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Generates effectiveness information for several beasts
+ * @param beastNames Beasts to query
+ * @param beastHashes hashName of each beast
+ * @param results Receives the counters of each beast ("" if unknown), in the order of beastNames
+ * @return void
+ * 
+ * Beasts are probed in name order so the frozen part's binary searches
+ * walk a shared path. Without a state file the filter words and delta
+ * index slot of the beast MULTI_GET_PREFETCH places ahead are loaded
+ * while the current one is read.
+ */
+void Bestiary::getEffectiveCounters(const vector<string> &beastNames, const vector<NameHash> &beastHashes,
+                                    vector<string> &results) const
+{
+    vector<size_t> order(beastNames.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [&beastNames](size_t left, size_t right)
+         { return beastNames[left] < beastNames[right]; });
+
+    results.assign(beastNames.size(), string());
+    for (size_t k = 0; k < order.size(); ++k)
+    {
+        if (!store && k + MULTI_GET_PREFETCH < order.size())
+        {
+            NameHash ahead = beastHashes[order[k + MULTI_GET_PREFETCH]];
+            filter.prefetch(ahead);
+            beasts.prefetch(ahead);
+        }
+        size_t i = order[k];
+        results[i] = getEffectiveCounters(beastNames[i], beastHashes[i]);
+    }
+}
+
+/**
+ * @brief Collects the names of every known beast
+ * @param names Receives the names, sorted
+ * @return void
+ */
+void Bestiary::collectBeastNames(vector<string> &names) const
+{
+    names.clear();
+    if (store)
+    {
+        store->collectNames(StoredKind::BEAST, names);
+    }
+    else
+    {
+        // A beast in the delta may also still be in the sealed or frozen part
+        for (const auto &entry : beasts)
+        {
+            names.push_back(entry.name);
+        }
+        for (const auto &entry : sealed)
+        {
+            if (!beasts.find(entry.name, entry.hash))
+                names.push_back(entry.name);
+        }
+        frozen.forEachKey([&](size_t, const string &name)
+        {
+            if (!findRecent(name, hashName(name)))
+                names.push_back(name);
+        });
+    }
+    sort(names.begin(), names.end());
+}
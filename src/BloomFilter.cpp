@@ -0,0 +1,121 @@
+#include "WitcherTracker.h"
+
+using namespace std;
+
+/**
+ * @brief BloomFilter implementation - negative lookup filter over NameHash values
+ *
+ * Probe i tests bit (h1 + i * h2) mod size, where h1 and h2 are the low and
+ * high halves of the name hash (h2 forced odd so probes cover the array).
+ */
+
+/**
+ * @brief Clears the filter and sizes it for the given number of keys
+ * @param expected Keys expected before the next reset
+ * @return void
+ * @side_effects Discards all inserted keys; statistics are kept
+ */
+void BloomFilter::reset(size_t expected)
+{
+    capacity = max(expected, static_cast<size_t>(64));
+    count = 0;
+
+    size_t words = 1;
+    while (words * 64 < capacity * BITS_PER_KEY)
+        words *= 2;
+    bits.assign(words, 0);
+}
+
+/**
+ * @brief Takes the bits of a filter filled aside, keeping this filter's counters
+ * @param other Filter to take from; receives the old bits
+ * @return void
+ */
+void BloomFilter::adopt(BloomFilter &other)
+{
+    bits.swap(other.bits);
+    swap(capacity, other.capacity);
+    swap(count, other.count);
+}
+
+/**
+ * @brief Adds a name hash to the filter
+ * @param hash hashName of the inserted name
+ * @return void
+ */
+void BloomFilter::insert(NameHash hash)
+{
+    if (bits.empty())
+        reset(0);
+
+    uint64_t mask = bits.size() * 64 - 1;
+    uint64_t h1 = hash & 0xFFFFFFFFULL;
+    uint64_t h2 = (hash >> 32) | 1;
+    for (int i = 0; i < PROBES; ++i)
+    {
+        uint64_t bit = (h1 + i * h2) & mask;
+        bits[bit / 64] |= 1ULL << (bit % 64);
+    }
+    count++;
+}
+
+/**
+ * @brief Tests a name hash, counting the lookup
+ * @param hash hashName of the name looked up
+ * @return false if the name was certainly never inserted
+ */
+bool BloomFilter::mayContain(NameHash hash) const
+{
+    lookups.fetch_add(1, memory_order_relaxed);
+    if (bits.empty())
+    {
+        rejected.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+
+    uint64_t mask = bits.size() * 64 - 1;
+    uint64_t h1 = hash & 0xFFFFFFFFULL;
+    uint64_t h2 = (hash >> 32) | 1;
+    for (int i = 0; i < PROBES; ++i)
+    {
+        uint64_t bit = (h1 + i * h2) & mask;
+        if (!(bits[bit / 64] & (1ULL << (bit % 64))))
+        {
+            rejected.fetch_add(1, memory_order_relaxed);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Starts loading the words a later mayContain(hash) reads
+ * @param hash Name hash about to be tested
+ * @return void
+ */
+void BloomFilter::prefetch(NameHash hash) const
+{
+    if (bits.empty())
+        return;
+
+    uint64_t mask = bits.size() * 64 - 1;
+    uint64_t h1 = hash & 0xFFFFFFFFULL;
+    uint64_t h2 = (hash >> 32) | 1;
+    for (int i = 0; i < PROBES; ++i)
+    {
+        __builtin_prefetch(&bits[((h1 + i * h2) & mask) / 64]);
+    }
+}
+
+/**
+ * @brief Snapshot of the lookup counters
+ * @return Current statistics
+ */
+FilterStats BloomFilter::stats() const
+{
+    FilterStats result;
+    result.lookups = lookups.load(memory_order_relaxed);
+    result.rejected = rejected.load(memory_order_relaxed);
+    result.falsePositives = falsePositives.load(memory_order_relaxed);
+    return result;
+}
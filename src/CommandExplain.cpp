@@ -0,0 +1,106 @@
+#include "WitcherTracker.h"
+
+using namespace std;
+
+/**
+ * @brief CommandExplain implementation - per-command cost counters
+ *
+ * Allocations are counted only when AllocationCounter.cpp, which
+ * replaces operator new, is linked in; otherwise the report says so.
+ */
+
+thread_local CommandExplain *CommandExplain::current = nullptr;
+bool CommandExplain::allocationsCounted = false;
+
+static const char *const SUBSYSTEM_NAMES[CommandExplain::SUBSYSTEMS] = {"inventory", "bestiary", "alchemy"};
+
+/**
+ * @brief Marks allocations as counted by a linked replacement operator new
+ * @return true
+ */
+bool CommandExplain::countAllocations()
+{
+    allocationsCounted = true;
+    return true;
+}
+
+/**
+ * @brief Constructs zeroed counters, not yet active
+ */
+CommandExplain::CommandExplain()
+    : tokenizations(0), tokens(0), allocations(0), allocatedBytes(0), bytesFormatted(0), cleanNanos(0),
+      tokenizeNanos(0), validateNanos(0), executeNanos(0), previous(nullptr)
+{
+    for (int i = 0; i < SUBSYSTEMS; ++i)
+    {
+        lookups[i] = 0;
+        inserts[i] = 0;
+    }
+
+    // Validators are recorded during the measurement, so their slots must not allocate then
+    validators.reserve(16);
+}
+
+/**
+ * @brief Makes these counters receive the calling thread's hooks
+ * @return void
+ */
+void CommandExplain::activate()
+{
+    previous = current;
+    current = this;
+}
+
+/**
+ * @brief Stops counting and restores the counters active before activate()
+ * @return void
+ */
+void CommandExplain::deactivate()
+{
+    current = previous;
+    previous = nullptr;
+}
+
+/**
+ * @brief Writes the cost breakdown
+ * @param out Stream receiving the report
+ * @param command Explained command line
+ * @param status Status returned by the command, -1 if it was rejected
+ * @return void
+ *
+ * Format, one item per line after a header line:
+ *   EXPLAIN <command>: <executed|rejected>
+ *   tokenize: <n> run(s), <n> tokens
+ *   validators: isLootAction rejected, isTradeAction accepted
+ *   inventory: <n> lookups, <n> inserts        (likewise bestiary, alchemy)
+ *   allocations: <n> (<n> bytes)                or "not counted"
+ *   formatted: <n> bytes
+ *   time: clean <n>ns, tokenize <n>ns, validate <n>ns, execute <n>ns, total <n>ns
+ */
+void CommandExplain::writeReport(ostream &out, const string &command, int status) const
+{
+    ostringstream report;
+    report << "EXPLAIN " << command << ": " << (status == -1 ? "rejected" : "executed") << "\n";
+    report << "  tokenize: " << tokenizations << (tokenizations == 1 ? " run, " : " runs, ") << tokens << " tokens\n";
+
+    report << "  validators:";
+    for (size_t i = 0; i < validators.size(); ++i)
+    {
+        report << (i > 0 ? ", " : " ") << validators[i].first << (validators[i].second ? " accepted" : " rejected");
+    }
+    report << (validators.empty() ? " none\n" : "\n");
+
+    for (int i = 0; i < SUBSYSTEMS; ++i)
+    {
+        report << "  " << SUBSYSTEM_NAMES[i] << ": " << lookups[i] << " lookups, " << inserts[i] << " inserts\n";
+    }
+    if (allocationsCounted)
+        report << "  allocations: " << allocations << " (" << allocatedBytes << " bytes)\n";
+    else
+        report << "  allocations: not counted\n";
+    report << "  formatted: " << bytesFormatted << " bytes\n";
+    report << "  time: clean " << cleanNanos << "ns, tokenize " << tokenizeNanos << "ns, validate " << validateNanos
+           << "ns, execute " << executeNanos << "ns, total "
+           << cleanNanos + tokenizeNanos + validateNanos + executeNanos << "ns\n";
+    out << report.str();
+}
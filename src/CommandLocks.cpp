@@ -0,0 +1,150 @@
+#include "WitcherTracker.h"
+
+using namespace std;
+
+/**
+ * @brief CommandLocks class implementation - per-command lock declaration
+ * 
+ * Each command declares the subsystems it touches. Acquisition order is fixed
+ * (alchemy, then bestiary, then inventory shards by ascending index) so two
+ * commands can never wait on each other in a cycle.
+ */
+
+// Acquisition stages; a command may only move forward through them
+static const int STAGE_ALCHEMY = 1;
+static const int STAGE_BESTIARY = 2;
+static const int STAGE_INVENTORY = 3;
+
+/**
+ * @brief Releases every held lock in reverse acquisition order
+ */
+CommandLocks::~CommandLocks()
+{
+    for (size_t i = held.size(); i > 0; --i)
+    {
+        if (held[i - 1].write)
+            held[i - 1].lock->unlockWrite();
+        else
+            held[i - 1].lock->unlockRead();
+    }
+}
+
+/**
+ * @brief Acquires a single lock and records it for release
+ * @param lock Lock to acquire
+ * @param write true for exclusive access
+ * @return void
+ */
+void CommandLocks::acquire(RWLock &lock, bool write)
+{
+    if (write)
+        lock.lockWrite();
+    else
+        lock.lockRead();
+    held.push_back(Held{&lock, write});
+}
+
+/**
+ * @brief Locks the alchemy knowledge base
+ * @param alchemy Knowledge base to lock
+ * @param write true for exclusive access
+ * @return void
+ * @side_effects Must be the first lock taken by the command
+ */
+void CommandLocks::lockAlchemy(const AlchemyKnowledge &alchemy, bool write)
+{
+    if (!enabled)
+        return;
+
+    if (stage >= STAGE_ALCHEMY)
+        throw logic_error("CommandLocks: alchemy locked out of order");
+    stage = STAGE_ALCHEMY;
+    acquire(alchemy.lock(), write);
+}
+
+/**
+ * @brief Locks the bestiary
+ * @param bestiary Bestiary to lock
+ * @param write true for exclusive access
+ * @return void
+ * @side_effects Must precede any inventory lock
+ */
+void CommandLocks::lockBestiary(const Bestiary &bestiary, bool write)
+{
+    if (!enabled)
+        return;
+
+    if (stage >= STAGE_BESTIARY)
+        throw logic_error("CommandLocks: bestiary locked out of order");
+    stage = STAGE_BESTIARY;
+    acquire(bestiary.lock(), write);
+}
+
+/**
+ * @brief Locks the inventory shards that store the given item names
+ * @param inventory Inventory to lock
+ * @param hashes Name hashes of the items the command touches (duplicates allowed)
+ * @param write true for exclusive access
+ * @return void
+ * @side_effects Shards are locked once each, in ascending index order
+ */
+void CommandLocks::lockInventory(const Inventory &inventory, const vector<NameHash> &hashes, bool write)
+{
+    if (!enabled)
+        return;
+
+    vector<size_t> shardIndices;
+    for (NameHash hash : hashes)
+    {
+        shardIndices.push_back(inventory.shardOf(hash));
+    }
+    lockInventoryShards(inventory, shardIndices, write);
+}
+
+/**
+ * @brief Locks a set of inventory shards
+ * @param inventory Inventory to lock
+ * @param shardIndices Shards to lock (any order, duplicates allowed)
+ * @param write true for exclusive access
+ * @return void
+ * @side_effects Shards are locked once each, in ascending index order
+ */
+void CommandLocks::lockInventoryShards(const Inventory &inventory, vector<size_t> shardIndices, bool write)
+{
+    if (!enabled)
+        return;
+
+    if (stage >= STAGE_INVENTORY)
+        throw logic_error("CommandLocks: inventory locked twice");
+    stage = STAGE_INVENTORY;
+
+    // Deduplicate and order shard indices to keep the global order
+    sort(shardIndices.begin(), shardIndices.end());
+    shardIndices.erase(unique(shardIndices.begin(), shardIndices.end()), shardIndices.end());
+
+    for (size_t shard : shardIndices)
+    {
+        acquire(inventory.shardLock(shard), write);
+    }
+}
+
+/**
+ * @brief Locks every inventory shard
+ * @param inventory Inventory to lock
+ * @param write true for exclusive access
+ * @return void
+ */
+void CommandLocks::lockAllInventory(const Inventory &inventory, bool write)
+{
+    if (!enabled)
+        return;
+
+    if (stage >= STAGE_INVENTORY)
+        throw logic_error("CommandLocks: inventory locked twice");
+    stage = STAGE_INVENTORY;
+
+    for (size_t shard = 0; shard < inventory.getShardCount(); ++shard)
+    {
+        acquire(inventory.shardLock(shard), write);
+    }
+}
@@ -10,17 +10,49 @@ using namespace std;
  * and tokenization for the Witcher tracking system.
  */
 
+/**
+ * @brief Tokenizes input and prepares name hashes for it
+ * @param input The raw input string to tokenize
+ * @param command Receives the tokens; their hashes are computed on first use
+ * @return void
+ */
+void CommandParser::tokenizeInput(const string &input, TokenizedCommand &command)
+{
+    command.tokens = tokenizeInput(input);
+    command.hashes.assign(command.tokens.size(), 0);
+    command.hashed.assign(command.tokens.size(), false);
+}
+
 /**
  * @brief Tokenizes input string into structured command components
  * @param input The raw input string to tokenize
  * @return Vector of string tokens representing parsed command elements
+ */
+vector<string> CommandParser::tokenizeInput(const string &input)
+{
+    CommandExplain::countTokenize();
+    vector<string> tokens;
+    size_t position;
+    TokenList list = tokenizeHead(input, tokens, position);
+    SliceMeter unlimited;
+    tokenizeList(input, list, position, tokens, unlimited);
+    return tokens;
+}
+
+/**
+ * @brief Tokenizes the fixed part of a line, up to any open-ended list
+ * @param input The raw input string to tokenize
+ * @param tokens Receives the tokens before the list
+ * @param position Receives the offset of the list in input
+ * @return Kind of list left for tokenizeList(), NONE if the line is done
  * 
  * Handles complex parsing for different command patterns including questions,
  * total queries, and Geralt commands with proper whitespace and punctuation handling.
  */
-vector<string> CommandParser::tokenizeInput(const string &input)
+CommandParser::TokenList CommandParser::tokenizeHead(const string &input, vector<string> &tokens, size_t &position)
 {
-    vector<string> tokens;
+    tokens.clear();
+    position = input.length();
     int inputLen = input.length();
     int i = 0;
 
@@ -114,7 +146,7 @@ vector<string> CommandParser::tokenizeInput(const string &input)
                         }
                     }
                 }
-                return tokens;
+                return TokenList::NONE;
             }
             // Parse bestiary query pattern: "What is effective against <monster>?"
             else if (i < inputLen && input.substr(i, 9) == "effective" &&
@@ -192,7 +224,7 @@ vector<string> CommandParser::tokenizeInput(const string &input)
                             }
                         }
                     }
-                    return tokens;
+                    return TokenList::NONE;
                 }
             }
         }
@@ -250,12 +282,12 @@ vector<string> CommandParser::tokenizeInput(const string &input)
                     tokens.push_back(input.substr(tokenStart, tokenLen));
                 }
             }
-            return tokens;
+            return TokenList::NONE;
         }
 
         // Return early if no more input to process
         if (i >= inputLen)
-            return tokens;
+            return TokenList::NONE;
 
         while (i < inputLen && isspace(input[i]))
             i++;
@@ -317,7 +349,7 @@ vector<string> CommandParser::tokenizeInput(const string &input)
                 }
             }
         }
-        return tokens;
+        return TokenList::NONE;
     }
 
     // Reset parser position for Geralt commands
@@ -352,7 +384,7 @@ vector<string> CommandParser::tokenizeInput(const string &input)
             {
                 tokens.push_back(input.substr(i));
             }
-            return tokens;
+            return TokenList::NONE;
         }
         // Parse "learns" command - complex pattern for knowledge statements
         else if (i < inputLen && input.substr(i, 6) == "learns" &&
@@ -446,7 +478,7 @@ vector<string> CommandParser::tokenizeInput(const string &input)
                                         {
                                             tokens.push_back(input.substr(i));
                                         }
-                                        return tokens;
+                                        return TokenList::NONE;
                                     }
                                 }
                             }
@@ -471,88 +503,17 @@ vector<string> CommandParser::tokenizeInput(const string &input)
                                     tokens.push_back("of");
                                     i += 2;
 
-                                    // Parse ingredient list with quantities
-                                    while (i < inputLen)
-                                    {
-                                        while (i < inputLen && isspace(input[i]))
-                                            i++;
-                                        if (i >= inputLen)
-                                            break;
-
-                                        // Handle quantity-ingredient pairs
-                                        if (isdigit(input[i]))
-                                        {
-                                            // Extract numeric quantity
-                                            int numStart = i;
-                                            while (i < inputLen && isdigit(input[i]))
-                                                i++;
-                                            int numLen = i - numStart;
-
-                                            if (numLen > 0)
-                                            {
-                                                tokens.push_back(input.substr(numStart, numLen));
-                                            }
-
-                                            // Skip spaces between quantity and ingredient
-                                            while (i < inputLen && isspace(input[i]))
-                                                i++;
-
-                                            // Extract ingredient name
-                                            int nameStart = i;
-                                            while (i < inputLen && !isspace(input[i]) && input[i] != ',')
-                                                i++;
-                                            int nameLen = i - nameStart;
-
-                                            if (nameLen > 0)
-                                            {
-                                                tokens.push_back(input.substr(nameStart, nameLen));
-                                            }
-
-                                            // Skip spaces after ingredient
-                                            while (i < inputLen && isspace(input[i]))
-                                                i++;
-
-                                            // Handle comma separators
-                                            if (i < inputLen && input[i] == ',')
-                                            {
-                                                tokens.push_back(",");
-                                                i++;
-                                            }
-                                        }
-                                        else
-                                        {
-                                            // Handle non-numeric tokens
-                                            int wordStart = i;
-                                            while (i < inputLen && !isspace(input[i]) && input[i] != ',')
-                                                i++;
-                                            int wordLen = i - wordStart;
-
-                                            if (wordLen > 0)
-                                            {
-                                                tokens.push_back(input.substr(wordStart, wordLen));
-                                            }
-
-                                            // Skip spaces
-                                            while (i < inputLen && isspace(input[i]))
-                                                i++;
-
-                                            // Handle comma if present
-                                            if (i < inputLen && input[i] == ',')
-                                            {
-                                                tokens.push_back(",");
-                                                i++;
-                                            }
-                                        }
-                                    }
-                                    return tokens;
+                                    // The ingredient list is left to tokenizeList()
+                                    position = i;
+                                    return TokenList::INGREDIENTS;
                                 }
                             }
                         }
                     }
-                    return tokens; // Fallback if parsing fails
+                    return TokenList::NONE; // Fallback if parsing fails
                 }
             }
-            return tokens; // Fallback if neither potion nor sign found
+            return TokenList::NONE; // Fallback if neither potion nor sign found
         }
         // Parse "trades" command - handles trophy-for-ingredient exchanges
         else if (i < inputLen && input.substr(i, 6) == "trades" &&
@@ -589,44 +550,138 @@ vector<string> CommandParser::tokenizeInput(const string &input)
                     tokens.push_back(input.substr(tokenStart, tokenLen));
                 }
             }
-            return tokens;
+            return TokenList::NONE;
         }
         // Note: "loots" and "encounters" commands fall through to generic parsing
     }
 
-    // Generic fallback parsing for unrecognized patterns
-    i = 0;
+    // Generic parsing for unrecognized patterns, left to tokenizeList()
     tokens.clear();
+    position = 0;
+    return TokenList::WORDS;
+}
 
-    while (i < inputLen)
-    {
-        // Skip spaces between tokens
-        while (i < inputLen && isspace(input[i]))
-            i++;
-        if (i >= inputLen)
-            break;
+/**
+ * @brief Tokenizes part of the list that follows the fixed part of a line
+ * @param input The raw input string being tokenized
+ * @param list Kind of list, as returned by tokenizeHead()
+ * @param position Offset of the next token; advanced past the tokens produced
+ * @param tokens Receives the tokens
+ * @param meter Budget, one unit per token or quantity-ingredient pair
+ * @return true once the whole input has been tokenized
+ */
+bool CommandParser::tokenizeList(const string &input, TokenList list, size_t &position, vector<string> &tokens,
+                                 SliceMeter &meter)
+{
+    size_t inputLen = input.length();
+    size_t i = list == TokenList::NONE ? inputLen : position;
 
-        // Handle comma as separate token
-        if (input[i] == ',')
+    while (i < inputLen && meter.take())
+    {
+        if (list == TokenList::WORDS)
         {
-            tokens.push_back(",");
-            i++;
-            continue;
-        }
+            // Skip spaces between tokens
+            while (i < inputLen && isspace(input[i]))
+                i++;
+            if (i >= inputLen)
+                break;
 
-        // Extract regular token until space or comma
-        int tokenStart = i;
-        while (i < inputLen && input[i] != ',' && !isspace(input[i]))
-            i++;
+            // Handle comma as separate token
+            if (input[i] == ',')
+            {
+                tokens.push_back(",");
+                i++;
+                continue;
+            }
+
+            // Extract regular token until space or comma
+            size_t tokenStart = i;
+            while (i < inputLen && input[i] != ',' && !isspace(input[i]))
+                i++;
 
-                    int tokenLen = i - tokenStart;
-        if (tokenLen > 0)
+            size_t tokenLen = i - tokenStart;
+            if (tokenLen > 0)
+            {
+                tokens.push_back(input.substr(tokenStart, tokenLen));
+            }
+        }
+        else
         {
-            tokens.push_back(input.substr(tokenStart, tokenLen));
+            // Skip spaces before the next pair
+            while (i < inputLen && isspace(input[i]))
+                i++;
+            if (i >= inputLen)
+                break;
+
+            // Handle quantity-ingredient pairs
+            if (isdigit(input[i]))
+            {
+                // Extract numeric quantity
+                size_t numStart = i;
+                while (i < inputLen && isdigit(input[i]))
+                    i++;
+                size_t numLen = i - numStart;
+
+                if (numLen > 0)
+                {
+                    tokens.push_back(input.substr(numStart, numLen));
+                }
+
+                // Skip spaces between quantity and ingredient
+                while (i < inputLen && isspace(input[i]))
+                    i++;
+
+                // Extract ingredient name
+                size_t nameStart = i;
+                while (i < inputLen && !isspace(input[i]) && input[i] != ',')
+                    i++;
+                size_t nameLen = i - nameStart;
+
+                if (nameLen > 0)
+                {
+                    tokens.push_back(input.substr(nameStart, nameLen));
+                }
+
+                // Skip spaces after ingredient
+                while (i < inputLen && isspace(input[i]))
+                    i++;
+
+                // Handle comma separators
+                if (i < inputLen && input[i] == ',')
+                {
+                    tokens.push_back(",");
+                    i++;
+                }
+            }
+            else
+            {
+                // Handle non-numeric tokens
+                size_t wordStart = i;
+                while (i < inputLen && !isspace(input[i]) && input[i] != ',')
+                    i++;
+                size_t wordLen = i - wordStart;
+
+                if (wordLen > 0)
+                {
+                    tokens.push_back(input.substr(wordStart, wordLen));
+                }
+
+                // Skip spaces
+                while (i < inputLen && isspace(input[i]))
+                    i++;
+
+                // Handle comma if present
+                if (i < inputLen && input[i] == ',')
+                {
+                    tokens.push_back(",");
+                    i++;
+                }
+            }
         }
     }
 
-    return tokens;
+    position = i;
+    return i >= inputLen;
 }
 
 /**
@@ -786,7 +841,18 @@ bool CommandParser::isValidPotionNameToken(const string &token)
  */
 bool CommandParser::isLootAction(const string &input)
 {
-    auto tokens = tokenizeInput(input);
+    return isLootAction(tokenizeInput(input));
+}
+
+/**
+ * @brief Validates loot action command format
+ * @param tokens The tokenized input to validate
+ * @return true if valid loot action, false otherwise
+ * 
+ * Expected format: "Geralt loots quantity ingredient [, quantity ingredient]..."
+ */
+bool CommandParser::isLootAction(const vector<string> &tokens)
+{
     
     if (hasCommaSpacingError(tokens))
     {
@@ -801,31 +867,8 @@ bool CommandParser::isLootAction(const string &input)
 
     // Validate pattern: quantity, ingredient [, quantity, ingredient]...
     size_t tokenIndex = 2;
-    while (tokenIndex < tokens.size())
-    {
-        // Expect positive integer quantity
-        if (!isPositiveInteger(tokens[tokenIndex]))
-            return false;
-        tokenIndex++;
-
-        // Expect alphabetic ingredient name
-        if (tokenIndex >= tokens.size() || !isAlphabeticOnly(tokens[tokenIndex]))
-            return false;
-        tokenIndex++;
-
-        // Check for comma separator or end of input
-        if (tokenIndex < tokens.size())
-        {
-            if (tokens[tokenIndex] == ",")
-            {
-                tokenIndex++;
-                if (tokenIndex >= tokens.size())
-                    return false; // Trailing comma is invalid
-            }
-        }
-    }
-
-    return true;
+    SliceMeter unlimited;
+    return checkItemList(tokens, tokenIndex, false, unlimited);
 }
 
 /**
@@ -837,7 +880,18 @@ bool CommandParser::isLootAction(const string &input)
  */
 bool CommandParser::isTradeAction(const string &input)
 {
-    auto tokens = tokenizeInput(input);
+    return isTradeAction(tokenizeInput(input));
+}
+
+/**
+ * @brief Validates trade action command format
+ * @param tokens The tokenized input to validate
+ * @return true if valid trade action, false otherwise
+ * 
+ * Expected format: "Geralt trades quantity monster [, quantity monster] trophy for quantity ingredient [, quantity ingredient]..."
+ */
+bool CommandParser::isTradeAction(const vector<string> &tokens)
+{
 
     if (hasCommaSpacingError(tokens))
         return false;
@@ -975,7 +1029,18 @@ bool CommandParser::isTradeAction(const string &input)
  */
 bool CommandParser::isBrewAction(const string &input)
 {
-    auto tokens = tokenizeInput(input);
+    return isBrewAction(tokenizeInput(input));
+}
+
+/**
+ * @brief Validates brew action command format
+ * @param tokens The tokenized input to validate
+ * @return true if valid brew action, false otherwise
+ * 
+ * Expected format: "Geralt brews <potion_name>"
+ */
+bool CommandParser::isBrewAction(const vector<string> &tokens)
+{
 
     // Minimum required tokens
     if (tokens.size() < 3)
@@ -1019,7 +1084,18 @@ bool CommandParser::isBrewAction(const string &input)
  */
 bool CommandParser::isEffectivenessKnowledge(const string &input)
 {
-    auto tokens = tokenizeInput(input);
+    return isEffectivenessKnowledge(tokenizeInput(input));
+}
+
+/**
+ * @brief Validates effectiveness knowledge statement format
+ * @param tokens The tokenized input to validate
+ * @return true if valid effectiveness knowledge, false otherwise
+ * 
+ * Expected format: "Geralt learns <item> potion/sign is effective against <monster>"
+ */
+bool CommandParser::isEffectivenessKnowledge(const vector<string> &tokens)
+{
 
     // Must start with "Geralt learns"
     if (tokens.size() < 5 || tokens[0] != "Geralt" || tokens[1] != "learns")
@@ -1063,7 +1139,18 @@ bool CommandParser::isEffectivenessKnowledge(const string &input)
  */
 bool CommandParser::isPotionFormulaKnowledge(const string &input)
 {
-    auto tokens = tokenizeInput(input);
+    return isPotionFormulaKnowledge(tokenizeInput(input));
+}
+
+/**
+ * @brief Validates potion formula knowledge statement format
+ * @param tokens The tokenized input to validate
+ * @return true if valid potion formula knowledge, false otherwise
+ * 
+ * Expected format: "Geralt learns <potion> potion consists of quantity ingredient [, quantity ingredient]..."
+ */
+bool CommandParser::isPotionFormulaKnowledge(const vector<string> &tokens)
+{
 
     if (tokens.size() < 7)
         return false;
@@ -1114,11 +1201,29 @@ bool CommandParser::isPotionFormulaKnowledge(const string &input)
 
     // Validate ingredient list after "of"
     size_t i = ofIndex + 1;
+    SliceMeter unlimited;
+    return checkItemList(tokens, i, true, unlimited);
+}
 
-    while (i < tokens.size())
+/**
+ * @brief Validates part of a "quantity ingredient [, quantity ingredient]..." list
+ * @param tokens The tokenized input
+ * @param position Index of the next item; advanced past each item validated
+ * @param commaRequired true if items must be separated by commas, as in formulas
+ * @param meter Budget, one unit per item
+ * @return false as soon as the list is found malformed
+ * 
+ * The list is complete once position reaches the end of tokens.
+ */
+bool CommandParser::checkItemList(const vector<string> &tokens, size_t &position, bool commaRequired,
+                                  SliceMeter &meter)
+{
+    size_t i = position;
+
+    while (i < tokens.size() && meter.take())
     {
         // Validate quantity
-        if (i >= tokens.size() || !isPositiveInteger(tokens[i]))
+        if (!isPositiveInteger(tokens[i]))
             return false;
         i++;
 
@@ -1127,7 +1232,7 @@ bool CommandParser::isPotionFormulaKnowledge(const string &input)
             return false;
         i++;
 
-        // Handle optional comma separator
+        // Handle comma separator or end of input
         if (i < tokens.size())
         {
             if (tokens[i] == ",")
@@ -1137,15 +1242,15 @@ bool CommandParser::isPotionFormulaKnowledge(const string &input)
                 if (i == tokens.size())
                     return false;
             }
-            else
+            else if (commaRequired)
             {
                 // No comma means this should be the last item
-                if ((tokens.size() - i) >= 1)
-                    return false;
+                return false;
             }
         }
     }
 
+    position = i;
     return true;
 }
 
@@ -1158,7 +1263,18 @@ bool CommandParser::isPotionFormulaKnowledge(const string &input)
  */
 bool CommandParser::isEncounterSentence(const string &input)
 {
-    auto tokens = tokenizeInput(input);
+    return isEncounterSentence(tokenizeInput(input));
+}
+
+/**
+ * @brief Validates encounter sentence format
+ * @param tokens The tokenized input to validate
+ * @return true if valid encounter sentence, false otherwise
+ * 
+ * Expected format: "Geralt encounters a <monster>"
+ */
+bool CommandParser::isEncounterSentence(const vector<string> &tokens)
+{
 
     // Exact pattern required
     if (tokens.size() != 4)
@@ -1184,7 +1300,19 @@ bool CommandParser::isEncounterSentence(const string &input)
  */
 bool CommandParser::isInventoryQuery(const string &input, bool &isSpecific)
 {
-    auto tokens = tokenizeInput(input);
+    return isInventoryQuery(tokenizeInput(input), isSpecific);
+}
+
+/**
+ * @brief Validates inventory query format
+ * @param tokens The tokenized input to validate
+ * @param isSpecific Reference to boolean indicating if query is for specific item
+ * @return true if valid inventory query, false otherwise
+ * 
+ * Expected formats: "Total <category> ?" or "Total <category> <item> ?"
+ */
+bool CommandParser::isInventoryQuery(const vector<string> &tokens, bool &isSpecific)
+{
 
     if (tokens.size() < 3 || tokens.size() > 4)
         return false;
@@ -1237,7 +1365,18 @@ bool CommandParser::isInventoryQuery(const string &input, bool &isSpecific)
  */
 bool CommandParser::isBestiaryQuery(const string &input)
 {
-    auto tokens = tokenizeInput(input);
+    return isBestiaryQuery(tokenizeInput(input));
+}
+
+/**
+ * @brief Validates bestiary query format
+ * @param tokens The tokenized input to validate
+ * @return true if valid bestiary query, false otherwise
+ * 
+ * Expected format: "What is effective against <monster> ?"
+ */
+bool CommandParser::isBestiaryQuery(const vector<string> &tokens)
+{
 
     // Exact pattern required
     if (tokens.size() != 6)
@@ -1255,6 +1394,126 @@ bool CommandParser::isBestiaryQuery(const string &input)
     return true;
 }
 
+/**
+ * @brief Validates recommendation query format
+ * @param tokens The tokenized input to validate
+ * @return true if valid recommendation query, false otherwise
+ * 
+ * Expected format: "What can I use against <monster> ?"
+ */
+bool CommandParser::isRecommendationQuery(const vector<string> &tokens)
+{
+    // Exact pattern required
+    if (tokens.size() != 7)
+        return false;
+
+    if (tokens[0] != "What" || tokens[1] != "can" || tokens[2] != "I" || tokens[3] != "use" || tokens[4] != "against")
+        return false;
+
+    if (!isAlphabeticOnly(tokens[5]))
+        return false;
+
+    return tokens[6] == "?";
+}
+
+/**
+ * @brief Splits the comma-separated name list of a multi-item query
+ * @param token The name list token, e.g. "Rebis, Vitriol ,Quebrith"
+ * @param names Receives the names with surrounding spaces removed
+ * @param hashes Receives hashName of each name, or nullptr to skip hashing
+ * @return true if the list holds at least two names and none is empty
+ * 
+ * The tokenizer keeps everything between the category (or "against") and
+ * the question mark as one token, so the whole list arrives in a single
+ * tokenization and is only split here.
+ */
+bool CommandParser::splitNameList(const string &token, vector<string> &names, vector<NameHash> *hashes)
+{
+    names.clear();
+    if (hashes)
+        hashes->clear();
+
+    size_t begin = 0;
+    while (true)
+    {
+        size_t comma = token.find(',', begin);
+        size_t end = comma == string::npos ? token.size() : comma;
+        size_t first = token.find_first_not_of(' ', begin);
+        if (first == string::npos || first >= end)
+            return false;
+        size_t last = token.find_last_not_of(' ', end - 1);
+
+        names.push_back(token.substr(first, last + 1 - first));
+        if (hashes)
+            hashes->push_back(hashName(names.back()));
+        if (comma == string::npos)
+            break;
+        begin = comma + 1;
+    }
+    return names.size() > 1;
+}
+
+/**
+ * @brief Validates multi-item inventory query format
+ * @param tokens The tokenized input to validate
+ * @return true if valid multi-item inventory query, false otherwise
+ * 
+ * Expected format: "Total <category> <item>, <item> [, <item>]... ?"
+ * Single-item queries are left to isInventoryQuery.
+ */
+bool CommandParser::isMultiInventoryQuery(const vector<string> &tokens)
+{
+    if (tokens.size() != 4 || tokens[0] != "Total" || tokens[3] != "?")
+        return false;
+
+    if (tokens[1] != "ingredient" &&
+        tokens[1] != "potion" &&
+        tokens[1] != "trophy")
+        return false;
+
+    vector<string> names;
+    if (!splitNameList(tokens[2], names, nullptr))
+        return false;
+
+    // Names follow the single-item rules of their category
+    for (const auto &name : names)
+    {
+        if (tokens[1] == "potion" ? !isValidPotionNameToken(name) : !isAlphabeticOnly(name))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Validates multi-beast bestiary query format
+ * @param tokens The tokenized input to validate
+ * @return true if valid multi-beast bestiary query, false otherwise
+ * 
+ * Expected format: "What is effective against <monster>, <monster> [, <monster>]... ?"
+ */
+bool CommandParser::isMultiBestiaryQuery(const vector<string> &tokens)
+{
+    if (tokens.size() != 6)
+        return false;
+
+    if (tokens[0] != "What" || tokens[1] != "is" || tokens[2] != "effective" || tokens[3] != "against")
+        return false;
+
+    if (tokens[5] != "?")
+        return false;
+
+    vector<string> names;
+    if (!splitNameList(tokens[4], names, nullptr))
+        return false;
+
+    for (const auto &name : names)
+    {
+        if (!isAlphabeticOnly(name))
+            return false;
+    }
+    return true;
+}
+
 /**
  * @brief Validates alchemy query format
  * @param input The input string to validate
@@ -1264,7 +1523,18 @@ bool CommandParser::isBestiaryQuery(const string &input)
  */
 bool CommandParser::isAlchemyQuery(const string &input)
 {
-    auto tokens = tokenizeInput(input);
+    return isAlchemyQuery(tokenizeInput(input));
+}
+
+/**
+ * @brief Validates alchemy query format
+ * @param tokens The tokenized input to validate
+ * @return true if valid alchemy query, false otherwise
+ * 
+ * Expected format: "What is in <potion> ?"
+ */
+bool CommandParser::isAlchemyQuery(const vector<string> &tokens)
+{
 
     // Minimum required tokens
     if (tokens.size() < 5)
@@ -1286,6 +1556,21 @@ bool CommandParser::isAlchemyQuery(const string &input)
     return true;
 }
 
+/**
+ * @brief Validates state digest query format
+ * @param tokens The tokenized input to validate
+ * @return true if valid state digest query, false otherwise
+ * 
+ * Expected format: "State digest?" (the generic tokenizer keeps the
+ * question mark attached unless it is spaced out)
+ */
+bool CommandParser::isStateDigestQuery(const vector<string> &tokens)
+{
+    if (tokens.size() == 2)
+        return tokens[0] == "State" && tokens[1] == "digest?";
+    return tokens.size() == 3 && tokens[0] == "State" && tokens[1] == "digest" && tokens[2] == "?";
+}
+
 /**
  * @brief Checks if input is the exit command
  * @param input The input string to check
@@ -1307,36 +1592,53 @@ bool CommandParser::isExitCommand(const string &input)
  * Order of validation is important as some patterns may overlap.
  */
 bool CommandParser::isValidCommand(const string &input, CommandType &cmdType)
+{
+    return isValidCommand(input, tokenizeInput(input), cmdType);
+}
+
+/**
+ * @brief Validates an already tokenized command and determines its type
+ * @param input The input string (needed for the exit command)
+ * @param tokens tokenizeInput(input)
+ * @param cmdType Reference to CommandType enum to store the determined command type
+ * @return true if input is a valid command, false otherwise
+ * @side_effects Sets cmdType to the appropriate CommandType enum value
+ * 
+ * Every validator works on the same token list, so the input is tokenized
+ * once per command instead of once per validator tried. Each validator
+ * tried is reported to an active CommandExplain.
+ */
+bool CommandParser::isValidCommand(const string &input, const vector<string> &tokens, CommandType &cmdType)
 {
     // Check action commands first
-    if (isLootAction(input))
+    if (CommandExplain::countValidator("isLootAction", isLootAction(tokens)))
     {
         cmdType = CommandType::ACTION_LOOT;
         return true;
     }
-    else if (isTradeAction(input))
+    else if (CommandExplain::countValidator("isTradeAction", isTradeAction(tokens)))
     {
         cmdType = CommandType::ACTION_TRADE;
         return true;
     }
-    else if (isBrewAction(input))
+    else if (CommandExplain::countValidator("isBrewAction", isBrewAction(tokens)))
     {
         cmdType = CommandType::ACTION_BREW;
         return true;
     }
     // Check knowledge commands
-    else if (isEffectivenessKnowledge(input))
+    else if (CommandExplain::countValidator("isEffectivenessKnowledge", isEffectivenessKnowledge(tokens)))
     {
         cmdType = CommandType::KNOWLEDGE_EFFECTIVENESS;
         return true;
     }
-    else if (isPotionFormulaKnowledge(input))
+    else if (CommandExplain::countValidator("isPotionFormulaKnowledge", isPotionFormulaKnowledge(tokens)))
     {
         cmdType = CommandType::KNOWLEDGE_POTION_FORMULA;
         return true;
     }
     // Check encounter command
-    else if (isEncounterSentence(input))
+    else if (CommandExplain::countValidator("isEncounterSentence", isEncounterSentence(tokens)))
     {
         cmdType = CommandType::ENCOUNTER;
         return true;
@@ -1345,23 +1647,43 @@ bool CommandParser::isValidCommand(const string &input, CommandType &cmdType)
     else
     {
         bool isSpecific = false;
-        if (isInventoryQuery(input, isSpecific))
+        if (CommandExplain::countValidator("isInventoryQuery", isInventoryQuery(tokens, isSpecific)))
         {
             // Set appropriate inventory query type based on specificity
             cmdType = isSpecific ? CommandType::QUERY_SPECIFIC_INVENTORY : CommandType::QUERY_ALL_INVENTORY;
             return true;
         }
-        else if (isBestiaryQuery(input))
+        else if (CommandExplain::countValidator("isBestiaryQuery", isBestiaryQuery(tokens)))
         {
             cmdType = CommandType::QUERY_BESTIARY;
             return true;
         }
-        else if (isAlchemyQuery(input))
+        else if (CommandExplain::countValidator("isRecommendationQuery", isRecommendationQuery(tokens)))
+        {
+            cmdType = CommandType::QUERY_RECOMMENDATION;
+            return true;
+        }
+        else if (CommandExplain::countValidator("isMultiInventoryQuery", isMultiInventoryQuery(tokens)))
+        {
+            cmdType = CommandType::QUERY_MULTI_INVENTORY;
+            return true;
+        }
+        else if (CommandExplain::countValidator("isMultiBestiaryQuery", isMultiBestiaryQuery(tokens)))
+        {
+            cmdType = CommandType::QUERY_MULTI_BESTIARY;
+            return true;
+        }
+        else if (CommandExplain::countValidator("isAlchemyQuery", isAlchemyQuery(tokens)))
         {
             cmdType = CommandType::QUERY_ALCHEMY;
             return true;
         }
-        else if (isExitCommand(input))
+        else if (CommandExplain::countValidator("isStateDigestQuery", isStateDigestQuery(tokens)))
+        {
+            cmdType = CommandType::QUERY_STATE_DIGEST;
+            return true;
+        }
+        else if (CommandExplain::countValidator("isExitCommand", isExitCommand(input)))
         {
             cmdType = CommandType::EXIT_COMMAND;
             return true;
@@ -1371,4 +1693,35 @@ bool CommandParser::isValidCommand(const string &input, CommandType &cmdType)
     // If no valid command pattern matched, mark as invalid
     cmdType = CommandType::INVALID_COMMAND;
     return false;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Joins a range of tokens into a space-separated name
+ * @param command Tokenized command
+ * @param begin Index of the first token
+ * @param end One past the last token
+ * @param hash Receives hashName of the joined name
+ * @return The joined name
+ * 
+ * Names almost always arrive as a single token, whose hash is shared with
+ * any other use of that token. A longer name is hashed once as a whole;
+ * its words are never hashed on their own.
+ */
+string CommandParser::joinTokens(const TokenizedCommand &command, size_t begin, size_t end, NameHash &hash)
+{
+    if (end == begin + 1)
+    {
+        hash = command.hash(begin);
+        return command.tokens[begin];
+    }
+
+    string name;
+    for (size_t i = begin; i < end; ++i)
+    {
+        if (i > begin)
+            name += " ";
+        name += command.tokens[i];
+    }
+    hash = hashName(name);
+    return name;
+}
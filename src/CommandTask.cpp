@@ -0,0 +1,365 @@
+#include "WitcherTracker.h"
+
+using namespace std;
+
+/**
+ * @brief CommandTask implementation - command lines executed in budgeted slices
+ *
+ * Each resumable phase repeats the matching execute method of
+ * WitcherTracker one item at a time, so a line gives the same response
+ * and the same state whether it runs in one slice or in many.
+ */
+
+/**
+ * @brief Prepares a line for execution
+ * @param tracker Tracker executing the line
+ * @param line Input command string
+ */
+CommandTask::CommandTask(WitcherTracker &tracker, const string &line)
+    : tracker(tracker), line(line), phase(Phase::START), status(-1), tokenList(CommandParser::TokenList::NONE),
+      position(0), cmdType(CommandType::INVALID_COMMAND), tokenIndex(0), potionHash(0),
+      category(ItemCategory::INGREDIENT), listed(0)
+{
+}
+
+/**
+ * @brief Runs the command until it finishes or the budget is spent
+ * @param out Stream receiving the next part of the response
+ * @param budget Work and time allowed for this slice
+ * @return true once the command has finished
+ */
+bool CommandTask::step(ostream &out, const CommandBudget &budget)
+{
+    SliceMeter meter(budget);
+    while (phase != Phase::FINISHED && !meter.exhausted())
+    {
+        switch (phase)
+        {
+        case Phase::START:
+            meter.take();
+            start(out);
+            break;
+        case Phase::TOKENIZE:
+            tokenize(out, meter);
+            break;
+        case Phase::VALIDATE:
+            validate(out, meter);
+            break;
+        case Phase::LOOT:
+            loot(out, meter);
+            break;
+        case Phase::FORMULA:
+            learnFormula(out, meter);
+            break;
+        case Phase::COLLECT:
+            collect(out, meter);
+            break;
+        case Phase::LIST:
+            list(out, meter);
+            break;
+        case Phase::FINISHED:
+            break;
+        }
+    }
+    return phase == Phase::FINISHED;
+}
+
+/**
+ * @brief Records the result and ends the task
+ * @param result Status for getStatus()
+ * @return void
+ */
+void CommandTask::finish(int result)
+{
+    status = result;
+    phase = Phase::FINISHED;
+}
+
+/**
+ * @brief Cleans the line and tokenizes its fixed part
+ * @param out Stream receiving responses of commands finished right away
+ * @return void
+ */
+void CommandTask::start(ostream &out)
+{
+    line = CommandParser::cleanInputLine(line);
+
+    if (line.empty())
+    {
+        finish(-1);
+        return;
+    }
+
+    // Slices would interleave with other threads' commands or leave a state file update open
+    if (tracker.concurrent || tracker.stateStore.isOpen() || line.compare(0, 8, "EXPLAIN ") == 0)
+    {
+        finish(tracker.executeLine(line, out));
+        return;
+    }
+
+    tokenList = CommandParser::tokenizeHead(line, command.tokens, position);
+    tokenIndex = command.tokens.size();
+    phase = Phase::TOKENIZE;
+
+    // Items take three tokens with their comma; reserving for them keeps
+    // the copy of a growing token vector off any one slice
+    if (tokenList != CommandParser::TokenList::NONE)
+    {
+        size_t expected = tokenIndex + 3 * static_cast<size_t>(count(line.begin() + position, line.end(), ',')) + 4;
+        command.tokens.reserve(expected);
+        command.hashes.reserve(expected);
+        command.hashed.reserve(expected);
+    }
+}
+
+/**
+ * @brief Tokenizes the list ending the line until done or out of budget, then validates the line
+ * @param out Stream receiving responses of commands finished right away
+ * @param meter Budget of this slice, one unit per token or formula item
+ * @return void
+ */
+void CommandTask::tokenize(ostream &out, SliceMeter &meter)
+{
+    vector<string> &tokens = command.tokens;
+    bool done = CommandParser::tokenizeList(line, tokenList, position, tokens, meter);
+    command.hashes.resize(tokens.size(), 0);
+    command.hashed.resize(tokens.size(), false);
+    if (!done)
+        return;
+
+    // A loot or formula is told apart by its fixed part and first item;
+    // the rest of its items are left to validate()
+    size_t listStart = 0;
+    if (tokenList == CommandParser::TokenList::INGREDIENTS)
+        listStart = tokenIndex;
+    else if (tokenList == CommandParser::TokenList::WORDS && tokens.size() >= 2 && tokens[0] == "Geralt" &&
+             tokens[1] == "loots")
+        listStart = 2;
+    if (listStart > 0)
+    {
+        tokenIndex = listStart;
+        vector<string> head(tokens.begin(), tokens.begin() + min(tokens.size(), listStart + 2));
+        if (CommandParser::isValidCommand(line, head, cmdType) &&
+            (cmdType == CommandType::ACTION_LOOT || cmdType == CommandType::KNOWLEDGE_POTION_FORMULA))
+        {
+            phase = Phase::VALIDATE;
+            return;
+        }
+    }
+
+    if (!CommandParser::isValidCommand(line, tokens, cmdType))
+    {
+        finish(-1);
+        return;
+    }
+    begin(out);
+}
+
+/**
+ * @brief Validates loot or formula items until done or out of budget, then starts the command
+ * @param out Stream receiving responses of commands finished right away
+ * @param meter Budget of this slice, one unit per item
+ * @return void
+ */
+void CommandTask::validate(ostream &out, SliceMeter &meter)
+{
+    bool commaRequired = cmdType == CommandType::KNOWLEDGE_POTION_FORMULA;
+    if (!CommandParser::checkItemList(command.tokens, tokenIndex, commaRequired, meter))
+    {
+        finish(-1);
+        return;
+    }
+    if (tokenIndex == command.tokens.size())
+        begin(out);
+}
+
+/**
+ * @brief Sets up the phase that executes a validated line
+ * @param out Stream receiving responses of commands finished right away
+ * @return void
+ */
+void CommandTask::begin(ostream &out)
+{
+    tracker.traffic.recordShape(cmdType, command.tokens.size());
+
+    const vector<string> &tokens = command.tokens;
+    switch (cmdType)
+    {
+    case CommandType::ACTION_LOOT:
+        tokenIndex = 2;
+        phase = Phase::LOOT;
+        break;
+
+    case CommandType::KNOWLEDGE_POTION_FORMULA:
+    {
+        size_t potionIndex = 0;
+        for (size_t i = 2; i < tokens.size(); ++i)
+        {
+            if (tokens[i] == "potion")
+            {
+                potionIndex = i;
+            }
+            else if (tokens[i] == "of")
+            {
+                tokenIndex = i + 1;
+                break;
+            }
+        }
+
+        potionName = CommandParser::joinTokens(command, 2, potionIndex, potionHash);
+        tracker.traffic.record(TrafficCategory::POTION, potionHash, potionName);
+        if (tracker.alchemy.hasPotion(potionName, potionHash))
+        {
+            out << "Already known formula\n";
+            finish(0);
+            return;
+        }
+        phase = Phase::FORMULA;
+        break;
+    }
+
+    case CommandType::QUERY_ALL_INVENTORY:
+        category = tokens[1] == "ingredient" ? ItemCategory::INGREDIENT
+                   : tokens[1] == "potion"   ? ItemCategory::POTION
+                                             : ItemCategory::TROPHY;
+        phase = Phase::COLLECT;
+        break;
+
+    case CommandType::QUERY_ALCHEMY:
+    {
+        NameHash queriedHash;
+        string queried = CommandParser::joinTokens(command, 3, tokens.size() - 1, queriedHash);
+        tracker.traffic.record(TrafficCategory::POTION, queriedHash, queried);
+        if (!tracker.alchemy.collectPotionIngredients(queried, queriedHash, items) || items.empty())
+        {
+            out << "No formula for " << queried << "\n";
+            finish(0);
+            return;
+        }
+        phase = Phase::LIST;
+        break;
+    }
+
+    default:
+        finish(tracker.executeCommand(command, cmdType, out));
+        break;
+    }
+}
+
+/**
+ * @brief Adds looted ingredients until done or out of budget
+ * @param out Stream receiving the response once every ingredient is added
+ * @param meter Budget of this slice, one unit per ingredient
+ * @return void
+ */
+void CommandTask::loot(ostream &out, SliceMeter &meter)
+{
+    const vector<string> &tokens = command.tokens;
+
+    while (tokenIndex < tokens.size() && meter.take())
+    {
+        int quantity = stoi(tokens[tokenIndex]);
+        tokenIndex++;
+
+        NameHash ingredientHash = command.hash(tokenIndex);
+        tracker.traffic.record(TrafficCategory::INGREDIENT, ingredientHash, tokens[tokenIndex]);
+        tracker.inventory.addIngredient(tokens[tokenIndex], ingredientHash, quantity);
+        tokenIndex++;
+
+        if (tokenIndex < tokens.size() && tokens[tokenIndex] == ",")
+        {
+            tokenIndex++;
+        }
+    }
+
+    if (tokenIndex >= tokens.size())
+    {
+        out << "Alchemy ingredients obtained\n";
+        finish(0);
+    }
+}
+
+/**
+ * @brief Parses formula ingredients until done or out of budget, then learns the formula
+ * @param out Stream receiving the response once the formula is learned
+ * @param meter Budget of this slice, one unit per ingredient
+ * @return void
+ */
+void CommandTask::learnFormula(ostream &out, SliceMeter &meter)
+{
+    const vector<string> &tokens = command.tokens;
+
+    while (tokenIndex < tokens.size() && meter.take())
+    {
+        int quantity = stoi(tokens[tokenIndex]);
+        tokenIndex++;
+
+        NameHash ingredientHash = command.hash(tokenIndex);
+        tracker.traffic.record(TrafficCategory::INGREDIENT, ingredientHash, tokens[tokenIndex]);
+        ingredients.push_back(tokens[tokenIndex]);
+        ingredientHashes.push_back(ingredientHash);
+        quantities.push_back(quantity);
+        tokenIndex++;
+
+        if (tokenIndex < tokens.size() && tokens[tokenIndex] == ",")
+        {
+            tokenIndex++;
+        }
+    }
+
+    if (tokenIndex >= tokens.size())
+    {
+        tracker.alchemy.addPotionFormula(potionName, potionHash, ingredients, quantities, ingredientHashes);
+        CommandLocks locks(tracker.concurrent);
+        tracker.joinRecipe(locks, potionName, potionHash, ingredients, ingredientHashes, quantities);
+        out << "New alchemy formula obtained: " << potionName << "\n";
+        finish(0);
+    }
+}
+
+/**
+ * @brief Gathers inventory items into the listing until done or out of budget
+ * @param out Stream receiving "None" if the category is empty
+ * @param meter Budget of this slice, one unit per item read or merged
+ * @return void
+ */
+void CommandTask::collect(ostream &out, SliceMeter &meter)
+{
+    if (!tracker.inventory.collectItemsStep(category, collection, meter))
+        return;
+
+    items.swap(collection.items);
+    if (items.empty())
+    {
+        out << "None\n";
+        finish(0);
+        return;
+    }
+    phase = Phase::LIST;
+}
+
+/**
+ * @brief Writes listed items until done or out of budget
+ * @param out Stream receiving the listing
+ * @param meter Budget of this slice, one unit per item written
+ * @return void
+ */
+void CommandTask::list(ostream &out, SliceMeter &meter)
+{
+    size_t end = listed;
+    while (end < items.size() && meter.take())
+    {
+        ++end;
+    }
+
+    string text;
+    appendItemList(items, listed, end, text);
+    out << text;
+    listed = end;
+
+    if (listed == items.size())
+    {
+        out << "\n";
+        finish(0);
+    }
+}
@@ -0,0 +1,308 @@
+#include "WitcherTracker.h"
+
+using namespace std;
+
+/**
+ * @brief CounterJoin implementation - incrementally maintained beast recommendations
+ *
+ * A recipe line is satisfied while the ingredient held is at least the
+ * quantity it requires, which is the check brewing makes; missing counts
+ * the unsatisfied lines. Lines are checked one by one, so a recipe that
+ * names an ingredient twice needs enough for the larger line only, as
+ * when brewing.
+ */
+
+/**
+ * @brief Constructs an empty join
+ * @param concurrent true to guard the join with its own lock
+ */
+CounterJoin::CounterJoin(bool concurrent) : concurrent(concurrent)
+{
+}
+
+/**
+ * @brief Forgets everything
+ * @return void
+ */
+void CounterJoin::clear()
+{
+    unique_lock<mutex> guard(lock, defer_lock);
+    if (concurrent)
+        guard.lock();
+
+    potions.clear();
+    potionIndex.clear();
+    beasts.clear();
+    beastIndex.clear();
+    recipeUses.clear();
+}
+
+/**
+ * @brief Finds the entry of a potion by key, then by name
+ * @param key StateDigest key of the potion
+ * @param potion Potion name
+ * @param entry Receives the entry number
+ * @return false if the potion has no entry
+ */
+bool CounterJoin::findPotion(uint64_t key, const string &potion, size_t &entry) const
+{
+    auto range = potionIndex.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (potions[it->second].name == potion)
+        {
+            entry = it->second;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Finds the entry of a beast by key, then by name
+ * @param key StateDigest key of the beast
+ * @param beast Beast name
+ * @param entry Receives the entry number
+ * @return false if the beast has no entry
+ */
+bool CounterJoin::findBeast(uint64_t key, const string &beast, size_t &entry) const
+{
+    auto range = beastIndex.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (beasts[it->second].name == beast)
+        {
+            entry = it->second;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Entry of a potion, created not in stock and without a recipe
+ * @param potion Potion name
+ * @param potionHash hashName(potion)
+ * @return Entry number
+ */
+size_t CounterJoin::potionEntry(const string &potion, NameHash potionHash)
+{
+    uint64_t key = StateDigest::key(StoredKind::POTION, potionHash);
+    size_t entry;
+    if (findPotion(key, potion, entry))
+        return entry;
+
+    potions.push_back(PotionEntry{potion, false, false, 0, vector<size_t>()});
+    potionIndex.insert(make_pair(key, potions.size() - 1));
+    return potions.size() - 1;
+}
+
+/**
+ * @brief Entry of a beast, created empty
+ * @param beast Beast name
+ * @param beastHash hashName(beast)
+ * @return Entry number
+ */
+size_t CounterJoin::beastEntry(const string &beast, NameHash beastHash)
+{
+    uint64_t key = StateDigest::key(StoredKind::BEAST, beastHash);
+    size_t entry;
+    if (findBeast(key, beast, entry))
+        return entry;
+
+    beasts.push_back(BeastEntry());
+    beasts.back().name = beast;
+    beastIndex.insert(make_pair(key, beasts.size() - 1));
+    return beasts.size() - 1;
+}
+
+/**
+ * @brief Updates whether a potion is in stock and the beasts listing it
+ * @param potion Potion entry
+ * @param inStock Whether at least one is held now
+ * @return void
+ */
+void CounterJoin::setInStock(PotionEntry &potion, bool inStock)
+{
+    if (potion.inStock == inStock)
+        return;
+
+    potion.inStock = inStock;
+    for (size_t beast : potion.beasts)
+    {
+        if (inStock)
+            beasts[beast].inStock.insert(potion.name);
+        else
+            beasts[beast].inStock.erase(potion.name);
+    }
+}
+
+/**
+ * @brief Updates a potion's unsatisfied recipe lines and the beasts listing it as brewable
+ * @param potion Potion entry
+ * @param missing Recipe lines not satisfied now
+ * @return void
+ */
+void CounterJoin::setMissing(PotionEntry &potion, int missing)
+{
+    bool wasBrewable = brewable(potion);
+    potion.missing = missing;
+    if (brewable(potion) == wasBrewable)
+        return;
+
+    for (size_t beast : potion.beasts)
+    {
+        if (!wasBrewable)
+            beasts[beast].brewable.insert(potion.name);
+        else
+            beasts[beast].brewable.erase(potion.name);
+    }
+}
+
+/**
+ * @brief Records a potion as effective against a beast
+ * @param beast Beast name
+ * @param beastHash hashName(beast)
+ * @param potion Potion name
+ * @param potionHash hashName(potion)
+ * @param held Potions held now
+ * @return void
+ */
+void CounterJoin::addEffectivePotion(const string &beast, NameHash beastHash, const string &potion,
+                                     NameHash potionHash, int held)
+{
+    unique_lock<mutex> guard(lock, defer_lock);
+    if (concurrent)
+        guard.lock();
+
+    size_t beastIndexOf = beastEntry(beast, beastHash);
+    PotionEntry &entry = potions[potionEntry(potion, potionHash)];
+    setInStock(entry, held > 0);
+    entry.beasts.push_back(beastIndexOf);
+
+    BeastEntry &target = beasts[beastIndexOf];
+    if (entry.inStock)
+        target.inStock.insert(potion);
+    if (brewable(entry))
+        target.brewable.insert(potion);
+}
+
+/**
+ * @brief Records a sign as effective against a beast
+ * @param beast Beast name
+ * @param beastHash hashName(beast)
+ * @param sign Sign name
+ * @return void
+ */
+void CounterJoin::addEffectiveSign(const string &beast, NameHash beastHash, const string &sign)
+{
+    unique_lock<mutex> guard(lock, defer_lock);
+    if (concurrent)
+        guard.lock();
+
+    beasts[beastEntry(beast, beastHash)].signs.insert(sign);
+}
+
+/**
+ * @brief Records the recipe of a potion
+ * @param potion Potion name
+ * @param potionHash hashName(potion)
+ * @param ingredients Ingredient names
+ * @param ingredientHashes hashName of each ingredient
+ * @param required Quantity of each ingredient used by one brew
+ * @param held Quantity of each ingredient held now
+ * @return void
+ */
+void CounterJoin::addRecipe(const string &potion, NameHash potionHash, const vector<string> &ingredients,
+                            const vector<NameHash> &ingredientHashes, const vector<int> &required,
+                            const vector<int> &held)
+{
+    unique_lock<mutex> guard(lock, defer_lock);
+    if (concurrent)
+        guard.lock();
+
+    size_t index = potionEntry(potion, potionHash);
+    int missing = 0;
+    for (size_t i = 0; i < ingredientHashes.size(); ++i)
+    {
+        recipeUses[StateDigest::key(StoredKind::INGREDIENT, ingredientHashes[i])].push_back(
+            RecipeUse{ingredients[i], index, required[i]});
+        if (held[i] < required[i])
+            ++missing;
+    }
+
+    PotionEntry &entry = potions[index];
+    entry.hasRecipe = true;
+    entry.missing = missing;
+    if (brewable(entry))
+    {
+        for (size_t beast : entry.beasts)
+        {
+            beasts[beast].brewable.insert(entry.name);
+        }
+    }
+}
+
+/**
+ * @brief Applies an inventory quantity change
+ * @param key StateDigest key of the item
+ * @param name Name of the item
+ * @param before Quantity before the change
+ * @param after Quantity after the change
+ * @return void
+ */
+void CounterJoin::itemChanged(uint64_t key, const string &name, int before, int after)
+{
+    unique_lock<mutex> guard(lock, defer_lock);
+    if (concurrent)
+        guard.lock();
+
+    size_t potion;
+    if (findPotion(key, name, potion))
+    {
+        setInStock(potions[potion], after > 0);
+        return;
+    }
+
+    auto uses = recipeUses.find(key);
+    if (uses == recipeUses.end())
+        return;
+
+    for (const RecipeUse &use : uses->second)
+    {
+        if (use.ingredient != name)
+            continue;
+
+        bool wasSatisfied = before >= use.required;
+        bool satisfied = after >= use.required;
+        if (wasSatisfied != satisfied)
+        {
+            PotionEntry &entry = potions[use.potion];
+            setMissing(entry, entry.missing + (satisfied ? -1 : 1));
+        }
+    }
+}
+
+/**
+ * @brief Reads the counters usable against a beast
+ * @param beast Beast name
+ * @param beastHash hashName(beast)
+ * @param result Receives the lists
+ * @return false if nothing is known to be effective against the beast
+ */
+bool CounterJoin::recommend(const string &beast, NameHash beastHash, Recommendation &result) const
+{
+    unique_lock<mutex> guard(lock, defer_lock);
+    if (concurrent)
+        guard.lock();
+
+    size_t found;
+    if (!findBeast(StateDigest::key(StoredKind::BEAST, beastHash), beast, found))
+        return false;
+
+    const BeastEntry &entry = beasts[found];
+    result.inStock.assign(entry.inStock.begin(), entry.inStock.end());
+    result.brewable.assign(entry.brewable.begin(), entry.brewable.end());
+    result.signs.assign(entry.signs.begin(), entry.signs.end());
+    return true;
+}
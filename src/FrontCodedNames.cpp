@@ -0,0 +1,132 @@
+#include "WitcherTracker.h"
+
+using namespace std;
+
+/**
+ * @brief FrontCodedNames implementation - compact sorted name arrays
+ *
+ * Each name is encoded as a varint shared-prefix length, a varint suffix
+ * length and the suffix bytes. Block heads always have a shared length of
+ * zero, so any block can be decoded without its predecessors.
+ */
+
+/**
+ * @brief Replaces the contents with the given names
+ * @param sortedNames Names in strictly ascending order
+ * @return void
+ * @side_effects Discards the previous encoding
+ */
+void FrontCodedNames::assign(const vector<string> &sortedNames)
+{
+    bytes.clear();
+    blockOffsets.clear();
+    count = 0;
+
+    for (size_t i = 0; i < sortedNames.size(); ++i)
+    {
+        append(sortedNames[i], sortedNames[i > 0 ? i - 1 : 0]);
+    }
+
+    bytes.shrink_to_fit();
+    blockOffsets.shrink_to_fit();
+}
+
+/**
+ * @brief Adds a name after the last one
+ * @param name Name greater than every name held
+ * @param previous The last name held (unused at the start of a block)
+ * @return void
+ */
+void FrontCodedNames::append(const string &name, const string &previous)
+{
+    size_t shared = 0;
+    if (count % FRONT_CODING_BLOCK == 0)
+    {
+        blockOffsets.push_back(static_cast<uint32_t>(bytes.size()));
+    }
+    else
+    {
+        size_t limit = min(previous.size(), name.size());
+        while (shared < limit && previous[shared] == name[shared])
+            shared++;
+    }
+
+    writeVarint(bytes, shared);
+    writeVarint(bytes, name.size() - shared);
+    bytes.append(name, shared, string::npos);
+    count++;
+}
+
+/**
+ * @brief Decodes the name at a byte offset given its predecessor
+ * @param offset Position of the encoded name, advanced past it
+ * @param name Predecessor on input, decoded name on output
+ * @return void
+ */
+void FrontCodedNames::decodeNext(size_t &offset, string &name) const
+{
+    // append() wrote both varints whole, so they need no length check
+    uint64_t shared, suffix;
+    readVarint(bytes, offset, bytes.size(), shared);
+    readVarint(bytes, offset, bytes.size(), suffix);
+    name.resize(shared);
+    name.append(bytes, offset, suffix);
+    offset += suffix;
+}
+
+/**
+ * @brief Finds the position of a name
+ * @param name Name to look up
+ * @return Index in sorted order, or string::npos if absent
+ *
+ * Binary search over block heads, then a linear decode of one block.
+ */
+size_t FrontCodedNames::find(const string &name) const
+{
+    if (count == 0)
+        return string::npos;
+
+    // Find the last block whose head is <= name
+    size_t low = 0, high = blockOffsets.size();
+    string head;
+    while (high - low > 1)
+    {
+        size_t mid = (low + high) / 2;
+        size_t offset = blockOffsets[mid];
+        head.clear();
+        decodeNext(offset, head);
+        if (head <= name)
+            low = mid;
+        else
+            high = mid;
+    }
+
+    size_t offset = blockOffsets[low];
+    size_t end = min(count, (low + 1) * FRONT_CODING_BLOCK);
+    string current;
+    for (size_t i = low * FRONT_CODING_BLOCK; i < end; ++i)
+    {
+        decodeNext(offset, current);
+        if (current == name)
+            return i;
+        if (current > name)
+            break;
+    }
+    return string::npos;
+}
+
+/**
+ * @brief Decodes the name at a position
+ * @param index Position in [0, size())
+ * @return The name
+ */
+string FrontCodedNames::at(size_t index) const
+{
+    size_t offset = blockOffsets[index / FRONT_CODING_BLOCK];
+    string name;
+    for (size_t i = 0; i <= index % FRONT_CODING_BLOCK; ++i)
+    {
+        decodeNext(offset, name);
+    }
+    return name;
+}
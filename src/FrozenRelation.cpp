@@ -0,0 +1,234 @@
+#include "WitcherTracker.h"
+
+using namespace std;
+
+/**
+ * @brief FrozenRelation implementation - compact read-only name relations
+ *
+ * Every distinct link target is stored once in a front-coded dictionary;
+ * rows refer to targets by id. The builder finds repeated targets through
+ * a hash index as links are added, so only distinct targets are sorted.
+ */
+
+/**
+ * @brief Sizes the buffers and the target index for the rows about to be added
+ * @param rowCount Rows expected
+ * @param linkCount Links expected
+ * @param targetCount Distinct targets expected
+ * @return void
+ */
+void FrozenRelation::Builder::reserve(size_t rowCount, size_t linkCount, size_t targetCount)
+{
+    keys.reserve(rowCount);
+    rowLinks.reserve(rowCount + 1);
+    rowOrder.reserve(rowCount);
+    links.reserve(linkCount);
+    values.reserve(linkCount);
+    targets.reserve(targetCount);
+    targetHashes.reserve(targetCount);
+    targetOrder.reserve(targetCount);
+
+    size_t capacity = 16;
+    while (capacity < (targetCount + 1) * 2)
+        capacity *= 2;
+    if (capacity > targetIndex.size())
+        targetIndex.assign(capacity, 0);
+}
+
+/**
+ * @brief Starts a row; the links added next belong to it
+ * @param key Row name, different from every other row's
+ * @return void
+ */
+void FrozenRelation::Builder::addRow(const string &key)
+{
+    rowOrder.push_back(static_cast<uint32_t>(keys.size()));
+    rowLinks.push_back(static_cast<uint32_t>(links.size()));
+    keys.push_back(key);
+}
+
+/**
+ * @brief Adds a link to the row added last
+ * @param name Target name
+ * @param hash hashName(name)
+ * @param value Payload (quantity or flag)
+ * @return void
+ */
+void FrozenRelation::Builder::addLink(const string &name, NameHash hash, uint64_t value)
+{
+    // Keep the index load factor at or below one half
+    if ((targets.size() + 1) * 2 > targetIndex.size())
+    {
+        vector<uint32_t> bigger(max<size_t>(16, targetIndex.size() * 2), 0);
+        size_t mask = bigger.size() - 1;
+        for (uint32_t target = 0; target < targets.size(); ++target)
+        {
+            size_t pos = static_cast<size_t>(targetHashes[target]) & mask;
+            while (bigger[pos] != 0)
+                pos = (pos + 1) & mask;
+            bigger[pos] = target + 1;
+        }
+        targetIndex.swap(bigger);
+    }
+
+    size_t mask = targetIndex.size() - 1;
+    size_t pos = static_cast<size_t>(hash) & mask;
+    uint32_t target = static_cast<uint32_t>(targets.size());
+    for (; targetIndex[pos] != 0; pos = (pos + 1) & mask)
+    {
+        uint32_t candidate = targetIndex[pos] - 1;
+        if (targetHashes[candidate] == hash && targets[candidate] == name)
+        {
+            target = candidate;
+            break;
+        }
+    }
+    if (target == targets.size())
+    {
+        targetIndex[pos] = target + 1;
+        targetOrder.push_back(target);
+        targets.push_back(name);
+        targetHashes.push_back(hash);
+    }
+
+    links.push_back(target);
+    values.push_back(value);
+    valueBits |= value;
+}
+
+/**
+ * @brief Continues a merge sort of row or target numbers
+ * @param order Numbers to sort; sorted runs of sort.width on entry
+ * @param less Strict weak order on the numbers
+ * @param meter Budget of the slice; each number merged takes a unit
+ * @return true once order is sorted
+ *
+ * Each pass merges neighbouring runs into sort.merged, then becomes the
+ * input of the next pass with runs twice as long. A merge stops wherever
+ * the budget runs out and resumes there. Equal numbers keep their order.
+ */
+template <class Less>
+bool FrozenRelation::Builder::sortStep(vector<uint32_t> &order, Less less, SliceMeter &meter)
+{
+    size_t count = order.size();
+    if (sort.merged.size() != count)
+        sort.merged.resize(count);
+
+    while (sort.width < count && meter.take())
+    {
+        size_t middle = min(count, sort.begin + sort.width);
+        size_t end = min(count, sort.begin + 2 * sort.width);
+        size_t out = sort.left + sort.right - middle;
+
+        if (sort.right < end && (sort.left == middle || less(order[sort.right], order[sort.left])))
+            sort.merged[out] = order[sort.right++];
+        else
+            sort.merged[out] = order[sort.left++];
+
+        if (sort.left == middle && sort.right == end)
+        {
+            sort.begin = end;
+            if (sort.begin >= count)
+            {
+                order.swap(sort.merged);
+                sort.width *= 2;
+                sort.begin = 0;
+            }
+            sort.left = sort.begin;
+            sort.right = min(count, sort.begin + sort.width);
+        }
+    }
+    if (sort.width < count)
+        return false;
+
+    sort = MergeSort();
+    return true;
+}
+
+/**
+ * @brief Continues the build; adding rows is over once this is called
+ * @param meter Budget of the slice; every row, link or target handled takes a unit
+ * @return true once the relation is ready for install()
+ */
+bool FrozenRelation::Builder::step(SliceMeter &meter)
+{
+    if (phase == Phase::ADDING)
+    {
+        rowLinks.push_back(static_cast<uint32_t>(links.size()));
+        vector<uint32_t>().swap(targetIndex);
+        sort.right = min(rowOrder.size(), sort.width);
+        phase = Phase::SORTING_ROWS;
+    }
+
+    if (phase == Phase::SORTING_ROWS)
+    {
+        if (!sortStep(rowOrder, [this](uint32_t left, uint32_t right) { return keys[left] < keys[right]; }, meter))
+            return false;
+        sort.right = min(targetOrder.size(), sort.width);
+        phase = Phase::SORTING_TARGETS;
+    }
+
+    if (phase == Phase::SORTING_TARGETS)
+    {
+        auto byName = [this](uint32_t left, uint32_t right)
+        {
+            return targets[left] != targets[right] ? targets[left] < targets[right]
+                                                   : targetHashes[left] < targetHashes[right];
+        };
+        if (!sortStep(targetOrder, byName, meter))
+            return false;
+        targetIds.resize(targets.size());
+        built.targetHashes.reserve(targets.size());
+        phase = Phase::NUMBERING;
+    }
+
+    // Each name is released once the next one has been coded against it
+    if (phase == Phase::NUMBERING)
+    {
+        for (; next < targetOrder.size() && meter.take(); ++next)
+        {
+            uint32_t target = targetOrder[next];
+            uint32_t previous = targetOrder[next > 0 ? next - 1 : 0];
+            built.targets.append(targets[target], targets[previous]);
+            built.targetHashes.push_back(targetHashes[target]);
+            targetIds[target] = static_cast<uint32_t>(next);
+            if (next > 0)
+                string().swap(targets[previous]);
+        }
+        if (next < targetOrder.size())
+            return false;
+
+        vector<string>().swap(targets);
+        built.offsets.reset(keys.size() + 1, links.size());
+        built.linkTargets.reset(links.size(), targetOrder.empty() ? 0 : targetOrder.size() - 1);
+        built.linkValues.reset(links.size(), valueBits);
+        next = 0;
+        phase = Phase::PACKING;
+    }
+
+    if (phase == Phase::PACKING)
+    {
+        for (; next < rowOrder.size() && meter.take(); ++next)
+        {
+            uint32_t row = rowOrder[next];
+            uint32_t previous = rowOrder[next > 0 ? next - 1 : 0];
+            built.keys.append(keys[row], keys[previous]);
+            built.offsets.set(next, packed);
+            for (uint32_t link = rowLinks[row]; link < rowLinks[row + 1]; ++link)
+            {
+                built.linkTargets.set(packed, targetIds[links[link]]);
+                built.linkValues.set(packed, values[link]);
+                packed++;
+            }
+            meter.take(rowLinks[row + 1] - rowLinks[row]);
+            if (next > 0)
+                string().swap(keys[previous]);
+        }
+        if (next < rowOrder.size())
+            return false;
+
+        built.offsets.set(rowOrder.size(), packed);
+        phase = Phase::BUILT;
+    }
+    return true;
+}
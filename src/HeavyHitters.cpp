@@ -0,0 +1,173 @@
+#include "WitcherTracker.h"
+
+using namespace std;
+
+/**
+ * @brief HeavyHitters implementation - Count-Min guided Space-Saving
+ *
+ * Row r of the sketch indexes with (low + r * high) mod width, where low
+ * and high are the two halves of the 64-bit key, so keys are not rehashed
+ * per row. Conservative update raises only the counters that are below
+ * the new estimate, which keeps the overcount of rare keys much smaller
+ * than plain Count-Min while still never undercounting.
+ */
+
+/**
+ * @brief Position of a key in one sketch row
+ */
+static inline size_t cellOf(NameHash hash, int row)
+{
+    uint32_t low = static_cast<uint32_t>(hash);
+    uint32_t high = static_cast<uint32_t>(hash >> 32) | 1;
+    return static_cast<size_t>(row) * COUNT_MIN_WIDTH + ((low + row * high) & (COUNT_MIN_WIDTH - 1));
+}
+
+/**
+ * @brief Constructs an empty sketch
+ */
+HeavyHitters::HeavyHitters()
+    : counters(static_cast<size_t>(COUNT_MIN_WIDTH) * COUNT_MIN_DEPTH, 0), minIndex(0), totalCount(0)
+{
+    hashes.reserve(HEAVY_HITTER_CAPACITY);
+    hitters.reserve(HEAVY_HITTER_CAPACITY);
+    monitored.reserve(HEAVY_HITTER_CAPACITY);
+}
+
+/**
+ * @brief Counts occurrences of a name
+ * @param hash hashName(name), or any stable 64-bit key
+ * @param name Name reported by top()
+ * @param count Occurrences to add
+ * @return void
+ * @side_effects May replace the least frequent monitored name
+ */
+void HeavyHitters::add(NameHash hash, const string &name, uint64_t count)
+{
+    totalCount += count;
+
+    // Conservative update: every counter ends at least at the new estimate
+    uint64_t updated = estimate(hash) + count;
+    for (int row = 0; row < COUNT_MIN_DEPTH; ++row)
+    {
+        uint64_t &cell = counters[cellOf(hash, row)];
+        if (cell < updated)
+            cell = updated;
+    }
+
+    auto found = monitored.find(hash);
+    if (found != monitored.end())
+    {
+        hitters[found->second].count = updated;
+        if (found->second == minIndex)
+            updateMinimum();
+        return;
+    }
+
+    if (hitters.size() < static_cast<size_t>(HEAVY_HITTER_CAPACITY))
+    {
+        monitored[hash] = hashes.size();
+        hashes.push_back(hash);
+        hitters.push_back(Hitter{name, updated});
+        updateMinimum();
+    }
+    else if (updated > hitters[minIndex].count)
+    {
+        monitored.erase(hashes[minIndex]);
+        monitored[hash] = minIndex;
+        hashes[minIndex] = hash;
+        hitters[minIndex] = Hitter{name, updated};
+        updateMinimum();
+    }
+}
+
+/**
+ * @brief Estimated occurrences of a key
+ * @param hash Key to look up
+ * @return Smallest of the key's counters, never below its true count
+ */
+uint64_t HeavyHitters::estimate(NameHash hash) const
+{
+    uint64_t lowest = counters[cellOf(hash, 0)];
+    for (int row = 1; row < COUNT_MIN_DEPTH; ++row)
+    {
+        lowest = min(lowest, counters[cellOf(hash, row)]);
+    }
+    return lowest;
+}
+
+/**
+ * @brief Finds the monitored name with the lowest estimate
+ * @return void
+ */
+void HeavyHitters::updateMinimum()
+{
+    minIndex = 0;
+    for (size_t i = 1; i < hitters.size(); ++i)
+    {
+        if (hitters[i].count < hitters[minIndex].count)
+            minIndex = i;
+    }
+}
+
+/**
+ * @brief Adds another sketch's counts to this one
+ * @param other Sketch to merge in
+ * @return void
+ *
+ * Summed counters still never undercount. Both sets of monitored names are
+ * re-estimated from the merged counters and the highest are kept.
+ */
+void HeavyHitters::merge(const HeavyHitters &other)
+{
+    for (size_t i = 0; i < counters.size(); ++i)
+    {
+        counters[i] += other.counters[i];
+    }
+    totalCount += other.totalCount;
+
+    vector<pair<NameHash, Hitter>> candidates;
+    for (size_t i = 0; i < hitters.size(); ++i)
+    {
+        candidates.push_back(make_pair(hashes[i], hitters[i]));
+    }
+    for (size_t i = 0; i < other.hitters.size(); ++i)
+    {
+        if (!monitored.count(other.hashes[i]))
+            candidates.push_back(make_pair(other.hashes[i], other.hitters[i]));
+    }
+    for (auto &candidate : candidates)
+    {
+        candidate.second.count = estimate(candidate.first);
+    }
+
+    sort(candidates.begin(), candidates.end(), [](const pair<NameHash, Hitter> &a, const pair<NameHash, Hitter> &b)
+         { return a.second.count > b.second.count; });
+    if (candidates.size() > static_cast<size_t>(HEAVY_HITTER_CAPACITY))
+        candidates.resize(HEAVY_HITTER_CAPACITY);
+
+    hashes.clear();
+    hitters.clear();
+    monitored.clear();
+    for (const auto &candidate : candidates)
+    {
+        monitored[candidate.first] = hashes.size();
+        hashes.push_back(candidate.first);
+        hitters.push_back(candidate.second);
+    }
+    updateMinimum();
+}
+
+/**
+ * @brief The most frequent names, highest estimate first
+ * @param k Names wanted
+ * @return Up to k names, ties in alphabetical order
+ */
+vector<HeavyHitters::Hitter> HeavyHitters::top(size_t k) const
+{
+    vector<Hitter> ranked = hitters;
+    sort(ranked.begin(), ranked.end(), [](const Hitter &a, const Hitter &b)
+         { return a.count != b.count ? a.count > b.count : a.name < b.name; });
+    if (ranked.size() > k)
+        ranked.resize(k);
+    return ranked;
+}
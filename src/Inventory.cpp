@@ -10,230 +10,704 @@ using namespace std;
  * formatted inventory lists sorted alphabetically.
  */
 
+/**
+ * @brief Constructs an inventory split into the given number of shards
+ * @param shardCount Number of hash partitions (values below 1 are treated as 1)
+ */
+Inventory::Inventory(size_t shardCount) : shards(shardCount > 0 ? shardCount : 1), store(nullptr), lsm(nullptr),
+                                          join(nullptr)
+{
+}
+
+/**
+ * @brief Keeps all items in a state file from now on
+ * @param stateStore Open store, or nullptr to return to in-memory tables
+ * @return void
+ * @side_effects Replaces the digest with one over the items in the file
+ */
+void Inventory::attachStore(MappedStateStore *stateStore)
+{
+    store = stateStore;
+    for (auto &shard : shards)
+    {
+        shard.digest = StateDigest();
+    }
+    if (!store)
+        return;
+
+    for (StoredKind kind : {StoredKind::INGREDIENT, StoredKind::POTION, StoredKind::TROPHY})
+    {
+        vector<pair<string, int>> items;
+        store->collect(kind, items);
+        for (const auto &item : items)
+        {
+            NameHash hash = hashName(item.first);
+            shards[shardOf(hash)].digest.add(StateDigest::key(kind, hash), item.second);
+        }
+    }
+}
+
+/**
+ * @brief Keeps all items in an out-of-core store from now on
+ * @param lsmStore Open store, or nullptr to return to in-memory tables
+ * @return void
+ * @side_effects Replaces the digest with one over the items in the store
+ */
+void Inventory::attachLsm(LsmItemStore *lsmStore)
+{
+    lsm = lsmStore;
+    for (auto &shard : shards)
+    {
+        shard.digest = StateDigest();
+    }
+    if (!lsm)
+        return;
+
+    for (StoredKind kind : {StoredKind::INGREDIENT, StoredKind::POTION, StoredKind::TROPHY})
+    {
+        vector<pair<string, int>> items;
+        lsm->collect(kind, items);
+        for (const auto &item : items)
+        {
+            NameHash hash = hashName(item.first);
+            shards[shardOf(hash)].digest.add(StateDigest::key(kind, hash), item.second);
+        }
+    }
+}
+
+/**
+ * @brief Replaces an item's contribution to a digest after a quantity change
+ * @param digest Digest of the shard holding the item
+ * @param key StateDigest key of the item
+ * @param before Quantity before the change
+ * @param after Quantity after the change
+ * @return void
+ * 
+ * Items that are not held (quantity 0) contribute nothing, so zero-quantity
+ * entries created by lookups never affect the digest.
+ */
+static void updateDigest(StateDigest &digest, uint64_t key, int before, int after)
+{
+    if (before > 0)
+        digest.remove(key, before);
+    if (after > 0)
+        digest.add(key, after);
+}
+
+/**
+ * @brief Accounts for a quantity change in the shard digest and the join
+ * @param shard Shard holding the item
+ * @param key StateDigest key of the item
+ * @param name Name of the item
+ * @param before Quantity before the change
+ * @param after Quantity after the change
+ * @return void
+ */
+void Inventory::recordChange(size_t shard, uint64_t key, const string &name, int before, int after)
+{
+    updateDigest(shards[shard].digest, key, before, after);
+    if (join)
+        join->itemChanged(key, name, before, after);
+}
+
+/**
+ * @brief Adds to an item of one category
+ * @param kind Category of the item
+ * @param table Shard table holding the category
+ * @param name The name of the item
+ * @param hash hashName(name)
+ * @param quantity The amount to add
+ * @return void
+ * @side_effects Increases the item quantity and updates the shard digest and join
+ */
+void Inventory::addItem(StoredKind kind, TieredItemStore Shard::*table, const string &name, NameHash hash, int quantity)
+{
+    CommandExplain::countLookup(ExplainSubsystem::INVENTORY);
+    size_t index = shardOf(hash);
+    Shard &shard = shards[index];
+    int before;
+    if (store)
+    {
+        int *held = store->quantityCell(kind, name, hash);
+        before = *held;
+        store->setQuantity(held, before + quantity);
+    }
+    else if (lsm)
+    {
+        before = lsm->quantity(kind, name, hash);
+        lsm->setQuantity(kind, name, before + quantity);
+    }
+    else
+    {
+        // Accumulate quantity starting from zero for new items
+        int &held = (shard.*table).update(name, hash);
+        before = held;
+        held += quantity;
+    }
+    recordChange(index, StateDigest::key(kind, hash), name, before, before + quantity);
+}
+
+/**
+ * @brief Removes from an item of one category if sufficient quantity exists
+ * @param kind Category of the item
+ * @param table Shard table holding the category
+ * @param name The name of the item
+ * @param hash hashName(name)
+ * @param quantity The amount to remove
+ * @return true if removal successful, false if insufficient quantity
+ * @side_effects Decreases the item quantity and updates the shard digest and join
+ */
+bool Inventory::removeItem(StoredKind kind, TieredItemStore Shard::*table, const string &name, NameHash hash, int quantity)
+{
+    CommandExplain::countLookup(ExplainSubsystem::INVENTORY);
+    size_t index = shardOf(hash);
+    Shard &shard = shards[index];
+    int before;
+    if (store)
+    {
+        int *stored = store->quantityCell(kind, name, hash);
+        before = *stored;
+        if (before < quantity)
+            return false;
+        store->setQuantity(stored, before - quantity);
+    }
+    else if (lsm)
+    {
+        before = lsm->quantity(kind, name, hash);
+        if (before < quantity)
+            return false;
+        lsm->setQuantity(kind, name, before - quantity);
+    }
+    else
+    {
+        int &held = (shard.*table).update(name, hash);
+        before = held;
+
+        // Check if sufficient quantity exists before removal
+        if (before < quantity)
+            return false;
+        held -= quantity;
+    }
+    recordChange(index, StateDigest::key(kind, hash), name, before, before - quantity);
+    return true;
+}
+
 /**
  * @brief Adds ingredients to the inventory
  * @param name The name of the ingredient to add
+ * @param hash hashName(name)
  * @param quantity The amount of ingredient to add
  * @return void
  * @side_effects Increases the ingredient quantity in the ingredients map
  */
-void Inventory::addIngredient(const string &name, int quantity)
+void Inventory::addIngredient(const string &name, NameHash hash, int quantity)
 {
-    // Accumulate ingredient quantity using map's default initialization
-    ingredients[name] += quantity;
+    addItem(StoredKind::INGREDIENT, &Shard::ingredients, name, hash, quantity);
 }
 
 /**
  * @brief Adds potions to the inventory
  * @param name The name of the potion to add
+ * @param hash hashName(name)
  * @param quantity The amount of potion to add
  * @return void
  * @side_effects Increases the potion quantity in the potions map
  */
-void Inventory::addPotion(const string &name, int quantity)
+void Inventory::addPotion(const string &name, NameHash hash, int quantity)
 {
-    // Accumulate potion quantity using map's default initialization
-    potions[name] += quantity;
+    addItem(StoredKind::POTION, &Shard::potions, name, hash, quantity);
 }
 
 /**
  * @brief Adds trophies to the inventory
  * @param name The name of the trophy to add
+ * @param hash hashName(name)
  * @param quantity The amount of trophy to add
  * @return void
  * @side_effects Increases the trophy quantity in the trophies map
  */
-void Inventory::addTrophy(const string &name, int quantity)
+void Inventory::addTrophy(const string &name, NameHash hash, int quantity)
 {
-    // Accumulate trophy quantity using map's default initialization
-    trophies[name] += quantity;
+    addItem(StoredKind::TROPHY, &Shard::trophies, name, hash, quantity);
 }
 
 /**
  * @brief Removes ingredients from the inventory if sufficient quantity exists
  * @param name The name of the ingredient to remove
+ * @param hash hashName(name)
  * @param quantity The amount of ingredient to remove
  * @return true if removal successful, false if insufficient quantity
  * @side_effects Decreases ingredient quantity if removal is possible
  */
-bool Inventory::removeIngredient(const string &name, int quantity)
+bool Inventory::removeIngredient(const string &name, NameHash hash, int quantity)
 {
-    // Check if sufficient quantity exists before removal
-    if (ingredients[name] >= quantity)
-    {
-        ingredients[name] -= quantity;
-        return true;
-    }
-    return false;
+    return removeItem(StoredKind::INGREDIENT, &Shard::ingredients, name, hash, quantity);
 }
 
 /**
  * @brief Removes potions from the inventory if sufficient quantity exists
  * @param name The name of the potion to remove
+ * @param hash hashName(name)
  * @param quantity The amount of potion to remove
  * @return true if removal successful, false if insufficient quantity
  * @side_effects Decreases potion quantity if removal is possible
  */
-bool Inventory::removePotion(const string &name, int quantity)
+bool Inventory::removePotion(const string &name, NameHash hash, int quantity)
 {
-    // Check if sufficient quantity exists before removal
-    if (potions[name] >= quantity)
-    {
-        potions[name] -= quantity;
-        return true;
-    }
-    return false;
+    return removeItem(StoredKind::POTION, &Shard::potions, name, hash, quantity);
 }
 
 /**
  * @brief Removes trophies from the inventory if sufficient quantity exists
  * @param name The name of the trophy to remove
+ * @param hash hashName(name)
  * @param quantity The amount of trophy to remove
  * @return true if removal successful, false if insufficient quantity
  * @side_effects Decreases trophy quantity if removal is possible
  */
-bool Inventory::removeTrophy(const string &name, int quantity)
+bool Inventory::removeTrophy(const string &name, NameHash hash, int quantity)
 {
-    // Check if sufficient quantity exists before removal
-    if (trophies[name] >= quantity)
-    {
-        trophies[name] -= quantity;
-        return true;
-    }
-    return false;
+    return removeItem(StoredKind::TROPHY, &Shard::trophies, name, hash, quantity);
+}
+
+/**
+ * @brief Reads the quantity of an item of one category
+ * @param kind Category of the item
+ * @param table Shard table holding the category
+ * @param name The name of the item
+ * @param hash hashName(name)
+ * @return The quantity of the item, 0 if not found
+ */
+int Inventory::getItemQuantity(StoredKind kind, TieredItemStore Shard::*table, const string &name, NameHash hash) const
+{
+    CommandExplain::countLookup(ExplainSubsystem::INVENTORY);
+    if (store)
+        return store->quantity(kind, name, hash);
+    if (lsm)
+        return lsm->quantity(kind, name, hash);
+
+    // Either tier answers; non-existent items read as 0
+    return (shards[shardOf(hash)].*table).quantity(name, hash);
 }
 
 /**
  * @brief Retrieves the quantity of a specific ingredient
  * @param name The name of the ingredient to query
+ * @param hash hashName(name)
  * @return The quantity of the ingredient, 0 if not found
  */
-int Inventory::getIngredientQuantity(const string &name) const
+int Inventory::getIngredientQuantity(const string &name, NameHash hash) const
 {
-    auto it = ingredients.find(name);
-    // Return quantity if found, otherwise return 0 for non-existent items
-    return (it != ingredients.end()) ? it->second : 0;
+    return getItemQuantity(StoredKind::INGREDIENT, &Shard::ingredients, name, hash);
 }
 
 /**
  * @brief Retrieves the quantity of a specific potion
  * @param name The name of the potion to query
+ * @param hash hashName(name)
  * @return The quantity of the potion, 0 if not found
  */
-int Inventory::getPotionQuantity(const string &name) const
+int Inventory::getPotionQuantity(const string &name, NameHash hash) const
 {
-    auto it = potions.find(name);
-    // Return quantity if found, otherwise return 0 for non-existent items
-    return (it != potions.end()) ? it->second : 0;
+    return getItemQuantity(StoredKind::POTION, &Shard::potions, name, hash);
 }
 
 /**
  * @brief Retrieves the quantity of a specific trophy
  * @param name The name of the trophy to query
+ * @param hash hashName(name)
  * @return The quantity of the trophy, 0 if not found
  */
-int Inventory::getTrophyQuantity(const string &name) const
+int Inventory::getTrophyQuantity(const string &name, NameHash hash) const
 {
-    auto it = trophies.find(name);
-    // Return quantity if found, otherwise return 0 for non-existent items
-    return (it != trophies.end()) ? it->second : 0;
+    return getItemQuantity(StoredKind::TROPHY, &Shard::trophies, name, hash);
 }
 
 /**
- * @brief Generates formatted string of all ingredients in inventory
- * @return Comma-separated string of ingredients with quantities, sorted alphabetically
- *         Format: "quantity ingredient, quantity ingredient, ..."
- *         Returns empty string if no ingredients
+ * @brief Retrieves the quantities of several items of one category
+ * @param category Category of every item
+ * @param names The names of the items to query
+ * @param hashes hashName of each name
+ * @param quantities Receives the quantity of each item, in the order of names
+ * @return void
+ * 
+ * The probe order is sorted by (shard, name): in-memory tables are visited
+ * one shard at a time and neighbouring names share the cold tier's binary
+ * search path and the out-of-core store's blocks. In-memory tables also
+ * have the filter words and hot index slot of a name MULTI_GET_PREFETCH
+ * places ahead loaded while the current name is read.
  */
-string Inventory::getAllIngredients() const
+void Inventory::getQuantities(ItemCategory category, const vector<string> &names, const vector<NameHash> &hashes,
+                              vector<int> &quantities) const
 {
-    vector<pair<string, int>> sortedIngredients;
-    
-    // Collect only ingredients with positive quantities
-    for (const auto &pair : ingredients)
+    static const StoredKind kinds[] = {StoredKind::INGREDIENT, StoredKind::POTION, StoredKind::TROPHY};
+    static TieredItemStore Shard::*const tables[] = {&Shard::ingredients, &Shard::potions, &Shard::trophies};
+    int index = static_cast<int>(category);
+
+    vector<size_t> order(names.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [&](size_t left, size_t right)
+         {
+             size_t leftShard = shardOf(hashes[left]), rightShard = shardOf(hashes[right]);
+             return leftShard != rightShard ? leftShard < rightShard : names[left] < names[right];
+         });
+
+    bool inMemory = !store && !lsm;
+    quantities.assign(names.size(), 0);
+    for (size_t k = 0; k < order.size(); ++k)
     {
-        if (pair.second > 0)
+        if (inMemory && k + MULTI_GET_PREFETCH < order.size())
         {
-            sortedIngredients.emplace_back(pair);
+            NameHash ahead = hashes[order[k + MULTI_GET_PREFETCH]];
+            (shards[shardOf(ahead)].*tables[index]).prefetch(ahead);
         }
+        size_t i = order[k];
+        quantities[i] = getItemQuantity(kinds[index], tables[index], names[i], hashes[i]);
     }
+}
 
-    // Sort alphabetically by ingredient name for consistent output
-    sort(sortedIngredients.begin(), sortedIngredients.end());
+/**
+ * @brief Resolves the storage slot of an item of one category
+ * @param kind Category of the item
+ * @param table Shard table holding the category
+ * @param name The name of the item
+ * @param hash hashName(name)
+ * @return Slot pointing at the item's quantity
+ * @side_effects Creates a zero-quantity entry for unknown items
+ * 
+ * The item is pinned in the hot tier or the out-of-core store (or lives at
+ * a fixed address in the state file), so the slot remains valid afterwards
+ */
+Inventory::ItemSlot Inventory::resolveItem(StoredKind kind, TieredItemStore Shard::*table, const string &name, NameHash hash)
+{
+    CommandExplain::countLookup(ExplainSubsystem::INVENTORY);
+    size_t shard = shardOf(hash);
+    int *quantity = store ? store->quantityCell(kind, name, hash)
+                    : lsm ? lsm->pin(kind, name, hash)
+                          : &(shards[shard].*table).pin(name, hash);
+    return ItemSlot{quantity, shard, StateDigest::key(kind, hash), name};
+}
 
-    // Build formatted result string
-    string result;
-    for (size_t i = 0; i < sortedIngredients.size(); ++i)
+/**
+ * @brief Resolves the storage slot of an ingredient
+ * @param name The name of the ingredient
+ * @param hash hashName(name)
+ * @return Slot pointing at the ingredient's quantity
+ * @side_effects Creates a zero-quantity entry for unknown ingredients
+ */
+Inventory::ItemSlot Inventory::resolveIngredient(const string &name, NameHash hash)
+{
+    return resolveItem(StoredKind::INGREDIENT, &Shard::ingredients, name, hash);
+}
+
+/**
+ * @brief Resolves the storage slot of a potion
+ * @param name The name of the potion
+ * @param hash hashName(name)
+ * @return Slot pointing at the potion's quantity
+ * @side_effects Creates a zero-quantity entry for unknown potions
+ */
+Inventory::ItemSlot Inventory::resolvePotion(const string &name, NameHash hash)
+{
+    return resolveItem(StoredKind::POTION, &Shard::potions, name, hash);
+}
+
+/**
+ * @brief Resolves the storage slot of a trophy
+ * @param name The name of the trophy
+ * @param hash hashName(name)
+ * @return Slot pointing at the trophy's quantity
+ * @side_effects Creates a zero-quantity entry for unknown trophies
+ */
+Inventory::ItemSlot Inventory::resolveTrophy(const string &name, NameHash hash)
+{
+    return resolveItem(StoredKind::TROPHY, &Shard::trophies, name, hash);
+}
+
+/**
+ * @brief Adds to a resolved item
+ * @param slot Slot returned by a resolve method
+ * @param quantity The amount to add
+ * @return void
+ * @side_effects Updates the digest of the slot's shard
+ */
+void Inventory::addToSlot(const ItemSlot &slot, int quantity)
+{
+    int before = *slot.quantity;
+    if (store)
+        store->setQuantity(slot.quantity, before + quantity);
+    else
+        *slot.quantity += quantity;
+    recordChange(slot.shard, slot.key, slot.name, before, before + quantity);
+}
+
+/**
+ * @brief Removes from a resolved item if sufficient quantity exists
+ * @param slot Slot returned by a resolve method
+ * @param quantity The amount to remove
+ * @return true if removal successful, false if insufficient quantity
+ * @side_effects Updates the digest of the slot's shard
+ */
+bool Inventory::removeFromSlot(const ItemSlot &slot, int quantity)
+{
+    int before = *slot.quantity;
+    if (before >= quantity)
     {
-        if (i > 0)
-            result += ", "; // Add comma separator between items
-        result += to_string(sortedIngredients[i].second) + " " + sortedIngredients[i].first;
+        if (store)
+            store->setQuantity(slot.quantity, before - quantity);
+        else
+            *slot.quantity -= quantity;
+        recordChange(slot.shard, slot.key, slot.name, before, before - quantity);
+        return true;
     }
-    return result;
+    return false;
 }
 
 /**
- * @brief Generates formatted string of all potions in inventory
- * @return Comma-separated string of potions with quantities, sorted alphabetically
- *         Format: "quantity potion, quantity potion, ..."
- *         Returns empty string if no potions
+ * @brief Reads a resolved item
+ * @param slot Slot returned by a resolve method
+ * @return The current quantity
  */
-string Inventory::getAllPotions() const
+int Inventory::getSlotQuantity(const ItemSlot &slot) const
 {
-    vector<pair<string, int>> sortedPotions;
-    
-    // Collect only potions with positive quantities
-    for (const auto &pair : potions)
+    return *slot.quantity;
+}
+
+/**
+ * @brief Runs one slice of compacting one table of one shard
+ * @param shard Shard index
+ * @param category Table within the shard
+ * @param meter Budget of the slice
+ * @return true once the table is compacted
+ * @side_effects Drops zero-quantity items that are not pinned by a slot
+ */
+bool Inventory::compactTable(size_t shard, ItemCategory category, SliceMeter &meter)
+{
+    if (store || lsm)
+        return true;
+
+    switch (category)
     {
-        if (pair.second > 0)
-        {
-            sortedPotions.emplace_back(pair);
-        }
+    case ItemCategory::INGREDIENT:
+        return shards[shard].ingredients.compactStep(meter);
+    case ItemCategory::POTION:
+        return shards[shard].potions.compactStep(meter);
+    case ItemCategory::TROPHY:
+        return shards[shard].trophies.compactStep(meter);
+    }
+    return true;
+}
+
+/**
+ * @brief Combines the digests of every shard
+ * @return Digest of all items with a positive quantity
+ */
+StateDigest Inventory::getDigest() const
+{
+    StateDigest total;
+    for (const auto &shard : shards)
+    {
+        total += shard.digest;
     }
+    return total;
+}
 
-    // Sort alphabetically by potion name for consistent output
-    sort(sortedPotions.begin(), sortedPotions.end());
+/**
+ * @brief Combines the negative lookup filter counters of every table
+ * @return Sum over shards and item categories
+ */
+FilterStats Inventory::getFilterStats() const
+{
+    FilterStats total;
+    for (const auto &shard : shards)
+    {
+        total += shard.ingredients.getFilterStats();
+        total += shard.potions.getFilterStats();
+        total += shard.trophies.getFilterStats();
+    }
+    return total;
+}
 
-    // Build formatted result string
-    string result;
-    for (size_t i = 0; i < sortedPotions.size(); ++i)
+/**
+ * @brief Combines the hot index switches of every table
+ * @return Sum over shards and item categories
+ */
+ContainerStats Inventory::getContainerStats() const
+{
+    ContainerStats total;
+    for (const auto &shard : shards)
     {
-        if (i > 0)
-            result += ", "; // Add comma separator between items
-        result += to_string(sortedPotions[i].second) + " " + sortedPotions[i].first;
+        total += shard.ingredients.getContainerStats();
+        total += shard.potions.getContainerStats();
+        total += shard.trophies.getContainerStats();
     }
-    return result;
+    return total;
 }
 
 /**
- * @brief Generates formatted string of all trophies in inventory
- * @return Comma-separated string of trophies with quantities, sorted alphabetically
- *         Format: "quantity trophy, quantity trophy, ..."
- *         Returns empty string if no trophies
+ * @brief Collects every item of one category with a positive quantity
+ * @param category Category to collect
+ * @param items Receives (name, quantity) pairs sorted by name
+ * @return void
  */
-string Inventory::getAllTrophies() const
+void Inventory::collectItems(ItemCategory category, vector<pair<string, int>> &items) const
 {
-    vector<pair<string, int>> sortedTrophies;
-    
-    // Collect only trophies with positive quantities
-    for (const auto &pair : trophies)
+    ItemCollection collection;
+    SliceMeter unlimited;
+    collectItemsStep(category, collection, unlimited);
+    items.swap(collection.items);
+}
+
+/**
+ * @brief Collects items into a collection until done or out of budget
+ * @param category Category to collect
+ * @param collection Progress so far
+ * @param meter Budget of this slice, one unit per item read or merged
+ * @return true once every source has been merged in
+ */
+bool Inventory::collectItemsStep(ItemCategory category, ItemCollection &collection, SliceMeter &meter) const
+{
+    static const StoredKind kinds[] = {StoredKind::INGREDIENT, StoredKind::POTION, StoredKind::TROPHY};
+    static TieredItemStore Shard::*const tables[] = {&Shard::ingredients, &Shard::potions, &Shard::trophies};
+    int index = static_cast<int>(category);
+    vector<pair<string, int>> &runs = collection.runs;
+    vector<size_t> &runEnds = collection.runEnds;
+
+    while (collection.nextSource <= shards.size())
     {
-        if (pair.second > 0)
+        if (meter.exhausted())
+            return false;
+
+        if (collection.nextSource == 0)
+        {
+            if (store)
+            {
+                store->collect(kinds[index], runs);
+                sort(runs.begin(), runs.end());
+            }
+            else if (lsm)
+            {
+                lsm->collect(kinds[index], runs);
+            }
+            meter.take(runs.size());
+        }
+        else if (!(shards[collection.nextSource - 1].*tables[index]).appendSortedStep(collection.listing, runs, meter))
+        {
+            continue;
+        }
+
+        // Each shard's items are sorted on their own; they are merged once all are read
+        if (runs.size() > (runEnds.empty() ? 0 : runEnds.back()))
+            runEnds.push_back(runs.size());
+        collection.listing = TieredItemStore::Listing();
+        ++collection.nextSource;
+
+        if (collection.nextSource > shards.size() && runEnds.size() <= 1)
         {
-            sortedTrophies.emplace_back(pair);
+            collection.items.swap(runs);
+            return true;
         }
     }
 
-    // Sort alphabetically by trophy name for consistent output
-    sort(sortedTrophies.begin(), sortedTrophies.end());
+    vector<size_t> &cursors = collection.cursors;
+    vector<size_t> &heap = collection.heap;
+    auto after = [&runs, &cursors](size_t a, size_t b) { return runs[cursors[b]] < runs[cursors[a]]; };
+    if (cursors.empty())
+    {
+        for (size_t i = 0; i < runEnds.size(); ++i)
+        {
+            cursors.push_back(i == 0 ? 0 : runEnds[i - 1]);
+            heap.push_back(i);
+        }
+        make_heap(heap.begin(), heap.end(), after);
+        collection.items.reserve(runs.size());
+    }
 
-    // Build formatted result string
-    string result;
-    for (size_t i = 0; i < sortedTrophies.size(); ++i)
+    while (!heap.empty() && meter.take())
+    {
+        pop_heap(heap.begin(), heap.end(), after);
+        size_t i = heap.back();
+        collection.items.push_back(std::move(runs[cursors[i]]));
+        if (++cursors[i] < runEnds[i])
+            push_heap(heap.begin(), heap.end(), after);
+        else
+            heap.pop_back();
+    }
+    if (!heap.empty())
+        return false;
+
+    runs.clear();
+    return true;
+}
+
+/**
+ * @brief Appends part of an item listing as "quantity name, quantity name, ..."
+ * @param items Items in listing order
+ * @param begin First item to append
+ * @param end One past the last item to append
+ * @param result String receiving the text
+ * @return void
+ */
+void appendItemList(const vector<pair<string, int>> &items, size_t begin, size_t end, string &result)
+{
+    for (size_t i = begin; i < end; ++i)
     {
         if (i > 0)
             result += ", "; // Add comma separator between items
-        result += to_string(sortedTrophies[i].second) + " " + sortedTrophies[i].first;
+        result += to_string(items[i].second) + " " + items[i].first;
     }
+}
+
+/**
+ * @brief Formats collected items as "quantity name, quantity name, ..."
+ * @param items Items sorted by name
+ * @return The formatted list, empty if there are no items
+ */
+static string formatItems(const vector<pair<string, int>> &items)
+{
+    string result;
+    appendItemList(items, 0, items.size(), result);
     return result;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Generates formatted string of all ingredients in inventory
+ * @return Comma-separated string of ingredients with quantities, sorted alphabetically
+ *         Format: "quantity ingredient, quantity ingredient, ..."
+ *         Returns empty string if no ingredients
+ */
+string Inventory::getAllIngredients() const
+{
+    vector<pair<string, int>> sortedIngredients;
+    collectItems(ItemCategory::INGREDIENT, sortedIngredients);
+    return formatItems(sortedIngredients);
+}
+
+/**
+ * @brief Generates formatted string of all potions in inventory
+ * @return Comma-separated string of potions with quantities, sorted alphabetically
+ *         Format: "quantity potion, quantity potion, ..."
+ *         Returns empty string if no potions
+ */
+string Inventory::getAllPotions() const
+{
+    vector<pair<string, int>> sortedPotions;
+    collectItems(ItemCategory::POTION, sortedPotions);
+    return formatItems(sortedPotions);
+}
+
+/**
+ * @brief Generates formatted string of all trophies in inventory
+ * @return Comma-separated string of trophies with quantities, sorted alphabetically
+ *         Format: "quantity trophy, quantity trophy, ..."
+ *         Returns empty string if no trophies
+ */
+string Inventory::getAllTrophies() const
+{
+    vector<pair<string, int>> sortedTrophies;
+    collectItems(ItemCategory::TROPHY, sortedTrophies);
+    return formatItems(sortedTrophies);
+}
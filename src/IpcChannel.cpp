@@ -0,0 +1,270 @@
+#include "WitcherTracker.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+ * @brief IpcChannel implementation - request/response rings in a shm segment
+ *
+ * Segment layout: a 64-byte header, the request ring, the response ring.
+ * The creator writes the magic number last, so a client that attaches
+ * early sees an unusable segment rather than half-initialized rings.
+ */
+
+static const uint64_t IPC_MAGIC = 0x3143504954575457ULL;   // "WTWTIPC1"
+
+/**
+ * @struct IpcChannel::Header
+ * @brief First cache line of the segment
+ */
+struct IpcChannel::Header
+{
+    alignas(64) atomic<uint64_t> magic;     ///< IPC_MAGIC once both rings are initialized
+    uint64_t ringBytes;                     ///< Record area of each ring
+};
+
+/**
+ * @brief Total segment size for a ring size
+ */
+static size_t segmentBytes(size_t ringBytes)
+{
+    return 64 + 2 * IpcRing::regionBytes(ringBytes);
+}
+
+/**
+ * @brief Maps an open segment descriptor
+ * @param fd Descriptor from shm_open (closed by this call)
+ * @param bytes Segment size
+ * @return false if mmap fails
+ */
+bool IpcChannel::map(int fd, size_t bytes)
+{
+    void *mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+        return false;
+
+    memory = static_cast<char *>(mapped);
+    size = bytes;
+    return true;
+}
+
+/**
+ * @brief Creates a segment, replacing any stale one with the same name
+ * @param segmentName shm_open name
+ * @param ringBytes Record area of each ring (power of two, at least 4096)
+ * @return false if the segment cannot be created or mapped
+ */
+bool IpcChannel::create(const string &segmentName, size_t ringBytes)
+{
+    close();
+    if (ringBytes < 4096 || (ringBytes & (ringBytes - 1)) != 0)
+        return false;
+
+    shm_unlink(segmentName.c_str());
+    int fd = shm_open(segmentName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return false;
+
+    size_t bytes = segmentBytes(ringBytes);
+    if (ftruncate(fd, static_cast<off_t>(bytes)) != 0)
+    {
+        ::close(fd);
+        shm_unlink(segmentName.c_str());
+        return false;
+    }
+    if (!map(fd, bytes))
+    {
+        shm_unlink(segmentName.c_str());
+        return false;
+    }
+
+    name = segmentName;
+    owner = true;
+
+    Header *header = new (memory) Header();
+    header->ringBytes = ringBytes;
+    requests.reset(new IpcRing(memory + 64, ringBytes, true));
+    responses.reset(new IpcRing(memory + 64 + IpcRing::regionBytes(ringBytes), ringBytes, true));
+    header->magic.store(IPC_MAGIC, memory_order_release);
+    return true;
+}
+
+/**
+ * @brief Attaches to a segment created by create()
+ * @param segmentName shm_open name used by the creator
+ * @return false if no valid segment exists under that name
+ */
+bool IpcChannel::attach(const string &segmentName)
+{
+    close();
+    int fd = shm_open(segmentName.c_str(), O_RDWR, 0);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < 64)
+    {
+        ::close(fd);
+        return false;
+    }
+    if (!map(fd, static_cast<size_t>(info.st_size)))
+        return false;
+
+    Header *header = reinterpret_cast<Header *>(memory);
+    if (header->magic.load(memory_order_acquire) != IPC_MAGIC || segmentBytes(header->ringBytes) != size)
+    {
+        close();
+        return false;
+    }
+
+    name = segmentName;
+    requests.reset(new IpcRing(memory + 64, header->ringBytes, false));
+    responses.reset(new IpcRing(memory + 64 + IpcRing::regionBytes(header->ringBytes), header->ringBytes, false));
+    return true;
+}
+
+/**
+ * @brief Unmaps the segment; the creator also unlinks its name
+ * @return void
+ */
+void IpcChannel::close()
+{
+    requests.reset();
+    responses.reset();
+    failed = false;
+    if (memory)
+    {
+        munmap(memory, size);
+        memory = nullptr;
+        size = 0;
+    }
+    if (owner)
+    {
+        shm_unlink(name.c_str());
+        owner = false;
+    }
+    name.clear();
+}
+
+/**
+ * @brief Sends a command line
+ * @param line Command as typed at the prompt
+ * @return void
+ */
+void IpcChannel::sendLine(const string &line)
+{
+    if (!requests->push(LINE, line.data(), line.size()))
+        throw length_error("IpcChannel: command larger than the ring allows");
+}
+
+/**
+ * @brief Sends a command template to prepare
+ * @param templateLine Template with "#" for quantities
+ * @return void
+ */
+void IpcChannel::sendPrepare(const string &templateLine)
+{
+    if (!requests->push(PREPARE, templateLine.data(), templateLine.size()))
+        throw length_error("IpcChannel: template larger than the ring allows");
+}
+
+/**
+ * @brief Sends the execution of a prepared template
+ * @param handle Handle from a PREPARE response
+ * @param params Quantities substituted for the template's "#"
+ * @return void
+ */
+void IpcChannel::sendExecute(int handle, const vector<int> &params)
+{
+    vector<int32_t> record;
+    record.reserve(params.size() + 1);
+    record.push_back(handle);
+    record.insert(record.end(), params.begin(), params.end());
+    if (!requests->push(EXECUTE, reinterpret_cast<const char *>(record.data()), record.size() * sizeof(int32_t)))
+        throw length_error("IpcChannel: too many parameters for the ring");
+}
+
+/**
+ * @brief Waits for the next response
+ * @param status Receives the status of the request
+ * @param output Receives the output text
+ * @return void
+ * @throws runtime_error if the response ring holds a malformed record
+ */
+void IpcChannel::receive(int &status, string &output)
+{
+    uint32_t type;
+    string record;
+    if (!responses->pop(type, record) || type != RESPONSE || record.size() < sizeof(int32_t))
+    {
+        failed = true;
+        throw runtime_error("IpcChannel: malformed response record");
+    }
+
+    int32_t code = -1;
+    memcpy(&code, record.data(), sizeof(code));
+    status = code;
+    output.assign(record, sizeof(code), string::npos);
+}
+
+/**
+ * @brief Executes one request and answers it
+ * @param tracker Tracker executing the request
+ * @param timeoutMillis Longest time to wait for a request
+ * @return false if no request arrived in time
+ *
+ * Rejected command lines are answered with "INVALID", as at the prompt.
+ * A response too large for the ring is replaced by status -2 and no text.
+ * A record that overruns the ring or has an unknown type is not answered:
+ * the client no longer speaks the protocol, so the channel fails.
+ */
+bool IpcChannel::serveOne(WitcherTracker &tracker, int timeoutMillis)
+{
+    uint32_t type;
+    string request;
+    if (failed || !requests->pop(type, request, timeoutMillis))
+        return false;
+    if (type != LINE && type != PREPARE && type != EXECUTE)
+    {
+        failed = true;
+        return false;
+    }
+
+    ostringstream out;
+    int32_t status = -1;
+    switch (type)
+    {
+    case LINE:
+        status = tracker.executeLine(request, out);
+        if (status == -1)
+            out << "INVALID\n";
+        break;
+    case PREPARE:
+        status = tracker.prepare(request);
+        break;
+    case EXECUTE:
+        if (request.size() >= sizeof(int32_t) && request.size() % sizeof(int32_t) == 0)
+        {
+            vector<int32_t> fields(request.size() / sizeof(int32_t));
+            memcpy(fields.data(), request.data(), request.size());
+            vector<int> params(fields.begin() + 1, fields.end());
+            status = tracker.executePrepared(fields[0], params, out);
+        }
+        break;
+    }
+
+    string response(reinterpret_cast<const char *>(&status), sizeof(status));
+    response += out.str();
+    if (!responses->push(RESPONSE, response.data(), response.size()))
+    {
+        status = -2;
+        responses->push(RESPONSE, reinterpret_cast<const char *>(&status), sizeof(status));
+    }
+    return true;
+}
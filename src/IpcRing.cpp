@@ -0,0 +1,241 @@
+#include "WitcherTracker.h"
+
+#include <cstring>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+ * @brief IpcRing implementation - SPSC record ring with futex sleeping
+ *
+ * Positions only grow; position & (capacity - 1) is the byte offset. The
+ * producer publishes tail with a release store after writing a record and
+ * the consumer publishes head after copying one out, so neither side ever
+ * reads bytes the other is still writing. Sleeping uses the classic
+ * announce-then-recheck protocol: a sleeper sets its waiting flag, fences,
+ * and re-reads the other side's position before calling FUTEX_WAIT on a
+ * signal word it sampled earlier; the other side fences after publishing
+ * and bumps and wakes the signal word only if the flag is set.
+ */
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "shared-memory rings need lock-free atomics");
+
+static const uint32_t PAD_RECORD = 0;
+
+/**
+ * @struct IpcRing::Control
+ * @brief Shared positions and futex words, one cache line per side
+ */
+struct IpcRing::Control
+{
+    alignas(64) atomic<uint64_t> head;      ///< Consumer position
+    atomic<uint32_t> spaceSignal;           ///< Bumped when space is freed for a sleeping producer
+    atomic<uint32_t> producerWaiting;       ///< 1 while the producer sleeps on spaceSignal
+    alignas(64) atomic<uint64_t> tail;      ///< Producer position
+    atomic<uint32_t> dataSignal;            ///< Bumped when data arrives for a sleeping consumer
+    atomic<uint32_t> consumerWaiting;       ///< 1 while the consumer sleeps on dataSignal
+};
+
+/**
+ * @struct RecordHeader
+ * @brief Prefix of every record in the data area
+ */
+struct RecordHeader
+{
+    uint32_t length;    ///< Payload bytes
+    uint32_t type;      ///< Record type, PAD_RECORD for padding
+};
+
+/**
+ * @brief Rounds a record size up to the 8-byte record alignment
+ */
+static inline uint64_t recordBytes(size_t payload)
+{
+    return (sizeof(RecordHeader) + payload + 7) & ~7ULL;
+}
+
+/**
+ * @brief Sleeps on a shared futex word while it holds an expected value
+ * @param word Futex word in shared memory
+ * @param expected Value sampled before deciding to sleep
+ * @param timeoutMillis Longest sleep; negative sleeps until woken
+ * @return void
+ */
+static void futexWait(atomic<uint32_t> &word, uint32_t expected, int timeoutMillis)
+{
+    timespec timeout;
+    timeout.tv_sec = timeoutMillis / 1000;
+    timeout.tv_nsec = (timeoutMillis % 1000) * 1000000L;
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT, expected,
+            timeoutMillis < 0 ? nullptr : &timeout, nullptr, 0);
+}
+
+/**
+ * @brief Wakes every sleeper on a shared futex word after changing it
+ * @param word Futex word in shared memory
+ * @return void
+ */
+static void futexWake(atomic<uint32_t> &word)
+{
+    word.fetch_add(1);
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+}
+
+/**
+ * @brief Bytes of shared memory needed for a ring
+ * @param dataBytes Record area size
+ * @return Control block plus record area
+ */
+size_t IpcRing::regionBytes(size_t dataBytes)
+{
+    return sizeof(Control) + dataBytes;
+}
+
+/**
+ * @brief Uses a region as a ring
+ * @param region Shared memory of regionBytes(dataBytes) bytes
+ * @param dataBytes Record area size (power of two)
+ * @param initialize true to reset the positions (creating side only)
+ */
+IpcRing::IpcRing(void *region, size_t dataBytes, bool initialize)
+    : control(static_cast<Control *>(region)), data(static_cast<char *>(region) + sizeof(Control)), capacity(dataBytes),
+      failed(false)
+{
+    if (initialize)
+    {
+        new (control) Control();
+        control->head.store(0);
+        control->tail.store(0);
+        control->spaceSignal.store(0);
+        control->producerWaiting.store(0);
+        control->dataSignal.store(0);
+        control->consumerWaiting.store(0);
+    }
+}
+
+/**
+ * @brief Appends a record, sleeping while the ring is full
+ * @param type Record type
+ * @param payload Record bytes
+ * @param length Bytes of payload
+ * @return false if the record is larger than a quarter of the ring
+ * @side_effects Wakes the consumer if it is sleeping
+ */
+bool IpcRing::push(uint32_t type, const char *payload, size_t length)
+{
+    uint64_t need = recordBytes(length);
+    if (need > capacity / 4)
+        return false;
+
+    uint64_t tail = control->tail.load(memory_order_relaxed);
+    uint64_t offset = tail & (capacity - 1);
+    uint64_t contiguous = capacity - offset;
+    uint64_t total = need <= contiguous ? need : contiguous + need;
+
+    // Wait for the consumer to free enough space
+    for (int spins = 0; capacity - (tail - control->head.load(memory_order_acquire)) < total;)
+    {
+        if (++spins < IPC_SPIN_LIMIT)
+        {
+            cpuRelax();
+            continue;
+        }
+
+        uint32_t signal = control->spaceSignal.load();
+        control->producerWaiting.store(1);
+        if (capacity - (tail - control->head.load()) < total)
+            futexWait(control->spaceSignal, signal, -1);
+        control->producerWaiting.store(0);
+        spins = 0;
+    }
+
+    // Pad to the end of the area if the record would wrap
+    if (need > contiguous)
+    {
+        RecordHeader pad{static_cast<uint32_t>(contiguous - sizeof(RecordHeader)), PAD_RECORD};
+        memcpy(data + offset, &pad, sizeof(pad));
+        tail += contiguous;
+        offset = 0;
+    }
+
+    RecordHeader header{static_cast<uint32_t>(length), type};
+    memcpy(data + offset, &header, sizeof(header));
+    memcpy(data + offset + sizeof(header), payload, length);
+
+    // Publish, then check for a sleeper (seq_cst pairs with its announcement)
+    control->tail.store(tail + need);
+    if (control->consumerWaiting.load())
+        futexWake(control->dataSignal);
+    return true;
+}
+
+/**
+ * @brief Removes the oldest record, sleeping while the ring is empty
+ * @param type Receives the record type
+ * @param payload Receives the record bytes
+ * @param timeoutMillis Longest time to sleep; negative waits forever
+ * @return false if no record arrived in time or the ring is corrupt (see isFailed)
+ * @side_effects Wakes the producer if it is sleeping
+ */
+bool IpcRing::pop(uint32_t &type, string &payload, int timeoutMillis)
+{
+    if (failed)
+        return false;
+
+    uint64_t head = control->head.load(memory_order_relaxed);
+
+    while (true)
+    {
+        // Wait for a record
+        for (int spins = 0; control->tail.load(memory_order_acquire) == head;)
+        {
+            if (++spins < IPC_SPIN_LIMIT)
+            {
+                cpuRelax();
+                continue;
+            }
+
+            uint32_t signal = control->dataSignal.load();
+            control->consumerWaiting.store(1);
+            bool empty = control->tail.load() == head;
+            if (empty)
+                futexWait(control->dataSignal, signal, timeoutMillis);
+            control->consumerWaiting.store(0);
+
+            if (empty && timeoutMillis >= 0 && control->tail.load(memory_order_acquire) == head)
+                return false;
+            spins = 0;
+        }
+
+        // The other side may be corrupt or hostile: a record must lie within
+        // what was published and must not run past the end of the area
+        RecordHeader header;
+        uint64_t offset = head & (capacity - 1);
+        uint64_t published = control->tail.load(memory_order_acquire) - head;
+        memcpy(&header, data + offset, sizeof(header));
+        uint64_t bytes = recordBytes(header.length);
+        if (published > capacity || bytes > capacity - offset || bytes > published ||
+            (header.type == PAD_RECORD && bytes != capacity - offset))
+        {
+            failed = true;
+            return false;
+        }
+        if (header.type != PAD_RECORD)
+        {
+            type = header.type;
+            payload.assign(data + offset + sizeof(header), header.length);
+        }
+        head += bytes;
+
+        control->head.store(head);
+        if (control->producerWaiting.load())
+            futexWake(control->spaceSignal);
+
+        if (header.type != PAD_RECORD)
+            return true;
+    }
+}
@@ -0,0 +1,160 @@
+#include "WitcherTracker.h"
+
+using namespace std;
+
+/**
+ * @brief LatencyHistogram implementation - log-linear latency buckets
+ *
+ * Bucket index of a value v >= 128 with highest set bit m: the range
+ * [2^m, 2^(m+1)) is split into 64 buckets of width 2^(m-6), numbered
+ * after the 128 exact buckets and the 64 buckets of every lower range.
+ */
+
+static const int SUB_BUCKET_BITS = 7;
+static const uint64_t SUB_BUCKETS = 1ULL << SUB_BUCKET_BITS;    // 128 exact values
+static const uint64_t HALF_BUCKETS = SUB_BUCKETS / 2;           // 64 buckets per range
+static const size_t BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 2) * HALF_BUCKETS;
+
+/**
+ * @brief Maps a value to its bucket
+ * @param value Latency in nanoseconds
+ * @return Bucket index in [0, BUCKET_COUNT)
+ */
+static size_t bucketOf(uint64_t value)
+{
+    if (value < SUB_BUCKETS)
+        return static_cast<size_t>(value);
+
+    int shift = 63 - __builtin_clzll(value) - (SUB_BUCKET_BITS - 1);
+    return static_cast<size_t>((shift + 1) * HALF_BUCKETS + (value >> shift) - HALF_BUCKETS);
+}
+
+/**
+ * @brief Largest value that maps to a bucket
+ * @param bucket Bucket index
+ * @return Upper bound of the bucket's range
+ */
+static uint64_t bucketLimit(size_t bucket)
+{
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+
+    int shift = static_cast<int>(bucket / HALF_BUCKETS) - 1;
+    uint64_t sub = bucket % HALF_BUCKETS + HALF_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+/**
+ * @brief Constructs an empty histogram with every bucket allocated
+ */
+LatencyHistogram::LatencyHistogram() : counts(BUCKET_COUNT, 0), total(0), maxValue(0)
+{
+}
+
+/**
+ * @brief Counts one value
+ * @param value Latency in nanoseconds
+ * @return void
+ */
+void LatencyHistogram::record(uint64_t value)
+{
+    counts[bucketOf(value)]++;
+    total++;
+    if (value > maxValue)
+        maxValue = value;
+}
+
+/**
+ * @brief Adds every value counted by another histogram
+ * @param other Histogram to merge in
+ * @return void
+ */
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    for (size_t i = 0; i < BUCKET_COUNT; ++i)
+    {
+        counts[i] += other.counts[i];
+    }
+    total += other.total;
+    maxValue = std::max(maxValue, other.maxValue);
+}
+
+/**
+ * @brief Finds the value at a quantile
+ * @param fraction Quantile in [0, 1]
+ * @return Upper bound of the bucket holding the quantile, capped at the maximum
+ */
+uint64_t LatencyHistogram::percentile(double fraction) const
+{
+    if (total == 0)
+        return 0;
+
+    // Rank of the quantile, counting from 1
+    uint64_t rank = static_cast<uint64_t>(fraction * total + 0.5);
+    rank = std::max<uint64_t>(1, std::min(rank, total));
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i)
+    {
+        seen += counts[i];
+        if (seen >= rank)
+            return std::min(bucketLimit(i), maxValue);
+    }
+    return maxValue;
+}
+
+/**
+ * @brief Writes one report line with latencies in microseconds
+ * @param out Stream receiving the line
+ * @param name Label of the measured operation
+ * @return void
+ */
+void LatencyHistogram::writeReport(ostream &out, const string &name) const
+{
+    ostringstream line;
+    line << fixed << setprecision(2);
+    line << "latency " << name << ": " << total << " requests"
+         << ", p50 " << percentile(0.5) / 1000.0 << "us"
+         << ", p99 " << percentile(0.99) / 1000.0 << "us"
+         << ", p99.9 " << percentile(0.999) / 1000.0 << "us"
+         << ", max " << maxValue / 1000.0 << "us\n";
+    out << line.str();
+}
+
+/**
+ * @brief Writes the percentile distribution in HdrHistogram's text layout
+ * @param out Stream receiving the table
+ * @return void
+ *
+ * Each halving of the distance to 100% is split into five rows
+ * (0, 10, ... 40, then 50, 55, ... 70, then 75, 77.5, ...), stopping once
+ * the remaining distance covers less than one recorded value; the last
+ * row is the maximum.
+ */
+void LatencyHistogram::writeDistribution(ostream &out) const
+{
+    ostringstream table;
+    table << fixed;
+    table << setw(12) << "Value(us)" << " " << setw(14) << "Percentile" << " " << setw(10) << "TotalCount"
+          << " " << setw(14) << "1/(1-Percentile)\n\n";
+
+    if (total > 0)
+    {
+        for (double remaining = 1.0; remaining * total >= 1.0; remaining /= 2)
+        {
+            for (int tick = 0; tick < 5; ++tick)
+            {
+                double fraction = 1.0 - remaining + remaining / 2 * tick / 5;
+                uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(fraction * total + 0.5));
+                table << setprecision(3) << setw(12) << percentile(fraction) / 1000.0 << " " << setprecision(12)
+                      << setw(14) << fraction << " " << setw(10) << rank << " " << setprecision(2) << setw(14)
+                      << 1.0 / (1.0 - fraction) << "\n";
+            }
+        }
+        table << setprecision(3) << setw(12) << maxValue / 1000.0 << " " << setprecision(12) << setw(14) << 1.0
+              << " " << setw(10) << total << "\n";
+    }
+
+    table << setprecision(3) << "#[Max = " << maxValue / 1000.0 << ", Total count = " << total << "]\n";
+    out << table.str();
+}
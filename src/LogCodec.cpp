@@ -0,0 +1,477 @@
+#include "WitcherTracker.h"
+
+#include <cstring>
+
+using namespace std;
+
+/**
+ * @brief LogCodec implementation - dictionary LZ compression of command logs
+ *
+ * Both sides lay out the keywords below, the name dictionary and the log
+ * in one buffer, so a match may start in the dictionary and run on into
+ * the log, and blocks need no special case at their edges.
+ *
+ * Decoding copies literals and matches 8 or 16 bytes at a time and lets
+ * the last copy run past its end into slack at the end of the buffer; the
+ * bytes written there are overwritten by the next sequence.
+ */
+
+static const char FRAME_MAGIC[4] = {'W', 'T', 'Z', '2'};
+static const size_t MAGIC_FAMILY = 3;
+static const size_t CHECKSUM_BYTES = 4;
+static const int MATCH_TABLE_BITS = 14;
+static const size_t MAX_OFFSET = 65535;
+static const size_t COPY_SLACK = 64;
+
+/**
+ * @brief Phrases of the command grammar, shared by every frame
+ */
+static const char COMMAND_KEYWORDS[] =
+    "EXPLAIN What can I use against \n"
+    "What is in \n"
+    "What is effective against \n"
+    "Total ingredient ?\nTotal potion ?\nTotal trophy ?\n"
+    "Geralt trades  trophy for \n"
+    " sign is effective against \n"
+    " potion is effective against \n"
+    "Geralt learns  potion consists of 1 , 2 , 3 , \n"
+    "Geralt encounters a \nGeralt encounters an \n"
+    "Geralt brews \n"
+    "Geralt loots 1 , 2 , 3 , 4 , 5 , 10 \n";
+
+/**
+ * @brief Reads 4 bytes as a word for hashing and comparing
+ */
+static inline uint32_t load32(const char *p)
+{
+    uint32_t word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+/**
+ * @brief Slot of a 4-byte sequence in the match table
+ */
+static inline size_t matchSlot(uint32_t sequence)
+{
+    return (sequence * 2654435761U) >> (32 - MATCH_TABLE_BITS);
+}
+
+/**
+ * @brief Checksum of a decoded block
+ * @param data First decoded byte
+ * @param length Decoded bytes
+ * @return 64-bit checksum, of which the frame keeps CHECKSUM_BYTES
+ *
+ * Four independent multiply-fold lanes take 32 bytes per round, so the
+ * check keeps up with the decoder; hashName takes the tail and folds the
+ * lanes together.
+ */
+static uint64_t blockChecksum(const char *data, size_t length)
+{
+    static const uint64_t CHECKSUM_MULTIPLIER = 0x9e3779b97f4a7c15ULL;
+    uint64_t lanes[4] = {1, 2, 3, 4};
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32)
+    {
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            uint64_t word;
+            memcpy(&word, data + i + 8 * lane, sizeof(word));
+            unsigned __int128 product = static_cast<unsigned __int128>(lanes[lane] ^ word) * CHECKSUM_MULTIPLIER;
+            lanes[lane] = static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+        }
+    }
+
+    uint64_t hash = hashName(data + i, length - i);
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        hash = hashName(reinterpret_cast<const char *>(&lanes[lane]), sizeof(uint64_t)) ^ (hash * CHECKSUM_MULTIPLIER);
+    }
+    return hash;
+}
+
+/**
+ * @brief Appends the checksum of a decoded block
+ * @param out Frame
+ * @param data First decoded byte
+ * @param length Decoded bytes
+ * @return void
+ */
+static void writeChecksum(string &out, const char *data, size_t length)
+{
+    uint64_t hash = blockChecksum(data, length);
+    for (size_t i = 0; i < CHECKSUM_BYTES; ++i)
+    {
+        out += static_cast<char>(hash >> (8 * i));
+    }
+}
+
+/**
+ * @brief Reads the checksum of a decoded block and compares it with the bytes
+ * @param data Frame
+ * @param pos Position of the checksum, advanced past it
+ * @param decoded First decoded byte
+ * @param length Decoded bytes
+ * @return false if the checksum is truncated or does not match
+ */
+static bool readChecksum(const string &data, size_t &pos, const char *decoded, size_t length)
+{
+    if (data.size() - pos < CHECKSUM_BYTES)
+        return false;
+    uint64_t hash = blockChecksum(decoded, length);
+    for (size_t i = 0; i < CHECKSUM_BYTES; ++i)
+    {
+        if (static_cast<uint8_t>(data[pos + i]) != static_cast<uint8_t>(hash >> (8 * i)))
+            return false;
+    }
+    pos += CHECKSUM_BYTES;
+    return true;
+}
+
+/**
+ * @brief Appends the continuation bytes of a length past its nibble
+ */
+static void writeLength(string &out, size_t length)
+{
+    for (; length >= 255; length -= 255)
+    {
+        out += static_cast<char>(255);
+    }
+    out += static_cast<char>(length);
+}
+
+/**
+ * @brief Appends one sequence
+ * @param out Compressed block
+ * @param literals First literal byte
+ * @param literalLength Literal bytes
+ * @param offset Distance back to the match, 0 for the final literals-only sequence
+ * @param matchLength Bytes matched, at least LOG_CODEC_MIN_MATCH unless offset is 0
+ * @return void
+ */
+static void writeSequence(string &out, const char *literals, size_t literalLength, size_t offset, size_t matchLength)
+{
+    size_t matchCode = offset ? matchLength - LOG_CODEC_MIN_MATCH : 0;
+    out += static_cast<char>((min<size_t>(literalLength, 15) << 4) | min<size_t>(matchCode, 15));
+    if (literalLength >= 15)
+        writeLength(out, literalLength - 15);
+    out.append(literals, literalLength);
+
+    if (offset)
+    {
+        out += static_cast<char>(offset & 0xFF);
+        out += static_cast<char>(offset >> 8);
+        if (matchCode >= 15)
+            writeLength(out, matchCode - 15);
+    }
+}
+
+/**
+ * @brief Reads the continuation bytes of a length whose nibble is 15
+ * @param in Position in the block, advanced past the bytes
+ * @param end End of the block
+ * @param length Nibble value, increased by the bytes
+ * @return false if the block ends first
+ */
+static inline bool readLength(const uint8_t *&in, const uint8_t *end, size_t &length)
+{
+    uint8_t byte;
+    do
+    {
+        if (in >= end)
+            return false;
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+/**
+ * @brief Prepares a compressor seeded with names
+ * @param names Names likely to occur in the text, most useful first;
+ *        those past LOG_CODEC_DICTIONARY bytes are left out
+ */
+LogCodec::LogCodec(const vector<string> &names)
+{
+    size_t room = LOG_CODEC_DICTIONARY - (sizeof(COMMAND_KEYWORDS) - 1);
+    for (const auto &name : names)
+    {
+        if (this->names.size() + name.size() + 1 > room)
+            break;
+        this->names += name;
+        this->names += ' ';
+    }
+}
+
+/**
+ * @brief Compresses a command log
+ * @param text Log text
+ * @param out Receives the frame
+ * @return void
+ */
+void LogCodec::compress(const string &text, string &out) const
+{
+    compressFrame(text, names, out);
+    if (names.empty())
+        return;
+
+    string plain;
+    compressFrame(text, string(), plain);
+    if (plain.size() < out.size())
+        out.swap(plain);
+}
+
+/**
+ * @brief Compresses a command log with a given name dictionary
+ * @param text Log text
+ * @param names Name dictionary, possibly empty
+ * @param out Receives the frame
+ * @return void
+ */
+void LogCodec::compressFrame(const string &text, const string &names, string &out)
+{
+    string history(COMMAND_KEYWORDS, sizeof(COMMAND_KEYWORDS) - 1);
+    size_t keywords = history.size();
+    history += names;
+    history += text;
+    size_t dictionary = keywords + names.size();
+
+    vector<size_t> table(size_t(1) << MATCH_TABLE_BITS, 0);
+    for (size_t pos = 0; pos + LOG_CODEC_MIN_MATCH <= keywords; ++pos)
+    {
+        table[matchSlot(load32(&history[pos]))] = pos + 1;
+    }
+
+    string block;
+    out.assign(FRAME_MAGIC, sizeof(FRAME_MAGIC));
+    writeVarint(out, text.size());
+    compressBlock(history, keywords, dictionary, table, block);
+    writeVarint(out, names.size());
+    writeVarint(out, block.size());
+    out += block;
+    writeChecksum(out, names.data(), names.size());
+
+    for (size_t begin = dictionary; begin < history.size(); begin += LOG_CODEC_BLOCK)
+    {
+        size_t end = min(begin + LOG_CODEC_BLOCK, history.size());
+        block.clear();
+        compressBlock(history, begin, end, table, block);
+        writeVarint(out, end - begin);
+        writeVarint(out, block.size());
+        out += block;
+        writeChecksum(out, history.data() + begin, end - begin);
+    }
+}
+
+/**
+ * @brief Compresses a block of a history buffer
+ * @param history Keywords, names and log
+ * @param begin Start of the block in history
+ * @param end End of the block in history
+ * @param table Last position + 1 of each 4-byte sequence hash, 0 if none;
+ *        carried from block to block
+ * @param out Receives the sequences
+ * @return void
+ *
+ * Greedy single-probe matching: each position looks up the last position
+ * with the same 4 bytes, and the step grows while no match is found so
+ * that incompressible stretches are passed over quickly.
+ */
+void LogCodec::compressBlock(const string &history, size_t begin, size_t end, vector<size_t> &table, string &out)
+{
+    const char *base = history.data();
+    size_t anchor = begin;
+    size_t pos = begin;
+    while (pos + LOG_CODEC_MIN_MATCH <= end)
+    {
+        uint32_t sequence = load32(base + pos);
+        size_t &slot = table[matchSlot(sequence)];
+        size_t candidate = slot;
+        slot = pos + 1;
+
+        if (candidate == 0 || pos - (candidate - 1) > MAX_OFFSET || load32(base + candidate - 1) != sequence)
+        {
+            pos += 1 + ((pos - anchor) >> 6);
+            continue;
+        }
+
+        size_t match = candidate - 1;
+        size_t length = LOG_CODEC_MIN_MATCH;
+        while (pos + length < end && base[match + length] == base[pos + length])
+        {
+            ++length;
+        }
+        while (pos > anchor && match > 0 && base[match - 1] == base[pos - 1])
+        {
+            --pos;
+            --match;
+            ++length;
+        }
+
+        writeSequence(out, base + anchor, pos - anchor, pos - match, length);
+        pos += length;
+        anchor = pos;
+        if (pos + 2 <= end)
+            table[matchSlot(load32(base + pos - 2))] = pos - 1;
+    }
+
+    writeSequence(out, base + anchor, end - anchor, 0, 0);
+}
+
+/**
+ * @brief Checks whether data starts with the frame magic
+ * @param data File contents
+ * @return true if the data is a compressed frame, of this version or another
+ */
+bool LogCodec::isCompressed(const string &data)
+{
+    return data.size() >= sizeof(FRAME_MAGIC) && memcmp(data.data(), FRAME_MAGIC, MAGIC_FAMILY) == 0;
+}
+
+/**
+ * @brief Decompresses a frame
+ * @param data Frame written by compress()
+ * @param text Receives the log text
+ * @return false if the frame is truncated, corrupt or of another version
+ */
+bool LogCodec::decompress(const string &data, string &text)
+{
+    text.clear();
+    if (data.size() < sizeof(FRAME_MAGIC) || memcmp(data.data(), FRAME_MAGIC, sizeof(FRAME_MAGIC)) != 0)
+        return false;
+
+    // A sequence of a few bytes expands to at most a few hundred
+    size_t pos = sizeof(FRAME_MAGIC);
+    uint64_t total, raw, length;
+    if (!readVarint(data, pos, data.size(), total) || total / 256 > data.size())
+        return false;
+
+    string dictionary(COMMAND_KEYWORDS, sizeof(COMMAND_KEYWORDS) - 1);
+    dictionary.resize(LOG_CODEC_DICTIONARY + COPY_SLACK);
+    size_t keywords = sizeof(COMMAND_KEYWORDS) - 1;
+    if (!readVarint(data, pos, data.size(), raw) || raw > LOG_CODEC_DICTIONARY - keywords ||
+        !readVarint(data, pos, data.size(), length) || length > data.size() - pos ||
+        !decompressBlock(data.data() + pos, length, nullptr, 0, &dictionary[0], keywords, raw))
+        return false;
+    pos += length;
+    if (!readChecksum(data, pos, dictionary.data() + keywords, raw))
+        return false;
+    dictionary.resize(keywords + raw);
+
+    // The slack takes the wide copies running past the end
+    text.resize(total + COPY_SLACK);
+    for (size_t done = 0; done < total; done += raw)
+    {
+        if (!readVarint(data, pos, data.size(), raw) || raw > total - done ||
+            !readVarint(data, pos, data.size(), length) || length > data.size() - pos ||
+            !decompressBlock(data.data() + pos, length, dictionary.data(), dictionary.size(), &text[0], done, raw))
+        {
+            text.clear();
+            return false;
+        }
+        pos += length;
+        if (!readChecksum(data, pos, text.data() + done, raw))
+        {
+            text.clear();
+            return false;
+        }
+    }
+    text.resize(pos == data.size() ? total : 0);
+    return pos == data.size();
+}
+
+/**
+ * @brief Decodes one block
+ * @param in Compressed block
+ * @param length Compressed bytes
+ * @param dictionary Keywords and names preceding the output, null when
+ *        decoding the names themselves
+ * @param dictionarySize Bytes of the dictionary
+ * @param out Output decoded so far, then room for the block and COPY_SLACK bytes
+ * @param begin Start of the block in out
+ * @param raw Bytes the block decodes to
+ * @return false if the block is corrupt
+ */
+bool LogCodec::decompressBlock(const char *in, size_t length, const char *dictionary, size_t dictionarySize,
+                               char *out, size_t begin, size_t raw)
+{
+    const uint8_t *ip = reinterpret_cast<const uint8_t *>(in);
+    const uint8_t *inEnd = ip + length;
+    char *op = out + begin;
+    char *outEnd = op + raw;
+
+    while (ip < inEnd)
+    {
+        uint8_t token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == 15 && !readLength(ip, inEnd, literals))
+            return false;
+        if (literals > static_cast<size_t>(inEnd - ip) || literals > static_cast<size_t>(outEnd - op))
+            return false;
+        if (literals <= 16 && inEnd - ip >= 16)
+            memcpy(op, ip, 16);
+        else
+            memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+
+        // Only the last sequence ends after its literals
+        if (ip == inEnd)
+            break;
+        if (inEnd - ip < 2)
+            return false;
+        size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+        ip += 2;
+
+        size_t match = (token & 15) + LOG_CODEC_MIN_MATCH;
+        if ((token & 15) == 15 && !readLength(ip, inEnd, match))
+            return false;
+        if (offset == 0 || match > static_cast<size_t>(outEnd - op))
+            return false;
+
+        const char *from = op - offset;
+        char *to = op;
+        op += match;
+        if (offset > static_cast<size_t>(to - out))
+        {
+            // Starts in the dictionary, and may run on into the output
+            size_t back = offset - (to - out);
+            if (back > dictionarySize)
+                return false;
+            from = dictionary + dictionarySize - back;
+            size_t head = min(back, match);
+            memcpy(to, from, head);
+            for (to += head, from = out; to < op; ++to, ++from)
+            {
+                *to = *from;
+            }
+        }
+        else if (offset >= 16)
+        {
+            // Most matches are names and phrases of up to 32 bytes
+            memcpy(to, from, 16);
+            memcpy(to + 16, from + 16, 16);
+            for (to += 32, from += 32; to < op; to += 16, from += 16)
+            {
+                memcpy(to, from, 16);
+            }
+        }
+        else
+        {
+            // A short repeating pattern: copying whole periods doubles the
+            // distance until 8-byte copies no longer overlap their source
+            while (static_cast<size_t>(to - from) < 8)
+            {
+                memcpy(to, from, to - from);
+                to += to - from;
+            }
+            for (; to < op; to += 8, from += 8)
+            {
+                memcpy(to, from, 8);
+            }
+        }
+    }
+    return op == outEnd;
+}
@@ -0,0 +1,697 @@
+#include "WitcherTracker.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+ * @brief LsmItemStore implementation - memtable, sorted runs and background merges
+ *
+ * A run is a file of records sorted by key: a varint key length, the key
+ * bytes and a varint quantity. Every LSM_INDEX_INTERVAL-th record starts
+ * a block whose first key and offset stay in memory. A key is the
+ * StoredKind as one byte followed by the name, so the items of one kind
+ * are contiguous and sorted by name.
+ */
+
+/**
+ * @brief Reads bytes at an offset of a run file
+ * @param fd Run file
+ * @param offset First byte to read
+ * @param length Bytes to read
+ * @param out Receives the bytes
+ * @return void
+ */
+static void readAt(int fd, uint64_t offset, size_t length, char *out)
+{
+    while (length > 0)
+    {
+        ssize_t got = pread(fd, out, length, static_cast<off_t>(offset));
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            throw runtime_error("LSM run read failed");
+        out += got;
+        offset += static_cast<uint64_t>(got);
+        length -= static_cast<size_t>(got);
+    }
+}
+
+/**
+ * @class LsmItemStore::KeyMerge
+ * @brief Merges sorted (key, quantity) sources into one sorted sequence
+ *
+ * A key found in several sources is returned once, with the quantity of
+ * the source added first, so sources are added newest first.
+ */
+class LsmItemStore::KeyMerge
+{
+public:
+    typedef function<bool(string &, int &)> Source;     ///< Yields the next record, false at the end
+
+    /**
+     * @brief Adds a source older than every source added before
+     */
+    void add(const Source &source)
+    {
+        sources.push_back(source);
+        keys.emplace_back();
+        values.push_back(0);
+        live.push_back(sources.back()(keys.back(), values.back()));
+    }
+
+    /**
+     * @brief Returns the smallest key not returned yet
+     * @return false once every source is exhausted
+     */
+    bool next(string &key, int &value)
+    {
+        size_t winner = string::npos;
+        for (size_t i = 0; i < sources.size(); ++i)
+        {
+            if (live[i] && (winner == string::npos || keys[i] < keys[winner]))
+                winner = i;
+        }
+        if (winner == string::npos)
+            return false;
+
+        key = keys[winner];
+        value = values[winner];
+        for (size_t i = 0; i < sources.size(); ++i)
+        {
+            if (live[i] && keys[i] == key)
+                live[i] = sources[i](keys[i], values[i]);
+        }
+        return true;
+    }
+
+private:
+    vector<Source> sources;
+    vector<string> keys;        ///< Current key of each source
+    vector<int> values;         ///< Current quantity of each source
+    vector<bool> live;          ///< false once a source is exhausted
+};
+
+/**
+ * @struct LsmItemStore::Run
+ * @brief One immutable sorted run file with its in-memory index and filter
+ */
+struct LsmItemStore::Run
+{
+    int fd;                         ///< Unlinked run file
+    int level;                      ///< 0 for a flushed memtable, +1 per merge
+    uint64_t size;                  ///< Bytes written to the file
+    size_t records;                 ///< Records in the run
+    vector<string> blockKeys;       ///< First key of each block
+    vector<uint64_t> blockOffsets;  ///< File offset of each block
+    BloomFilter filter;             ///< StateDigest keys of the records
+    string pending;                 ///< Bytes not yet written while the run is built
+
+    Run() : fd(-1), level(0), size(0), records(0) {}
+    ~Run()
+    {
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    /**
+     * @brief Appends a record; keys must arrive in increasing order
+     */
+    void append(const string &key, int value)
+    {
+        if (records % LSM_INDEX_INTERVAL == 0)
+        {
+            blockKeys.push_back(key);
+            blockOffsets.push_back(size + pending.size());
+        }
+        writeVarint(pending, key.size());
+        pending += key;
+        writeVarint(pending, static_cast<uint32_t>(value));
+        filter.insert(StateDigest::key(static_cast<StoredKind>(key[0]), hashName(key.data() + 1, key.size() - 1)));
+        ++records;
+
+        if (pending.size() >= LSM_READ_BUFFER)
+            finish();
+    }
+
+    /**
+     * @brief Writes the buffered records to the file
+     */
+    void finish()
+    {
+        const char *data = pending.data();
+        size_t length = pending.size();
+        while (length > 0)
+        {
+            ssize_t written = ::write(fd, data, length);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                throw runtime_error("LSM run write failed");
+            data += written;
+            length -= static_cast<size_t>(written);
+        }
+        size += pending.size();
+        pending.clear();
+    }
+
+    /**
+     * @brief Offset of the block that would hold a key
+     */
+    uint64_t seek(const string &key) const
+    {
+        size_t block = lower_bound(blockKeys.begin(), blockKeys.end(), key) - blockKeys.begin();
+        return block == 0 ? 0 : blockOffsets[block - 1];
+    }
+
+    /**
+     * @brief Looks a key up through the filter and one block read
+     * @param key Record key
+     * @param filterKey StateDigest key of the item
+     * @param value Receives the quantity when found
+     * @param blockReads Incremented when a block is read
+     * @return false if the run has no record for the key
+     */
+    bool find(const string &key, uint64_t filterKey, int &value, uint64_t &blockReads) const
+    {
+        if (!filter.mayContain(filterKey))
+            return false;
+
+        size_t block = upper_bound(blockKeys.begin(), blockKeys.end(), key) - blockKeys.begin();
+        if (block > 0)
+        {
+            --block;
+            uint64_t begin = blockOffsets[block];
+            uint64_t end = block + 1 < blockOffsets.size() ? blockOffsets[block + 1] : size;
+            string bytes(static_cast<size_t>(end - begin), '\0');
+            readAt(fd, begin, bytes.size(), &bytes[0]);
+            ++blockReads;
+
+            const char *cursor = bytes.data();
+            const char *last = cursor + bytes.size();
+            uint64_t length, quantity;
+            while (readVarint(cursor, last, length) && length <= static_cast<uint64_t>(last - cursor))
+            {
+                int order = key.compare(0, string::npos, cursor, static_cast<size_t>(length));
+                cursor += length;
+                if (!readVarint(cursor, last, quantity) || order < 0)
+                    break;
+                if (order == 0)
+                {
+                    value = static_cast<int>(quantity);
+                    return true;
+                }
+            }
+        }
+        filter.recordFalsePositive();
+        return false;
+    }
+};
+
+/**
+ * @class LsmItemStore::RunReader
+ * @brief Sequential reader of a run through a buffer of LSM_READ_BUFFER bytes
+ */
+class LsmItemStore::RunReader
+{
+public:
+    /**
+     * @brief Starts reading a run at a block offset
+     */
+    RunReader(const Run &run, uint64_t start) : run(run), offset(start), position(0) {}
+
+    /**
+     * @brief Reads the next record
+     * @return false at the end of the run
+     */
+    bool next(string &key, int &value)
+    {
+        fill(10);
+        const char *start = buffer.data() + position;
+        const char *cursor = start;
+        uint64_t length;
+        if (!readVarint(cursor, buffer.data() + buffer.size(), length))
+            return false;
+
+        size_t header = static_cast<size_t>(cursor - start);
+        fill(header + static_cast<size_t>(length) + 10);
+        cursor = buffer.data() + position + header;
+        const char *end = buffer.data() + buffer.size();
+        if (length > static_cast<uint64_t>(end - cursor))
+            return false;
+
+        key.assign(cursor, static_cast<size_t>(length));
+        cursor += length;
+        uint64_t quantity;
+        if (!readVarint(cursor, end, quantity))
+            return false;
+        value = static_cast<int>(quantity);
+        position = static_cast<size_t>(cursor - buffer.data());
+        return true;
+    }
+
+private:
+    const Run &run;
+    uint64_t offset;        ///< File offset of the first byte not buffered yet
+    string buffer;          ///< Bytes read but not consumed, from position on
+    size_t position;        ///< First unconsumed byte of buffer
+
+    /**
+     * @brief Buffers at least the given number of bytes, or the rest of the run
+     */
+    void fill(size_t needed)
+    {
+        if (buffer.size() - position >= needed || offset == run.size)
+            return;
+
+        buffer.erase(0, position);
+        position = 0;
+        size_t length = static_cast<size_t>(min<uint64_t>(max(needed, LSM_READ_BUFFER), run.size - offset));
+        size_t kept = buffer.size();
+        buffer.resize(kept + length);
+        readAt(run.fd, offset, length, &buffer[kept]);
+        offset += length;
+    }
+};
+
+/**
+ * @brief Constructs a closed store
+ */
+LsmItemStore::LsmItemStore() : nextRunNumber(0), stopping(false)
+{
+}
+
+/**
+ * @brief Stops the merge thread and releases the run files
+ */
+LsmItemStore::~LsmItemStore()
+{
+    close();
+}
+
+/**
+ * @brief Key of an item: its kind as one byte, then its name
+ */
+string LsmItemStore::makeKey(StoredKind kind, const string &name)
+{
+    string key(1, static_cast<char>(kind));
+    key += name;
+    return key;
+}
+
+/**
+ * @brief Creates an empty run file in the store's directory
+ * @param level Level of the run
+ * @param expected Records the filter is sized for
+ * @return The run; its file is already unlinked
+ */
+unique_ptr<LsmItemStore::Run> LsmItemStore::createRun(int level, size_t expected)
+{
+    string path = directory + "/witchertracker-" + to_string(getpid()) + "-" + to_string(nextRunNumber++) + ".run";
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        throw runtime_error("cannot create LSM run " + path);
+    unlink(path.c_str());
+
+    unique_ptr<Run> run(new Run());
+    run->fd = fd;
+    run->level = level;
+    run->filter.reset(expected);
+    return run;
+}
+
+/**
+ * @brief Starts an empty store keeping its runs in a directory
+ * @param path Existing writable directory
+ * @return false if no run file can be created there
+ * @side_effects Starts the merge thread
+ */
+bool LsmItemStore::open(const string &path)
+{
+    close();
+    directory = path.empty() ? "." : path;
+    try
+    {
+        createRun(0, 0);
+    }
+    catch (const runtime_error &)
+    {
+        directory.clear();
+        return false;
+    }
+
+    stopping = false;
+    merger = thread(&LsmItemStore::mergeLoop, this);
+    return true;
+}
+
+/**
+ * @brief Stops the merge thread and discards every item
+ * @return void
+ */
+void LsmItemStore::close()
+{
+    if (merger.joinable())
+    {
+        {
+            lock_guard<mutex> guard(runsLock);
+            stopping = true;
+        }
+        mergeWake.notify_all();
+        merger.join();
+    }
+
+    runs.clear();
+    memtable.clear();
+    pinnedIndex.clear();
+    pinned.clear();
+    counters = LsmStats();
+    retiredFilters = FilterStats();
+    directory.clear();
+}
+
+/**
+ * @brief Reads an item's quantity
+ * @param kind INGREDIENT, POTION or TROPHY
+ * @param name Item name
+ * @param hash hashName(name)
+ * @return Quantity, 0 if unknown
+ */
+int LsmItemStore::quantity(StoredKind kind, const string &name, NameHash hash) const
+{
+    string key = makeKey(kind, name);
+    auto cell = pinnedIndex.find(key);
+    if (cell != pinnedIndex.end())
+        return pinned[cell->second];
+
+    auto entry = memtable.find(key);
+    if (entry != memtable.end())
+        return entry->second;
+
+    uint64_t filterKey = StateDigest::key(kind, hash);
+    lock_guard<mutex> guard(runsLock);
+    int value;
+    for (size_t i = runs.size(); i-- > 0;)
+    {
+        if (runs[i]->find(key, filterKey, value, counters.blockReads))
+            return value;
+    }
+    return 0;
+}
+
+/**
+ * @brief Sets an item's quantity
+ * @param kind INGREDIENT, POTION or TROPHY
+ * @param name Item name
+ * @param value New quantity; 0 removes the item
+ * @return void
+ */
+void LsmItemStore::setQuantity(StoredKind kind, const string &name, int value)
+{
+    string key = makeKey(kind, name);
+    auto cell = pinnedIndex.find(key);
+    if (cell != pinnedIndex.end())
+    {
+        pinned[cell->second] = value;
+        return;
+    }
+
+    memtable[key] = value;
+    if (memtable.size() >= LSM_MEMTABLE_ITEMS)
+        flush();
+}
+
+/**
+ * @brief Keeps an item in memory for the lifetime of the store
+ * @param kind INGREDIENT, POTION or TROPHY
+ * @param name Item name
+ * @param hash hashName(name)
+ * @return Quantity cell at a fixed address
+ *
+ * The pinned cell hides every older value of the item, so the memtable
+ * entry is dropped and the runs are left as they are.
+ */
+int *LsmItemStore::pin(StoredKind kind, const string &name, NameHash hash)
+{
+    string key = makeKey(kind, name);
+    auto cell = pinnedIndex.find(key);
+    if (cell != pinnedIndex.end())
+        return &pinned[cell->second];
+
+    pinned.push_back(quantity(kind, name, hash));
+    memtable.erase(key);
+    pinnedIndex[key] = pinned.size() - 1;
+    return &pinned.back();
+}
+
+/**
+ * @brief Writes the memtable out as a level 0 run
+ * @return void
+ * @side_effects Wakes the merge thread; waits for it while more than
+ *               LSM_MAX_RUNS runs exist and some of them can be merged
+ */
+void LsmItemStore::flush()
+{
+    vector<pair<string, int>> entries(memtable.begin(), memtable.end());
+    sort(entries.begin(), entries.end());
+    memtable.clear();
+
+    bool oldest;
+    {
+        lock_guard<mutex> guard(runsLock);
+        oldest = runs.empty();
+    }
+
+    // Nothing older can hold a value that a tombstone would need to hide
+    unique_ptr<Run> run = createRun(0, entries.size());
+    for (const auto &entry : entries)
+    {
+        if (entry.second != 0 || !oldest)
+            run->append(entry.first, entry.second);
+    }
+    run->finish();
+    if (run->records == 0)
+        return;
+
+    unique_lock<mutex> guard(runsLock);
+    counters.flushes++;
+    counters.bytesWritten += run->size;
+    runs.push_back(move(run));
+    mergeWake.notify_one();
+
+    size_t first;
+    mergeDone.wait(guard, [this, &first] { return runs.size() <= LSM_MAX_RUNS || stopping || !findMerge(first); });
+}
+
+/**
+ * @brief Finds the oldest LSM_MERGE_RUNS consecutive runs of one level
+ * @param first Receives the index of the first of them
+ * @return false if no level holds enough runs
+ */
+bool LsmItemStore::findMerge(size_t &first) const
+{
+    size_t sameLevel = 0;
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        sameLevel = (i > 0 && runs[i]->level == runs[i - 1]->level) ? sameLevel + 1 : 1;
+        if (sameLevel == LSM_MERGE_RUNS)
+        {
+            first = i + 1 - LSM_MERGE_RUNS;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Body of the merge thread
+ * @return void
+ *
+ * The runs being merged are read without holding runsLock: the foreground
+ * only appends runs, so their positions stay the same until the merged
+ * run replaces them. A failed write stops merging; lookups and listings
+ * keep working on the runs as they are.
+ */
+void LsmItemStore::mergeLoop()
+{
+    unique_lock<mutex> guard(runsLock);
+    while (!stopping)
+    {
+        size_t first;
+        if (!findMerge(first))
+        {
+            mergeWake.wait(guard);
+            continue;
+        }
+
+        vector<Run *> inputs;
+        for (size_t i = 0; i < LSM_MERGE_RUNS; ++i)
+        {
+            inputs.push_back(runs[first + i].get());
+        }
+        int level = inputs[0]->level + 1;
+        guard.unlock();
+
+        unique_ptr<Run> merged;
+        try
+        {
+            merged = mergeRuns(inputs, level, first == 0);
+        }
+        catch (const runtime_error &)
+        {
+            guard.lock();
+            break;
+        }
+
+        guard.lock();
+        vector<unique_ptr<Run>> retired;
+        for (size_t i = 0; i < LSM_MERGE_RUNS; ++i)
+        {
+            retiredFilters += runs[first + i]->filter.stats();
+            retired.push_back(move(runs[first + i]));
+        }
+        runs.erase(runs.begin() + first, runs.begin() + first + LSM_MERGE_RUNS);
+        counters.merges++;
+        counters.bytesWritten += merged->size;
+        if (merged->records > 0)
+            runs.insert(runs.begin() + first, move(merged));
+        mergeDone.notify_all();
+
+        // Close the replaced files outside the lock
+        guard.unlock();
+        retired.clear();
+        guard.lock();
+    }
+    stopping = true;
+    mergeDone.notify_all();
+}
+
+/**
+ * @brief Merges runs into one new run
+ * @param inputs Consecutive runs, oldest first
+ * @param level Level of the new run
+ * @param dropTombstones true if no older run exists, so zero quantities can go
+ * @return The new run, fully written
+ */
+unique_ptr<LsmItemStore::Run> LsmItemStore::mergeRuns(const vector<Run *> &inputs, int level, bool dropTombstones)
+{
+    size_t expected = 0;
+    for (const Run *input : inputs)
+    {
+        expected += input->records;
+    }
+    unique_ptr<Run> output = createRun(level, expected);
+
+    KeyMerge merge;
+    vector<unique_ptr<RunReader>> readers;
+    for (size_t i = inputs.size(); i-- > 0;)
+    {
+        readers.emplace_back(new RunReader(*inputs[i], 0));
+        RunReader *reader = readers.back().get();
+        merge.add([reader](string &key, int &value) { return reader->next(key, value); });
+    }
+
+    string key;
+    int value;
+    while (merge.next(key, value))
+    {
+        if (value != 0 || !dropTombstones)
+            output->append(key, value);
+    }
+    output->finish();
+    return output;
+}
+
+/**
+ * @brief Appends every item of a kind with a positive quantity, sorted by name
+ * @param kind INGREDIENT, POTION or TROPHY
+ * @param items Receives (name, quantity) pairs
+ * @return void
+ *
+ * Only the memtable and pinned items of the kind are copied; the runs are
+ * streamed from the block holding the kind's first key.
+ */
+void LsmItemStore::collect(StoredKind kind, vector<pair<string, int>> &items) const
+{
+    string prefix(1, static_cast<char>(kind));
+    vector<pair<string, int>> recent;
+    for (const auto &entry : memtable)
+    {
+        if (entry.first[0] == prefix[0])
+            recent.push_back(entry);
+    }
+    for (const auto &entry : pinnedIndex)
+    {
+        if (entry.first[0] == prefix[0])
+            recent.emplace_back(entry.first, pinned[entry.second]);
+    }
+    sort(recent.begin(), recent.end());
+
+    lock_guard<mutex> guard(runsLock);
+    KeyMerge merge;
+    size_t next = 0;
+    merge.add([&recent, &next](string &key, int &value) {
+        if (next == recent.size())
+            return false;
+        key = recent[next].first;
+        value = recent[next].second;
+        ++next;
+        return true;
+    });
+
+    vector<unique_ptr<RunReader>> readers;
+    for (size_t i = runs.size(); i-- > 0;)
+    {
+        readers.emplace_back(new RunReader(*runs[i], runs[i]->seek(prefix)));
+        RunReader *reader = readers.back().get();
+        merge.add([reader, &prefix](string &key, int &value) {
+            while (reader->next(key, value))
+            {
+                if (key < prefix)
+                    continue;
+                return key[0] == prefix[0];
+            }
+            return false;
+        });
+    }
+
+    string key;
+    int value;
+    while (merge.next(key, value))
+    {
+        if (value > 0)
+            items.emplace_back(key.substr(1), value);
+    }
+}
+
+/**
+ * @brief Waits until no level holds enough runs to merge
+ * @return void
+ */
+void LsmItemStore::waitForMerges()
+{
+    unique_lock<mutex> guard(runsLock);
+    size_t first;
+    mergeDone.wait(guard, [this, &first] { return stopping || !findMerge(first); });
+}
+
+/**
+ * @brief Snapshot of the counters and of the runs on disk
+ * @return Counters, with the filters of live and merged runs combined
+ */
+LsmStats LsmItemStore::stats() const
+{
+    lock_guard<mutex> guard(runsLock);
+    LsmStats result = counters;
+    result.filter = retiredFilters;
+    for (const auto &run : runs)
+    {
+        result.runs++;
+        result.runBytes += run->size;
+        result.filter += run->filter.stats();
+    }
+    return result;
+}
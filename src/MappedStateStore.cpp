@@ -0,0 +1,658 @@
+#include "WitcherTracker.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+ * @brief MappedStateStore implementation - offset-based state in a mapped file
+ *
+ * File layout: a fixed header (with the undo log), then records, links and
+ * index arrays allocated by bumping header.used. Records are found through
+ * an open-addressing index of record offsets. Space released by replacing
+ * links or growing the index is not reused.
+ */
+
+static const uint64_t STATE_MAGIC = 0x3145544154535457ULL;   // "WTSTATE1"
+static const uint64_t STATE_VERSION = 1;
+static const uint64_t INITIAL_INDEX_CAPACITY = 1024;
+static const uint64_t FILE_GROWTH = 1ULL << 20;
+static const uint64_t UNDO_CHUNK_RESERVE = 64;    // Undo entries one item operation may need
+
+/**
+ * @struct MappedStateStore::Header
+ * @brief First bytes of the file
+ */
+struct MappedStateStore::Header
+{
+    uint64_t magic;             ///< STATE_MAGIC once the file is initialized
+    uint64_t version;           ///< Layout version
+    uint64_t used;              ///< Bytes allocated from the start of the file
+    uint64_t indexOffset;       ///< Record index (array of record offsets)
+    uint64_t indexCapacity;     ///< Index slots (power of two)
+    uint64_t recordCount;       ///< Records in the index
+    uint64_t undoCount;         ///< Valid undo entries; non-zero only mid-update
+    uint64_t reserved;
+
+    /**
+     * @brief Old value of one 8-byte word changed by the current update
+     */
+    struct UndoEntry
+    {
+        uint64_t offset;
+        uint64_t value;
+    } undo[STATE_UNDO_CAPACITY];
+};
+
+/**
+ * @struct MappedStateStore::Record
+ * @brief One inventory item, beast, recipe or sign; the name follows it
+ */
+struct MappedStateStore::Record
+{
+    uint64_t hash;          ///< Name hash mixed with the kind
+    uint64_t links;         ///< Offset of the newest link, 0 if none
+    int32_t quantity;       ///< Inventory quantity
+    uint32_t kind;          ///< StoredKind
+    uint32_t nameLength;    ///< Bytes of name
+    uint32_t linkCount;     ///< Links in the chain
+
+    const char *name() const { return reinterpret_cast<const char *>(this + 1); }
+};
+
+/**
+ * @struct MappedStateStore::Link
+ * @brief One counter or ingredient of a record; the name follows it
+ */
+struct MappedStateStore::Link
+{
+    uint64_t next;          ///< Offset of the previous (older) link, 0 at the end
+    uint64_t hash;          ///< hashName of the target
+    int32_t value;          ///< Payload (sign flag or quantity)
+    uint32_t nameLength;    ///< Bytes of name
+
+    const char *name() const { return reinterpret_cast<const char *>(this + 1); }
+};
+
+static const uint64_t HEADER_BYTES = 8 * sizeof(uint64_t) + 2 * sizeof(uint64_t) * STATE_UNDO_CAPACITY;
+static const uint64_t DATA_START = (HEADER_BYTES + 4095) & ~4095ULL;
+
+/**
+ * @brief Mixes the record kind into a name hash so kinds do not collide
+ */
+static uint64_t keyHash(StoredKind kind, NameHash hash)
+{
+    return hash ^ ((static_cast<uint64_t>(kind) + 1) * 0x9E3779B97F4A7C15ULL);
+}
+
+/**
+ * @brief Maps a state file, creating it if it does not exist
+ * @param path File to map
+ * @param durableUpdates true to msync at every step of the update protocol
+ * @return false if the file cannot be created, mapped, or is not a state file
+ * @side_effects Rolls back an update interrupted by a crash
+ */
+bool MappedStateStore::open(const string &path, bool durableUpdates)
+{
+    static_assert(sizeof(Header) == HEADER_BYTES, "state file header layout changed");
+    static_assert(sizeof(Record) == 32 && sizeof(Link) == 24, "state file record layout changed");
+
+    close();
+    durable = durableUpdates;
+
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        close();
+        return false;
+    }
+
+    fileSize = static_cast<uint64_t>(info.st_size);
+    bool fresh = (fileSize == 0);
+    if (fresh)
+    {
+        fileSize = DATA_START + FILE_GROWTH;
+        if (ftruncate(fd, static_cast<off_t>(fileSize)) != 0)
+        {
+            close();
+            return false;
+        }
+    }
+    else if (fileSize < DATA_START)
+    {
+        close();
+        return false;
+    }
+
+    void *mapping = mmap(nullptr, STATE_FILE_RESERVE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+        close();
+        return false;
+    }
+    base = static_cast<char *>(mapping);
+
+    Header *state = header();
+    if (fresh || (state->magic == 0 && state->version == 0))
+    {
+        // The magic number is written last, so a torn creation is redone
+        state->version = STATE_VERSION;
+        state->indexOffset = DATA_START;
+        state->indexCapacity = INITIAL_INDEX_CAPACITY;
+        state->used = DATA_START + INITIAL_INDEX_CAPACITY * sizeof(uint64_t);
+        state->recordCount = 0;
+        state->undoCount = 0;
+        memset(base + DATA_START, 0, INITIAL_INDEX_CAPACITY * sizeof(uint64_t));
+        msync(base, state->used, MS_SYNC);
+        state->magic = STATE_MAGIC;
+        msync(base, sizeof(uint64_t), MS_SYNC);
+    }
+    else if (state->magic != STATE_MAGIC || state->version != STATE_VERSION)
+    {
+        close();
+        return false;
+    }
+
+    recover();
+    return true;
+}
+
+/**
+ * @brief Unmaps the file
+ * @return void
+ */
+void MappedStateStore::close()
+{
+    if (base)
+    {
+        munmap(base, STATE_FILE_RESERVE);
+        base = nullptr;
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+    updateDepth = 0;
+    headerLogged = 0;
+}
+
+/**
+ * @brief Restores the words saved by an interrupted update
+ * @return void
+ */
+void MappedStateStore::recover()
+{
+    Header *state = header();
+    for (uint64_t i = state->undoCount; i > 0; --i)
+    {
+        const Header::UndoEntry &entry = state->undo[i - 1];
+        *reinterpret_cast<uint64_t *>(base + entry.offset) = entry.value;
+    }
+
+    if (state->undoCount > 0)
+    {
+        msync(base, state->used, MS_SYNC);
+        state->undoCount = 0;
+        msync(base, sizeof(Header), MS_SYNC);
+    }
+}
+
+/**
+ * @brief Flushes a byte range to the file in durable mode
+ * @param address First byte
+ * @param length Bytes to flush
+ * @return void
+ */
+void MappedStateStore::flush(const void *address, size_t length) const
+{
+    if (!durable)
+        return;
+
+    uintptr_t start = reinterpret_cast<uintptr_t>(address) & ~static_cast<uintptr_t>(4095);
+    uintptr_t end = reinterpret_cast<uintptr_t>(address) + length;
+    msync(reinterpret_cast<void *>(start), end - start, MS_SYNC);
+}
+
+/**
+ * @brief Starts an update; nested calls join the outer update
+ * @return void
+ */
+void MappedStateStore::beginUpdate()
+{
+    if (updateDepth++ == 0)
+    {
+        headerLogged = 0;
+        updateStart = header()->used;
+    }
+}
+
+/**
+ * @brief Makes everything written so far durable and empties the undo log
+ * @return void
+ * @side_effects In durable mode the data is flushed before the log is cleared
+ */
+void MappedStateStore::checkpoint()
+{
+    Header *state = header();
+    if (state->undoCount > 0)
+    {
+        flush(base, state->used);
+        state->undoCount = 0;
+        flush(&state->undoCount, sizeof(uint64_t));
+    }
+    headerLogged = 0;
+    updateStart = state->used;
+}
+
+/**
+ * @brief Commits the outermost update
+ * @return void
+ * 
+ * An item operation finishing inside a larger update commits what the
+ * update has done so far once the undo log is nearly full, so a command
+ * touching any number of names never overflows it. A crash can then
+ * leave a prefix of that command's operations applied.
+ */
+void MappedStateStore::commitUpdate()
+{
+    if (--updateDepth > 0)
+    {
+        if (updateDepth == 1 && header()->undoCount + UNDO_CHUNK_RESERVE > static_cast<uint64_t>(STATE_UNDO_CAPACITY))
+            checkpoint();
+        return;
+    }
+
+    checkpoint();
+}
+
+/**
+ * @brief Saves the 8-byte word containing an address in the undo log
+ * @param address Byte of committed state about to change
+ * @return void
+ * 
+ * Words at or past the end of the state committed before this update are
+ * not logged: rolling back the allocation pointer discards them.
+ */
+void MappedStateStore::logWord(const void *address)
+{
+    Header *state = header();
+    uint64_t offset = (reinterpret_cast<uintptr_t>(address) - reinterpret_cast<uintptr_t>(base)) & ~7ULL;
+
+    if (offset >= updateStart)
+        return;
+    if (state->undoCount > 0 && state->undo[state->undoCount - 1].offset == offset)
+        return;
+    if (state->undoCount >= static_cast<uint64_t>(STATE_UNDO_CAPACITY))
+        throw runtime_error("state file update exceeds the undo log");
+
+    Header::UndoEntry &entry = state->undo[state->undoCount];
+    entry.offset = offset;
+    entry.value = *reinterpret_cast<const uint64_t *>(base + offset);
+    flush(&entry, sizeof(entry));
+
+    // The entry must be in place before it is counted
+    state->undoCount++;
+    flush(&state->undoCount, sizeof(uint64_t));
+}
+
+/**
+ * @brief Saves a header word in the undo log once per update
+ * @param word Field of the header
+ * @return void
+ */
+void MappedStateStore::logHeaderWord(uint64_t *word)
+{
+    unsigned bit = 1u << (word - reinterpret_cast<uint64_t *>(base));
+    if (headerLogged & bit)
+        return;
+
+    logWord(word);
+    headerLogged |= bit;
+}
+
+/**
+ * @brief Logs and writes one 8-byte word
+ * @param address Word to change
+ * @param value New value
+ * @return void
+ */
+void MappedStateStore::writeWord(uint64_t *address, uint64_t value)
+{
+    logWord(address);
+    *address = value;
+}
+
+/**
+ * @brief Allocates zero or more bytes at the end of the used area
+ * @param bytes Size (rounded up to 8)
+ * @return Offset of the allocation
+ * @side_effects Grows the file when needed; throws runtime_error if the
+ *               reservation is exhausted or the file cannot grow
+ */
+uint64_t MappedStateStore::allocate(uint64_t bytes)
+{
+    Header *state = header();
+    bytes = (bytes + 7) & ~7ULL;
+
+    uint64_t needed = state->used + bytes;
+    if (needed > fileSize)
+    {
+        uint64_t newSize = max(fileSize * 2, (needed + FILE_GROWTH - 1) & ~(FILE_GROWTH - 1));
+        if (newSize > STATE_FILE_RESERVE || ftruncate(fd, static_cast<off_t>(newSize)) != 0)
+            throw runtime_error("state file cannot grow");
+        fileSize = newSize;
+    }
+
+    // Space past the committed end is invisible until linked, so only the
+    // allocation pointer itself needs to be logged
+    logHeaderWord(&state->used);
+
+    uint64_t offset = state->used;
+    state->used = needed;
+    return offset;
+}
+
+/**
+ * @brief Doubles the record index into freshly allocated space
+ * @return void
+ */
+void MappedStateStore::growIndex()
+{
+    Header *state = header();
+    uint64_t capacity = state->indexCapacity * 2;
+    uint64_t offset = allocate(capacity * sizeof(uint64_t));
+
+    uint64_t *bigger = reinterpret_cast<uint64_t *>(base + offset);
+    memset(bigger, 0, capacity * sizeof(uint64_t));
+
+    const uint64_t *index = reinterpret_cast<const uint64_t *>(base + state->indexOffset);
+    for (uint64_t i = 0; i < state->indexCapacity; ++i)
+    {
+        if (index[i] == 0)
+            continue;
+
+        uint64_t pos = record(index[i])->hash & (capacity - 1);
+        while (bigger[pos] != 0)
+            pos = (pos + 1) & (capacity - 1);
+        bigger[pos] = index[i];
+    }
+
+    logHeaderWord(&state->indexOffset);
+    logHeaderWord(&state->indexCapacity);
+    state->indexOffset = offset;
+    state->indexCapacity = capacity;
+}
+
+/**
+ * @brief Finds a record
+ * @return Record offset, or 0 if absent
+ */
+uint64_t MappedStateStore::findRecord(StoredKind kind, const string &name, NameHash hash) const
+{
+    const Header *state = header();
+    const uint64_t *index = reinterpret_cast<const uint64_t *>(base + state->indexOffset);
+    uint64_t mask = state->indexCapacity - 1;
+    uint64_t key = keyHash(kind, hash);
+
+    for (uint64_t pos = key & mask;; pos = (pos + 1) & mask)
+    {
+        if (index[pos] == 0)
+            return 0;
+
+        const Record *candidate = record(index[pos]);
+        if (candidate->hash == key && candidate->kind == static_cast<uint32_t>(kind) &&
+            candidate->nameLength == name.size() && memcmp(candidate->name(), name.data(), name.size()) == 0)
+        {
+            return index[pos];
+        }
+    }
+}
+
+/**
+ * @brief Finds a record, creating an empty one if absent
+ * @return Record offset
+ */
+uint64_t MappedStateStore::findOrCreateRecord(StoredKind kind, const string &name, NameHash hash)
+{
+    uint64_t found = findRecord(kind, name, hash);
+    if (found)
+        return found;
+
+    Header *state = header();
+    if ((state->recordCount + 1) * 2 > state->indexCapacity)
+        growIndex();
+
+    uint64_t offset = allocate(sizeof(Record) + name.size());
+    Record *created = record(offset);
+    created->hash = keyHash(kind, hash);
+    created->links = 0;
+    created->quantity = 0;
+    created->kind = static_cast<uint32_t>(kind);
+    created->nameLength = static_cast<uint32_t>(name.size());
+    created->linkCount = 0;
+    memcpy(base + offset + sizeof(Record), name.data(), name.size());
+
+    uint64_t *index = reinterpret_cast<uint64_t *>(base + state->indexOffset);
+    uint64_t mask = state->indexCapacity - 1;
+    uint64_t pos = created->hash & mask;
+    while (index[pos] != 0)
+        pos = (pos + 1) & mask;
+
+    writeWord(&index[pos], offset);
+    logHeaderWord(&state->recordCount);
+    state->recordCount++;
+
+    if (kind == StoredKind::BEAST)
+        CommandExplain::countInsert(ExplainSubsystem::BESTIARY);
+    else if (kind == StoredKind::RECIPE || kind == StoredKind::SIGN)
+        CommandExplain::countInsert(ExplainSubsystem::ALCHEMY);
+    else
+        CommandExplain::countInsert(ExplainSubsystem::INVENTORY);
+    return offset;
+}
+
+/**
+ * @brief Returns the quantity cell of an inventory record
+ * @param kind INGREDIENT, POTION or TROPHY
+ * @param name Item name
+ * @param hash hashName(name)
+ * @return Cell inside the mapping
+ */
+int *MappedStateStore::quantityCell(StoredKind kind, const string &name, NameHash hash)
+{
+    beginUpdate();
+    Record *item = record(findOrCreateRecord(kind, name, hash));
+    commitUpdate();
+    return &item->quantity;
+}
+
+/**
+ * @brief Writes a quantity cell through the undo log
+ * @param cell Cell from quantityCell()
+ * @param value New quantity
+ * @return void
+ */
+void MappedStateStore::setQuantity(int *cell, int value)
+{
+    beginUpdate();
+    logWord(cell);
+    *cell = value;
+    commitUpdate();
+}
+
+/**
+ * @brief Reads an inventory quantity
+ * @return Quantity, 0 if the record does not exist
+ */
+int MappedStateStore::quantity(StoredKind kind, const string &name, NameHash hash) const
+{
+    uint64_t found = findRecord(kind, name, hash);
+    return found ? record(found)->quantity : 0;
+}
+
+/**
+ * @brief Checks whether a record exists
+ */
+bool MappedStateStore::contains(StoredKind kind, const string &name, NameHash hash) const
+{
+    return findRecord(kind, name, hash) != 0;
+}
+
+/**
+ * @brief Creates a record without links if absent
+ * @return void
+ */
+void MappedStateStore::addName(StoredKind kind, const string &name, NameHash hash)
+{
+    beginUpdate();
+    findOrCreateRecord(kind, name, hash);
+    commitUpdate();
+}
+
+/**
+ * @brief Adds a link to a record unless an equal link exists
+ * @return true if the link was added
+ */
+bool MappedStateStore::addLink(StoredKind kind, const string &name, NameHash hash, const string &linkName,
+                               NameHash linkHash, int value)
+{
+    beginUpdate();
+    uint64_t offset = findOrCreateRecord(kind, name, hash);
+
+    for (uint64_t next = record(offset)->links; next != 0; next = link(next)->next)
+    {
+        const Link *existing = link(next);
+        if (existing->hash == linkHash && existing->value == value && existing->nameLength == linkName.size() &&
+            memcmp(existing->name(), linkName.data(), linkName.size()) == 0)
+        {
+            commitUpdate();
+            return false;
+        }
+    }
+
+    uint64_t linkOffset = allocate(sizeof(Link) + linkName.size());
+    Link *added = link(linkOffset);
+    Record *owner = record(offset);
+    added->next = owner->links;
+    added->hash = linkHash;
+    added->value = value;
+    added->nameLength = static_cast<uint32_t>(linkName.size());
+    memcpy(base + linkOffset + sizeof(Link), linkName.data(), linkName.size());
+
+    writeWord(&owner->links, linkOffset);
+    logWord(&owner->linkCount);
+    owner->linkCount++;
+    commitUpdate();
+    return true;
+}
+
+/**
+ * @brief Replaces all links of a record
+ * @return void
+ */
+void MappedStateStore::setLinks(StoredKind kind, const string &name, NameHash hash, const vector<string> &linkNames,
+                                const vector<NameHash> &linkHashes, const vector<int> &values)
+{
+    beginUpdate();
+    uint64_t offset = findOrCreateRecord(kind, name, hash);
+
+    // Build the new chain off to the side, then switch to it
+    uint64_t head = 0;
+    for (size_t i = 0; i < linkNames.size(); ++i)
+    {
+        uint64_t linkOffset = allocate(sizeof(Link) + linkNames[i].size());
+        Link *added = link(linkOffset);
+        added->next = head;
+        added->hash = linkHashes[i];
+        added->value = values[i];
+        added->nameLength = static_cast<uint32_t>(linkNames[i].size());
+        memcpy(base + linkOffset + sizeof(Link), linkNames[i].data(), linkNames[i].size());
+        head = linkOffset;
+    }
+
+    Record *owner = record(offset);
+    writeWord(&owner->links, head);
+    logWord(&owner->linkCount);
+    owner->linkCount = static_cast<uint32_t>(linkNames.size());
+    commitUpdate();
+}
+
+/**
+ * @brief Reads the links of a record in the order they were added
+ * @return false if the record does not exist
+ */
+bool MappedStateStore::getLinks(StoredKind kind, const string &name, NameHash hash, vector<string> &linkNames,
+                                vector<NameHash> &linkHashes, vector<int> &values) const
+{
+    uint64_t offset = findRecord(kind, name, hash);
+    if (!offset)
+        return false;
+
+    linkNames.clear();
+    linkHashes.clear();
+    values.clear();
+    for (uint64_t next = record(offset)->links; next != 0; next = link(next)->next)
+    {
+        const Link *current = link(next);
+        linkNames.emplace_back(current->name(), current->nameLength);
+        linkHashes.push_back(current->hash);
+        values.push_back(current->value);
+    }
+
+    // Chains run newest first
+    reverse(linkNames.begin(), linkNames.end());
+    reverse(linkHashes.begin(), linkHashes.end());
+    reverse(values.begin(), values.end());
+    return true;
+}
+
+/**
+ * @brief Appends every record of a kind with a positive quantity
+ * @param kind Record kind
+ * @param items Receives (name, quantity) pairs in index order
+ * @return void
+ */
+void MappedStateStore::collect(StoredKind kind, vector<pair<string, int>> &items) const
+{
+    const Header *state = header();
+    const uint64_t *index = reinterpret_cast<const uint64_t *>(base + state->indexOffset);
+    for (uint64_t i = 0; i < state->indexCapacity; ++i)
+    {
+        if (index[i] == 0)
+            continue;
+
+        const Record *item = record(index[i]);
+        if (item->kind == static_cast<uint32_t>(kind) && item->quantity > 0)
+            items.emplace_back(string(item->name(), item->nameLength), item->quantity);
+    }
+}
+
+/**
+ * @brief Appends the name of every record of a kind
+ * @param kind Record kind
+ * @param names Receives the names in index order
+ * @return void
+ */
+void MappedStateStore::collectNames(StoredKind kind, vector<string> &names) const
+{
+    const Header *state = header();
+    const uint64_t *index = reinterpret_cast<const uint64_t *>(base + state->indexOffset);
+    for (uint64_t i = 0; i < state->indexCapacity; ++i)
+    {
+        if (index[i] == 0)
+            continue;
+
+        const Record *item = record(index[i]);
+        if (item->kind == static_cast<uint32_t>(kind))
+            names.emplace_back(item->name(), item->nameLength);
+    }
+}
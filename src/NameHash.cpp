@@ -0,0 +1,56 @@
+#include <cstring>
+#include "WitcherTracker.h"
+
+using namespace std;
+
+/**
+ * @brief Name hashing implementation - fast 64-bit hash for short names
+ * 
+ * Reads the name eight bytes at a time and folds each word in with a
+ * 64x64->128-bit multiply, whose high and low halves are xor-ed together.
+ * This gives full avalanche on the short ASCII names used for items,
+ * beasts and signs at a cost of a few cycles per word.
+ */
+
+static const uint64_t HASH_SEED = 0xa0761d6478bd642fULL;
+static const uint64_t HASH_MULTIPLIER = 0xe7037ed1a0b428dbULL;
+static const uint64_t HASH_FINALIZER = 0x8ebc6af09c88c6e3ULL;
+
+/**
+ * @brief Multiplies two words and folds the 128-bit product to 64 bits
+ * @param a First operand
+ * @param b Second operand
+ * @return Low half xor high half of a * b
+ */
+static inline uint64_t foldMultiply(uint64_t a, uint64_t b)
+{
+    unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+    return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+}
+
+/**
+ * @brief Computes the 64-bit hash of a name
+ * @param data First character of the name
+ * @param length Number of characters
+ * @return Hash value; equal names always hash equally
+ */
+NameHash hashName(const char *data, size_t length)
+{
+    uint64_t h = HASH_SEED ^ (length * HASH_MULTIPLIER);
+    size_t i = 0;
+
+    // Whole eight-byte words
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = foldMultiply(h ^ word, HASH_MULTIPLIER);
+    }
+
+    // Remaining zero to seven bytes
+    uint64_t tail = 0;
+    memcpy(&tail, data + i, length - i);
+    h = foldMultiply(h ^ tail ^ HASH_FINALIZER, HASH_MULTIPLIER);
+
+    return foldMultiply(h, HASH_FINALIZER);
+}
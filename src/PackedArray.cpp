@@ -0,0 +1,24 @@
+#include "WitcherTracker.h"
+
+using namespace std;
+
+/**
+ * @brief PackedArray implementation - fixed-width bit packing
+ */
+
+/**
+ * @brief Replaces the contents with zeros, wide enough for the values set() will store
+ * @param size Number of values
+ * @param largest Bitwise OR of every value to be stored
+ * @return void
+ * @side_effects Width becomes the bit length of largest
+ */
+void PackedArray::reset(size_t size, uint64_t largest)
+{
+    width = 0;
+    while (width < 64 && (largest >> width) != 0)
+        width++;
+
+    count = size;
+    vector<uint64_t>((count * width + 63) / 64, 0).swap(words);
+}
@@ -0,0 +1,343 @@
+#include "WitcherTracker.h"
+
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+ * @brief PollingServer implementation - pinned busy-polling TCP workers
+ *
+ * Nothing on the request path sleeps or blocks: accept and recv are
+ * non-blocking and a worker that finds no work spins with a pause
+ * instruction. Per-connection buffers are reserved when the connection is
+ * accepted, and the worker's stack is touched before the loop starts, so
+ * with mlockall in effect requests do not take page faults (allocations
+ * made by the tracker itself as its state grows are the exception).
+ */
+
+/**
+ * @brief Touches a stack region so its pages are resident before the hot loop
+ * @return void
+ */
+static void prefaultStack()
+{
+    volatile char region[SERVER_PREFAULT_STACK];
+    for (size_t i = 0; i < sizeof(region); i += 4096)
+    {
+        region[i] = 0;
+    }
+}
+
+/**
+ * @brief Opens a non-blocking SO_REUSEPORT listening socket
+ * @param port TCP port
+ * @param error Receives a description on failure
+ * @return Socket descriptor, -1 on failure
+ */
+static int openListener(int port, string &error)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+    {
+        error = string("socket: ") + strerror(errno);
+        return -1;
+    }
+
+    int enable = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) != 0)
+    {
+        error = string("SO_REUSEPORT: ") + strerror(errno);
+        ::close(fd);
+        return -1;
+    }
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0)
+    {
+        error = "port " + to_string(port) + ": " + strerror(errno);
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Constructs a stopped server
+ * @param tracker Tracker executing the requests
+ * @param options Server configuration
+ */
+PollingServer::PollingServer(WitcherTracker &tracker, const ServerOptions &options)
+    : tracker(tracker), options(options), stopping(false), nextSession(1), memoryLocked(false)
+{
+}
+
+/**
+ * @brief Stops the workers if still running
+ */
+PollingServer::~PollingServer()
+{
+    stop();
+}
+
+/**
+ * @brief Locks memory, opens the listening sockets and starts the workers
+ * @param error Receives a description when starting fails
+ * @return false if a socket could not be set up
+ * @side_effects With options.lockMemory, locks all current and future pages
+ *               of the process; failure to lock (e.g. RLIMIT_MEMLOCK) is not
+ *               fatal and is reported by isMemoryLocked()
+ */
+bool PollingServer::start(string &error)
+{
+    if (options.workers < 1 || (options.workers > 1 && !tracker.isConcurrent()))
+    {
+        error = "several workers need a concurrent tracker";
+        return false;
+    }
+
+    if (options.lockMemory)
+    {
+        memoryLocked = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+    }
+
+    int cores = max(1, static_cast<int>(thread::hardware_concurrency()));
+    for (int i = 0; i < options.workers; ++i)
+    {
+        unique_ptr<Worker> worker(new Worker());
+        worker->listenFd = openListener(options.port, error);
+        if (worker->listenFd < 0)
+        {
+            stop();
+            return false;
+        }
+        worker->cpu = options.cpus.empty() ? i % cores : options.cpus[i % options.cpus.size()];
+        worker->pinned = false;
+        worker->served.store(0);
+        worker->connections.reserve(SERVER_MAX_CONNECTIONS);
+        workers.push_back(move(worker));
+    }
+
+    stopping.store(false);
+    for (auto &worker : workers)
+    {
+        Worker *owned = worker.get();
+        worker->runner = thread([this, owned]() { runWorker(*owned); });
+    }
+    return true;
+}
+
+/**
+ * @brief Stops and joins the workers and closes every socket
+ * @return void
+ */
+void PollingServer::stop()
+{
+    stopping.store(true);
+    for (auto &worker : workers)
+    {
+        if (worker->runner.joinable())
+            worker->runner.join();
+
+        for (auto &connection : worker->connections)
+        {
+            ::close(connection.fd);
+        }
+        worker->connections.clear();
+        if (worker->listenFd >= 0)
+        {
+            ::close(worker->listenFd);
+            worker->listenFd = -1;
+        }
+    }
+}
+
+/**
+ * @brief Polling loop of one worker
+ * @param worker The worker whose sockets are served
+ * @return void
+ *
+ * Pins the thread, faults in its stack and buffers, then alternates
+ * between accepting and servicing connections until stop() is called.
+ */
+void PollingServer::runWorker(Worker &worker)
+{
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(worker.cpu, &cpus);
+    worker.pinned = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+
+    prefaultStack();
+    vector<char> buffer(SERVER_RECEIVE_BYTES, 0);
+    ostringstream response;
+
+    while (!stopping.load(memory_order_relaxed))
+    {
+        bool active = false;
+
+        // Accept everything that is waiting
+        if (worker.connections.size() < static_cast<size_t>(SERVER_MAX_CONNECTIONS))
+        {
+            int fd = accept4(worker.listenFd, nullptr, nullptr, SOCK_NONBLOCK);
+            if (fd >= 0)
+            {
+                int enable = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+                worker.connections.push_back(
+                    Connection{fd, string(), string(), nextSession.fetch_add(1, memory_order_relaxed)});
+                worker.connections.back().input.reserve(SERVER_RECEIVE_BYTES);
+                worker.connections.back().output.reserve(SERVER_RECEIVE_BYTES);
+                active = true;
+            }
+        }
+
+        for (size_t i = 0; i < worker.connections.size();)
+        {
+            if (serviceConnection(worker, worker.connections[i], buffer.data(), response, active))
+            {
+                ++i;
+                continue;
+            }
+
+            // Closed: move the last connection into this position
+            ::close(worker.connections[i].fd);
+            swap(worker.connections[i], worker.connections.back());
+            worker.connections.pop_back();
+        }
+
+        if (!active)
+            cpuRelax();
+    }
+}
+
+/**
+ * @brief Reads, executes and answers what one connection has sent
+ * @param worker Worker owning the connection
+ * @param connection Connection to service
+ * @param buffer SERVER_RECEIVE_BYTES of scratch space
+ * @param response Reusable stream for command output
+ * @param active Set to true if any bytes moved
+ * @return false if the connection was closed by the peer, failed, sent
+ *         "Exit" or an over-long line
+ */
+bool PollingServer::serviceConnection(Worker &worker, Connection &connection, char *buffer, ostringstream &response,
+                                      bool &active)
+{
+    ssize_t received = recv(connection.fd, buffer, SERVER_RECEIVE_BYTES, MSG_DONTWAIT);
+    if (received == 0)
+        return false;
+    if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        return false;
+
+    bool keepOpen = true;
+    size_t requests = 0;
+    uint64_t receivedAt = 0;
+    if (received > 0)
+    {
+        active = true;
+        receivedAt = nowNanos();
+        connection.input.append(buffer, static_cast<size_t>(received));
+
+        size_t start = 0;
+        for (size_t end; keepOpen && (end = connection.input.find('\n', start)) != string::npos; start = end + 1)
+        {
+            size_t length = end - start;
+            if (length > 0 && connection.input[end - 1] == '\r')
+                length--;
+            string line = connection.input.substr(start, length);
+
+            if (line == "Exit")
+            {
+                keepOpen = false;
+                break;
+            }
+
+            response.str(string());
+            if (tracker.executeLine(line, response, connection.session) == -1)
+                response << "INVALID\n";
+            connection.output += response.str();
+            requests++;
+        }
+        connection.input.erase(0, start);
+
+        if (connection.input.size() > static_cast<size_t>(MAX_INPUT_LENGTH))
+            keepOpen = false;
+    }
+
+    if (!connection.output.empty())
+    {
+        ssize_t sent = send(connection.fd, connection.output.data(), connection.output.size(),
+                            MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            return false;
+        if (sent > 0)
+        {
+            connection.output.erase(0, static_cast<size_t>(sent));
+            active = true;
+        }
+    }
+
+    // Every request of this read waited for the same receive and send
+    if (requests > 0)
+    {
+        uint64_t latency = nowNanos() - receivedAt;
+        for (size_t i = 0; i < requests; ++i)
+        {
+            worker.latency.record(latency);
+        }
+        worker.served.fetch_add(requests, memory_order_relaxed);
+    }
+
+    return keepOpen;
+}
+
+/**
+ * @brief Requests executed so far by every worker
+ * @return Sum of the per-worker counts
+ */
+uint64_t PollingServer::requestsServed() const
+{
+    uint64_t total = 0;
+    for (const auto &worker : workers)
+    {
+        total += worker->served.load(memory_order_relaxed);
+    }
+    return total;
+}
+
+/**
+ * @brief Writes the latency percentiles over all workers and per worker
+ * @param out Stream receiving the report
+ * @return void
+ */
+void PollingServer::writeReport(ostream &out) const
+{
+    LatencyHistogram all;
+    for (const auto &worker : workers)
+    {
+        all.merge(worker->latency);
+    }
+    all.writeReport(out, "all workers");
+
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        string name = "worker " + to_string(i) + " (core " + to_string(workers[i]->cpu) +
+                      (workers[i]->pinned ? "" : ", not pinned") + ")";
+        workers[i]->latency.writeReport(out, name);
+    }
+    out << "memory " << (memoryLocked ? "locked" : "not locked") << "\n";
+}
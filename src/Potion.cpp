@@ -19,9 +19,23 @@ using namespace std;
  * Maintains parallel vectors where ingredientNames[i] corresponds to ingredientQuantities[i]
  */
 void Potion::addIngredient(const string &ingredientName, int ingredientQuantity)
+{
+    addIngredient(ingredientName, hashName(ingredientName), ingredientQuantity);
+}
+
+/**
+ * @brief Adds an ingredient whose name hash is already known
+ * @param ingredientName The name of the ingredient to add
+ * @param ingredientHash hashName(ingredientName)
+ * @param ingredientQuantity The quantity of the ingredient required
+ * @return void
+ * @side_effects Appends name, hash and quantity to the parallel vectors
+ */
+void Potion::addIngredient(const string &ingredientName, NameHash ingredientHash, int ingredientQuantity)
 {
     // Add ingredient name to the names list
     ingredientNames.push_back(ingredientName);
-    // Add corresponding quantity to maintain parallel structure
+    // Add corresponding quantity and hash to maintain parallel structure
     ingredientQuantities.push_back(ingredientQuantity);
+    ingredientHashes.push_back(ingredientHash);
 }
\ No newline at end of file
@@ -0,0 +1,77 @@
+#include "WitcherTracker.h"
+
+using namespace std;
+
+/**
+ * @brief RWLock class implementation - reader-writer lock for concurrent trackers
+ * 
+ * Built from a mutex and two condition variables so it only needs C++11.
+ * Writers take priority over newly arriving readers to avoid starvation.
+ */
+
+/**
+ * @brief Acquires the lock in shared mode
+ * @return void
+ * @side_effects Blocks while a writer holds or waits for the lock
+ */
+void RWLock::lockRead()
+{
+    unique_lock<mutex> guard(stateMutex);
+    // Yield to active and queued writers
+    readersCv.wait(guard, [this]
+                   { return !writerActive && waitingWriters == 0; });
+    activeReaders++;
+}
+
+/**
+ * @brief Releases a shared acquisition
+ * @return void
+ * @side_effects Wakes a waiting writer when the last reader leaves
+ */
+void RWLock::unlockRead()
+{
+    unique_lock<mutex> guard(stateMutex);
+    activeReaders--;
+    if (activeReaders == 0 && waitingWriters > 0)
+    {
+        guard.unlock();
+        writersCv.notify_one();
+    }
+}
+
+/**
+ * @brief Acquires the lock in exclusive mode
+ * @return void
+ * @side_effects Blocks until no reader or writer holds the lock
+ */
+void RWLock::lockWrite()
+{
+    unique_lock<mutex> guard(stateMutex);
+    waitingWriters++;
+    writersCv.wait(guard, [this]
+                   { return !writerActive && activeReaders == 0; });
+    waitingWriters--;
+    writerActive = true;
+}
+
+/**
+ * @brief Releases an exclusive acquisition
+ * @return void
+ * @side_effects Hands the lock to the next writer, or to all waiting readers
+ */
+void RWLock::unlockWrite()
+{
+    unique_lock<mutex> guard(stateMutex);
+    writerActive = false;
+    bool writersQueued = waitingWriters > 0;
+    guard.unlock();
+
+    if (writersQueued)
+    {
+        writersCv.notify_one();
+    }
+    else
+    {
+        readersCv.notify_all();
+    }
+}
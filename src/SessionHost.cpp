@@ -0,0 +1,348 @@
+#include "WitcherTracker.h"
+
+using namespace std;
+
+/**
+ * @brief SessionHost implementation - sharded session workers with fan-out aggregates
+ *
+ * Session id s lives in shard s % shards at position s / shards. The
+ * shard lock guards the session list and every session's inbox; a
+ * session's tracker is only touched by the shard's worker. A session with
+ * commands waiting has exactly one run task in the shard queue, which
+ * runs one slice of the oldest command and requeues itself while the
+ * inbox is not empty.
+ */
+
+/**
+ * @struct SessionHost::PendingCommand
+ * @brief A queued command with the response written so far
+ */
+struct SessionHost::PendingCommand
+{
+    PendingCommand(WitcherTracker &tracker, const string &line, uint64_t sequence)
+        : task(tracker, line), sequence(sequence)
+    {
+    }
+
+    CommandTask task;           ///< Execution state
+    uint64_t sequence;          ///< Commands queued on the shard before this one
+    ostringstream output;       ///< Response written by the finished slices
+    promise<string> result;     ///< Fulfilled with the response when the task finishes
+};
+
+/**
+ * @struct SessionHost::Session
+ * @brief One player's tracker and its queued commands
+ */
+struct SessionHost::Session
+{
+    WitcherTracker tracker;                         ///< Owned by the shard's worker
+    deque<unique_ptr<PendingCommand>> inbox;        ///< Oldest first; the front one may be partly run
+};
+
+/**
+ * @struct SessionHost::Shard
+ * @brief One worker thread, its sessions and its task queue
+ */
+struct SessionHost::Shard
+{
+    mutex lock;                                 ///< Guards tasks, stopping, sessions and inboxes
+    condition_variable ready;                   ///< Signalled when a task is queued
+    deque<function<void()>> tasks;              ///< Commands and aggregate slices, in arrival order
+    bool stopping = false;                      ///< Set to end the worker once the queue drains
+    uint64_t commands = 0;                      ///< Commands queued so far, numbering them
+    vector<unique_ptr<Session>> sessions;       ///< Sessions owned by this shard
+    thread worker;                              ///< Runs every task of this shard
+};
+
+/**
+ * @struct SessionHost::Aggregation
+ * @brief State of one fan-out query shared by its slices
+ */
+struct SessionHost::Aggregation
+{
+    function<int64_t(const WitcherTracker &)> partial;  ///< Value of one session
+    atomic<int64_t> sum;                                ///< Merged partial results
+    atomic<int> remaining;                              ///< Shards still working
+    promise<void> done;                                 ///< Fulfilled by the last shard
+};
+
+/**
+ * @brief Starts the shard workers
+ * @param shardCount Worker threads (at least one)
+ * @param budget Work and time of one command slice
+ */
+SessionHost::SessionHost(int shardCount, CommandBudget budget) : budget(budget), sessions(0)
+{
+    for (int i = 0; i < max(1, shardCount); ++i)
+    {
+        shards.emplace_back(new Shard());
+    }
+    for (auto &shard : shards)
+    {
+        Shard *owned = shard.get();
+        shard->worker = thread([this, owned]() { runWorker(*owned); });
+    }
+}
+
+/**
+ * @brief Stops the workers after their queued tasks
+ */
+SessionHost::~SessionHost()
+{
+    for (auto &shard : shards)
+    {
+        lock_guard<mutex> guard(shard->lock);
+        shard->stopping = true;
+        shard->ready.notify_one();
+    }
+    for (auto &shard : shards)
+    {
+        shard->worker.join();
+    }
+}
+
+/**
+ * @brief Appends a task to a shard's queue
+ * @param shard Shard whose worker runs the task
+ * @param task Work to run
+ * @return void
+ */
+void SessionHost::post(Shard &shard, function<void()> task)
+{
+    lock_guard<mutex> guard(shard.lock);
+    shard.tasks.push_back(move(task));
+    shard.ready.notify_one();
+}
+
+/**
+ * @brief Runs a shard's tasks until the host is destroyed
+ * @param shard The shard to serve
+ * @return void
+ */
+void SessionHost::runWorker(Shard &shard)
+{
+    while (true)
+    {
+        function<void()> task;
+        {
+            unique_lock<mutex> guard(shard.lock);
+            shard.ready.wait(guard, [&shard] { return shard.stopping || !shard.tasks.empty(); });
+            if (shard.tasks.empty())
+                return;
+            task = move(shard.tasks.front());
+            shard.tasks.pop_front();
+        }
+        task();
+    }
+}
+
+/**
+ * @brief Creates a session with an empty tracker
+ * @return Session id for execute()
+ */
+int SessionHost::addSession()
+{
+    unique_ptr<Session> session(new Session());
+
+    // Held while appending so ids of one shard are appended in order
+    lock_guard<mutex> guard(sessionsLock);
+    int id = sessions++;
+    Shard &shard = *shards[id % shards.size()];
+    lock_guard<mutex> shardGuard(shard.lock);
+    shard.sessions.push_back(move(session));
+    return id;
+}
+
+/**
+ * @brief Number of sessions created
+ * @return Sessions created so far
+ */
+int SessionHost::sessionCount() const
+{
+    lock_guard<mutex> guard(sessionsLock);
+    return sessions;
+}
+
+/**
+ * @brief Queues a command for a session
+ * @param session Id from addSession()
+ * @param line Command line
+ * @return Future output of the command
+ */
+future<string> SessionHost::execute(int session, const string &line)
+{
+    if (session < 0 || session >= sessionCount())
+        throw out_of_range("SessionHost: unknown session");
+
+    Shard &shard = *shards[session % shards.size()];
+    size_t position = session / shards.size();
+
+    lock_guard<mutex> guard(shard.lock);
+    Session *target = shard.sessions[position].get();
+    target->inbox.emplace_back(new PendingCommand(target->tracker, line, shard.commands++));
+    future<string> result = target->inbox.back()->result.get_future();
+
+    // The first waiting command schedules the session; later ones queue behind it
+    if (target->inbox.size() == 1)
+    {
+        shard.tasks.push_back([this, &shard, target]() { runSession(shard, *target); });
+        shard.ready.notify_one();
+    }
+    return result;
+}
+
+/**
+ * @brief Runs one slice of a session's oldest command
+ * @param shard Shard whose worker runs this
+ * @param session Session with at least one waiting command
+ * @return void
+ * @side_effects Fulfils the command's future when it finishes; requeues
+ *               the session while it has commands left
+ */
+void SessionHost::runSession(Shard &shard, Session &session)
+{
+    PendingCommand *pending;
+    {
+        lock_guard<mutex> guard(shard.lock);
+        pending = session.inbox.front().get();
+    }
+
+    if (pending->task.step(pending->output, budget) && pending->task.getStatus() == -1)
+        pending->output << "INVALID\n";
+
+    // The reply goes out once the command has left the inbox, so a next
+    // command sent on receiving it schedules the session afresh instead of
+    // finding it still queued and running after the other sessions
+    unique_ptr<PendingCommand> finished;
+    {
+        lock_guard<mutex> guard(shard.lock);
+        if (pending->task.isFinished())
+        {
+            finished = move(session.inbox.front());
+            session.inbox.pop_front();
+        }
+        if (!session.inbox.empty())
+            shard.tasks.push_back([this, &shard, &session]() { runSession(shard, session); });
+    }
+    if (finished)
+        finished->result.set_value(finished->output.str());
+}
+
+/**
+ * @brief Folds one slice of a shard's sessions into an aggregation
+ * @param shard Shard whose worker runs this
+ * @param begin First session of the slice
+ * @param cutoff Commands queued on the shard before the query
+ * @param waiting Sessions of earlier slices that were not yet settled
+ * @param aggregation Query being answered
+ * @return void
+ * @side_effects Requeues the next slice and the sessions still waiting
+ *               behind the queued commands, or completes the query if this
+ *               was the last shard to finish
+ *
+ * A session is settled once every command queued before the query has
+ * finished and its oldest command has not run a slice. Otherwise its run
+ * task is ahead in the queue, so by the requeued slice it has moved on.
+ */
+void SessionHost::aggregateSlice(Shard &shard, size_t begin, uint64_t cutoff, const vector<Session *> &waiting,
+                                 const shared_ptr<Aggregation> &aggregation)
+{
+    vector<Session *> settled;
+    vector<Session *> unsettled;
+    size_t count;
+    size_t end;
+    {
+        lock_guard<mutex> guard(shard.lock);
+        count = shard.sessions.size();
+        end = min(count, begin + HOST_AGGREGATE_SLICE);
+
+        vector<Session *> candidates(waiting);
+        for (size_t i = begin; i < end; ++i)
+        {
+            candidates.push_back(shard.sessions[i].get());
+        }
+        for (Session *session : candidates)
+        {
+            const deque<unique_ptr<PendingCommand>> &inbox = session->inbox;
+            if (inbox.empty() || (inbox.front()->sequence >= cutoff && !inbox.front()->task.isStarted()))
+                settled.push_back(session);
+            else
+                unsettled.push_back(session);
+        }
+    }
+
+    int64_t sum = 0;
+    for (Session *session : settled)
+    {
+        sum += aggregation->partial(session->tracker);
+    }
+    aggregation->sum.fetch_add(sum);
+
+    if (end < count || !unsettled.empty())
+    {
+        post(shard, [this, &shard, end, cutoff, unsettled, aggregation]()
+             { aggregateSlice(shard, end, cutoff, unsettled, aggregation); });
+    }
+    else if (aggregation->remaining.fetch_sub(1) == 1)
+    {
+        aggregation->done.set_value();
+    }
+}
+
+/**
+ * @brief Sums a per-session value over every session, in parallel over the shards
+ * @param partial Value of one session; runs on that session's worker
+ * @return Sum over all sessions
+ *
+ * Commands queued before the query see their effect counted; commands
+ * queued while it runs may or may not, depending on which slice of their
+ * shard was done first. No command is seen partly done.
+ */
+int64_t SessionHost::aggregate(const function<int64_t(const WitcherTracker &)> &partial)
+{
+    shared_ptr<Aggregation> aggregation(new Aggregation());
+    aggregation->partial = partial;
+    aggregation->sum.store(0);
+    aggregation->remaining.store(static_cast<int>(shards.size()));
+    future<void> done = aggregation->done.get_future();
+
+    for (auto &shard : shards)
+    {
+        // The cutoff is read with the slice queued, so no command falls between them
+        Shard *target = shard.get();
+        lock_guard<mutex> guard(target->lock);
+        uint64_t cutoff = target->commands;
+        target->tasks.push_back([this, target, cutoff, aggregation]()
+                                { aggregateSlice(*target, 0, cutoff, vector<Session *>(), aggregation); });
+        target->ready.notify_one();
+    }
+
+    done.wait();
+    return aggregation->sum.load();
+}
+
+/**
+ * @brief Total quantity of an item across all sessions
+ * @param category Ingredient, potion or trophy
+ * @param name Item name
+ * @return Sum of the item's quantity over every session
+ */
+int64_t SessionHost::totalQuantity(ItemCategory category, const string &name)
+{
+    NameHash hash = hashName(name);
+    return aggregate([category, &name, hash](const WitcherTracker &session)
+                     { return static_cast<int64_t>(session.getItemQuantity(category, name, hash)); });
+}
+
+/**
+ * @brief Number of sessions that know the recipe of a potion
+ * @param potion Potion name
+ * @return Sessions with a formula for the potion
+ */
+int64_t SessionHost::sessionsKnowingFormula(const string &potion)
+{
+    NameHash hash = hashName(potion);
+    return aggregate([&potion, hash](const WitcherTracker &session)
+                     { return static_cast<int64_t>(session.knowsFormula(potion, hash)); });
+}
@@ -0,0 +1,369 @@
+#include "WitcherTracker.h"
+
+#include <climits>
+
+using namespace std;
+
+/**
+ * @brief SharedStash class implementation - lock-free guild inventory
+ * 
+ * Open-addressing table with linear probing. A slot becomes owned by a name
+ * through a compare-and-swap on its key pointer and keeps it forever, so
+ * readers can follow probe chains without any locking. Quantities are
+ * updated with atomic read-modify-write operations.
+ *
+ * A transfer claims each of its slots by swapping the quantity for
+ * CLAIMED, checks and computes every new quantity, and releases each slot
+ * by storing its new value. Every other operation that meets CLAIMED waits
+ * for the release, so no operation observes a transfer half-applied and a
+ * failed transfer is invisible: transfers are two-phase and single-item
+ * operations stay linearizable. Slots are claimed in table order, so two
+ * transfers never wait for each other in a cycle.
+ */
+
+static const int CLAIMED = INT_MIN;     ///< Quantity of a slot claimed by a transfer
+static const int CLAIM_SPINS = 64;      ///< Pauses before a waiter yields its core
+
+/**
+ * @brief Reads a slot's quantity, waiting while a transfer has claimed it
+ * @param quantity Quantity word of the slot
+ * @return Unclaimed quantity
+ */
+static int loadUnclaimed(const atomic<int> &quantity)
+{
+    int current = quantity.load(memory_order_acquire);
+    for (int spins = 0; current == CLAIMED; current = quantity.load(memory_order_acquire))
+    {
+        if (++spins < CLAIM_SPINS)
+        {
+            cpuRelax();
+        }
+        else
+        {
+            this_thread::yield();
+            spins = 0;
+        }
+    }
+    return current;
+}
+
+/**
+ * @brief Constructs an empty stash
+ * @param slotCount Requested capacity, rounded up to a power of two
+ */
+SharedStash::SharedStash(size_t slotCount) : capacity(1)
+{
+    while (capacity < slotCount)
+    {
+        capacity <<= 1;
+    }
+    slots.reset(new Slot[capacity]);
+}
+
+/**
+ * @brief Releases every published key
+ */
+SharedStash::~SharedStash()
+{
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        delete slots[i].key.load(memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Hashes an item identity
+ * @param category Item category
+ * @param name Item identifier
+ * @return Hash mixing category into the name hash
+ */
+size_t SharedStash::hashItem(ItemCategory category, const string &name)
+{
+    return static_cast<size_t>(hashName(name)) * 31 + static_cast<size_t>(category);
+}
+
+/**
+ * @brief Finds the slot owned by an item without inserting
+ * @param category Item category
+ * @param name Item identifier
+ * @return Slot pointer, or nullptr if the item was never added
+ */
+SharedStash::Slot *SharedStash::findSlot(ItemCategory category, const string &name) const
+{
+    size_t h = hashItem(category, name);
+    for (size_t probe = 0; probe < capacity; ++probe)
+    {
+        Slot &slot = slots[(h + probe) & (capacity - 1)];
+        Key *key = slot.key.load(memory_order_acquire);
+
+        // An empty slot ends the probe chain since slots are never freed
+        if (!key)
+            return nullptr;
+        if (key->hash == h && key->category == category && key->name == name)
+            return &slot;
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Finds the slot owned by an item, claiming an empty one if needed
+ * @param category Item category
+ * @param name Item identifier
+ * @return Slot pointer, or nullptr if the table is full
+ * @side_effects May publish a new key with a compare-and-swap
+ */
+SharedStash::Slot *SharedStash::findOrInsertSlot(ItemCategory category, const string &name)
+{
+    size_t h = hashItem(category, name);
+    Key *newKey = nullptr;
+
+    for (size_t probe = 0; probe < capacity; ++probe)
+    {
+        Slot &slot = slots[(h + probe) & (capacity - 1)];
+        Key *key = slot.key.load(memory_order_acquire);
+
+        if (!key)
+        {
+            if (!newKey)
+                newKey = new Key{h, category, name};
+
+            // Claim the empty slot; on failure 'key' holds the winner
+            if (slot.key.compare_exchange_strong(key, newKey, memory_order_acq_rel, memory_order_acquire))
+                return &slot;
+        }
+
+        if (key->hash == h && key->category == category && key->name == name)
+        {
+            // Another session published the same name first
+            delete newKey;
+            return &slot;
+        }
+    }
+
+    delete newKey;
+    return nullptr;
+}
+
+/**
+ * @brief Adds to an item's quantity
+ * @param category Item category
+ * @param name Item identifier
+ * @param quantity Amount to add
+ * @return false if the item is new and the stash is full
+ */
+bool SharedStash::addItem(ItemCategory category, const string &name, int quantity)
+{
+    Slot *slot = findOrInsertSlot(category, name);
+    if (!slot)
+        return false;
+
+    int current = loadUnclaimed(slot->quantity);
+    while (!slot->quantity.compare_exchange_weak(current, current + quantity, memory_order_acq_rel,
+                                                 memory_order_acquire))
+    {
+        if (current == CLAIMED)
+            current = loadUnclaimed(slot->quantity);
+    }
+    return true;
+}
+
+/**
+ * @brief Removes from an item's quantity only if enough is held
+ * @param category Item category
+ * @param name Item identifier
+ * @param quantity Amount to remove
+ * @return true if removed, false if insufficient
+ * 
+ * Compare-and-swap loop: retries while other sessions change the counter,
+ * waits while a transfer has claimed it, and gives up as soon as the
+ * observed quantity is too small.
+ */
+bool SharedStash::removeItem(ItemCategory category, const string &name, int quantity)
+{
+    Slot *slot = findSlot(category, name);
+    if (!slot)
+        return quantity <= 0;
+
+    int current = loadUnclaimed(slot->quantity);
+    while (current >= quantity)
+    {
+        if (slot->quantity.compare_exchange_weak(current, current - quantity, memory_order_acq_rel, memory_order_acquire))
+            return true;
+        if (current == CLAIMED)
+            current = loadUnclaimed(slot->quantity);
+    }
+    return false;
+}
+
+/**
+ * @brief Reads an item's quantity
+ * @param category Item category
+ * @param name Item identifier
+ * @return Current quantity, 0 if never added
+ */
+int SharedStash::getQuantity(ItemCategory category, const string &name) const
+{
+    Slot *slot = findSlot(category, name);
+    return slot ? loadUnclaimed(slot->quantity) : 0;
+}
+
+/**
+ * @brief Formats every positive item of a category
+ * @param category Category to list
+ * @return "quantity name, ..." sorted by name, empty if none
+ * 
+ * Each counter is read atomically, after any transfer holding it; the
+ * listing as a whole is not a point-in-time snapshot while other sessions
+ * are mutating the stash.
+ */
+string SharedStash::getAll(ItemCategory category) const
+{
+    vector<pair<string, int>> sortedItems;
+
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        Key *key = slots[i].key.load(memory_order_acquire);
+        if (key && key->category == category)
+        {
+            int quantity = loadUnclaimed(slots[i].quantity);
+            if (quantity > 0)
+            {
+                sortedItems.emplace_back(key->name, quantity);
+            }
+        }
+    }
+
+    sort(sortedItems.begin(), sortedItems.end());
+
+    string result;
+    for (size_t i = 0; i < sortedItems.size(); ++i)
+    {
+        if (i > 0)
+            result += ", ";
+        result += to_string(sortedItems[i].second) + " " + sortedItems[i].first;
+    }
+    return result;
+}
+
+/**
+ * @struct TransferSlot
+ * @brief What a transfer does to one slot
+ */
+struct SharedStash::TransferSlot
+{
+    Slot *slot;             ///< Slot claimed by the transfer
+    long long withdrawn;    ///< Total taken from it
+    long long deposited;    ///< Total given to it
+    int held;               ///< Quantity when claimed
+};
+
+/**
+ * @brief Exchanges items atomically
+ * @param taken Items to withdraw
+ * @param given Items to deposit if every withdrawal is covered
+ * @return true if applied, false if some withdrawal was insufficient (nothing changes)
+ * @side_effects Claims the slots involved for the duration of the check and update
+ *
+ * Withdrawals are checked against the quantities held before the exchange,
+ * as when they are made one by one before any deposit; a name listed twice
+ * needs the sum of its lines.
+ */
+bool SharedStash::transfer(const vector<StashItem> &taken, const vector<StashItem> &given)
+{
+    vector<TransferSlot> claims;
+    auto claimOf = [&claims](Slot *slot) -> TransferSlot &
+    {
+        for (auto &claim : claims)
+        {
+            if (claim.slot == slot)
+                return claim;
+        }
+        claims.push_back(TransferSlot{slot, 0, 0, 0});
+        return claims.back();
+    };
+
+    // Find slots for every deposited name first so deposits cannot fail later
+    for (const auto &item : given)
+    {
+        Slot *slot = findOrInsertSlot(item.category, item.name);
+        if (!slot)
+            return false;
+        claimOf(slot).deposited += item.quantity;
+    }
+    for (const auto &item : taken)
+    {
+        Slot *slot = findSlot(item.category, item.name);
+        if (!slot)
+        {
+            if (item.quantity > 0)
+                return false;
+            continue;
+        }
+        claimOf(slot).withdrawn += item.quantity;
+    }
+
+    // Claim in table order, so concurrent transfers never wait on each other in a cycle
+    sort(claims.begin(), claims.end(), [](const TransferSlot &a, const TransferSlot &b) { return a.slot < b.slot; });
+    for (auto &claim : claims)
+    {
+        claim.held = loadUnclaimed(claim.slot->quantity);
+        while (!claim.slot->quantity.compare_exchange_weak(claim.held, CLAIMED, memory_order_acq_rel,
+                                                           memory_order_acquire))
+        {
+            if (claim.held == CLAIMED)
+                claim.held = loadUnclaimed(claim.slot->quantity);
+        }
+    }
+
+    bool covered = true;
+    for (const auto &claim : claims)
+    {
+        covered = covered && claim.held >= claim.withdrawn;
+    }
+
+    // Releasing publishes the new quantities; a failed exchange restores the old ones
+    for (const auto &claim : claims)
+    {
+        int released = covered ? static_cast<int>(claim.held - claim.withdrawn + claim.deposited) : claim.held;
+        claim.slot->quantity.store(released, memory_order_release);
+    }
+    return covered;
+}
+
+/**
+ * @brief Trades trophies for ingredients
+ * @param trophies Trophies to give up
+ * @param ingredients Ingredients received
+ * @return true if the trade happened
+ */
+bool SharedStash::trade(const vector<pair<string, int>> &trophies, const vector<pair<string, int>> &ingredients)
+{
+    vector<StashItem> taken, given;
+    for (const auto &trophy : trophies)
+    {
+        taken.emplace_back(ItemCategory::TROPHY, trophy.first, trophy.second);
+    }
+    for (const auto &ingredient : ingredients)
+    {
+        given.emplace_back(ItemCategory::INGREDIENT, ingredient.first, ingredient.second);
+    }
+    return transfer(taken, given);
+}
+
+/**
+ * @brief Brews one potion from stash ingredients
+ * @param potion Potion whose formula is consumed
+ * @return true if brewed, false if the formula is unknown or ingredients are short
+ */
+bool SharedStash::brew(const Potion &potion)
+{
+    if (!potion.hasFormula())
+        return false;
+
+    vector<StashItem> taken;
+    for (size_t i = 0; i < potion.ingredientNames.size(); ++i)
+    {
+        taken.emplace_back(ItemCategory::INGREDIENT, potion.ingredientNames[i], potion.ingredientQuantities[i]);
+    }
+    return transfer(taken, vector<StashItem>(1, StashItem(ItemCategory::POTION, potion.name, 1)));
+}
@@ -0,0 +1,283 @@
+#include "WitcherTracker.h"
+
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+ * @brief SnapshotWriter implementation - snapshots serialized by a forked child
+ *
+ * The child is single-threaded, so it switches its copy of the tracker to
+ * unlocked access: the locks it inherited are held by the parent's
+ * threads or by the fork itself and would never be released in the child.
+ * It leaves with _exit() so that the parent's buffered output is not
+ * written a second time.
+ */
+
+/**
+ * @struct SnapshotWriter::Result
+ * @brief Report the child writes through the pipe
+ */
+struct SnapshotWriter::Result
+{
+    uint64_t ok;            ///< 1 if the snapshot file is complete
+    uint64_t commands;      ///< Commands in the snapshot
+    uint64_t bytes;         ///< Bytes of the snapshot file
+    double millis;          ///< Time the child spent serializing and writing
+};
+
+/**
+ * @brief Minor page faults of this process so far
+ */
+static long minorFaults()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt;
+}
+
+/**
+ * @brief Writes a whole buffer to a file descriptor, retrying short writes
+ * @param fd File descriptor to write
+ * @param data First byte to write
+ * @param length Bytes to write
+ * @return false on a write error
+ */
+bool writeAll(int fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = ::write(fd, data, length);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        data += written;
+        length -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+/**
+ * @brief Constructs a writer with no snapshot running
+ */
+SnapshotWriter::SnapshotWriter() : child(0), resultPipe(-1), faultsBefore(0), forkMicros(0)
+{
+}
+
+/**
+ * @brief Waits for a running snapshot without reporting it
+ */
+SnapshotWriter::~SnapshotWriter()
+{
+    ostringstream ignored;
+    wait(ignored);
+}
+
+/**
+ * @brief Forks a child that writes a snapshot of the tracker
+ * @param tracker Tracker to snapshot
+ * @param path File the snapshot replaces once complete
+ * @param compress true to write a LogCodec frame instead of plain text
+ * @return false if a snapshot is still running, the tracker keeps its
+ *         state in a file or fork() fails
+ * @side_effects Pauses the caller for the duration of fork()
+ * 
+ * A state file is mapped shared, so the child would not see a
+ * copy-on-write view of it but the parent's later updates.
+ */
+bool SnapshotWriter::start(WitcherTracker &tracker, const string &path, bool compress)
+{
+    int fds[2];
+    if (running() || tracker.stateStore.isOpen() || pipe(fds) != 0)
+        return false;
+
+    long faults = minorFaults();
+    auto forkStart = chrono::steady_clock::now();
+    pid_t pid;
+    {
+        // Nothing may be half-updated in the copy the child receives
+        CommandLocks locks(tracker.concurrent);
+        locks.lockAlchemy(tracker.alchemy, false);
+        locks.lockBestiary(tracker.bestiary, false);
+        locks.lockAllInventory(tracker.inventory, false);
+        if (tracker.lsmStore.isOpen())
+            tracker.lsmStore.beginFork();
+
+        pid = fork();
+
+        if (tracker.lsmStore.isOpen())
+            tracker.lsmStore.endFork();
+        if (pid == 0)
+        {
+            ::close(fds[0]);
+            tracker.concurrent = false;
+            Result result = Result();
+            result.ok = writeSnapshot(tracker, path, compress, result) ? 1 : 0;
+            writeAll(fds[1], reinterpret_cast<const char *>(&result), sizeof(result));
+            _exit(result.ok ? 0 : 1);
+        }
+    }
+    chrono::duration<double, micro> elapsed = chrono::steady_clock::now() - forkStart;
+
+    ::close(fds[1]);
+    if (pid < 0)
+    {
+        ::close(fds[0]);
+        return false;
+    }
+
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    child = pid;
+    resultPipe = fds[0];
+    target = path;
+    faultsBefore = faults;
+    forkMicros = elapsed.count();
+    return true;
+}
+
+/**
+ * @brief Serializes the tracker into a file, in the child
+ * @param tracker The child's copy of the tracker
+ * @param path Target file, replaced by rename once the data is on disk
+ * @param compress true to write a LogCodec frame
+ * @param result Receives the command count, size and time
+ * @return false if the file cannot be written
+ */
+bool SnapshotWriter::writeSnapshot(WitcherTracker &tracker, const string &path, bool compress, Result &result)
+{
+    auto start = chrono::steady_clock::now();
+    ostringstream log;
+    result.commands = tracker.writeEquivalentLog(log);
+    string data = log.str();
+    if (compress)
+    {
+        vector<string> names;
+        tracker.collectKnownNames(names);
+        string frame;
+        LogCodec(names).compress(data, frame);
+        data.swap(frame);
+    }
+
+    string temporary = path + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    bool written = writeAll(fd, data.data(), data.size()) && fsync(fd) == 0;
+    ::close(fd);
+    if (!written || rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        unlink(temporary.c_str());
+        return false;
+    }
+
+    result.bytes = data.size();
+    chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+    result.millis = elapsed.count();
+    return true;
+}
+
+/**
+ * @brief Collects the running snapshot if it has finished, without blocking
+ * @param report Stream receiving one line about the finished snapshot
+ * @return true if a snapshot finished
+ */
+bool SnapshotWriter::poll(ostream &report)
+{
+    if (!running())
+        return false;
+
+    Result result = Result();
+    ssize_t got = read(resultPipe, &result, sizeof(result));
+    if (got < 0 && (errno == EAGAIN || errno == EINTR))
+        return false;
+
+    // A short or empty read means the child died before reporting
+    finish(got == static_cast<ssize_t>(sizeof(result)), result, report);
+    return true;
+}
+
+/**
+ * @brief Blocks until the running snapshot, if any, finishes
+ * @param report Stream receiving one line about the finished snapshot
+ * @return void
+ */
+void SnapshotWriter::wait(ostream &report)
+{
+    if (!running())
+        return;
+
+    fcntl(resultPipe, F_SETFL, fcntl(resultPipe, F_GETFL) & ~O_NONBLOCK);
+    Result result = Result();
+    ssize_t got;
+    do
+    {
+        got = read(resultPipe, &result, sizeof(result));
+    } while (got < 0 && errno == EINTR);
+    finish(got == static_cast<ssize_t>(sizeof(result)), result, report);
+}
+
+/**
+ * @brief Reaps the child and accounts for its snapshot
+ * @param reported true if the child wrote a complete report
+ * @param result The report
+ * @param report Stream receiving one line about the snapshot
+ * @return void
+ */
+void SnapshotWriter::finish(bool reported, const Result &result, ostream &report)
+{
+    int status = 0;
+    while (waitpid(child, &status, 0) < 0 && errno == EINTR)
+    {
+    }
+    ::close(resultPipe);
+    child = 0;
+    resultPipe = -1;
+
+    uint64_t copiedPages = static_cast<uint64_t>(max(minorFaults() - faultsBefore, 0L));
+    totals.longestForkMicros = max(totals.longestForkMicros, forkMicros);
+    totals.totalForkMicros += forkMicros;
+    totals.mostCopiedPages = max(totals.mostCopiedPages, copiedPages);
+    totals.totalCopiedPages += copiedPages;
+
+    ostringstream line;
+    line << fixed << setprecision(1);
+    if (reported && result.ok)
+    {
+        totals.taken++;
+        line << "snapshot " << target << ": " << result.commands << " commands, " << result.bytes << " bytes in "
+             << result.millis << " ms; fork " << forkMicros << " us, " << copiedPages << " pages copied on write\n";
+    }
+    else
+    {
+        totals.failed++;
+        line << "snapshot " << target << " failed; fork " << forkMicros << " us\n";
+    }
+    report << line.str();
+}
+
+/**
+ * @brief Writes the counters as one line
+ * @param out Stream receiving the line
+ * @return void
+ *
+ * Format: "snapshots: <taken> taken, <failed> failed, fork <mean>/<longest>
+ * us, pages copied on write <mean>/<most>" (means over finished snapshots).
+ */
+void SnapshotWriter::writeStats(ostream &out) const
+{
+    uint64_t finished = totals.taken + totals.failed;
+    double divisor = finished > 0 ? static_cast<double>(finished) : 1.0;
+
+    ostringstream line;
+    line << fixed << setprecision(1) << "snapshots: " << totals.taken << " taken, " << totals.failed
+         << " failed, fork " << totals.totalForkMicros / divisor << "/" << totals.longestForkMicros
+         << " us, pages copied on write " << totals.totalCopiedPages / divisor << "/" << totals.mostCopiedPages
+         << "\n";
+    out << line.str();
+}
@@ -0,0 +1,87 @@
+#include "WitcherTracker.h"
+
+using namespace std;
+
+/**
+ * @brief StateDigest implementation - incremental multiset hashing
+ *
+ * An element contributes mix(key ^ f(value)) to one lane and a differently
+ * seeded mix to the other. Lanes are sums modulo 2^64, so a digest is a
+ * multiset hash: insertion order never matters and removal is subtraction.
+ */
+
+static const uint64_t DIGEST_KIND_MULTIPLIER = 0x9e3779b97f4a7c15ULL;
+static const uint64_t DIGEST_LOW_SEED = 0x243f6a8885a308d3ULL;
+static const uint64_t DIGEST_HIGH_SEED = 0x13198a2e03707344ULL;
+
+/**
+ * @brief Bijective 64-bit finalizer (splitmix64)
+ * @param x Input word
+ * @return Well-mixed output word
+ */
+static inline uint64_t mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/**
+ * @brief Builds the key of a named element
+ * @param kind What the element is
+ * @param hash hashName of the element's name
+ * @return Key distinct for every (kind, name)
+ */
+uint64_t StateDigest::key(StoredKind kind, NameHash hash)
+{
+    return mix(hash ^ ((static_cast<uint64_t>(kind) + 1) * DIGEST_KIND_MULTIPLIER));
+}
+
+/**
+ * @brief Folds one more word into an ordered sequence value
+ * @param sequence Value of the sequence so far
+ * @param word Next word
+ * @return Value of the extended sequence
+ */
+uint64_t StateDigest::combine(uint64_t sequence, uint64_t word)
+{
+    return mix(sequence * DIGEST_KIND_MULTIPLIER + word);
+}
+
+/**
+ * @brief Adds an element
+ * @param key Element key
+ * @param value Element value
+ * @return void
+ */
+void StateDigest::add(uint64_t key, uint64_t value)
+{
+    low += mix(key ^ mix(value ^ DIGEST_LOW_SEED));
+    high += mix((key + DIGEST_HIGH_SEED) ^ mix(value + DIGEST_HIGH_SEED));
+}
+
+/**
+ * @brief Removes an element
+ * @param key Element key
+ * @param value Element value it was added with
+ * @return void
+ */
+void StateDigest::remove(uint64_t key, uint64_t value)
+{
+    low -= mix(key ^ mix(value ^ DIGEST_LOW_SEED));
+    high -= mix((key + DIGEST_HIGH_SEED) ^ mix(value + DIGEST_HIGH_SEED));
+}
+
+/**
+ * @brief Formats the digest as 32 lowercase hex digits, high lane first
+ * @return Hex string
+ */
+string StateDigest::toString() const
+{
+    ostringstream text;
+    text << hex << setfill('0') << setw(16) << high << setw(16) << low;
+    return text.str();
+}
@@ -0,0 +1,1009 @@
+#include "WitcherTracker.h"
+
+using namespace std;
+
+/**
+ * @brief TieredItemStore implementation - hot/cold item quantity storage
+ *
+ * The hot tier is a deque of entries, scanned while it is small and
+ * otherwise reached through an open-addressing index; entries released
+ * by demotion are reused, never moved. The scan covers the whole deque,
+ * released entries included, so the switch points count deque entries.
+ * Cold runs are read-only apart from marking names that have been
+ * promoted back into the hot tier, so a name is live in at most one run.
+ * A finished merge replaces its inputs only while no filter refill is
+ * walking the runs. Compaction moves entries down only while it runs,
+ * and leaves the free list holding entries it filled or cut off; touch()
+ * skips those.
+ */
+
+static const uint64_t HOT_TAG_MASK = 0xFFFFFFFF00000000ULL;
+
+/**
+ * @struct TieredItemStore::ColdRun
+ * @brief One sorted run of the cold tier
+ */
+struct TieredItemStore::ColdRun
+{
+    FrontCodedNames names;  ///< Sorted names
+    vector<int> counts;     ///< Quantity per name; COLD_PROMOTED once moved hot
+    BloomFilter filter;     ///< Names of the run, so most runs are skipped unsearched
+    size_t live;            ///< Names not promoted
+    int level;              ///< Merges the names have been through
+    bool merging;           ///< Input of a merge in progress
+
+    ColdRun() : live(0), level(0), merging(false) {}
+};
+
+/**
+ * @struct TieredItemStore::ColdMerge
+ * @brief Merge of cold runs into one, done a few entries at a time
+ */
+struct TieredItemStore::ColdMerge
+{
+    vector<ColdRun *> inputs;                   ///< Runs being merged
+    vector<FrontCodedNames::Cursor> cursors;    ///< Position in each input
+    vector<size_t> heap;                        ///< Inputs whose cursor holds a name not yet merged
+    unique_ptr<ColdRun> output;                 ///< Run being filled
+    string lastName;                            ///< Last name appended to the output
+};
+
+/**
+ * @struct TieredItemStore::FilterRefill
+ * @brief Filter being filled from the hot entries, then from the cold runs
+ */
+struct TieredItemStore::FilterRefill
+{
+    BloomFilter filter;                 ///< Filter being filled
+    size_t position;                    ///< Next hot entry to visit
+    size_t run;                         ///< Cold run visited once the hot entries are done
+    FrontCodedNames::Cursor cursor;     ///< Next name of that run
+
+    FilterRefill() : position(0), run(0) {}
+};
+
+/**
+ * @struct TieredItemStore::Compaction
+ * @brief Progress of a compaction spread over several slices
+ */
+struct TieredItemStore::Compaction
+{
+    enum Phase
+    {
+        RELEASE,    ///< Releasing zero-quantity hot entries
+        MOVE,       ///< Moving tail entries down and cutting the dead tail off
+        PURGE,      ///< Dropping filled and cut-off entries from the free list
+        INDEX,      ///< Filling a right-sized hot index
+        COLD,       ///< Merging every cold run into one
+        FILTER,     ///< Filling a right-sized filter
+        DONE
+    };
+
+    Phase phase;                    ///< Step running now
+    bool started;                   ///< The phase has set up what it fills
+    size_t position;                ///< Next hot entry (free entry while purging) to visit
+    vector<uint64_t> index;         ///< Hot index being filled
+
+    explicit Compaction(Phase phase = RELEASE) : phase(phase), started(false), position(0) {}
+
+    /**
+     * @brief Moves on to a phase, which starts from the first entry
+     */
+    void enter(Phase next)
+    {
+        phase = next;
+        started = false;
+        position = 0;
+    }
+};
+
+/**
+ * @brief Orders run cursors so that a heap holds the smallest name on top
+ * @param cursors Cursor of each run, each holding a name
+ * @param a Run compared
+ * @param b Other run
+ * @return true if a's name comes after b's
+ */
+static bool cursorAfter(const vector<FrontCodedNames::Cursor> &cursors, size_t a, size_t b)
+{
+    int order = cursors[a].name.compare(cursors[b].name);
+    return order != 0 ? order > 0 : a > b;
+}
+
+/**
+ * @brief Adds a hot entry to an index with room for it
+ * @param index Index (power-of-two size, load at most one half)
+ * @param hash hashName of the entry's name
+ * @param entryIndex Position of the entry in the deque
+ */
+static void indexEntry(vector<uint64_t> &index, NameHash hash, size_t entryIndex)
+{
+    size_t mask = index.size() - 1;
+    size_t pos = static_cast<size_t>(hash) & mask;
+    while (index[pos] != 0)
+        pos = (pos + 1) & mask;
+    index[pos] = (hash & HOT_TAG_MASK) | (entryIndex + 1);
+}
+
+/**
+ * @brief Constructs an empty store
+ */
+TieredItemStore::TieredItemStore() : hotCount(0), clock(0), coldLive(0)
+{
+}
+
+/**
+ * @brief Destructor; defined where Compaction is complete
+ */
+TieredItemStore::~TieredItemStore()
+{
+}
+
+/**
+ * @brief Finds a live hot entry
+ * @param name Item name
+ * @param hash hashName(name)
+ * @return The entry, or nullptr if the item is not hot
+ */
+TieredItemStore::HotEntry *TieredItemStore::findHot(const string &name, NameHash hash)
+{
+    if (hotIndex.empty())
+    {
+        for (auto &entry : hot)
+        {
+            if (entry.live && entry.hash == hash && entry.name == name)
+                return &entry;
+        }
+        return nullptr;
+    }
+
+    size_t mask = hotIndex.size() - 1;
+    for (size_t pos = static_cast<size_t>(hash) & mask;; pos = (pos + 1) & mask)
+    {
+        uint64_t slot = hotIndex[pos];
+        if (slot == 0)
+            return nullptr;
+        if ((slot & HOT_TAG_MASK) == (hash & HOT_TAG_MASK))
+        {
+            HotEntry &entry = hot[(slot & 0xFFFFFFFFULL) - 1];
+            if (entry.hash == hash && entry.name == name)
+                return &entry;
+        }
+    }
+}
+
+/**
+ * @brief Rebuilds the hot index over the live entries
+ * @param capacity Number of index slots (power of two)
+ * @return void
+ */
+void TieredItemStore::rebuildHotIndex(size_t capacity)
+{
+    vector<uint64_t> index(capacity, 0);
+    for (size_t i = 0; i < hot.size(); ++i)
+    {
+        if (hot[i].live)
+            indexEntry(index, hot[i].hash, i);
+    }
+    hotIndex.swap(index);
+}
+
+/**
+ * @brief Removes a live hot entry from the index
+ * @param entryIndex Position of the entry, which still holds its hash
+ * @return void
+ * @side_effects Shifts the rest of the probe run back, so lookups need no tombstones
+ */
+void TieredItemStore::unindex(size_t entryIndex)
+{
+    if (hotIndex.empty())
+        return;
+
+    size_t mask = hotIndex.size() - 1;
+    uint64_t slot = (hot[entryIndex].hash & HOT_TAG_MASK) | (entryIndex + 1);
+    size_t hole = static_cast<size_t>(hot[entryIndex].hash) & mask;
+    while (hotIndex[hole] != slot)
+        hole = (hole + 1) & mask;
+
+    for (size_t pos = (hole + 1) & mask; hotIndex[pos] != 0; pos = (pos + 1) & mask)
+    {
+        // A later slot may fill the hole unless its home lies between the two
+        size_t home = static_cast<size_t>(hot[(hotIndex[pos] & 0xFFFFFFFFULL) - 1].hash) & mask;
+        if (((pos - home) & mask) >= ((pos - hole) & mask))
+        {
+            hotIndex[hole] = hotIndex[pos];
+            hole = pos;
+        }
+    }
+    hotIndex[hole] = 0;
+}
+
+/**
+ * @brief Points the index slot of a moved hot entry at its new position
+ * @param from Former position of the entry
+ * @param to Position the entry now occupies
+ * @return void
+ */
+void TieredItemStore::reindex(size_t from, size_t to)
+{
+    if (hotIndex.empty())
+        return;
+
+    size_t mask = hotIndex.size() - 1;
+    uint64_t tag = hot[to].hash & HOT_TAG_MASK;
+    size_t pos = static_cast<size_t>(hot[to].hash) & mask;
+    while (hotIndex[pos] != (tag | (from + 1)))
+        pos = (pos + 1) & mask;
+    hotIndex[pos] = tag | (to + 1);
+}
+
+/**
+ * @brief Smallest index size keeping the load factor at or below one half
+ * @return Number of slots (power of two, at least 16)
+ */
+size_t TieredItemStore::indexCapacity() const
+{
+    size_t capacity = 16;
+    while (hotCount * 2 > capacity)
+        capacity *= 2;
+    return capacity;
+}
+
+/**
+ * @brief Finds the live cold copy of a name
+ * @param name Item name
+ * @param hash hashName(name)
+ * @param run Receives the run holding it
+ * @param position Receives its position in that run
+ * @return false if no run holds the name unpromoted
+ */
+bool TieredItemStore::findCold(const string &name, NameHash hash, ColdRun *&run, size_t &position) const
+{
+    // Newer runs hold the names demoted last, which come back most often
+    for (size_t i = coldRuns.size(); coldLive > 0 && i > 0; --i)
+    {
+        ColdRun &candidate = *coldRuns[i - 1];
+        if (candidate.live == 0 || !candidate.filter.mayContain(hash))
+            continue;
+
+        size_t found = candidate.names.find(name);
+        if (found != string::npos && candidate.counts[found] != COLD_PROMOTED)
+        {
+            run = &candidate;
+            position = found;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Marks a cold name as promoted, here and in a merge that has copied it
+ * @param run Run holding the live copy
+ * @param position Position of the name in the run
+ * @param name The name
+ * @return void
+ */
+void TieredItemStore::markPromoted(ColdRun &run, size_t position, const string &name)
+{
+    run.counts[position] = COLD_PROMOTED;
+    run.live--;
+    coldLive--;
+    if (!run.merging)
+        return;
+
+    for (auto &merge : merges)
+    {
+        for (size_t i = 0; i < merge->inputs.size(); ++i)
+        {
+            if (merge->inputs[i] != &run)
+                continue;
+
+            // The cursor holds the next name to merge unless the input is used up
+            bool pending = find(merge->heap.begin(), merge->heap.end(), i) != merge->heap.end();
+            if (position + (pending ? 1 : 0) >= merge->cursors[i].index)
+                return;
+
+            ColdRun &output = *merge->output;
+            size_t copied = output.names.find(name);
+            output.counts[copied] = COLD_PROMOTED;
+            output.live--;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Starts merging runs into a new run
+ * @param inputs Runs not yet being merged
+ * @param level Level of the merged run
+ * @return void
+ */
+void TieredItemStore::startMerge(const vector<ColdRun *> &inputs, int level)
+{
+    unique_ptr<ColdMerge> merge(new ColdMerge());
+    merge->inputs = inputs;
+    merge->cursors.resize(inputs.size());
+    merge->output.reset(new ColdRun());
+    merge->output->level = level;
+
+    size_t live = 0;
+    size_t bytes = 0;
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        inputs[i]->merging = true;
+        live += inputs[i]->live;
+        bytes += inputs[i]->names.byteSize();
+        if (inputs[i]->names.next(merge->cursors[i]))
+            merge->heap.push_back(i);
+    }
+    const vector<FrontCodedNames::Cursor> &cursors = merge->cursors;
+    make_heap(merge->heap.begin(), merge->heap.end(),
+              [&cursors](size_t a, size_t b) { return cursorAfter(cursors, a, b); });
+
+    merge->output->filter.reset(live);
+    merge->output->names.reserve(live, bytes);
+    merge->output->counts.reserve(live);
+    merges.push_back(std::move(merge));
+}
+
+/**
+ * @brief Starts a merge on every level holding COLD_MERGE_RUNS runs not yet merged
+ * @return void
+ */
+void TieredItemStore::scheduleMerges()
+{
+    int top = 0;
+    for (const auto &run : coldRuns)
+        top = max(top, run->level);
+
+    for (int level = 0; level <= top; ++level)
+    {
+        // The oldest runs of a level go first
+        vector<ColdRun *> inputs;
+        for (const auto &run : coldRuns)
+        {
+            if (run->level == level && !run->merging)
+            {
+                inputs.push_back(run.get());
+                if (inputs.size() == COLD_MERGE_RUNS)
+                {
+                    startMerge(inputs, level + 1);
+                    inputs.clear();
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Moves a merge one name forward
+ * @param merge Merge in progress
+ * @return true once every input has been merged
+ */
+bool TieredItemStore::mergeStep(ColdMerge &merge)
+{
+    if (merge.heap.empty())
+        return true;
+
+    const vector<FrontCodedNames::Cursor> &cursors = merge.cursors;
+    auto after = [&cursors](size_t a, size_t b) { return cursorAfter(cursors, a, b); };
+    pop_heap(merge.heap.begin(), merge.heap.end(), after);
+    size_t i = merge.heap.back();
+    merge.heap.pop_back();
+
+    // Promoted names are dropped here
+    const ColdRun &input = *merge.inputs[i];
+    FrontCodedNames::Cursor &cursor = merge.cursors[i];
+    int count = input.counts[cursor.index - 1];
+    if (count > 0)
+    {
+        ColdRun &output = *merge.output;
+        output.names.append(cursor.name, merge.lastName);
+        output.filter.insert(hashName(cursor.name));
+        output.counts.push_back(count);
+        output.live++;
+        merge.lastName = cursor.name;
+    }
+
+    if (input.names.next(cursor))
+    {
+        merge.heap.push_back(i);
+        push_heap(merge.heap.begin(), merge.heap.end(), after);
+    }
+    return merge.heap.empty();
+}
+
+/**
+ * @brief Replaces the inputs of every finished merge with its output
+ * @return void
+ * @side_effects Waits while a filter refill walks the runs; schedules
+ *               the merges the new runs complete
+ */
+void TieredItemStore::installMerges()
+{
+    if (refill)
+        return;
+
+    bool installed = false;
+    for (size_t m = 0; m < merges.size();)
+    {
+        ColdMerge &merge = *merges[m];
+        if (!merge.heap.empty())
+        {
+            ++m;
+            continue;
+        }
+
+        // The output takes the place of the oldest input, unless every name was promoted
+        if (merge.output->live > 0)
+        {
+            auto first = find_if(coldRuns.begin(), coldRuns.end(),
+                                 [&merge](const unique_ptr<ColdRun> &run) { return run.get() == merge.inputs[0]; });
+            first->swap(merge.output);
+        }
+        coldRuns.erase(remove_if(coldRuns.begin(), coldRuns.end(),
+                                 [&merge](const unique_ptr<ColdRun> &run)
+                                 {
+                                     return find(merge.inputs.begin(), merge.inputs.end(), run.get()) !=
+                                            merge.inputs.end();
+                                 }),
+                       coldRuns.end());
+
+        merges.erase(merges.begin() + m);
+        installed = true;
+    }
+
+    if (installed)
+        scheduleMerges();
+}
+
+/**
+ * @brief Starts filling a new filter aside
+ * @param expected Names the new filter is sized for
+ * @return void
+ * @side_effects Replaces a refill in progress
+ */
+void TieredItemStore::startRefill(size_t expected)
+{
+    refill.reset(new FilterRefill());
+    refill->filter.reset(expected);
+}
+
+/**
+ * @brief Adds one more name to the filter being refilled
+ * @return true once the new filter has replaced the current one
+ */
+bool TieredItemStore::refillStep()
+{
+    FilterRefill &state = *refill;
+    if (state.position < hot.size())
+    {
+        if (hot[state.position].live)
+            state.filter.insert(hot[state.position].hash);
+        state.position++;
+        return false;
+    }
+
+    while (state.run < coldRuns.size())
+    {
+        const ColdRun &run = *coldRuns[state.run];
+        if (run.names.next(state.cursor))
+        {
+            if (run.counts[state.cursor.index - 1] != COLD_PROMOTED)
+                state.filter.insert(hashName(state.cursor.name));
+            return false;
+        }
+        state.run++;
+        state.cursor = FrontCodedNames::Cursor();
+    }
+
+    filter.adopt(state.filter);
+    refill.reset();
+    installMerges();
+    return true;
+}
+
+/**
+ * @brief Moves the filter refill and every merge a few names forward
+ * @return void
+ */
+void TieredItemStore::advance()
+{
+    for (size_t i = 0; refill && i < COLD_BACKGROUND_STEPS; ++i)
+        refillStep();
+
+    bool finished = false;
+    for (auto &merge : merges)
+    {
+        for (size_t i = 0; i < COLD_BACKGROUND_STEPS && !merge->heap.empty(); ++i)
+            mergeStep(*merge);
+        finished = finished || merge->heap.empty();
+    }
+    if (finished)
+        installMerges();
+}
+
+/**
+ * @brief Makes an item hot and marks it as just accessed
+ * @param name Item name
+ * @param hash hashName(name)
+ * @return The hot entry of the item
+ * @side_effects May demote other items, promotes a cold item, or inserts
+ *               a zero-quantity entry for an unknown item; moves merges
+ *               and a filter refill forward
+ */
+TieredItemStore::HotEntry &TieredItemStore::touch(const string &name, NameHash hash)
+{
+    clock++;
+
+    HotEntry *entry = findHot(name, hash);
+    if (entry)
+    {
+        entry->lastAccess = clock;
+        return *entry;
+    }
+
+    // Inserts and promotions pay for the background work a few names at a time
+    advance();
+    if (hotCount >= static_cast<size_t>(INVENTORY_HOT_CAPACITY))
+    {
+        demote();
+    }
+
+    // Promote the cold copy if there is one; the filter skips the cold
+    // search for items that were never stored
+    int quantity = 0;
+    bool known = filter.mayContain(hash);
+    ColdRun *run = nullptr;
+    size_t coldPos = 0;
+    bool promoted = known && findCold(name, hash, run, coldPos);
+    if (promoted)
+    {
+        quantity = run->counts[coldPos];
+        markPromoted(*run, coldPos, name);
+    }
+    else
+    {
+        if (known)
+        {
+            // New item whose bits were already set by other names
+            filter.recordFalsePositive();
+        }
+        else
+        {
+            filter.insert(hash);
+        }
+        CommandExplain::countInsert(ExplainSubsystem::INVENTORY);
+    }
+    if (refill)
+    {
+        refill->filter.insert(hash);
+    }
+
+    // Free entries filled or cut off by a compaction are skipped
+    size_t entryIndex = hot.size();
+    while (!freeEntries.empty() && entryIndex == hot.size())
+    {
+        size_t candidate = freeEntries.back();
+        freeEntries.pop_back();
+        if (candidate < hot.size() && !hot[candidate].live)
+            entryIndex = candidate;
+    }
+    if (entryIndex < hot.size())
+        hot[entryIndex] = HotEntry{name, hash, quantity, clock, false, true};
+    else
+        hot.push_back(HotEntry{name, hash, quantity, clock, false, true});
+    hotCount++;
+
+    // Keep the index load factor at or below one half
+    if (hotIndex.empty())
+    {
+        if (hot.size() > ADAPTIVE_INDEX_ABOVE)
+        {
+            rebuildHotIndex(indexCapacity());
+            switches.record(false, true);
+        }
+    }
+    else if (hotCount * 2 > hotIndex.size())
+    {
+        rebuildHotIndex(hotIndex.size() * 2);
+    }
+    else
+    {
+        indexEntry(hotIndex, hash, entryIndex);
+    }
+
+    // A compaction filling an index carries the entry into it
+    if (compaction && compaction->phase == Compaction::INDEX && compaction->started &&
+        entryIndex < compaction->position)
+    {
+        Compaction &state = *compaction;
+        if (hotCount * 2 > state.index.size())
+        {
+            vector<uint64_t>().swap(state.index);
+            state.enter(Compaction::COLD);
+        }
+        else
+        {
+            indexEntry(state.index, hash, entryIndex);
+        }
+    }
+
+    // A full filter keeps answering, with more false positives, until the
+    // larger one is filled
+    if (filter.full() && !refill)
+    {
+        startRefill(2 * (hotCount + coldLive));
+    }
+
+    return hot[entryIndex];
+}
+
+/**
+ * @brief Moves the least recently touched half of the hot tier into a new cold run
+ * @return void
+ * @side_effects Rebuilds the hot index; zero quantities are dropped
+ *               instead of demoted; may start merges
+ */
+void TieredItemStore::demote()
+{
+    // The index a compaction is filling would point at released entries
+    if (compaction && compaction->phase == Compaction::INDEX)
+    {
+        vector<uint64_t>().swap(compaction->index);
+        compaction->enter(Compaction::COLD);
+    }
+
+    vector<size_t> candidates;
+    for (size_t i = 0; i < hot.size(); ++i)
+    {
+        if (hot[i].live && !hot[i].pinned)
+            candidates.push_back(i);
+    }
+
+    size_t demoteCount = min(candidates.size(), hotCount - hotCount / 2);
+    if (demoteCount == 0)
+        return;
+
+    nth_element(candidates.begin(), candidates.begin() + (demoteCount - 1), candidates.end(),
+                [this](size_t a, size_t b) { return hot[a].lastAccess < hot[b].lastAccess; });
+
+    unique_ptr<ColdRun> run(new ColdRun());
+    run->filter.reset(demoteCount);
+    vector<pair<string, int>> demoted;
+    size_t bytes = 0;
+    for (size_t i = 0; i < demoteCount; ++i)
+    {
+        HotEntry &entry = hot[candidates[i]];
+        if (entry.quantity > 0)
+        {
+            bytes += entry.name.size() + 2;
+            run->filter.insert(entry.hash);
+            demoted.emplace_back(std::move(entry.name), entry.quantity);
+        }
+
+        entry.live = false;
+        string().swap(entry.name);
+        freeEntries.push_back(candidates[i]);
+        hotCount--;
+    }
+    if (!hotIndex.empty())
+        rebuildHotIndex(hotIndex.size());
+    if (demoted.empty())
+        return;
+    sort(demoted.begin(), demoted.end());
+
+    run->names.reserve(demoted.size(), bytes);
+    run->counts.reserve(demoted.size());
+    for (size_t i = 0; i < demoted.size(); ++i)
+    {
+        run->names.append(demoted[i].first, demoted[i > 0 ? i - 1 : 0].first);
+        run->counts.push_back(demoted[i].second);
+    }
+    run->live = demoted.size();
+    coldLive += run->live;
+    coldRuns.push_back(std::move(run));
+    scheduleMerges();
+}
+
+/**
+ * @brief Runs one slice of rebuilding both tiers into dense, right-sized storage
+ * @param meter Budget of the slice; one unit per entry visited
+ * @return true once the pass is complete
+ * @side_effects Moves unpinned hot entries, which invalidates references
+ *               returned by update() (but not by pin())
+ */
+bool TieredItemStore::compactStep(SliceMeter &meter)
+{
+    if (!compaction)
+        compaction.reset(new Compaction());
+    Compaction &state = *compaction;
+
+    // Release zero-quantity entries; pinned ones back ItemSlots and stay
+    while (state.phase == Compaction::RELEASE && meter.take())
+    {
+        if (state.position >= hot.size())
+        {
+            state.enter(Compaction::MOVE);
+            continue;
+        }
+
+        size_t i = state.position++;
+        HotEntry &entry = hot[i];
+        if (entry.live && !entry.pinned && entry.quantity == 0)
+        {
+            unindex(i);
+            entry.live = false;
+            freeEntries.push_back(i);
+            hotCount--;
+        }
+        if (!entry.live)
+            string().swap(entry.name);
+    }
+
+    // Fill the lowest free slots from the top of the deque, stopping at
+    // the first pinned entry, and cut the dead tail off
+    while (state.phase == Compaction::MOVE && meter.take())
+    {
+        size_t last = hot.empty() ? 0 : hot.size() - 1;
+        if (!hot.empty() && !hot[last].live)
+        {
+            hot.pop_back();
+        }
+        else if (hot.empty() || hot[last].pinned || state.position >= last)
+        {
+            state.enter(Compaction::PURGE);
+        }
+        else if (hot[state.position].live)
+        {
+            state.position++;
+        }
+        else
+        {
+            // A refill may already have passed the slot the entry moves to
+            if (refill)
+                refill->filter.insert(hot[last].hash);
+            hot[state.position] = std::move(hot[last]);
+            reindex(last, state.position);
+            hot.pop_back();
+            state.position++;
+        }
+    }
+
+    // Forget the free entries that were filled or cut off; touch() may
+    // pop some of them between slices
+    while (state.phase == Compaction::PURGE && meter.take())
+    {
+        if (state.position >= freeEntries.size())
+        {
+            if (freeEntries.empty())
+                vector<size_t>().swap(freeEntries);
+            state.enter(Compaction::INDEX);
+        }
+        else if (freeEntries[state.position] >= hot.size() || hot[freeEntries[state.position]].live)
+        {
+            freeEntries[state.position] = freeEntries.back();
+            freeEntries.pop_back();
+        }
+        else
+        {
+            state.position++;
+        }
+    }
+
+    // A right-sized index, or none once the deque is short enough to scan
+    if (state.phase == Compaction::INDEX && !state.started)
+    {
+        state.started = true;
+        if (!hotIndex.empty() && hot.size() < ADAPTIVE_LINEAR_BELOW)
+        {
+            vector<uint64_t>().swap(hotIndex);
+            switches.record(true, false);
+        }
+        if (hotIndex.empty() || indexCapacity() >= hotIndex.size())
+            state.enter(Compaction::COLD);
+        else
+            state.index.assign(indexCapacity(), 0);
+    }
+    while (state.phase == Compaction::INDEX && meter.take())
+    {
+        if (state.position >= hot.size())
+        {
+            hotIndex.swap(state.index);
+            vector<uint64_t>().swap(state.index);
+            state.enter(Compaction::COLD);
+        }
+        else if (hot[state.position++].live)
+        {
+            indexEntry(state.index, hot[state.position - 1].hash, state.position - 1);
+        }
+    }
+
+    // Finish the merges in progress, which a refill holds back, then merge
+    // every run into one without promoted names
+    while (state.phase == Compaction::COLD && meter.take())
+    {
+        if (refill)
+        {
+            refillStep();
+        }
+        else if (!merges.empty())
+        {
+            if (mergeStep(*merges.front()))
+                installMerges();
+        }
+        else if (!state.started)
+        {
+            state.started = true;
+            if (coldRuns.size() > 1 || (coldRuns.size() == 1 && coldRuns[0]->live < coldRuns[0]->counts.size()))
+            {
+                vector<ColdRun *> inputs;
+                int level = 0;
+                for (const auto &run : coldRuns)
+                {
+                    inputs.push_back(run.get());
+                    level = max(level, run->level);
+                }
+                startMerge(inputs, level);
+            }
+        }
+        else
+        {
+            state.enter(Compaction::FILTER);
+        }
+    }
+
+    // Refill a right-sized filter with the hot names, then the cold ones
+    if (state.phase == Compaction::FILTER && !state.started)
+    {
+        state.started = true;
+        startRefill(2 * (hotCount + coldLive));
+    }
+    while (state.phase == Compaction::FILTER && meter.take())
+    {
+        if (!refill || refillStep())
+            state.enter(Compaction::DONE);
+    }
+
+    if (state.phase != Compaction::DONE)
+        return false;
+
+    compaction.reset();
+    return true;
+}
+
+/**
+ * @brief Returns the quantity cell of an item for modification
+ * @param name Item name
+ * @param hash hashName(name)
+ * @return Reference valid until the next update of the store
+ */
+int &TieredItemStore::update(const string &name, NameHash hash)
+{
+    return touch(name, hash).quantity;
+}
+
+/**
+ * @brief Returns a quantity cell that stays valid for the store lifetime
+ * @param name Item name
+ * @param hash hashName(name)
+ * @return Reference to the pinned hot entry's quantity
+ */
+int &TieredItemStore::pin(const string &name, NameHash hash)
+{
+    HotEntry &entry = touch(name, hash);
+    entry.pinned = true;
+    return entry.quantity;
+}
+
+/**
+ * @brief Reads an item from either tier without promoting it
+ * @param name Item name
+ * @param hash hashName(name)
+ * @return Quantity, 0 if unknown
+ */
+int TieredItemStore::quantity(const string &name, NameHash hash) const
+{
+    if (!filter.mayContain(hash))
+        return 0;
+
+    const HotEntry *entry = const_cast<TieredItemStore *>(this)->findHot(name, hash);
+    if (entry)
+        return entry->quantity;
+
+    ColdRun *run = nullptr;
+    size_t coldPos = 0;
+    if (findCold(name, hash, run, coldPos))
+        return run->counts[coldPos];
+
+    filter.recordFalsePositive();
+    return 0;
+}
+
+/**
+ * @brief Starts loading the filter words and hot index slot quantity() reads first
+ * @param hash hashName of an item about to be read
+ * @return void
+ */
+void TieredItemStore::prefetch(NameHash hash) const
+{
+    filter.prefetch(hash);
+    if (!hotIndex.empty())
+        __builtin_prefetch(&hotIndex[static_cast<size_t>(hash) & (hotIndex.size() - 1)]);
+}
+
+/**
+ * @brief Appends every item with a positive quantity, sorted by name
+ * @param items Receives (name, quantity) pairs
+ * @return void
+ */
+void TieredItemStore::appendSorted(vector<pair<string, int>> &items) const
+{
+    Listing listing;
+    SliceMeter unlimited;
+    appendSortedStep(listing, items, unlimited);
+}
+
+/**
+ * @brief Appends the next items of a listing until done or out of budget
+ * @param listing Progress so far
+ * @param items Receives (name, quantity) pairs
+ * @param meter Budget of this slice, one unit per item
+ * @return true once every item has been appended
+ */
+bool TieredItemStore::appendSortedStep(Listing &listing, vector<pair<string, int>> &items, SliceMeter &meter) const
+{
+    vector<pair<string, int>> &hotItems = listing.hotItems;
+    vector<FrontCodedNames::Cursor> &cursors = listing.cursors;
+    vector<size_t> &heap = listing.heap;
+    auto after = [&cursors](size_t a, size_t b) { return cursorAfter(cursors, a, b); };
+
+    // The hot tier is at most a few hundred entries, so it is gathered at once
+    if (!listing.started)
+    {
+        for (const auto &entry : hot)
+        {
+            if (entry.live && entry.quantity > 0)
+                hotItems.emplace_back(entry.name, entry.quantity);
+        }
+        sort(hotItems.begin(), hotItems.end());
+        meter.take(hot.size());
+
+        cursors.assign(coldRuns.size(), FrontCodedNames::Cursor());
+        for (size_t i = 0; i < coldRuns.size(); ++i)
+        {
+            if (coldRuns[i]->live > 0 && coldRuns[i]->names.next(cursors[i]))
+                heap.push_back(i);
+        }
+        make_heap(heap.begin(), heap.end(), after);
+        listing.started = true;
+    }
+
+    while (!heap.empty() && meter.take())
+    {
+        const string &coldName = cursors[heap.front()].name;
+        while (listing.hotNext < hotItems.size() && hotItems[listing.hotNext].first < coldName)
+            items.push_back(std::move(hotItems[listing.hotNext++]));
+
+        pop_heap(heap.begin(), heap.end(), after);
+        size_t i = heap.back();
+        heap.pop_back();
+
+        const ColdRun &run = *coldRuns[i];
+        int count = run.counts[cursors[i].index - 1];
+        if (count > 0)
+            items.emplace_back(cursors[i].name, count);
+        if (run.names.next(cursors[i]))
+        {
+            heap.push_back(i);
+            push_heap(heap.begin(), heap.end(), after);
+        }
+    }
+    if (!heap.empty())
+        return false;
+
+    move(hotItems.begin() + listing.hotNext, hotItems.end(), back_inserter(items));
+    listing.hotNext = hotItems.size();
+    return true;
+}
@@ -0,0 +1,298 @@
+#include "WitcherTracker.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+ * @brief TraceRecorder implementation - binary capture of executed lines
+ *
+ * The hot path is one clock read, a few varints and a string append under
+ * an uncontended lock. Sealing a block copies it once into the writer's
+ * queue; the writer compresses it and is the only thread that touches
+ * the file. Compression needs no name dictionary: lines repeat within a
+ * block far more than LogCodec's keywords would add.
+ */
+
+static const char TRACE_MAGIC[4] = {'W', 'T', 'T', '1'};
+static const size_t BLOCK_HEADER_BYTES = 16;
+
+/**
+ * @brief Constructs a closed recorder
+ * @param concurrent true if lines may be recorded from several threads
+ */
+TraceRecorder::TraceRecorder(bool concurrent)
+    : concurrent(concurrent), fd(-1), origin(0), stopping(false), lines(0), rawBytes(0), bytes(0), blocks(0),
+      failed(false)
+{
+    int count = concurrent ? TRAFFIC_STRIPES : 1;
+    for (int i = 0; i < count; ++i)
+    {
+        stripes.emplace_back(new Stripe());
+    }
+}
+
+/**
+ * @brief Writes what is buffered and closes the file
+ */
+TraceRecorder::~TraceRecorder()
+{
+    close();
+}
+
+/**
+ * @brief Creates the trace file and starts the writer thread
+ * @param path File to create or truncate
+ * @return false if the file cannot be created or the recorder is already open
+ */
+bool TraceRecorder::open(const string &path)
+{
+    if (isOpen())
+        return false;
+
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    if (!writeAll(fd, TRACE_MAGIC, sizeof(TRACE_MAGIC)))
+    {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    bytes = sizeof(TRACE_MAGIC);
+    stopping = false;
+    origin = nowNanos();
+    writer = thread(&TraceRecorder::runWriter, this);
+    return true;
+}
+
+/**
+ * @brief Stripe buffering the calling thread's records
+ * @return The only stripe, or the one picked by the thread id
+ */
+TraceRecorder::Stripe &TraceRecorder::stripeOfThisThread()
+{
+    if (!concurrent)
+        return *stripes[0];
+
+    static thread_local size_t index = hash<thread::id>()(this_thread::get_id()) % TRAFFIC_STRIPES;
+    return *stripes[index];
+}
+
+/**
+ * @brief Captures one line
+ * @param session Connection or client the line came from
+ * @param line Line as received
+ * @return void
+ */
+void TraceRecorder::record(uint32_t session, const string &line)
+{
+    Stripe &stripe = stripeOfThisThread();
+    unique_lock<mutex> guard(stripe.lock, defer_lock);
+    if (concurrent)
+        guard.lock();
+
+    // Read under the lock, so the times within a block never decrease
+    uint64_t now = nowNanos() - origin;
+    if (stripe.count == 0)
+        stripe.first = stripe.last = now;
+    writeVarint(stripe.records, now - stripe.last);
+    writeVarint(stripe.records, session);
+    writeVarint(stripe.records, line.size());
+    stripe.records += line;
+    stripe.last = now;
+    stripe.count++;
+    lines.fetch_add(1, memory_order_relaxed);
+
+    if (stripe.records.size() >= TRACE_BLOCK_BYTES)
+        seal(stripe);
+}
+
+/**
+ * @brief Moves a stripe's records into a block queued for the writer
+ * @param stripe Stripe whose lock the caller holds (or a single-threaded stripe)
+ * @return void
+ */
+void TraceRecorder::seal(Stripe &stripe)
+{
+    if (stripe.count == 0)
+        return;
+
+    uint32_t header[2] = {static_cast<uint32_t>(stripe.records.size()), stripe.count};
+    string block(BLOCK_HEADER_BYTES + stripe.records.size(), '\0');
+    memcpy(&block[0], header, sizeof(header));
+    memcpy(&block[sizeof(header)], &stripe.first, sizeof(stripe.first));
+    memcpy(&block[BLOCK_HEADER_BYTES], stripe.records.data(), stripe.records.size());
+
+    // The buffer keeps its capacity for the next block
+    stripe.records.clear();
+    stripe.count = 0;
+
+    lock_guard<mutex> guard(queueLock);
+    sealed.push_back(move(block));
+    queueReady.notify_one();
+}
+
+/**
+ * @brief Writer thread: compresses sealed blocks and appends them to the file until close()
+ * @return void
+ */
+void TraceRecorder::runWriter()
+{
+    LogCodec codec((vector<string>()));
+    string frame;
+    unique_lock<mutex> guard(queueLock);
+    while (true)
+    {
+        queueReady.wait(guard, [this] { return stopping || !sealed.empty(); });
+        if (sealed.empty())
+            return;
+
+        string block = move(sealed.front());
+        sealed.pop_front();
+        guard.unlock();
+
+        // The header's byte count becomes that of the frame replacing the records
+        rawBytes.fetch_add(block.size() - BLOCK_HEADER_BYTES, memory_order_relaxed);
+        codec.compress(block.substr(BLOCK_HEADER_BYTES), frame);
+        uint32_t stored = static_cast<uint32_t>(frame.size());
+        memcpy(&block[0], &stored, sizeof(stored));
+        block.resize(BLOCK_HEADER_BYTES);
+        block += frame;
+
+        if (writeAll(fd, block.data(), block.size()))
+        {
+            bytes.fetch_add(block.size(), memory_order_relaxed);
+            blocks.fetch_add(1, memory_order_relaxed);
+        }
+        else
+        {
+            failed = true;
+        }
+        guard.lock();
+    }
+}
+
+/**
+ * @brief Seals every buffer, waits for the writer and closes the file
+ * @return false if a write failed at any point
+ *
+ * Lines recorded while this runs may be lost; stop executing first.
+ */
+bool TraceRecorder::close()
+{
+    if (!isOpen())
+        return !failed;
+
+    for (auto &stripe : stripes)
+    {
+        lock_guard<mutex> guard(stripe->lock);
+        seal(*stripe);
+    }
+    {
+        lock_guard<mutex> guard(queueLock);
+        stopping = true;
+        queueReady.notify_one();
+    }
+    writer.join();
+
+    if (::close(fd) != 0)
+        failed = true;
+    fd = -1;
+    return !failed;
+}
+
+/**
+ * @brief Writes the capture counters as one line
+ * @param out Stream receiving the line
+ * @return void
+ */
+void TraceRecorder::writeStats(ostream &out) const
+{
+    uint64_t recorded = lines.load(memory_order_relaxed);
+    uint64_t written = bytes.load(memory_order_relaxed);
+    uint64_t raw = rawBytes.load(memory_order_relaxed);
+
+    ostringstream line;
+    line << fixed << setprecision(1) << "trace: " << recorded << " lines, " << written << " bytes ("
+         << (recorded > 0 ? static_cast<double>(written) / recorded : 0.0) << " per line, "
+         << (raw > 0 ? 100.0 * written / raw : 0.0) << "% of the records), " << blocks.load(memory_order_relaxed)
+         << " blocks" << (failed ? ", WRITE FAILED" : "") << "\n";
+    out << line.str();
+}
+
+/**
+ * @brief Reads a whole trace
+ * @param path File written by a recorder
+ * @param events Receives the events in time order (stable for equal times)
+ * @param truncated Set if the file ends inside a block; events then holds the complete blocks before it
+ * @return false if the file cannot be read, is not a trace or has a damaged block
+ */
+bool TraceRecorder::load(const string &path, vector<TraceEvent> &events, bool &truncated)
+{
+    events.clear();
+    truncated = false;
+    ifstream in(path, ios::binary);
+    if (!in)
+        return false;
+    string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    if (data.size() < sizeof(TRACE_MAGIC) || memcmp(data.data(), TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0)
+        return false;
+
+    // Each block is in time order; blocks from different stripes are not
+    bool ordered = true;
+    string records;
+    size_t offset = sizeof(TRACE_MAGIC);
+    while (offset < data.size())
+    {
+        // A recorder stopped mid-write leaves a short last block; the blocks before it still replay
+        if (data.size() - offset < BLOCK_HEADER_BYTES)
+        {
+            truncated = true;
+            break;
+        }
+        uint32_t header[2];
+        uint64_t time;
+        memcpy(header, &data[offset], sizeof(header));
+        memcpy(&time, &data[offset + sizeof(header)], sizeof(time));
+        offset += BLOCK_HEADER_BYTES;
+        if (data.size() - offset < header[0])
+        {
+            truncated = true;
+            break;
+        }
+        if (!LogCodec::decompress(data.substr(offset, header[0]), records))
+            return false;
+        offset += header[0];
+
+        size_t pos = 0;
+        for (uint32_t i = 0; i < header[1]; ++i)
+        {
+            uint64_t delta, session, length;
+            size_t end = records.size();
+            if (!readVarint(records, pos, end, delta) || !readVarint(records, pos, end, session) ||
+                !readVarint(records, pos, end, length) || end - pos < length)
+                return false;
+            time += delta;
+            if (!events.empty() && time < events.back().nanos)
+                ordered = false;
+            events.push_back(TraceEvent{time, static_cast<uint32_t>(session), records.substr(pos, length)});
+            pos += length;
+        }
+        if (pos != records.size())
+            return false;
+    }
+
+    if (!ordered)
+    {
+        stable_sort(events.begin(), events.end(),
+                    [](const TraceEvent &left, const TraceEvent &right) { return left.nanos < right.nanos; });
+    }
+    return true;
+}
@@ -0,0 +1,163 @@
+#include "WitcherTracker.h"
+
+#include <chrono>
+
+using namespace std;
+
+/**
+ * @brief TraceReplayer implementation - paced replay of captured traffic
+ *
+ * Lines are spread over lanes by session, one thread per lane. Every lane
+ * schedules against the same start time, so the bursts and gaps between
+ * sessions are reproduced, not just those within one session.
+ */
+
+/**
+ * @struct TraceReplayer::Lane
+ * @brief The sessions one thread replays, with that thread's measurements
+ */
+struct TraceReplayer::Lane
+{
+    vector<size_t> events;          ///< Indexes of this lane's events, in time order
+    LatencyHistogram response;      ///< Due time to completion
+    LatencyHistogram service;       ///< executeLine time
+    uint64_t lines;                 ///< Lines replayed
+    uint64_t invalid;               ///< Lines rejected
+    uint64_t maxLagNanos;           ///< Longest start after the due time
+
+    Lane() : lines(0), invalid(0), maxLagNanos(0) {}
+};
+
+/**
+ * @brief Returns at a point on the monotonic clock, or at once if it has passed
+ * @param due Time to wait for, in nanoseconds
+ *
+ * Sleeps until TRACE_SPIN_NANOS before the time and spins the rest, since
+ * a sleep can overshoot by far more than the gaps inside a burst.
+ */
+static void waitUntil(uint64_t due)
+{
+    uint64_t now = nowNanos();
+    if (due > now + TRACE_SPIN_NANOS)
+        this_thread::sleep_for(chrono::nanoseconds(due - now - TRACE_SPIN_NANOS));
+    while (nowNanos() < due)
+    {
+        cpuRelax();
+    }
+}
+
+/**
+ * @brief Constructor
+ * @param tracker Tracker receiving the lines
+ * @param options Pacing and threads
+ */
+TraceReplayer::TraceReplayer(WitcherTracker &tracker, const ReplayOptions &options)
+    : tracker(tracker), options(options), lines(0), invalid(0), maxLagNanos(0), elapsedMillis(0)
+{
+}
+
+/**
+ * @brief Replays every event and returns when the last line has run
+ * @param events Events in time order
+ * @return void
+ *
+ * A tracker that is not concurrent is replayed from this thread alone,
+ * whatever options.threads says.
+ */
+void TraceReplayer::run(const vector<TraceEvent> &events)
+{
+    size_t laneCount = tracker.isConcurrent() ? static_cast<size_t>(max(options.threads, 1)) : 1;
+    vector<unique_ptr<Lane>> lanes;
+    for (size_t i = 0; i < laneCount; ++i)
+    {
+        lanes.emplace_back(new Lane());
+    }
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        lanes[events[i].session % laneCount]->events.push_back(i);
+    }
+
+    uint64_t start = nowNanos();
+    if (laneCount == 1)
+    {
+        runLane(*lanes[0], events, start);
+    }
+    else
+    {
+        vector<thread> runners;
+        for (auto &lane : lanes)
+        {
+            runners.emplace_back(&TraceReplayer::runLane, this, ref(*lane), cref(events), start);
+        }
+        for (auto &runner : runners)
+        {
+            runner.join();
+        }
+    }
+    elapsedMillis = (nowNanos() - start) / 1e6;
+
+    for (const auto &lane : lanes)
+    {
+        response.merge(lane->response);
+        service.merge(lane->service);
+        lines += lane->lines;
+        invalid += lane->invalid;
+        maxLagNanos = max(maxLagNanos, lane->maxLagNanos);
+    }
+}
+
+/**
+ * @brief Replays the events of one lane
+ * @param lane Lane to replay and measure
+ * @param events All events
+ * @param start Clock reading the first event of the trace is due at
+ * @return void
+ */
+void TraceReplayer::runLane(Lane &lane, const vector<TraceEvent> &events, uint64_t start)
+{
+    uint64_t origin = events.empty() ? 0 : events[0].nanos;
+    ostringstream sink;
+    for (size_t index : lane.events)
+    {
+        const TraceEvent &event = events[index];
+        uint64_t due = options.speed > 0 ? start + static_cast<uint64_t>((event.nanos - origin) / options.speed)
+                                         : nowNanos();
+        waitUntil(due);
+
+        uint64_t begin = nowNanos();
+        sink.str(string());
+        if (tracker.executeLine(event.line, sink, event.session) == -1)
+            lane.invalid++;
+        uint64_t end = nowNanos();
+
+        lane.maxLagNanos = max(lane.maxLagNanos, begin - due);
+        lane.service.record(end - begin);
+        lane.response.record(end - due);
+        lane.lines++;
+    }
+}
+
+/**
+ * @brief Writes a summary line and the response and service latency percentiles
+ * @param out Stream receiving the report
+ * @return void
+ *
+ * Format: "replay: <lines> lines (<invalid> invalid) in <ms> ms, <rate>
+ * lines/s at <speed>x pace on <threads> threads, up to <lag> us behind
+ * schedule", then the "latency response" and "latency service" lines.
+ */
+void TraceReplayer::writeReport(ostream &out) const
+{
+    ostringstream line;
+    line << fixed << setprecision(1) << "replay: " << lines << " lines (" << invalid << " invalid) in "
+         << elapsedMillis << " ms, " << (elapsedMillis > 0 ? lines * 1000.0 / elapsedMillis : 0.0) << " lines/s ";
+    if (options.speed > 0)
+        line << "at " << options.speed << "x pace";
+    else
+        line << "as fast as possible";
+    line << " on " << (tracker.isConcurrent() ? max(options.threads, 1) : 1) << " threads, up to "
+         << maxLagNanos / 1000.0 << " us behind schedule\n";
+    out << line.str();
+    response.writeReport(out, "response");
+    service.writeReport(out, "service");
+}
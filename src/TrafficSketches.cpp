@@ -0,0 +1,178 @@
+#include "WitcherTracker.h"
+
+#include <functional>
+
+using namespace std;
+
+/**
+ * @brief TrafficSketches implementation - per-category heavy hitters
+ */
+
+static const char *const CATEGORY_NAMES[TrafficSketches::CATEGORIES] = {"ingredients", "potions", "beasts", "signs",
+                                                                         "command shapes"};
+
+/**
+ * @brief Short label of a command type used in shape names
+ */
+static const char *shapeLabel(CommandType type)
+{
+    switch (type)
+    {
+    case CommandType::ACTION_LOOT:
+        return "loot";
+    case CommandType::ACTION_TRADE:
+        return "trade";
+    case CommandType::ACTION_BREW:
+        return "brew";
+    case CommandType::KNOWLEDGE_EFFECTIVENESS:
+        return "learn-effect";
+    case CommandType::KNOWLEDGE_POTION_FORMULA:
+        return "learn-formula";
+    case CommandType::ENCOUNTER:
+        return "encounter";
+    case CommandType::QUERY_SPECIFIC_INVENTORY:
+        return "query-item";
+    case CommandType::QUERY_ALL_INVENTORY:
+        return "query-all";
+    case CommandType::QUERY_BESTIARY:
+        return "query-beast";
+    case CommandType::QUERY_ALCHEMY:
+        return "query-recipe";
+    case CommandType::QUERY_STATE_DIGEST:
+        return "query-digest";
+    case CommandType::QUERY_RECOMMENDATION:
+        return "query-use";
+    case CommandType::QUERY_MULTI_INVENTORY:
+        return "query-items";
+    case CommandType::QUERY_MULTI_BESTIARY:
+        return "query-beasts";
+    case CommandType::EXIT_COMMAND:
+        return "exit";
+    default:
+        return "invalid";
+    }
+}
+
+/**
+ * @brief Constructs disabled sketches
+ * @param concurrent true to stripe across threads and lock each stripe
+ */
+TrafficSketches::TrafficSketches(bool concurrent) : concurrent(concurrent)
+{
+}
+
+/**
+ * @brief Allocates the sketches and starts counting
+ * @return void
+ */
+void TrafficSketches::enable()
+{
+    if (isEnabled())
+        return;
+
+    int count = concurrent ? TRAFFIC_STRIPES : 1;
+    for (int i = 0; i < count; ++i)
+    {
+        stripes.emplace_back(new Stripe());
+    }
+}
+
+/**
+ * @brief Stripe updated by the calling thread
+ * @return The only stripe, or the one picked by the thread id
+ */
+TrafficSketches::Stripe &TrafficSketches::stripeOfThisThread()
+{
+    if (!concurrent)
+        return *stripes[0];
+
+    static thread_local size_t index = hash<thread::id>()(this_thread::get_id()) % TRAFFIC_STRIPES;
+    return *stripes[index];
+}
+
+/**
+ * @brief Counts one occurrence of a name
+ * @param category What the name is
+ * @param hash hashName(name)
+ * @param name The name
+ * @return void
+ */
+void TrafficSketches::record(TrafficCategory category, NameHash hash, const string &name)
+{
+    if (!isEnabled())
+        return;
+
+    Stripe &stripe = stripeOfThisThread();
+    unique_lock<mutex> guard(stripe.lock, defer_lock);
+    if (concurrent)
+        guard.lock();
+    stripe.sketches[static_cast<int>(category)].add(hash, name);
+}
+
+/**
+ * @brief Counts one validated command by type and token count
+ * @param type Command type
+ * @param tokens Tokens in the command
+ * @return void
+ *
+ * The shape name, such as "loot/8", is short enough to stay in the
+ * string's inline buffer, so counting a shape does not allocate.
+ */
+void TrafficSketches::recordShape(CommandType type, size_t tokens)
+{
+    if (!isEnabled())
+        return;
+
+    string shape = shapeLabel(type);
+    shape += "/";
+    shape += to_string(tokens);
+    record(TrafficCategory::SHAPE, hashName(shape), shape);
+}
+
+/**
+ * @brief Merges the stripes of one category
+ * @param category Category to merge
+ * @return Sketch counting the category over all threads
+ */
+HeavyHitters TrafficSketches::merged(TrafficCategory category) const
+{
+    HeavyHitters total;
+    for (const auto &stripe : stripes)
+    {
+        unique_lock<mutex> guard(stripe->lock, defer_lock);
+        if (concurrent)
+            guard.lock();
+        total.merge(stripe->sketches[static_cast<int>(category)]);
+    }
+    return total;
+}
+
+/**
+ * @brief Writes the most frequent names of every category
+ * @param out Stream receiving the lines
+ * @return void
+ *
+ * Format: "top <category>: <name> <count>, ... (<total> total)"; counts
+ * are estimates that may exceed the true count by a small fraction of
+ * the total. Disabled sketches write nothing.
+ */
+void TrafficSketches::writeStats(ostream &out) const
+{
+    if (!isEnabled())
+        return;
+
+    for (int i = 0; i < CATEGORIES; ++i)
+    {
+        HeavyHitters category = merged(static_cast<TrafficCategory>(i));
+        vector<HeavyHitters::Hitter> top = category.top(TRAFFIC_TOP_K);
+
+        ostringstream line;
+        line << "top " << CATEGORY_NAMES[i] << ":";
+        for (size_t j = 0; j < top.size(); ++j)
+        {
+            line << (j > 0 ? ", " : " ") << top[j].name << " " << top[j].count;
+        }
+        line << " (" << category.total() << " total)\n";
+        out << line.str();
+    }
+}
@@ -1,5 +1,11 @@
 #include "WitcherTracker.h"
 
+#include <chrono>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
 using namespace std;
 
 /**
@@ -10,15 +16,195 @@ using namespace std;
  * and bestiary data. Handles all command execution and system interactions.
  */
 
+/**
+ * @brief Constructs a tracker
+ * @param concurrent true to enable per-subsystem locking for multi-threaded callers
+ * 
+ * A concurrent tracker shards its inventory so that commands touching
+ * different items do not contend on the same lock.
+ */
+WitcherTracker::WitcherTracker(bool concurrent)
+    : concurrent(concurrent), inventory(concurrent ? INVENTORY_SHARDS : 1), compactCursor(0), traffic(concurrent),
+      counters(concurrent), trace(nullptr)
+{
+    inventory.attachJoin(&counters);
+}
+
+/**
+ * @brief Maps a state file that holds the tracker's live state
+ * @param path State file, created if it does not exist
+ * @param durable true to msync at every step of each update
+ * @return false for a concurrent tracker or if the file cannot be used
+ * @side_effects Inventory, bestiary and alchemy knowledge read and write
+ *               the file from now on
+ */
+bool WitcherTracker::openStateFile(const string &path, bool durable)
+{
+    if (concurrent || lsmStore.isOpen() || !stateStore.open(path, durable))
+    {
+        return false;
+    }
+
+    inventory.attachStore(&stateStore);
+    bestiary.attachStore(&stateStore);
+    alchemy.attachStore(&stateStore);
+    rebuildJoin();
+    return true;
+}
+
+/**
+ * @brief Starts an out-of-core store that holds the inventory
+ * @param directory Directory receiving scratch run files
+ * @return false for a concurrent tracker, with a state file open or if
+ *         the directory cannot hold run files
+ * @side_effects The inventory reads and writes the store from now on
+ */
+bool WitcherTracker::openLsmStore(const string &directory)
+{
+    if (concurrent || stateStore.isOpen() || !lsmStore.open(directory))
+    {
+        return false;
+    }
+
+    inventory.attachLsm(&lsmStore);
+    return true;
+}
+
+/**
+ * @brief Rebuilds the counter join from the current knowledge and inventory
+ * @return void
+ * 
+ * Used when state appears without commands, as when a state file is opened.
+ */
+void WitcherTracker::rebuildJoin()
+{
+    counters.clear();
+    CommandLocks locks(concurrent);
+    locks.lockAlchemy(alchemy, false);
+    locks.lockBestiary(bestiary, false);
+    locks.lockAllInventory(inventory, false);
+
+    vector<string> names;
+    alchemy.collectPotionNames(names);
+    for (const auto &name : names)
+    {
+        Potion potion;
+        if (alchemy.getPotion(name, hashName(name), potion) && potion.hasFormula())
+        {
+            vector<int> held;
+            for (size_t i = 0; i < potion.ingredientNames.size(); ++i)
+            {
+                held.push_back(inventory.getIngredientQuantity(potion.ingredientNames[i], potion.ingredientHashes[i]));
+            }
+            counters.addRecipe(name, hashName(name), potion.ingredientNames, potion.ingredientHashes,
+                               potion.ingredientQuantities, held);
+        }
+    }
+
+    bestiary.collectBeastNames(names);
+    for (const auto &name : names)
+    {
+        NameHash hash = hashName(name);
+        Beast beast;
+        bestiary.getBeast(name, hash, beast);
+        for (size_t i = 0; i < beast.effectivePotions.size(); ++i)
+        {
+            counters.addEffectivePotion(name, hash, beast.effectivePotions[i], beast.potionHashes[i],
+                                        inventory.getPotionQuantity(beast.effectivePotions[i], beast.potionHashes[i]));
+        }
+        for (const auto &sign : beast.effectiveSigns)
+        {
+            counters.addEffectiveSign(name, hash, sign);
+        }
+    }
+}
+
+/**
+ * @brief Adds a newly learned recipe to the counter join
+ * @param locks Locks held by the learning command
+ * @param potionName Potion whose recipe was learned
+ * @param potionHash hashName(potionName)
+ * @param ingredients Ingredient names
+ * @param ingredientHashes hashName of each ingredient
+ * @param quantities Quantity of each ingredient
+ * @return void
+ * 
+ * The ingredient shards stay read-locked until the command ends, so no
+ * change of those ingredients falls between reading them and joining.
+ */
+void WitcherTracker::joinRecipe(CommandLocks &locks, const string &potionName, NameHash potionHash,
+                                const vector<string> &ingredients, const vector<NameHash> &ingredientHashes,
+                                const vector<int> &quantities)
+{
+    locks.lockInventory(inventory, ingredientHashes, false);
+
+    vector<int> held;
+    held.reserve(ingredients.size());
+    for (size_t i = 0; i < ingredients.size(); ++i)
+    {
+        held.push_back(inventory.getIngredientQuantity(ingredients[i], ingredientHashes[i]));
+    }
+    counters.addRecipe(potionName, potionHash, ingredients, ingredientHashes, quantities, held);
+}
+
+/**
+ * @class StoreUpdate
+ * @brief Scoped update of the state file; does nothing without one
+ *
+ * The update is left uncommitted when an exception escapes, so the next
+ * open rolls it back.
+ */
+class StoreUpdate
+{
+public:
+    explicit StoreUpdate(MappedStateStore &store) : store(store), active(store.isOpen())
+    {
+        if (active)
+            store.beginUpdate();
+    }
+
+    ~StoreUpdate()
+    {
+        if (active && !uncaught_exception())
+            store.commitUpdate();
+    }
+
+private:
+    StoreUpdate(const StoreUpdate &) = delete;
+    StoreUpdate &operator=(const StoreUpdate &) = delete;
+
+    MappedStateStore &store;
+    bool active;
+};
+
 /**
  * @brief Processes a single line of user input
  * @param line The raw input line from the user
  * @return 0 on successful execution, -1 on invalid input
  * 
- * Cleans input, validates command format, and delegates to appropriate execution method
+ * Responses are written to standard output
  */
 int WitcherTracker::executeLine(const string &line)
 {
+    return executeLine(line, cout);
+}
+
+/**
+ * @brief Processes a single line of user input
+ * @param line The raw input line from the user
+ * @param out Stream receiving the command's response
+ * @param session Connection or client the line came from, 0 for standard input
+ * @return 0 on successful execution, -1 on invalid input
+ * 
+ * Cleans input, validates command format, and delegates to appropriate execution method.
+ * A line starting with "EXPLAIN " runs the rest of the line through explainLine.
+ * An attached trace records the line as received, before any of that.
+ */
+int WitcherTracker::executeLine(const string &line, ostream &out, uint32_t session)
+{
+    if (trace)
+        trace->record(session, line);
+
     // Clean input to remove extra whitespace and newlines
     string inputCopy = CommandParser::cleanInputLine(line);
 
@@ -27,48 +213,509 @@ int WitcherTracker::executeLine(const string &line)
         return -1;
     }
 
+    if (inputCopy.compare(0, 8, "EXPLAIN ") == 0)
+    {
+        return explainLine(inputCopy.substr(8), out);
+    }
+
+    // Tokenize once; validation and execution share the tokens and name hashes
+    TokenizedCommand command;
+    CommandParser::tokenizeInput(inputCopy, command);
+
     CommandType cmdType;
     // Validate command format and determine type
-    if (CommandParser::isValidCommand(inputCopy, cmdType))
+    if (CommandParser::isValidCommand(inputCopy, command.tokens, cmdType))
     {
-        return executeCommand(inputCopy, cmdType);
+        traffic.recordShape(cmdType, command.tokens.size());
+        StoreUpdate update(stateStore);
+        return executeCommand(command, cmdType, out);
     }
 
     return -1;
 }
 
+/**
+ * @brief Starts a line as a command that runs in budgeted slices
+ * @param line The raw input line from the user
+ * @return Task to step until it finishes
+ */
+unique_ptr<CommandTask> WitcherTracker::startLine(const string &line)
+{
+    return unique_ptr<CommandTask>(new CommandTask(*this, line));
+}
+
+/**
+ * @brief Runs a command under EXPLAIN and reports what it cost
+ * @param line Command line without the "EXPLAIN " prefix
+ * @param out Stream receiving the command's response, then the report
+ * @return 0; a rejected command is reported rather than returned
+ * 
+ * Follows executeLine step by step with the counters active, timing each
+ * phase. The response is formatted into a buffer so its size can be
+ * reported; the report itself is written after the counters stop.
+ */
+int WitcherTracker::explainLine(const string &line, ostream &out)
+{
+    CommandExplain explain;
+    ostringstream response;
+    int status = -1;
+
+    explain.activate();
+    try
+    {
+        uint64_t start = nowNanos();
+        string inputCopy = CommandParser::cleanInputLine(line);
+        uint64_t cleaned = nowNanos();
+
+        TokenizedCommand command;
+        CommandParser::tokenizeInput(inputCopy, command);
+        uint64_t tokenized = nowNanos();
+
+        CommandType cmdType;
+        bool valid = !inputCopy.empty() && CommandParser::isValidCommand(inputCopy, command.tokens, cmdType);
+        uint64_t validated = nowNanos();
+
+        if (valid)
+        {
+            StoreUpdate update(stateStore);
+            status = executeCommand(command, cmdType, response);
+        }
+        uint64_t executed = nowNanos();
+
+        explain.tokens = command.tokens.size();
+        explain.cleanNanos = cleaned - start;
+        explain.tokenizeNanos = tokenized - cleaned;
+        explain.validateNanos = validated - tokenized;
+        explain.executeNanos = executed - validated;
+    }
+    catch (...)
+    {
+        explain.deactivate();
+        throw;
+    }
+    explain.deactivate();
+
+    string text = response.str();
+    explain.bytesFormatted = text.size();
+    out << text;
+    if (status == -1)
+        out << "INVALID\n";
+    explain.writeReport(out, line, status);
+    return 0;
+}
+
+/**
+ * @brief Formats one filter statistics line
+ * @param out Stream receiving the line
+ * @param name Structure the filter belongs to
+ * @param stats Counters to report
+ * @return void
+ */
+static void writeFilterStats(ostream &out, const string &name, const FilterStats &stats)
+{
+    ostringstream rate;
+    rate << fixed << setprecision(2) << stats.falsePositiveRate() * 100.0;
+    out << "filter " << name << ": " << stats.lookups << " lookups, " << stats.rejected << " rejected, "
+        << stats.falsePositives << " false positives (" << rate.str() << "% false positive rate)\n";
+}
+
+/**
+ * @brief Formats one container switch statistics line
+ * @param out Stream receiving the line
+ * @param name Structure the containers belong to
+ * @param stats Counters to report
+ * @return void
+ */
+static void writeContainerStats(ostream &out, const string &name, const ContainerStats &stats)
+{
+    out << "containers " << name << ": " << stats.toIndexed << " switched to indexed, " << stats.toLinear
+        << " switched to linear\n";
+}
+
+/**
+ * @brief Writes runtime statistics
+ * @param out Stream receiving the statistics
+ * @return void
+ * 
+ * Counters are read without locking; in a concurrent tracker each value is
+ * exact but the lines may come from slightly different moments. Traffic
+ * sketches are merged stripe by stripe under each stripe's lock.
+ */
+void WitcherTracker::writeStats(ostream &out) const
+{
+    writeFilterStats(out, "inventory", inventory.getFilterStats());
+    writeFilterStats(out, "bestiary", bestiary.getFilterStats());
+    writeFilterStats(out, "alchemy", alchemy.getFilterStats());
+    writeContainerStats(out, "inventory", inventory.getContainerStats());
+    writeContainerStats(out, "bestiary", bestiary.getContainerStats());
+    writeContainerStats(out, "alchemy", alchemy.getContainerStats());
+    if (lsmStore.isOpen())
+    {
+        LsmStats lsm = lsmStore.stats();
+        out << "lsm: " << lsm.runs << " runs, " << lsm.runBytes << " bytes on disk, " << lsm.flushes << " flushes, "
+            << lsm.merges << " merges, " << lsm.bytesWritten << " bytes written, " << lsm.blockReads
+            << " block reads\n";
+        writeFilterStats(out, "lsm runs", lsm.filter);
+    }
+    traffic.writeStats(out);
+}
+
+/**
+ * @brief Computes the digest of all state
+ * @return Sum of the inventory, bestiary and alchemy digests
+ * 
+ * Each subsystem keeps its digest current on every mutation, so this only
+ * adds a few words. In a concurrent tracker every subsystem is read-locked,
+ * so the digest reflects a single consistent moment.
+ */
+StateDigest WitcherTracker::getStateDigest() const
+{
+    CommandLocks locks(concurrent);
+    locks.lockAlchemy(alchemy, false);
+    locks.lockBestiary(bestiary, false);
+    locks.lockAllInventory(inventory, false);
+
+    StateDigest digest = inventory.getDigest();
+    digest += bestiary.getDigest();
+    digest += alchemy.getDigest();
+    return digest;
+}
+
+/**
+ * @brief Quantity of one item held
+ * @param category Ingredient, potion or trophy
+ * @param name Item name
+ * @param hash hashName(name)
+ * @return Quantity, 0 if not held
+ */
+int WitcherTracker::getItemQuantity(ItemCategory category, const string &name, NameHash hash) const
+{
+    CommandLocks locks(concurrent);
+    locks.lockInventory(inventory, vector<NameHash>(1, hash), false);
+
+    switch (category)
+    {
+    case ItemCategory::INGREDIENT:
+        return inventory.getIngredientQuantity(name, hash);
+    case ItemCategory::POTION:
+        return inventory.getPotionQuantity(name, hash);
+    default:
+        return inventory.getTrophyQuantity(name, hash);
+    }
+}
+
+/**
+ * @brief Checks whether the recipe of a potion is known
+ * @param name Potion name
+ * @param hash hashName(name)
+ * @return true if a formula for the potion has been learned
+ */
+bool WitcherTracker::knowsFormula(const string &name, NameHash hash) const
+{
+    CommandLocks locks(concurrent);
+    locks.lockAlchemy(alchemy, false);
+    return alchemy.hasPotion(name, hash);
+}
+
+/**
+ * @brief Runs one slice of online compaction
+ * @param budget Work and time the slice may take
+ * @return true when this slice completed a pass over every structure
+ * 
+ * A pass visits the inventory tables (shard by shard), the bestiary and
+ * the alchemy knowledge, each resuming where the previous slice stopped.
+ * Every step takes only the write lock of what it rebuilds, and releases
+ * it before the next structure is locked. Trimming the malloc heap ends
+ * the pass, in a slice of its own if the last step spent the budget.
+ */
+bool WitcherTracker::compactStep(const CommandBudget &budget)
+{
+    static const ItemCategory categories[] = {ItemCategory::INGREDIENT, ItemCategory::POTION, ItemCategory::TROPHY};
+    size_t tables = inventory.getShardCount() * 3;
+
+    SliceMeter meter(budget);
+    for (; compactCursor <= tables + 1; ++compactCursor)
+    {
+        bool done;
+        CommandLocks locks(concurrent);
+        if (compactCursor < tables)
+        {
+            size_t shard = compactCursor / 3;
+            locks.lockInventoryShards(inventory, vector<size_t>(1, shard), true);
+            done = inventory.compactTable(shard, categories[compactCursor % 3], meter);
+        }
+        else if (compactCursor == tables)
+        {
+            locks.lockBestiary(bestiary, true);
+            done = bestiary.freezeStep(meter);
+        }
+        else
+        {
+            locks.lockAlchemy(alchemy, true);
+            done = alchemy.freezeStep(meter);
+        }
+
+        // Each step stops only once the slice is spent
+        if (!done)
+            return false;
+    }
+
+#ifdef __GLIBC__
+    // Hand the pages freed by the pass back to the kernel, in a slice of its own
+    if (meter.exhausted())
+        return false;
+    malloc_trim(0);
+#endif
+    compactCursor = 0;
+    return true;
+}
+
+/**
+ * @brief Appends loot lines for a set of ingredients, each under MAX_INPUT_LENGTH
+ * @param loot Ingredient -> quantity to loot
+ * @param lines Receives the commands
+ * @return void
+ */
+static void appendLootLines(const map<string, long long> &loot, vector<string> &lines)
+{
+    string line;
+    for (const auto &item : loot)
+    {
+        string entry = to_string(item.second) + " " + item.first;
+        if (!line.empty() && line.size() + 2 + entry.size() >= static_cast<size_t>(MAX_INPUT_LENGTH))
+        {
+            lines.push_back(line);
+            line.clear();
+        }
+        line += line.empty() ? "Geralt loots " + entry : ", " + entry;
+    }
+    if (!line.empty())
+        lines.push_back(line);
+}
+
+/**
+ * @brief Writes the shortest command log that rebuilds the current state
+ * @param out Stream receiving one command per line
+ * @return Number of commands written
+ * 
+ * Order of the log:
+ *   1. every recipe, then every beast's effective signs and potions
+ *   2. one loot of each ingredient: what is held plus what the brews use
+ *   3. encounters for the trophies: a beast with an effective sign is
+ *      simply encountered again; otherwise one of its effective potions is
+ *      brewed right before each encounter, which consumes it
+ *   4. one brew per potion held
+ * No potion is held during step 3, so encounters consume only the potion
+ * brewed for them. Potions and trophies can only be produced by brewing and
+ * encountering, which is why those take one command per unit.
+ */
+size_t WitcherTracker::writeEquivalentLog(ostream &out) const
+{
+    CommandLocks locks(concurrent);
+    locks.lockAlchemy(alchemy, false);
+    locks.lockBestiary(bestiary, false);
+    locks.lockAllInventory(inventory, false);
+
+    vector<string> lines;
+
+    // Knowledge, and the recipes needed to reproduce potions
+    vector<string> potionNames;
+    alchemy.collectPotionNames(potionNames);
+    map<string, Potion> recipes;
+    for (const auto &name : potionNames)
+    {
+        Potion &recipe = recipes[name];
+        alchemy.getPotion(name, recipe);
+
+        string line = "Geralt learns " + name + " potion consists of ";
+        for (size_t i = 0; i < recipe.ingredientNames.size(); ++i)
+        {
+            line += (i > 0 ? ", " : "") + to_string(recipe.ingredientQuantities[i]) + " " + recipe.ingredientNames[i];
+        }
+        lines.push_back(line);
+    }
+
+    vector<string> beastNames;
+    bestiary.collectBeastNames(beastNames);
+    map<string, Beast> beasts;
+    for (const auto &name : beastNames)
+    {
+        Beast &beast = beasts[name];
+        bestiary.getBeast(name, beast);
+        for (const auto &sign : beast.effectiveSigns)
+        {
+            lines.push_back("Geralt learns " + sign + " sign is effective against " + name);
+        }
+        for (const auto &potion : beast.effectivePotions)
+        {
+            lines.push_back("Geralt learns " + potion + " potion is effective against " + name);
+        }
+    }
+
+    // Ingredients held, plus those consumed by the brews below
+    vector<pair<string, int>> items;
+    map<string, long long> loot;
+    inventory.collectItems(ItemCategory::INGREDIENT, items);
+    for (const auto &item : items)
+    {
+        loot[item.first] += item.second;
+    }
+
+    vector<string> brews;
+    auto brew = [&](const string &potion, int count)
+    {
+        const Potion &recipe = recipes[potion];
+        for (size_t i = 0; i < recipe.ingredientNames.size(); ++i)
+        {
+            loot[recipe.ingredientNames[i]] += static_cast<long long>(recipe.ingredientQuantities[i]) * count;
+        }
+    };
+
+    vector<string> encounters;
+    inventory.collectItems(ItemCategory::TROPHY, items);
+    for (const auto &item : items)
+    {
+        const Beast &beast = beasts[item.first];
+        string counter;
+        for (size_t i = 0; beast.effectiveSigns.empty() && counter.empty() && i < beast.effectivePotions.size(); ++i)
+        {
+            if (recipes.count(beast.effectivePotions[i]))
+                counter = beast.effectivePotions[i];
+        }
+        if (!counter.empty())
+        {
+            brew(counter, item.second);
+        }
+        for (int i = 0; i < item.second; ++i)
+        {
+            if (!counter.empty())
+                encounters.push_back("Geralt brews " + counter);
+            encounters.push_back("Geralt encounters a " + item.first);
+        }
+    }
+
+    inventory.collectItems(ItemCategory::POTION, items);
+    for (const auto &item : items)
+    {
+        brew(item.first, item.second);
+        brews.insert(brews.end(), item.second, "Geralt brews " + item.first);
+    }
+
+    appendLootLines(loot, lines);
+    lines.insert(lines.end(), encounters.begin(), encounters.end());
+    lines.insert(lines.end(), brews.begin(), brews.end());
+
+    for (const auto &line : lines)
+    {
+        out << line << "\n";
+    }
+    return lines.size();
+}
+
+/**
+ * @brief Lists every name the tracker knows, to seed a LogCodec
+ * @param names Receives item, beast, sign and potion names, most
+ *        frequently logged kinds first
+ * @return void
+ *
+ * Ingredients come first as loots make up most of a log, then potions,
+ * beasts and signs; each name is listed once.
+ */
+void WitcherTracker::collectKnownNames(vector<string> &names) const
+{
+    CommandLocks locks(concurrent);
+    locks.lockAlchemy(alchemy, false);
+    locks.lockBestiary(bestiary, false);
+    locks.lockAllInventory(inventory, false);
+
+    vector<string> ingredients, potions, beasts, signs;
+    vector<pair<string, int>> items;
+    inventory.collectItems(ItemCategory::INGREDIENT, items);
+    for (const auto &item : items)
+    {
+        ingredients.push_back(item.first);
+    }
+
+    alchemy.collectPotionNames(potions);
+    for (const auto &name : potions)
+    {
+        Potion recipe;
+        alchemy.getPotion(name, recipe);
+        ingredients.insert(ingredients.end(), recipe.ingredientNames.begin(), recipe.ingredientNames.end());
+    }
+    inventory.collectItems(ItemCategory::POTION, items);
+    for (const auto &item : items)
+    {
+        potions.push_back(item.first);
+    }
+
+    bestiary.collectBeastNames(beasts);
+    size_t known = beasts.size();
+    for (size_t i = 0; i < known; ++i)
+    {
+        Beast beast;
+        bestiary.getBeast(beasts[i], beast);
+        signs.insert(signs.end(), beast.effectiveSigns.begin(), beast.effectiveSigns.end());
+        potions.insert(potions.end(), beast.effectivePotions.begin(), beast.effectivePotions.end());
+    }
+    inventory.collectItems(ItemCategory::TROPHY, items);
+    for (const auto &item : items)
+    {
+        beasts.push_back(item.first);
+    }
+
+    set<string> listed;
+    for (const vector<string> *kind : {&ingredients, &potions, &beasts, &signs})
+    {
+        for (const auto &name : *kind)
+        {
+            if (listed.insert(name).second)
+                names.push_back(name);
+        }
+    }
+}
+
 /**
  * @brief Dispatches validated commands to appropriate execution methods
- * @param input The cleaned and validated input string
+ * @param command The cleaned, tokenized and validated input
  * @param cmdType The determined command type from validation
+ * @param out Stream receiving the response
  * @return 0 on successful execution, -1 on error
  * 
  * Central dispatcher that routes commands to specialized execution methods
  */
-int WitcherTracker::executeCommand(const string &input, CommandType cmdType)
+int WitcherTracker::executeCommand(const TokenizedCommand &command, CommandType cmdType, ostream &out)
 {
     switch (cmdType)
     {
     case CommandType::ACTION_LOOT:
-        return executeLootAction(input);
+        return executeLootAction(command, out);
     case CommandType::ACTION_TRADE:
-        return executeTradeAction(input);
+        return executeTradeAction(command, out);
     case CommandType::ACTION_BREW:
-        return executeBrewAction(input);
+        return executeBrewAction(command, out);
     case CommandType::KNOWLEDGE_EFFECTIVENESS:
-        return executeEffectivenessKnowledge(input);
+        return executeEffectivenessKnowledge(command, out);
     case CommandType::KNOWLEDGE_POTION_FORMULA:
-        return executeFormulaKnowledge(input);
+        return executeFormulaKnowledge(command, out);
     case CommandType::ENCOUNTER:
-        return executeEncounter(input);
+        return executeEncounter(command, out);
     case CommandType::QUERY_SPECIFIC_INVENTORY:
-        return executeSpecificInventoryQuery(input);
+        return executeSpecificInventoryQuery(command, out);
     case CommandType::QUERY_ALL_INVENTORY:
-        return executeAllInventoryQuery(input);
+        return executeAllInventoryQuery(command, out);
     case CommandType::QUERY_BESTIARY:
-        return executeBestiaryQuery(input);
+        return executeBestiaryQuery(command, out);
     case CommandType::QUERY_ALCHEMY:
-        return executeAlchemyQuery(input);
+        return executeAlchemyQuery(command, out);
+    case CommandType::QUERY_STATE_DIGEST:
+        return executeStateDigestQuery(command, out);
+    case CommandType::QUERY_RECOMMENDATION:
+        return executeRecommendationQuery(command, out);
+    case CommandType::QUERY_MULTI_INVENTORY:
+        return executeMultiInventoryQuery(command, out);
+    case CommandType::QUERY_MULTI_BESTIARY:
+        return executeMultiBestiaryQuery(command, out);
     case CommandType::EXIT_COMMAND:
         return 0;
     default:
@@ -78,31 +725,34 @@ int WitcherTracker::executeCommand(const string &input, CommandType cmdType)
 
 /**
  * @brief Executes loot action commands
- * @param input The validated loot command string
+ * @param command The validated, tokenized loot command
+ * @param out Stream receiving the response
  * @return 0 on successful execution
  * 
  * Parses ingredient quantities and names, adds them to inventory
  * Format: "Geralt loots quantity ingredient [, quantity ingredient]..."
  */
-int WitcherTracker::executeLootAction(const string &input)
+int WitcherTracker::executeLootAction(const TokenizedCommand &command, ostream &out)
 {
-    auto tokens = CommandParser::tokenizeInput(input);
+    const vector<string> &tokens = command.tokens;
 
     // Parse ingredient-quantity pairs starting after "Geralt loots"
+    vector<string> ingredientNames;
+    vector<NameHash> ingredientHashes;
+    vector<int> quantities;
     size_t tokenIndex = 2;
 
     while (tokenIndex < tokens.size())
     {
         // Extract quantity and ingredient name
-        int quantity = stoi(tokens[tokenIndex]);
+        quantities.push_back(stoi(tokens[tokenIndex]));
         tokenIndex++;
 
-        string ingredientName = tokens[tokenIndex];
+        ingredientNames.push_back(tokens[tokenIndex]);
+        ingredientHashes.push_back(command.hash(tokenIndex));
+        traffic.record(TrafficCategory::INGREDIENT, command.hash(tokenIndex), tokens[tokenIndex]);
         tokenIndex++;
 
-        // Add to inventory
-        inventory.addIngredient(ingredientName, quantity);
-
         // Skip comma separator if present
         if (tokenIndex < tokens.size() && tokens[tokenIndex] == ",")
         {
@@ -110,22 +760,32 @@ int WitcherTracker::executeLootAction(const string &input)
         }
     }
 
-    cout << "Alchemy ingredients obtained\n";
+    // Add to inventory under the locks of the affected shards only
+    CommandLocks locks(concurrent);
+    locks.lockInventory(inventory, ingredientHashes, true);
+
+    for (size_t i = 0; i < ingredientNames.size(); ++i)
+    {
+        inventory.addIngredient(ingredientNames[i], ingredientHashes[i], quantities[i]);
+    }
+
+    out << "Alchemy ingredients obtained\n";
     return 0;
 }
 
 /**
  * @brief Executes trade action commands
- * @param input The validated trade command string
+ * @param command The validated, tokenized trade command
+ * @param out Stream receiving the response
  * @return 0 on successful execution
  * 
  * Parses trophy requirements and ingredient rewards, validates sufficient trophies,
  * and performs the exchange if possible
  * Format: "Geralt trades quantity monster [, quantity monster] trophy for quantity ingredient [, quantity ingredient]..."
  */
-int WitcherTracker::executeTradeAction(const string &input)
+int WitcherTracker::executeTradeAction(const TokenizedCommand &command, ostream &out)
 {
-    auto tokens = CommandParser::tokenizeInput(input);
+    const vector<string> &tokens = command.tokens;
 
     // Find "for" keyword to separate trophy and ingredient lists
     size_t forIndex = 0;
@@ -140,6 +800,7 @@ int WitcherTracker::executeTradeAction(const string &input)
 
     // Parse required trophies (before "for")
     vector<pair<string, int>> requiredTrophies;
+    vector<NameHash> trophyHashes;
     size_t tokenIndex = 2;
 
     while (tokenIndex < forIndex)
@@ -148,6 +809,8 @@ int WitcherTracker::executeTradeAction(const string &input)
         tokenIndex++;
 
         string trophyName = tokens[tokenIndex];
+        trophyHashes.push_back(command.hash(tokenIndex));
+        traffic.record(TrafficCategory::BEAST, command.hash(tokenIndex), trophyName);
         tokenIndex++;
 
         requiredTrophies.emplace_back(trophyName, quantity);
@@ -165,6 +828,7 @@ int WitcherTracker::executeTradeAction(const string &input)
 
     // Parse gained ingredients (after "for")
     vector<pair<string, int>> gainedIngredients;
+    vector<NameHash> ingredientHashes;
     tokenIndex = forIndex + 1;
 
     while (tokenIndex < tokens.size())
@@ -173,6 +837,8 @@ int WitcherTracker::executeTradeAction(const string &input)
         tokenIndex++;
 
         string ingredientName = tokens[tokenIndex];
+        ingredientHashes.push_back(command.hash(tokenIndex));
+        traffic.record(TrafficCategory::INGREDIENT, command.hash(tokenIndex), ingredientName);
         tokenIndex++;
 
         gainedIngredients.emplace_back(ingredientName, quantity);
@@ -184,11 +850,18 @@ int WitcherTracker::executeTradeAction(const string &input)
         }
     }
 
+    // Lock every shard touched by either side of the trade
+    vector<NameHash> touchedItems = trophyHashes;
+    touchedItems.insert(touchedItems.end(), ingredientHashes.begin(), ingredientHashes.end());
+
+    CommandLocks locks(concurrent);
+    locks.lockInventory(inventory, touchedItems, true);
+
     // Validate sufficient trophy quantities before trade
     bool hasEnoughTrophies = true;
-    for (const auto &trophy : requiredTrophies)
+    for (size_t i = 0; i < requiredTrophies.size(); ++i)
     {
-        if (inventory.getTrophyQuantity(trophy.first) < trophy.second)
+        if (inventory.getTrophyQuantity(requiredTrophies[i].first, trophyHashes[i]) < requiredTrophies[i].second)
         {
             hasEnoughTrophies = false;
             break;
@@ -197,60 +870,65 @@ int WitcherTracker::executeTradeAction(const string &input)
 
     if (!hasEnoughTrophies)
     {
-        cout << "Not enough trophies\n";
+        out << "Not enough trophies\n";
         return 0;
     }
 
     // Execute the trade: remove trophies and add ingredients
-    for (const auto &trophy : requiredTrophies)
+    for (size_t i = 0; i < requiredTrophies.size(); ++i)
     {
-        inventory.removeTrophy(trophy.first, trophy.second);
+        inventory.removeTrophy(requiredTrophies[i].first, trophyHashes[i], requiredTrophies[i].second);
     }
 
-    for (const auto &ingredient : gainedIngredients)
+    for (size_t i = 0; i < gainedIngredients.size(); ++i)
     {
-        inventory.addIngredient(ingredient.first, ingredient.second);
+        inventory.addIngredient(gainedIngredients[i].first, ingredientHashes[i], gainedIngredients[i].second);
     }
 
-    cout << "Trade successful\n";
+    out << "Trade successful\n";
     return 0;
 }
 
 /**
  * @brief Executes brew action commands
- * @param input The validated brew command string
+ * @param command The validated, tokenized brew command
+ * @param out Stream receiving the response
  * @return 0 on successful execution
  * 
  * Checks for known formula and sufficient ingredients, consumes ingredients
  * and creates potion if conditions are met
  * Format: "Geralt brews <potion_name>"
  */
-int WitcherTracker::executeBrewAction(const string &input)
+int WitcherTracker::executeBrewAction(const TokenizedCommand &command, ostream &out)
 {
-    auto tokens = CommandParser::tokenizeInput(input);
+    const vector<string> &tokens = command.tokens;
 
     // Extract potion name (everything after "Geralt brews")
-    string potionName;
-    for (size_t i = 2; i < tokens.size(); ++i)
-    {
-        if (i > 2)
-            potionName += " ";
-        potionName += tokens[i];
-    }
+    NameHash potionHash;
+    string potionName = CommandParser::joinTokens(command, 2, tokens.size(), potionHash);
+    traffic.record(TrafficCategory::POTION, potionHash, potionName);
+
+    // Formula is read under the alchemy lock, which stays held while brewing
+    CommandLocks locks(concurrent);
+    locks.lockAlchemy(alchemy, false);
 
     // Check if formula is known
-    Potion *potion = alchemy.getPotion(potionName);
-    if (!potion || !potion->hasFormula())
+    Potion potion;
+    if (!alchemy.getPotion(potionName, potionHash, potion) || !potion.hasFormula())
     {
-        cout << "No formula for " << potionName << "\n";
+        out << "No formula for " << potionName << "\n";
         return 0;
     }
 
+    vector<NameHash> touchedItems = potion.ingredientHashes;
+    touchedItems.push_back(potionHash);
+    locks.lockInventory(inventory, touchedItems, true);
+
     // Validate sufficient ingredients for brewing
     bool hasEnoughIngredients = true;
-    for (size_t i = 0; i < potion->ingredientNames.size(); ++i)
+    for (size_t i = 0; i < potion.ingredientNames.size(); ++i)
     {
-        if (inventory.getIngredientQuantity(potion->ingredientNames[i]) < potion->ingredientQuantities[i])
+        if (inventory.getIngredientQuantity(potion.ingredientNames[i], potion.ingredientHashes[i]) < potion.ingredientQuantities[i])
         {
             hasEnoughIngredients = false;
             break;
@@ -259,33 +937,34 @@ int WitcherTracker::executeBrewAction(const string &input)
 
     if (!hasEnoughIngredients)
     {
-        cout << "Not enough ingredients\n";
+        out << "Not enough ingredients\n";
         return 0;
     }
 
     // Consume ingredients and create potion
-    for (size_t i = 0; i < potion->ingredientNames.size(); ++i)
+    for (size_t i = 0; i < potion.ingredientNames.size(); ++i)
     {
-        inventory.removeIngredient(potion->ingredientNames[i], potion->ingredientQuantities[i]);
+        inventory.removeIngredient(potion.ingredientNames[i], potion.ingredientHashes[i], potion.ingredientQuantities[i]);
     }
 
-    inventory.addPotion(potionName, 1);
+    inventory.addPotion(potionName, potionHash, 1);
 
-    cout << "Alchemy item created: " << potionName << "\n";
+    out << "Alchemy item created: " << potionName << "\n";
     return 0;
 }
 
 /**
  * @brief Executes effectiveness knowledge commands
- * @param input The validated effectiveness knowledge string
+ * @param command The validated, tokenized effectiveness knowledge
+ * @param out Stream receiving the response
  * @return 0 on successful execution
  * 
  * Parses item effectiveness information, updates bestiary, and adds items to alchemy knowledge
  * Format: "Geralt learns <item> potion/sign is effective against <monster>"
  */
-int WitcherTracker::executeEffectivenessKnowledge(const string &input)
+int WitcherTracker::executeEffectivenessKnowledge(const TokenizedCommand &command, ostream &out)
 {
-    auto tokens = CommandParser::tokenizeInput(input);
+    const vector<string> &tokens = command.tokens;
 
     // Find key indices for parsing
     size_t isIndex = 0, againstIndex = 0;
@@ -310,6 +989,8 @@ int WitcherTracker::executeEffectivenessKnowledge(const string &input)
 
     // Extract counter name (before "sign/potion")
     string counterName;
+    size_t counterIndex = 0;
+    size_t counterTokens = 0;
     for (size_t i = 2; i < isIndex; ++i)
     {
         if (tokens[i] != "sign" && tokens[i] != "potion")
@@ -317,21 +998,31 @@ int WitcherTracker::executeEffectivenessKnowledge(const string &input)
             if (!counterName.empty())
                 counterName += " ";
             counterName += tokens[i];
+            counterIndex = i;
+            counterTokens++;
         }
     }
 
+    // A single-token name shares its token's hash; a longer one is hashed whole
+    NameHash counterHash = counterTokens == 1 ? command.hash(counterIndex) : hashName(counterName);
+
     // Extract monster name (after "against")
-    string monsterName;
-    for (size_t i = againstIndex + 1; i < tokens.size(); ++i)
+    NameHash monsterHash;
+    string monsterName = CommandParser::joinTokens(command, againstIndex + 1, tokens.size(), monsterHash);
+    traffic.record(isSign ? TrafficCategory::SIGN : TrafficCategory::POTION, counterHash, counterName);
+    traffic.record(TrafficCategory::BEAST, monsterHash, monsterName);
+
+    // Signs are also recorded in alchemy knowledge, which is locked first
+    CommandLocks locks(concurrent);
+    if (isSign)
     {
-        if (i > againstIndex + 1)
-            monsterName += " ";
-        monsterName += tokens[i];
+        locks.lockAlchemy(alchemy, true);
     }
+    locks.lockBestiary(bestiary, true);
 
     // Check for existing beast and knowledge
-    Beast *existingBeast = bestiary.getBeast(monsterName);
-    bool beastExists = (existingBeast != nullptr);
+    Beast existingBeast;
+    bool beastExists = bestiary.getBeast(monsterName, monsterHash, existingBeast);
 
     // Check if effectiveness is already known
     bool alreadyKnown = false;
@@ -339,39 +1030,45 @@ int WitcherTracker::executeEffectivenessKnowledge(const string &input)
     {
         if (isSign)
         {
-            const auto &signs = existingBeast->effectiveSigns;
-            alreadyKnown = find(signs.begin(), signs.end(), counterName) != signs.end();
+            alreadyKnown = existingBeast.hasEffectiveSign(counterName, counterHash);
         }
         else
         {
-            const auto &potions = existingBeast->effectivePotions;
-            alreadyKnown = find(potions.begin(), potions.end(), counterName) != potions.end();
+            alreadyKnown = existingBeast.hasEffectivePotion(counterName, counterHash);
         }
     }
 
     if (alreadyKnown)
     {
-        cout << "Already known effectiveness\n";
+        out << "Already known effectiveness\n";
     }
     else
     {
         // Add to bestiary and alchemy knowledge
-        bestiary.addEffectiveness(monsterName, counterName, isSign);
+        bestiary.addEffectiveness(monsterName, monsterHash, counterName, counterHash, isSign);
 
         // Add sign to alchemy knowledge if not already known
         if (isSign)
         {
-            alchemy.addSign(counterName);
+            alchemy.addSign(counterName, counterHash);
+            counters.addEffectiveSign(monsterName, monsterHash, counterName);
+        }
+        else
+        {
+            // The potion's shard stays read-locked so its stock cannot change before it is joined
+            locks.lockInventory(inventory, vector<NameHash>(1, counterHash), false);
+            counters.addEffectivePotion(monsterName, monsterHash, counterName, counterHash,
+                                        inventory.getPotionQuantity(counterName, counterHash));
         }
 
         // Output appropriate message based on beast existence
         if (beastExists)
         {
-            cout << "Bestiary entry updated: " << monsterName << "\n";
+            out << "Bestiary entry updated: " << monsterName << "\n";
         }
         else
         {
-            cout << "New bestiary entry added: " << monsterName << "\n";
+            out << "New bestiary entry added: " << monsterName << "\n";
         }
     }
 
@@ -380,15 +1077,16 @@ int WitcherTracker::executeEffectivenessKnowledge(const string &input)
 
 /**
  * @brief Executes potion formula knowledge commands
- * @param input The validated formula knowledge string
+ * @param command The validated, tokenized formula knowledge
+ * @param out Stream receiving the response
  * @return 0 on successful execution
  * 
  * Parses potion formula ingredients and quantities, adds to alchemy knowledge if new
  * Format: "Geralt learns <potion> potion consists of quantity ingredient [, quantity ingredient]..."
  */
-int WitcherTracker::executeFormulaKnowledge(const string &input)
+int WitcherTracker::executeFormulaKnowledge(const TokenizedCommand &command, ostream &out)
 {
-    auto tokens = CommandParser::tokenizeInput(input);
+    const vector<string> &tokens = command.tokens;
 
     // Find key indices for parsing
     size_t potionIndex = 0, ofIndex = 0;
@@ -407,23 +1105,23 @@ int WitcherTracker::executeFormulaKnowledge(const string &input)
     }
 
     // Extract potion name (before "potion")
-    string potionName;
-    for (size_t i = 2; i < potionIndex; ++i)
-    {
-        if (i > 2)
-            potionName += " ";
-        potionName += tokens[i];
-    }
+    NameHash potionHash;
+    string potionName = CommandParser::joinTokens(command, 2, potionIndex, potionHash);
+    traffic.record(TrafficCategory::POTION, potionHash, potionName);
+
+    CommandLocks locks(concurrent);
+    locks.lockAlchemy(alchemy, true);
 
     // Check if formula already known
-    if (alchemy.hasPotion(potionName))
+    if (alchemy.hasPotion(potionName, potionHash))
     {
-        cout << "Already known formula\n";
+        out << "Already known formula\n";
         return 0;
     }
 
     // Parse ingredient list (after "of")
     vector<string> ingredients;
+    vector<NameHash> ingredientHashes;
     vector<int> quantities;
 
     size_t tokenIndex = ofIndex + 1;
@@ -433,9 +1131,12 @@ int WitcherTracker::executeFormulaKnowledge(const string &input)
         tokenIndex++;
 
         string ingredientName = tokens[tokenIndex];
+        NameHash ingredientHash = command.hash(tokenIndex);
+        traffic.record(TrafficCategory::INGREDIENT, ingredientHash, ingredientName);
         tokenIndex++;
 
         ingredients.push_back(ingredientName);
+        ingredientHashes.push_back(ingredientHash);
         quantities.push_back(quantity);
 
         // Skip comma if present
@@ -446,49 +1147,55 @@ int WitcherTracker::executeFormulaKnowledge(const string &input)
     }
 
     // Add formula to alchemy knowledge
-    alchemy.addPotionFormula(potionName, ingredients, quantities);
+    alchemy.addPotionFormula(potionName, potionHash, ingredients, quantities, ingredientHashes);
+    joinRecipe(locks, potionName, potionHash, ingredients, ingredientHashes, quantities);
 
-    cout << "New alchemy formula obtained: " << potionName << "\n";
+    out << "New alchemy formula obtained: " << potionName << "\n";
     return 0;
 }
 
 /**
  * @brief Executes encounter commands
- * @param input The validated encounter string
+ * @param command The validated, tokenized encounter
+ * @param out Stream receiving the response
  * @return 0 on successful execution
  * 
  * Handles monster encounters, checks for effective counters, consumes potions,
  * and awards trophies or reports failure
  * Format: "Geralt encounters a <monster>"
  */
-int WitcherTracker::executeEncounter(const string &input)
+int WitcherTracker::executeEncounter(const TokenizedCommand &command, ostream &out)
 {
-    auto tokens = CommandParser::tokenizeInput(input);
+    const vector<string> &tokens = command.tokens;
 
     // Extract monster name (after "a")
-    string monsterName;
-    for (size_t i = 3; i < tokens.size(); ++i)
-    {
-        if (i > 3)
-            monsterName += " ";
-        monsterName += tokens[i];
-    }
+    NameHash monsterHash;
+    string monsterName = CommandParser::joinTokens(command, 3, tokens.size(), monsterHash);
+    traffic.record(TrafficCategory::BEAST, monsterHash, monsterName);
+
+    CommandLocks locks(concurrent);
+    locks.lockBestiary(bestiary, false);
 
     // Check if beast is known
-    Beast *beast = bestiary.getBeast(monsterName);
-    if (!beast)
+    Beast beast;
+    if (!bestiary.getBeast(monsterName, monsterHash, beast))
     {
-        cout << "Geralt is unprepared and barely escapes with his life\n";
+        out << "Geralt is unprepared and barely escapes with his life\n";
         return 0;
     }
 
+    // Effective potions may be consumed and a trophy awarded
+    vector<NameHash> touchedItems = beast.potionHashes;
+    touchedItems.push_back(monsterHash);
+    locks.lockInventory(inventory, touchedItems, true);
+
     // Check for effective counters in inventory or signs
     bool hasEffectiveCounter = false;
 
     // Check for effective potions in inventory
-    for (const auto &potionName : beast->effectivePotions)
+    for (size_t i = 0; i < beast.effectivePotions.size(); ++i)
     {
-        if (inventory.getPotionQuantity(potionName) > 0)
+        if (inventory.getPotionQuantity(beast.effectivePotions[i], beast.potionHashes[i]) > 0)
         {
             hasEffectiveCounter = true;
             break;
@@ -496,7 +1203,7 @@ int WitcherTracker::executeEncounter(const string &input)
     }
 
     // Check for effective signs (always available if known)
-    if (!hasEffectiveCounter && !beast->effectiveSigns.empty())
+    if (!hasEffectiveCounter && !beast.effectiveSigns.empty())
     {
         hasEffectiveCounter = true;
     }
@@ -504,21 +1211,21 @@ int WitcherTracker::executeEncounter(const string &input)
     if (hasEffectiveCounter)
     {
         // Consume one of each effective potion in inventory
-        for (const auto &potionName : beast->effectivePotions)
+        for (size_t i = 0; i < beast.effectivePotions.size(); ++i)
         {
-            if (inventory.getPotionQuantity(potionName) > 0)
+            if (inventory.getPotionQuantity(beast.effectivePotions[i], beast.potionHashes[i]) > 0)
             {
-                inventory.removePotion(potionName, 1);
+                inventory.removePotion(beast.effectivePotions[i], beast.potionHashes[i], 1);
             }
         }
 
         // Award trophy for successful encounter
-        inventory.addTrophy(monsterName, 1);
-        cout << "Geralt defeats " << monsterName << "\n";
+        inventory.addTrophy(monsterName, monsterHash, 1);
+        out << "Geralt defeats " << monsterName << "\n";
     }
     else
     {
-        cout << "Geralt is unprepared and barely escapes with his life\n";
+        out << "Geralt is unprepared and barely escapes with his life\n";
     }
 
     return 0;
@@ -526,61 +1233,68 @@ int WitcherTracker::executeEncounter(const string &input)
 
 /**
  * @brief Executes specific inventory queries
- * @param input The validated specific inventory query string
+ * @param command The validated, tokenized specific inventory query
+ * @param out Stream receiving the response
  * @return 0 on successful execution
  * 
  * Queries inventory for specific item quantity and outputs the result
  * Format: "Total <category> <item> ?"
  */
-int WitcherTracker::executeSpecificInventoryQuery(const string &input)
+int WitcherTracker::executeSpecificInventoryQuery(const TokenizedCommand &command, ostream &out)
 {
-    auto tokens = CommandParser::tokenizeInput(input);
+    const vector<string> &tokens = command.tokens;
 
     string category = tokens[1];
 
     // Extract item name (everything between category and "?")
-    string itemName;
-    for (size_t i = 2; i < tokens.size() - 1; ++i)
-    {
-        if (i > 2)
-            itemName += " ";
-        itemName += tokens[i];
-    }
+    NameHash itemHash;
+    string itemName = CommandParser::joinTokens(command, 2, tokens.size() - 1, itemHash);
+    traffic.record(category == "ingredient" ? TrafficCategory::INGREDIENT
+                   : category == "potion"   ? TrafficCategory::POTION
+                                            : TrafficCategory::BEAST,
+                   itemHash, itemName);
+
+    CommandLocks locks(concurrent);
+    locks.lockInventory(inventory, vector<NameHash>(1, itemHash), false);
 
     // Query appropriate inventory category
     int quantity = 0;
     if (category == "ingredient")
     {
-        quantity = inventory.getIngredientQuantity(itemName);
+        quantity = inventory.getIngredientQuantity(itemName, itemHash);
     }
     else if (category == "potion")
     {
-        quantity = inventory.getPotionQuantity(itemName);
+        quantity = inventory.getPotionQuantity(itemName, itemHash);
     }
     else if (category == "trophy")
     {
-        quantity = inventory.getTrophyQuantity(itemName);
+        quantity = inventory.getTrophyQuantity(itemName, itemHash);
     }
 
-    cout << quantity << "\n";
+    out << quantity << "\n";
     return 0;
 }
 
 /**
  * @brief Executes general inventory queries
- * @param input The validated general inventory query string
+ * @param command The validated, tokenized general inventory query
+ * @param out Stream receiving the response
  * @return 0 on successful execution
  * 
  * Outputs all items in specified category or "None" if empty
  * Format: "Total <category> ?"
  */
-int WitcherTracker::executeAllInventoryQuery(const string &input)
+int WitcherTracker::executeAllInventoryQuery(const TokenizedCommand &command, ostream &out)
 {
-    auto tokens = CommandParser::tokenizeInput(input);
+    const vector<string> &tokens = command.tokens;
 
     string category = tokens[1];
     string result;
 
+    CommandLocks locks(concurrent);
+    locks.lockAllInventory(inventory, false);
+
     // Get all items from appropriate category
     if (category == "ingredient")
     {
@@ -598,11 +1312,11 @@ int WitcherTracker::executeAllInventoryQuery(const string &input)
     // Output result or "None" if empty
     if (result.empty())
     {
-        cout << "None\n";
+        out << "None\n";
     }
     else
     {
-        cout << result << "\n";
+        out << result << "\n";
     }
 
     return 0;
@@ -610,37 +1324,36 @@ int WitcherTracker::executeAllInventoryQuery(const string &input)
 
 /**
  * @brief Executes bestiary queries
- * @param input The validated bestiary query string
+ * @param command The validated, tokenized bestiary query
+ * @param out Stream receiving the response
  * @return 0 on successful execution
  * 
  * Outputs effective counters for specified monster or reports no knowledge
  * Format: "What is effective against <monster> ?"
  */
-int WitcherTracker::executeBestiaryQuery(const string &input)
+int WitcherTracker::executeBestiaryQuery(const TokenizedCommand &command, ostream &out)
 {
-    auto tokens = CommandParser::tokenizeInput(input);
+    const vector<string> &tokens = command.tokens;
 
     // Extract monster name (between "against" and "?")
-    string monsterName;
     size_t startIndex = 4; // After "What is effective against"
+    NameHash monsterHash;
+    string monsterName = CommandParser::joinTokens(command, startIndex, tokens.size() - 1, monsterHash);
+    traffic.record(TrafficCategory::BEAST, monsterHash, monsterName);
 
-        for (size_t i = startIndex; i < tokens.size() - 1; ++i)
-    {
-        if (i > startIndex)
-            monsterName += " ";
-        monsterName += tokens[i];
-    }
+    CommandLocks locks(concurrent);
+    locks.lockBestiary(bestiary, false);
 
-    string result = bestiary.getEffectiveCounters(monsterName);
+    string result = bestiary.getEffectiveCounters(monsterName, monsterHash);
 
     // Output effective counters or report no knowledge
     if (result.empty())
     {
-        cout << "No knowledge of " << monsterName << "\n";
+        out << "No knowledge of " << monsterName << "\n";
     }
     else
     {
-        cout << result << "\n";
+        out << result << "\n";
     }
 
     return 0;
@@ -648,36 +1361,519 @@ int WitcherTracker::executeBestiaryQuery(const string &input)
 
 /**
  * @brief Executes alchemy queries
- * @param input The validated alchemy query string
+ * @param command The validated, tokenized alchemy query
+ * @param out Stream receiving the response
  * @return 0 on successful execution
  * 
  * Outputs potion formula ingredients or reports no formula knowledge
  * Format: "What is in <potion> ?"
  */
-int WitcherTracker::executeAlchemyQuery(const string &input)
+int WitcherTracker::executeAlchemyQuery(const TokenizedCommand &command, ostream &out)
 {
-    auto tokens = CommandParser::tokenizeInput(input);
+    const vector<string> &tokens = command.tokens;
 
     // Extract potion name (between "in" and "?")
-    string potionName;
-    for (size_t i = 3; i < tokens.size() - 1; ++i)
-    {
-        if (i > 3)
-            potionName += " ";
-        potionName += tokens[i];
-    }
+    NameHash potionHash;
+    string potionName = CommandParser::joinTokens(command, 3, tokens.size() - 1, potionHash);
+    traffic.record(TrafficCategory::POTION, potionHash, potionName);
 
-    string result = alchemy.getPotionIngredients(potionName);
+    CommandLocks locks(concurrent);
+    locks.lockAlchemy(alchemy, false);
+
+    string result = alchemy.getPotionIngredients(potionName, potionHash);
 
     // Output formula ingredients or report no formula
     if (result.empty())
     {
-        cout << "No formula for " << potionName << "\n";
+        out << "No formula for " << potionName << "\n";
     }
     else
     {
-        cout << result << "\n";
+        out << result << "\n";
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Writes one labelled list of a recommendation
+ */
+static void writeCounterList(ostream &out, const char *label, const vector<string> &names)
+{
+    out << label;
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        out << (i > 0 ? ", " : " ") << names[i];
+    }
+    if (names.empty())
+        out << " None";
+}
+
+/**
+ * @brief Executes recommendation queries
+ * @param command The validated, tokenized recommendation query
+ * @param out Stream receiving the response
+ * @return 0 on successful execution
+ * 
+ * Outputs the effective potions in stock, the effective potions brewable
+ * from the ingredients held, and the effective signs, each sorted, or
+ * reports no knowledge of the beast.
+ * Format: "What can I use against <monster> ?"
+ * Output: "In stock: <potions>; brewable: <potions>; signs: <signs>"
+ */
+int WitcherTracker::executeRecommendationQuery(const TokenizedCommand &command, ostream &out)
+{
+    const vector<string> &tokens = command.tokens;
+
+    // Extract monster name (between "against" and "?")
+    NameHash monsterHash;
+    string monsterName = CommandParser::joinTokens(command, 5, tokens.size() - 1, monsterHash);
+    traffic.record(TrafficCategory::BEAST, monsterHash, monsterName);
+
+    // Read-locking every subsystem waits out any command halfway through
+    // updating the join, as the other whole-state queries do
+    CommandLocks locks(concurrent);
+    locks.lockAlchemy(alchemy, false);
+    locks.lockBestiary(bestiary, false);
+    locks.lockAllInventory(inventory, false);
+
+    CounterJoin::Recommendation usable;
+    if (!counters.recommend(monsterName, monsterHash, usable))
+    {
+        out << "No knowledge of " << monsterName << "\n";
+        return 0;
+    }
+
+    ostringstream response;
+    writeCounterList(response, "In stock:", usable.inStock);
+    writeCounterList(response, "; brewable:", usable.brewable);
+    writeCounterList(response, "; signs:", usable.signs);
+    response << "\n";
+    out << response.str();
+    return 0;
+}
+
+/**
+ * @brief Executes multi-item inventory queries
+ * @param command The validated, tokenized multi-item inventory query
+ * @param out Stream receiving the response
+ * @return 0 on successful execution
+ * 
+ * Outputs "<quantity> <item>" for every listed item in the order asked,
+ * zero quantities included, on one line
+ * Format: "Total <category> <item>, <item> [, <item>]... ?"
+ */
+int WitcherTracker::executeMultiInventoryQuery(const TokenizedCommand &command, ostream &out)
+{
+    const vector<string> &tokens = command.tokens;
+
+    string category = tokens[1];
+    ItemCategory itemCategory = category == "ingredient" ? ItemCategory::INGREDIENT
+                                : category == "potion"   ? ItemCategory::POTION
+                                                         : ItemCategory::TROPHY;
+    TrafficCategory trafficCategory = category == "ingredient" ? TrafficCategory::INGREDIENT
+                                      : category == "potion"   ? TrafficCategory::POTION
+                                                               : TrafficCategory::BEAST;
+
+    vector<string> itemNames;
+    vector<NameHash> itemHashes;
+    CommandParser::splitNameList(tokens[2], itemNames, &itemHashes);
+    for (size_t i = 0; i < itemNames.size(); ++i)
+    {
+        traffic.record(trafficCategory, itemHashes[i], itemNames[i]);
+    }
+
+    vector<int> quantities;
+    {
+        CommandLocks locks(concurrent);
+        locks.lockInventory(inventory, itemHashes, false);
+        inventory.getQuantities(itemCategory, itemNames, itemHashes, quantities);
+    }
+
+    vector<pair<string, int>> items;
+    for (size_t i = 0; i < itemNames.size(); ++i)
+    {
+        items.emplace_back(itemNames[i], quantities[i]);
+    }
+    string result;
+    appendItemList(items, 0, items.size(), result);
+    out << result << "\n";
+    return 0;
+}
+
+/**
+ * @brief Executes multi-beast bestiary queries
+ * @param command The validated, tokenized multi-beast bestiary query
+ * @param out Stream receiving the response
+ * @return 0 on successful execution
+ * 
+ * Outputs "<monster>: <counters>" for every listed beast in the order
+ * asked, "<monster>: No knowledge" for unknown ones, separated by "; "
+ * Format: "What is effective against <monster>, <monster> [, <monster>]... ?"
+ */
+int WitcherTracker::executeMultiBestiaryQuery(const TokenizedCommand &command, ostream &out)
+{
+    vector<string> monsterNames;
+    vector<NameHash> monsterHashes;
+    CommandParser::splitNameList(command.tokens[4], monsterNames, &monsterHashes);
+    for (size_t i = 0; i < monsterNames.size(); ++i)
+    {
+        traffic.record(TrafficCategory::BEAST, monsterHashes[i], monsterNames[i]);
+    }
+
+    vector<string> results;
+    {
+        CommandLocks locks(concurrent);
+        locks.lockBestiary(bestiary, false);
+        bestiary.getEffectiveCounters(monsterNames, monsterHashes, results);
     }
 
+    ostringstream response;
+    for (size_t i = 0; i < monsterNames.size(); ++i)
+    {
+        response << (i > 0 ? "; " : "") << monsterNames[i] << ": "
+                 << (results[i].empty() ? "No knowledge" : results[i]);
+    }
+    response << "\n";
+    out << response.str();
     return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Executes state digest queries
+ * @param command The validated, tokenized state digest query
+ * @param out Stream receiving the response
+ * @return 0 on successful execution
+ * 
+ * Outputs the 128-bit digest of all state as 32 hex digits
+ * Format: "State digest?"
+ */
+int WitcherTracker::executeStateDigestQuery(const TokenizedCommand &command, ostream &out)
+{
+    (void)command;
+    out << "State digest: " << getStateDigest().toString() << "\n";
+    return 0;
+}
+
+/**
+ * @brief Registers a command template for repeated execution
+ * @param templateLine Command text in which "#" stands for a quantity
+ * @return Handle for executePrepared, or -1 if the template is not a valid command
+ * 
+ * The template is validated with every parameter standing in as 1, so "#"
+ * is only accepted where the grammar expects a quantity.
+ * Example: "Geralt loots # Rebis, # Vitriol"
+ */
+int WitcherTracker::prepare(const string &templateLine)
+{
+    PreparedCommand command;
+    command.text = CommandParser::cleanInputLine(templateLine);
+    command.paramCount = 0;
+    command.resolved = false;
+
+    // Every '#' must be a whole token of its own
+    auto tokens = CommandParser::tokenizeInput(command.text);
+    for (const auto &token : tokens)
+    {
+        if (token == "#")
+            command.paramCount++;
+        else if (token.find('#') != string::npos)
+            return -1;
+    }
+
+    string sample = command.text;
+    replace(sample.begin(), sample.end(), '#', '1');
+
+    if (sample.empty() || !CommandParser::isValidCommand(sample, command.type) ||
+        command.type == CommandType::EXIT_COMMAND)
+    {
+        return -1;
+    }
+
+    {
+        StoreUpdate update(stateStore);
+        resolvePrepared(command);
+    }
+
+    ScopedRWLock guard(preparedLock, true, concurrent);
+    preparedCommands.push_back(command);
+    return static_cast<int>(preparedCommands.size()) - 1;
+}
+
+/**
+ * @brief Resolves the inventory slots used by a prepared command
+ * @param command The prepared command to resolve
+ * @return void
+ * @side_effects Sets command.resolved when a fast path is available;
+ *               may create zero-quantity inventory entries
+ * 
+ * Loots, trades, brews of known formulas and specific inventory queries
+ * get direct slots. Other commands run from the template text.
+ */
+void WitcherTracker::resolvePrepared(PreparedCommand &command)
+{
+    TokenizedCommand tokenized;
+    CommandParser::tokenizeInput(command.text, tokenized);
+    const vector<string> &tokens = tokenized.tokens;
+    int nextParam = 0;
+
+    // Reads a quantity token: either a literal or the next parameter
+    auto makeItem = [&](const string &quantityToken, const Inventory::ItemSlot &slot)
+    {
+        if (quantityToken == "#")
+            return PreparedItem{slot, 0, nextParam++};
+        return PreparedItem{slot, stoi(quantityToken), -1};
+    };
+
+    // Collects the token indices of "quantity name [trophy] [, ...]" pairs
+    auto collectPairs = [&tokens](size_t begin, size_t end, vector<size_t> &pairs)
+    {
+        size_t tokenIndex = begin;
+        while (tokenIndex + 1 < end)
+        {
+            pairs.push_back(tokenIndex);
+            tokenIndex += 2;
+
+            if (tokenIndex < end && tokens[tokenIndex] == "trophy")
+                tokenIndex++;
+            if (tokenIndex < end && tokens[tokenIndex] == ",")
+                tokenIndex++;
+        }
+    };
+
+    CommandLocks locks(concurrent);
+    vector<NameHash> names;
+    vector<size_t> takenPairs, givenPairs;
+
+    switch (command.type)
+    {
+    case CommandType::ACTION_LOOT:
+    {
+        collectPairs(2, tokens.size(), givenPairs);
+        break;
+    }
+    case CommandType::ACTION_TRADE:
+    {
+        size_t forIndex = find(tokens.begin() + 2, tokens.end(), "for") - tokens.begin();
+        collectPairs(2, forIndex, takenPairs);
+        collectPairs(forIndex + 1, tokens.size(), givenPairs);
+        break;
+    }
+    case CommandType::ACTION_BREW:
+    {
+        command.itemName = tokens[2];
+
+        // Formula is immutable once learned, so it can be captured here
+        locks.lockAlchemy(alchemy, false);
+        Potion potion;
+        if (!alchemy.getPotion(command.itemName, tokenized.hash(2), potion) || !potion.hasFormula())
+        {
+            return;
+        }
+
+        names = potion.ingredientHashes;
+        names.push_back(tokenized.hash(2));
+        locks.lockInventory(inventory, names, true);
+
+        for (size_t i = 0; i < potion.ingredientNames.size(); ++i)
+        {
+            command.taken.push_back(PreparedItem{inventory.resolveIngredient(potion.ingredientNames[i],
+                                                                             potion.ingredientHashes[i]),
+                                                 potion.ingredientQuantities[i], -1});
+        }
+        command.given.push_back(PreparedItem{inventory.resolvePotion(command.itemName, tokenized.hash(2)), 1, -1});
+        break;
+    }
+    case CommandType::QUERY_SPECIFIC_INVENTORY:
+    {
+        command.itemName = tokens[2];
+        NameHash itemHash = tokenized.hash(2);
+        locks.lockInventory(inventory, vector<NameHash>(1, itemHash), true);
+
+        if (tokens[1] == "ingredient")
+            command.given.push_back(PreparedItem{inventory.resolveIngredient(command.itemName, itemHash), 0, -1});
+        else if (tokens[1] == "potion")
+            command.given.push_back(PreparedItem{inventory.resolvePotion(command.itemName, itemHash), 0, -1});
+        else
+            command.given.push_back(PreparedItem{inventory.resolveTrophy(command.itemName, itemHash), 0, -1});
+        break;
+    }
+    default:
+        return;
+    }
+
+    // Loot and trade items are resolved here, after their names are known
+    if (command.type == CommandType::ACTION_LOOT || command.type == CommandType::ACTION_TRADE)
+    {
+        for (size_t index : takenPairs)
+            names.push_back(tokenized.hash(index + 1));
+        for (size_t index : givenPairs)
+            names.push_back(tokenized.hash(index + 1));
+        locks.lockInventory(inventory, names, true);
+
+        for (size_t index : takenPairs)
+            command.taken.push_back(makeItem(tokens[index], inventory.resolveTrophy(tokens[index + 1],
+                                                                                     tokenized.hash(index + 1))));
+        for (size_t index : givenPairs)
+            command.given.push_back(makeItem(tokens[index], inventory.resolveIngredient(tokens[index + 1],
+                                                                                         tokenized.hash(index + 1))));
+    }
+
+    for (const auto &item : command.taken)
+        command.shards.push_back(item.slot.shard);
+    for (const auto &item : command.given)
+        command.shards.push_back(item.slot.shard);
+
+    command.resolved = true;
+}
+
+/**
+ * @brief Executes a prepared template, writing to standard output
+ * @param handle Handle returned by prepare
+ * @param params Quantities for the template parameters
+ * @return 0 on success, -1 on invalid handle or parameters
+ */
+int WitcherTracker::executePrepared(int handle, const vector<int> &params)
+{
+    return executePrepared(handle, params, cout);
+}
+
+/**
+ * @brief Executes a prepared template with the given quantities
+ * @param handle Handle returned by prepare
+ * @param params Quantities for the template parameters, all positive
+ * @param out Stream receiving the response
+ * @return 0 on success, -1 on invalid handle or parameters
+ * 
+ * Resolved templates go straight to their inventory slots. Brews whose
+ * formula was unknown at prepare time are resolved on first use; commands
+ * without a fast path run from the substituted template text, skipping
+ * validation.
+ */
+int WitcherTracker::executePrepared(int handle, const vector<int> &params, ostream &out)
+{
+    for (int quantity : params)
+    {
+        if (quantity <= 0)
+            return -1;
+    }
+
+    StoreUpdate update(stateStore);
+    bool retryResolve = false;
+    {
+        ScopedRWLock guard(preparedLock, false, concurrent);
+        if (handle < 0 || handle >= static_cast<int>(preparedCommands.size()) ||
+            preparedCommands[handle].paramCount != params.size())
+        {
+            return -1;
+        }
+
+        const PreparedCommand &command = preparedCommands[handle];
+        if (command.resolved)
+        {
+            return runPrepared(command, params, out);
+        }
+        retryResolve = (command.type == CommandType::ACTION_BREW);
+    }
+
+    if (retryResolve)
+    {
+        ScopedRWLock guard(preparedLock, true, concurrent);
+        PreparedCommand &command = preparedCommands[handle];
+        if (!command.resolved)
+        {
+            resolvePrepared(command);
+        }
+        if (command.resolved)
+        {
+            return runPrepared(command, params, out);
+        }
+    }
+
+    // Substitute parameters into the template text
+    ScopedRWLock guard(preparedLock, false, concurrent);
+    const PreparedCommand &command = preparedCommands[handle];
+    string input;
+    size_t nextParam = 0;
+    for (char c : command.text)
+    {
+        if (c == '#')
+            input += to_string(params[nextParam++]);
+        else
+            input += c;
+    }
+
+    TokenizedCommand tokenized;
+    CommandParser::tokenizeInput(input, tokenized);
+    return executeCommand(tokenized, command.type, out);
+}
+
+/**
+ * @brief Runs a resolved prepared command directly on inventory slots
+ * @param command The resolved prepared command
+ * @param params Quantities for the template parameters
+ * @param out Stream receiving the response
+ * @return 0 on successful execution
+ * 
+ * Produces exactly the responses of the corresponding execute method.
+ */
+int WitcherTracker::runPrepared(const PreparedCommand &command, const vector<int> &params, ostream &out)
+{
+    auto quantityOf = [&params](const PreparedItem &item)
+    {
+        return item.paramIndex < 0 ? item.quantity : params[item.paramIndex];
+    };
+
+    CommandLocks locks(concurrent);
+    locks.lockInventoryShards(inventory, command.shards,
+                              command.type != CommandType::QUERY_SPECIFIC_INVENTORY);
+
+    switch (command.type)
+    {
+    case CommandType::ACTION_LOOT:
+        for (const auto &item : command.given)
+        {
+            inventory.addToSlot(item.slot, quantityOf(item));
+        }
+        out << "Alchemy ingredients obtained\n";
+        return 0;
+
+    case CommandType::ACTION_TRADE:
+    case CommandType::ACTION_BREW:
+    {
+        bool isTrade = (command.type == CommandType::ACTION_TRADE);
+
+        // Validate every requirement before changing anything
+        for (const auto &item : command.taken)
+        {
+            if (inventory.getSlotQuantity(item.slot) < quantityOf(item))
+            {
+                out << (isTrade ? "Not enough trophies\n" : "Not enough ingredients\n");
+                return 0;
+            }
+        }
+
+        for (const auto &item : command.taken)
+        {
+            inventory.removeFromSlot(item.slot, quantityOf(item));
+        }
+        for (const auto &item : command.given)
+        {
+            inventory.addToSlot(item.slot, quantityOf(item));
+        }
+
+        if (isTrade)
+            out << "Trade successful\n";
+        else
+            out << "Alchemy item created: " << command.itemName << "\n";
+        return 0;
+    }
+
+    case CommandType::QUERY_SPECIFIC_INVENTORY:
+        out << inventory.getSlotQuantity(command.given[0].slot) << "\n";
+        return 0;
+
+    default:
+        return -1;
+    }
+}
@@ -7,7 +7,22 @@
 #include <map>
 #include <algorithm>
 #include <sstream>
+#include <iomanip>
 #include <cctype>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+#include <atomic>
+#include <memory>
+#include <deque>
+#include <iterator>
+#include <set>
+#include <unordered_map>
+#include <cstdint>
+#include <thread>
+#include <functional>
+#include <future>
+#include <chrono>
 
 using namespace std;
 
@@ -35,6 +50,44 @@ constexpr int MAX_SIGNS = 1024;                 ///< Maximum magical signs
 constexpr int MAX_BEASTS = 1024;                ///< Maximum beast entries
 constexpr int MAX_EFFECTIVENESS = 1024;         ///< Maximum effectiveness entries
 constexpr int MAX_POTION_INGREDIENTS = 1024;    ///< Maximum ingredients per potion
+constexpr int INVENTORY_SHARDS = 16;            ///< Inventory shards used by a concurrent tracker
+constexpr int SHARED_STASH_CAPACITY = 65536;    ///< Default item slots in a shared stash
+constexpr int INVENTORY_HOT_CAPACITY = 256;     ///< Items kept in the hot tier of each inventory table
+constexpr int FRONT_CODING_BLOCK = 16;          ///< Names per restart point in front-coded arrays
+constexpr size_t COLD_MERGE_RUNS = 4;           ///< Cold runs of one level merged into a run of the next
+constexpr size_t COLD_BACKGROUND_STEPS = 8;     ///< Entries each cold merge or filter refill advances per insert
+constexpr int KNOWLEDGE_DELTA_LIMIT = 1024;     ///< Minimum mutable entries before knowledge is refrozen
+constexpr int STATE_UNDO_CAPACITY = 8192;       ///< Undo log entries; larger commands commit in chunks
+constexpr uint64_t STATE_FILE_RESERVE = 1ULL << 36; ///< Address space reserved for a state file mapping
+constexpr int SERVER_MAX_CONNECTIONS = 1024;    ///< Open connections per server worker
+constexpr int SERVER_RECEIVE_BYTES = 65536;     ///< Bytes read from a connection per poll
+constexpr int SERVER_PREFAULT_STACK = 262144;   ///< Stack bytes each server worker faults in up front
+constexpr size_t IPC_RING_BYTES = 1 << 20;      ///< Default data bytes of each shared-memory ring
+constexpr int IPC_SPIN_LIMIT = 4096;            ///< Polls of an idle ring before sleeping on its futex
+constexpr int HEAVY_HITTER_CAPACITY = 64;       ///< Names monitored per heavy-hitter sketch
+constexpr int COUNT_MIN_WIDTH = 1024;           ///< Counters per Count-Min row (power of two)
+constexpr int COUNT_MIN_DEPTH = 4;              ///< Count-Min rows
+constexpr int TRAFFIC_STRIPES = 16;             ///< Sketch sets of a concurrent tracker, one per group of threads
+constexpr int TRAFFIC_TOP_K = 10;               ///< Names listed per category in the stats dump
+constexpr int HOST_AGGREGATE_SLICE = 64;        ///< Sessions an aggregate query visits before yielding to commands
+constexpr size_t COMMAND_WORK_BUDGET = 1024;    ///< Items a resumable command handles per slice
+constexpr uint64_t COMMAND_TIME_BUDGET_NANOS = 100000;  ///< Time a resumable command may run per slice
+constexpr size_t COMPACT_WORK_BUDGET = 1024;    ///< Entries one online compaction slice visits
+constexpr uint64_t COMPACT_TIME_BUDGET_NANOS = 100000;  ///< Time one online compaction slice may run
+constexpr int SERVER_COMPACT_PAUSE_MICROS = 1000;   ///< Pause of a server between two compaction slices
+constexpr size_t LOG_CODEC_BLOCK = 65536;       ///< Log bytes per compressed block
+constexpr size_t LOG_CODEC_DICTIONARY = 32768;  ///< Keyword and name bytes a compressed log starts from
+constexpr size_t LOG_CODEC_MIN_MATCH = 4;       ///< Shortest match worth encoding
+constexpr size_t ADAPTIVE_INDEX_ABOVE = 16;     ///< Entries past which a scanned container builds a hash index
+constexpr size_t ADAPTIVE_LINEAR_BELOW = 8;     ///< Entries under which a shrunk container drops its index
+constexpr size_t LSM_MEMTABLE_ITEMS = 4096;     ///< Items an out-of-core inventory buffers before writing a run
+constexpr size_t LSM_INDEX_INTERVAL = 32;       ///< Run records per sparse index entry (one block)
+constexpr size_t LSM_MERGE_RUNS = 4;            ///< Runs of one level merged into a run of the next
+constexpr size_t LSM_MAX_RUNS = 32;             ///< Runs past which writing a memtable waits for merges
+constexpr size_t LSM_READ_BUFFER = 65536;       ///< Bytes read at a time when scanning a run
+constexpr size_t MULTI_GET_PREFETCH = 4;        ///< Names a multi-item query prefetches ahead of the one it probes
+constexpr size_t TRACE_BLOCK_BYTES = 65536;     ///< Captured bytes a stripe buffers before handing them to the writer
+constexpr uint64_t TRACE_SPIN_NANOS = 200000;   ///< Replay waits shorter than this spin instead of sleeping
 
 //========================================================================
 // ENUMERATIONS
@@ -60,6 +113,10 @@ enum class CommandType
     QUERY_ALL_INVENTORY,      ///< View complete inventory
     QUERY_BESTIARY,           ///< Check beast information
     QUERY_ALCHEMY,            ///< View potion recipes
+    QUERY_STATE_DIGEST,       ///< Print the digest of all state
+    QUERY_RECOMMENDATION,     ///< List counters usable against a beast now
+    QUERY_MULTI_INVENTORY,    ///< Check the quantities of several items at once
+    QUERY_MULTI_BESTIARY,     ///< Check several beasts at once
     EXIT_COMMAND              ///< Terminate program
 };
 
@@ -84,652 +141,4849 @@ class Inventory;
 class Bestiary;
 class AlchemyKnowledge;
 class CommandParser;
+class WitcherTracker;
+class CounterJoin;
+class TraceRecorder;
 
 //========================================================================
-// GAME ENTITY CLASSES
+// SYNCHRONIZATION
 //========================================================================
 
 /**
- * @class Ingredient
- * @brief Represents a brewing ingredient with quantity tracking
+ * @class RWLock
+ * @brief Writer-preferring reader-writer lock
  * 
- * Simple data structure for storing ingredient name and current quantity
- * in the player's inventory.
+ * Allows any number of concurrent readers or a single writer. Waiting
+ * writers block new readers so that a steady stream of queries cannot
+ * starve mutating commands.
  */
-class Ingredient
+class RWLock
 {
+private:
+    mutex stateMutex;               ///< Guards the counters below
+    condition_variable readersCv;   ///< Signalled when readers may proceed
+    condition_variable writersCv;   ///< Signalled when a writer may proceed
+    int activeReaders;              ///< Readers currently holding the lock
+    int waitingWriters;             ///< Writers blocked in lockWrite()
+    bool writerActive;              ///< true while a writer holds the lock
+
 public:
-    string name;        ///< Unique ingredient identifier
-    int quantity;       ///< Current amount owned
+    RWLock() : activeReaders(0), waitingWriters(0), writerActive(false) {}
+    RWLock(const RWLock &) = delete;
+    RWLock &operator=(const RWLock &) = delete;
 
     /**
-     * @brief Constructor with optional initialization
-     * @param n Ingredient name (default: empty)
-     * @param q Initial quantity (default: 0)
+     * @brief Acquires shared (read) ownership
      */
-    Ingredient(const string &n = "", int q = 0) : name(n), quantity(q) {}
-};
-
-/**
- * @class Potion
- * @brief Represents a magical potion with recipe and inventory data
- * 
- * Stores both the brewing recipe (if known) and current inventory quantity.
- * Recipes consist of ingredient names paired with required quantities.
- */
-class Potion
-{
-public:
-    string name;                        ///< Unique potion identifier
-    vector<string> ingredientNames;     ///< Required ingredient types
-    vector<int> ingredientQuantities;   ///< Required amounts per ingredient
-    int quantity;                       ///< Current potions in inventory
-
+    void lockRead();
+    
     /**
-     * @brief Constructor initializes potion with zero quantity
-     * @param n Potion name (default: empty)
+     * @brief Releases shared (read) ownership
      */
-    Potion(const string &n = "") : name(n), quantity(0) {}
-
+    void unlockRead();
+    
     /**
-     * @brief Adds an ingredient requirement to the recipe
-     * @param ingredientName Name of required ingredient
-     * @param ingredientQuantity Amount needed for brewing
-     * 
-     * Side effects: Modifies ingredient vectors to store recipe data
+     * @brief Acquires exclusive (write) ownership
      */
-    void addIngredient(const string &ingredientName, int ingredientQuantity);
+    void lockWrite();
     
     /**
-     * @brief Checks if brewing recipe is known
-     * @return true if recipe contains ingredients, false otherwise
-     * 
-     * Used to determine if player can attempt brewing this potion
+     * @brief Releases exclusive (write) ownership
      */
-    bool hasFormula() const { return !ingredientNames.empty(); }
+    void unlockWrite();
 };
 
 /**
- * @class Trophy
- * @brief Represents collectible beast trophies
- * 
- * Trophies serve as proof of victory and may have trade or quest value.
+ * @class ScopedRWLock
+ * @brief RAII holder of an RWLock in read or write mode
  */
-class Trophy
+class ScopedRWLock
 {
+private:
+    RWLock *lock;   ///< Held lock, null when locking is disabled
+    bool write;     ///< true if held exclusively
+
 public:
-    string name;        ///< Trophy identifier (typically beast name)
-    int quantity;       ///< Number collected
+    /**
+     * @brief Acquires the lock
+     * @param rwLock Lock to acquire
+     * @param write true for exclusive access
+     * @param enabled false turns the guard into a no-op
+     */
+    ScopedRWLock(RWLock &rwLock, bool write, bool enabled = true)
+        : lock(enabled ? &rwLock : nullptr), write(write)
+    {
+        if (lock)
+            write ? lock->lockWrite() : lock->lockRead();
+    }
+    ScopedRWLock(const ScopedRWLock &) = delete;
+    ScopedRWLock &operator=(const ScopedRWLock &) = delete;
 
     /**
-     * @brief Constructor with optional initialization
-     * @param n Trophy name (default: empty)
-     * @param q Initial quantity (default: 0)
+     * @brief Releases the lock
      */
-    Trophy(const string &n = "", int q = 0) : name(n), quantity(q) {}
+    ~ScopedRWLock()
+    {
+        if (lock)
+            write ? lock->unlockWrite() : lock->unlockRead();
+    }
 };
 
+//========================================================================
+// SYSTEM HELPERS
+//========================================================================
+
 /**
- * @class Sign
- * @brief Represents a magical sign ability
- * 
- * Signs are combat abilities that may be effective against certain beasts.
+ * @brief Nanoseconds on the monotonic clock
  */
-class Sign
+inline uint64_t nowNanos()
 {
-public:
-    string name;        ///< Unique sign identifier
+    return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count());
+}
 
-    /**
-     * @brief Constructor with name initialization
-     * @param n Sign name (default: empty)
-     */
-    Sign(const string &n = "") : name(n) {}
+/**
+ * @brief Tells the core we are spinning (cheaper for the sibling hyperthread)
+ */
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/**
+ * @brief Appends an unsigned LEB128 varint
+ * @param out Buffer receiving the bytes
+ * @param value Value to append
+ */
+inline void writeVarint(string &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+/**
+ * @brief Reads an unsigned LEB128 varint
+ * @param cursor Position of the varint, advanced past it
+ * @param end End of the readable bytes
+ * @param value Receives the value
+ * @return false if the varint is truncated or too long
+ */
+inline bool readVarint(const char *&cursor, const char *end, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && cursor < end; shift += 7)
+    {
+        uint8_t byte = static_cast<uint8_t>(*cursor++);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Reads an unsigned LEB128 varint from a buffer
+ * @param data Buffer holding the varint
+ * @param pos Position of the varint, advanced past it
+ * @param end End of the readable bytes
+ * @param value Receives the value
+ * @return false if the varint is truncated or too long
+ */
+inline bool readVarint(const string &data, size_t &pos, size_t end, uint64_t &value)
+{
+    const char *cursor = data.data() + pos;
+    bool complete = readVarint(cursor, data.data() + end, value);
+    pos = static_cast<size_t>(cursor - data.data());
+    return complete;
+}
+
+/**
+ * @brief Writes a whole buffer to a file descriptor, retrying short writes
+ * @param fd File descriptor to write
+ * @param data First byte to write
+ * @param length Bytes to write
+ * @return false on a write error
+ */
+bool writeAll(int fd, const char *data, size_t length);
+
+//========================================================================
+// COMMAND EXPLAIN
+//========================================================================
+
+/**
+ * @enum ExplainSubsystem
+ * @brief Subsystems whose lookups and inserts EXPLAIN counts separately
+ */
+enum class ExplainSubsystem
+{
+    INVENTORY,  ///< Ingredients, potions and trophies held
+    BESTIARY,   ///< Beasts and their counters
+    ALCHEMY     ///< Recipes and signs
 };
 
 /**
- * @class Beast
- * @brief Represents a creature with known combat weaknesses
+ * @class CommandExplain
+ * @brief Work counted while one command runs under the EXPLAIN prefix
  * 
- * Stores tactical information about which signs and potions are
- * effective against this beast type.
+ * While a CommandExplain is active on a thread, the parser and the
+ * subsystems report what they do to it through the static count* hooks;
+ * with none active each hook is a single thread-local load. Allocations
+ * are counted only by programs linking AllocationCounter.cpp, whose
+ * replacement operator new would otherwise apply to every program built
+ * from these sources.
  */
-class Beast
+class CommandExplain
 {
 public:
-    string name;                    ///< Beast identifier
-    vector<string> effectiveSigns;  ///< Signs that counter this beast
-    vector<string> effectivePotions;///< Potions effective against this beast
+    static constexpr int SUBSYSTEMS = 3;    ///< Number of ExplainSubsystem values
+
+    int tokenizations;                          ///< Calls of CommandParser::tokenize
+    size_t tokens;                              ///< Tokens of the explained command
+    vector<pair<const char *, bool>> validators;    ///< Validators tried, with whether each matched
+    uint64_t lookups[SUBSYSTEMS];               ///< Name lookups per subsystem
+    uint64_t inserts[SUBSYSTEMS];               ///< Names newly stored per subsystem
+    uint64_t allocations;                       ///< operator new calls
+    uint64_t allocatedBytes;                    ///< Bytes requested from operator new
+    size_t bytesFormatted;                      ///< Response bytes written by the command
+    uint64_t cleanNanos;                        ///< Time spent cleaning the input line
+    uint64_t tokenizeNanos;                     ///< Time spent tokenizing and hashing
+    uint64_t validateNanos;                     ///< Time spent finding the command type
+    uint64_t executeNanos;                      ///< Time spent locking and executing
 
     /**
-     * @brief Constructor with name initialization
-     * @param n Beast name (default: empty)
+     * @brief Constructs zeroed counters, not yet active
      */
-    Beast(const string &n = "") : name(n) {}
+    CommandExplain();
 
     /**
-     * @brief Records a sign as effective against this beast
-     * @param signName Name of the effective sign
-     * 
-     * Side effects: Adds sign to effectiveness list if not already present
+     * @brief Makes these counters receive the calling thread's hooks
+     * @side_effects Replaces any counters active before; deactivate() restores them
      */
-    void addEffectiveSign(const string &signName);
-    
+    void activate();
+
     /**
-     * @brief Records a potion as effective against this beast
-     * @param potionName Name of the effective potion
-     * 
-     * Side effects: Adds potion to effectiveness list if not already present
+     * @brief Stops counting and restores the counters active before activate()
+     */
+    void deactivate();
+
+    /**
+     * @brief Writes the cost breakdown after the command's own output
+     * @param out Stream receiving the report
+     * @param command Explained command line
+     * @param status Status returned by the command, -1 if it was rejected
      */
-    void addEffectivePotion(const string &potionName);
+    void writeReport(ostream &out, const string &command, int status) const;
+
+    /**
+     * @brief Counts one tokenizer run
+     */
+    static void countTokenize()
+    {
+        if (current)
+            current->tokenizations++;
+    }
+
+    /**
+     * @brief Records one validator tried by CommandParser::isValidCommand
+     * @param validator Name of the validator
+     * @param matched Whether it accepted the command
+     * @return matched, so the call can wrap the validator in a condition
+     */
+    static bool countValidator(const char *validator, bool matched)
+    {
+        if (current)
+            current->validators.push_back(make_pair(validator, matched));
+        return matched;
+    }
+
+    /**
+     * @brief Counts one name lookup of a subsystem
+     */
+    static void countLookup(ExplainSubsystem subsystem)
+    {
+        if (current)
+            current->lookups[static_cast<int>(subsystem)]++;
+    }
+
+    /**
+     * @brief Counts one name newly stored by a subsystem
+     */
+    static void countInsert(ExplainSubsystem subsystem)
+    {
+        if (current)
+            current->inserts[static_cast<int>(subsystem)]++;
+    }
+
+    /**
+     * @brief Marks allocations as counted (called once by AllocationCounter.cpp)
+     * @return true
+     */
+    static bool countAllocations();
+
+    /**
+     * @brief Counts one allocation (called by operator new)
+     */
+    static void countAllocation(size_t bytes)
+    {
+        if (current)
+        {
+            current->allocations++;
+            current->allocatedBytes += bytes;
+        }
+    }
+
+private:
+    CommandExplain(const CommandExplain &) = delete;
+    CommandExplain &operator=(const CommandExplain &) = delete;
+
+    CommandExplain *previous;                   ///< Counters active before activate()
+    static thread_local CommandExplain *current;    ///< Counters receiving this thread's hooks
+    static bool allocationsCounted;             ///< true if a replacement operator new reports allocations
 };
 
 //========================================================================
-// MANAGEMENT SYSTEM CLASSES
+// NAME HASHING
 //========================================================================
 
+typedef uint64_t NameHash;  ///< 64-bit hash of an item, beast or sign name
+
 /**
- * @class Inventory
- * @brief Centralized storage system for all player items
+ * @brief Computes the hash of a name
+ * @param data First character of the name
+ * @param length Number of characters
+ * @return 64-bit hash with good avalanche for short strings
  * 
- * Manages ingredients, potions, and trophies with quantity tracking,
- * addition/removal operations, and query capabilities.
+ * The tokenizer calls this once per token; every container below accepts
+ * the result so that names are never rehashed downstream.
  */
-class Inventory
-{
-private:
-    map<string, int> ingredients;   ///< Ingredient name -> quantity mapping
-    map<string, int> potions;       ///< Potion name -> quantity mapping
-    map<string, int> trophies;      ///< Trophy name -> quantity mapping
+NameHash hashName(const char *data, size_t length);
+
+/**
+ * @brief Computes the hash of a name
+ * @param name Name to hash
+ * @return 64-bit hash
+ */
+inline NameHash hashName(const string &name) { return hashName(name.data(), name.size()); }
 
+/**
+ * @class NameTable
+ * @brief Hash table from names to values keyed by precomputed NameHash
+ * 
+ * Entries are stored in insertion order in a deque, so references to values
+ * remain valid while the table grows. Up to ADAPTIVE_INDEX_ABOVE entries
+ * are found by scanning their hashes; a larger table builds an
+ * open-addressing index that stores the upper hash bits next to each
+ * entry number, so probes rarely touch an entry whose name does not match.
+ * Tables only grow until popBack() tears them down, which drops the index.
+ */
+template <class V>
+class NameTable
+{
 public:
     /**
-     * @brief Adds ingredients to inventory
-     * @param name Ingredient identifier
-     * @param quantity Amount to add (must be positive)
-     * 
-     * Side effects: Creates new entry or increases existing quantity
+     * @struct Entry
+     * @brief One stored name with its hash and value
      */
-    void addIngredient(const string &name, int quantity);
-    
+    struct Entry
+    {
+        string name;    ///< Key
+        NameHash hash;  ///< Cached hash of name
+        V value;        ///< Mapped value
+    };
+
+private:
+    deque<Entry> entries;       ///< Stable storage in insertion order
+    vector<uint64_t> index;     ///< (hash tag << 32 | entry number + 1), 0 = empty
+
+    static uint64_t tagOf(NameHash hash) { return hash & 0xFFFFFFFF00000000ULL; }
+
     /**
-     * @brief Adds potions to inventory
-     * @param name Potion identifier  
-     * @param quantity Amount to add (must be positive)
-     * 
-     * Side effects: Creates new entry or increases existing quantity
+     * @brief Locates the index slot of a name or the empty slot ending its probe
      */
-    void addPotion(const string &name, int quantity);
-    
+    size_t probe(const string &name, NameHash hash) const
+    {
+        size_t mask = index.size() - 1;
+        for (size_t pos = static_cast<size_t>(hash) & mask;; pos = (pos + 1) & mask)
+        {
+            uint64_t slot = index[pos];
+            if (slot == 0)
+                return pos;
+            if ((slot & 0xFFFFFFFF00000000ULL) == tagOf(hash))
+            {
+                const Entry &entry = entries[(slot & 0xFFFFFFFFULL) - 1];
+                if (entry.hash == hash && entry.name == name)
+                    return pos;
+            }
+        }
+    }
+
     /**
-     * @brief Adds trophies to inventory
-     * @param name Trophy identifier
-     * @param quantity Amount to add (must be positive)
-     * 
-     * Side effects: Creates new entry or increases existing quantity
+     * @brief Finds an entry by scanning, while the table has no index
      */
-    void addTrophy(const string &name, int quantity);
+    size_t scan(const string &name, NameHash hash) const
+    {
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            if (entries[i].hash == hash && entries[i].name == name)
+                return i;
+        }
+        return entries.size();
+    }
 
     /**
-     * @brief Attempts to remove ingredients from inventory
-     * @param name Ingredient identifier
-     * @param quantity Amount to remove
-     * @return true if sufficient quantity available and removed, false otherwise
-     * 
-     * Side effects: Decreases quantity if successful, no change if insufficient
+     * @brief Doubles the index, or builds it, and reinserts every entry
      */
-    bool removeIngredient(const string &name, int quantity);
-    
+    void grow()
+    {
+        size_t capacity = index.empty() ? 16 : index.size() * 2;
+        while (capacity < (entries.size() + 1) * 2)
+            capacity *= 2;
+        vector<uint64_t> bigger(capacity, 0);
+        size_t mask = bigger.size() - 1;
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            size_t pos = static_cast<size_t>(entries[i].hash) & mask;
+            while (bigger[pos] != 0)
+                pos = (pos + 1) & mask;
+            bigger[pos] = tagOf(entries[i].hash) | (i + 1);
+        }
+        index.swap(bigger);
+    }
+
+public:
+    typedef typename deque<Entry>::iterator iterator;
+    typedef typename deque<Entry>::const_iterator const_iterator;
+
     /**
-     * @brief Attempts to remove potions from inventory
-     * @param name Potion identifier
-     * @param quantity Amount to remove
-     * @return true if sufficient quantity available and removed, false otherwise
+     * @brief Finds the value stored for a name
+     * @param name Key
+     * @param hash hashName(name)
+     * @return Pointer to the value, or nullptr if absent
      */
-    bool removePotion(const string &name, int quantity);
-    
+    V *find(const string &name, NameHash hash)
+    {
+        if (index.empty())
+        {
+            size_t i = scan(name, hash);
+            return i < entries.size() ? &entries[i].value : nullptr;
+        }
+        uint64_t slot = index[probe(name, hash)];
+        return slot ? &entries[(slot & 0xFFFFFFFFULL) - 1].value : nullptr;
+    }
+
     /**
-     * @brief Attempts to remove trophies from inventory
-     * @param name Trophy identifier
-     * @param quantity Amount to remove
-     * @return true if sufficient quantity available and removed, false otherwise
+     * @brief Finds the value stored for a name
+     * @param name Key
+     * @param hash hashName(name)
+     * @return Pointer to the value, or nullptr if absent
      */
-    bool removeTrophy(const string &name, int quantity);
+    const V *find(const string &name, NameHash hash) const
+    {
+        return const_cast<NameTable *>(this)->find(name, hash);
+    }
 
     /**
-     * @brief Queries current ingredient quantity
-     * @param name Ingredient identifier
-     * @return Current quantity (0 if item not found)
+     * @brief Starts loading the index slot a later find() of this hash reads first
+     * @param hash hashName of a name about to be looked up
      */
-    int getIngredientQuantity(const string &name) const;
-    
+    void prefetch(NameHash hash) const
+    {
+        if (!index.empty())
+            __builtin_prefetch(&index[static_cast<size_t>(hash) & (index.size() - 1)]);
+    }
+
     /**
-     * @brief Queries current potion quantity
-     * @param name Potion identifier
-     * @return Current quantity (0 if item not found)
+     * @brief Finds the value for a name, inserting a default one if absent
+     * @param name Key
+     * @param hash hashName(name)
+     * @return Reference to the stored value (stable for the table lifetime)
      */
-    int getPotionQuantity(const string &name) const;
-    
+    V &findOrInsert(const string &name, NameHash hash)
+    {
+        if (index.empty() && entries.size() < ADAPTIVE_INDEX_ABOVE)
+        {
+            size_t i = scan(name, hash);
+            if (i == entries.size())
+                entries.push_back(Entry{name, hash, V()});
+            return entries[i].value;
+        }
+
+        // Keep the load factor at or below one half
+        if ((entries.size() + 1) * 2 > index.size())
+            grow();
+
+        size_t pos = probe(name, hash);
+        if (index[pos] == 0)
+        {
+            entries.push_back(Entry{name, hash, V()});
+            index[pos] = tagOf(hash) | entries.size();
+        }
+        return entries[(index[pos] & 0xFFFFFFFFULL) - 1].value;
+    }
+
     /**
-     * @brief Queries current trophy quantity
-     * @param name Trophy identifier
-     * @return Current quantity (0 if item not found)
+     * @brief Destroys the newest entry
+     * 
+     * Lets a large table be freed a few entries at a time. Lookups scan
+     * the remaining entries until an insertion builds a new index.
      */
-    int getTrophyQuantity(const string &name) const;
+    void popBack()
+    {
+        vector<uint64_t>().swap(index);
+        entries.pop_back();
+    }
 
     /**
-     * @brief Generates formatted listing of all ingredients
-     * @return String containing all ingredients with quantities
+     * @brief Number of stored names
      */
-    string getAllIngredients() const;
-    
+    size_t size() const { return entries.size(); }
+
     /**
-     * @brief Generates formatted listing of all potions
-     * @return String containing all potions with quantities
+     * @brief Whether lookups go through the hash index instead of a scan
      */
-    string getAllPotions() const;
-    
+    bool indexed() const { return !index.empty(); }
+
+    iterator begin() { return entries.begin(); }
+    iterator end() { return entries.end(); }
+    const_iterator begin() const { return entries.begin(); }
+    const_iterator end() const { return entries.end(); }
+};
+
+/**
+ * @struct FilterStats
+ * @brief Counters describing how well a BloomFilter answers lookups
+ */
+struct FilterStats
+{
+    uint64_t lookups;           ///< Lookups that consulted the filter
+    uint64_t rejected;          ///< Lookups answered "absent" by the filter alone
+    uint64_t falsePositives;    ///< Lookups the filter passed but the index missed
+
+    FilterStats() : lookups(0), rejected(0), falsePositives(0) {}
+
     /**
-     * @brief Generates formatted listing of all trophies
-     * @return String containing all trophies with quantities
+     * @brief Share of absent names that the filter failed to reject
+     * @return Value in [0, 1], 0 when no absent name was looked up
      */
-    string getAllTrophies() const;
+    double falsePositiveRate() const
+    {
+        uint64_t absent = rejected + falsePositives;
+        return absent == 0 ? 0.0 : static_cast<double>(falsePositives) / absent;
+    }
+
+    FilterStats &operator+=(const FilterStats &other)
+    {
+        lookups += other.lookups;
+        rejected += other.rejected;
+        falsePositives += other.falsePositives;
+        return *this;
+    }
 };
 
 /**
- * @class Bestiary
- * @brief Knowledge database for beast combat information
+ * @class BloomFilter
+ * @brief Bloom filter over name hashes for answering misses early
  * 
- * Stores and manages information about beast weaknesses, allowing
- * players to record and query effective combat strategies.
+ * Probe positions are derived from the precomputed NameHash by double
+ * hashing, so no name is rehashed. Filters are sized for an expected key
+ * count and rebuilt by their owner when that count is exceeded. Bits only
+ * change under the owner's write lock; the statistics are atomic because
+ * lookups also happen under shared locks.
  */
-class Bestiary
+class BloomFilter
 {
 private:
-    map<string, Beast> beasts;      ///< Beast name -> Beast data mapping
+    vector<uint64_t> bits;                      ///< Bit array (power-of-two size)
+    size_t capacity;                            ///< Keys the filter is sized for
+    size_t count;                               ///< Keys inserted since reset
+    mutable atomic<uint64_t> lookups;           ///< See FilterStats
+    mutable atomic<uint64_t> rejected;          ///< See FilterStats
+    mutable atomic<uint64_t> falsePositives;    ///< See FilterStats
+
+    static const int PROBES = 6;                ///< Bits set per key
+    static const int BITS_PER_KEY = 10;         ///< About 1% false positives
 
 public:
+    BloomFilter() : capacity(0), count(0), lookups(0), rejected(0), falsePositives(0) {}
+    BloomFilter(const BloomFilter &) = delete;
+    BloomFilter &operator=(const BloomFilter &) = delete;
+
     /**
-     * @brief Creates new beast entry in bestiary
-     * @param name Beast identifier
-     * 
-     * Side effects: Adds empty beast entry if not already present
+     * @brief Clears the filter and sizes it for the given number of keys
+     * @param expected Keys expected before the next reset
      */
-    void addBeast(const string &name);
-    
+    void reset(size_t expected);
+
     /**
-     * @brief Records effectiveness data for a beast
-     * @param beastName Target beast identifier
-     * @param counter Name of effective sign or potion
-     * @param isSign true for sign effectiveness, false for potion
+     * @brief Adds a name hash to the filter
+     */
+    void insert(NameHash hash);
+
+    /**
+     * @brief Tests a name hash, counting the lookup
+     * @return false if the name is certainly absent
+     */
+    bool mayContain(NameHash hash) const;
+
+    /**
+     * @brief Starts loading the words a later mayContain(hash) reads
      * 
-     * Side effects: Creates beast entry if needed, adds counter to appropriate list
+     * Counts nothing; a batch of lookups issues it a few names ahead so
+     * the probes of one name overlap the cache misses of the next.
      */
-    void addEffectiveness(const string &beastName, const string &counter, bool isSign);
-    
+    void prefetch(NameHash hash) const;
+
     /**
-     * @brief Retrieves beast data for modification
-     * @param name Beast identifier
-     * @return Pointer to Beast object or nullptr if not found
+     * @brief Records that a name passed by mayContain() was not found
      */
-    Beast *getBeast(const string &name);
-    
+    void recordFalsePositive() const { falsePositives.fetch_add(1, memory_order_relaxed); }
+
     /**
-     * @brief Generates formatted effectiveness information
-     * @param beastName Beast to query
-     * @return String listing effective signs and potions for this beast
+     * @brief true once more keys were inserted than the filter was sized for
+     */
+    bool full() const { return count >= capacity; }
+
+    /**
+     * @brief Takes the bits of a filter filled aside, keeping this filter's counters
+     * @param other Filter to take from; receives the old bits
+     */
+    void adopt(BloomFilter &other);
+
+    /**
+     * @brief Snapshot of the lookup counters
      */
-    string getEffectiveCounters(const string &beastName) const;
+    FilterStats stats() const;
 };
 
 /**
- * @class AlchemyKnowledge
- * @brief Repository for potion recipes and magical sign knowledge
+ * @struct ContainerStats
+ * @brief Representation switches of adaptive containers
  * 
- * Manages learned potion formulas and available magical signs,
- * enabling brewing operations and combat planning.
+ * A container small enough is searched by a linear scan; once it grows
+ * past ADAPTIVE_INDEX_ABOVE entries it builds a hash index, and it drops
+ * the index only after shrinking below ADAPTIVE_LINEAR_BELOW, so a size
+ * hovering around one threshold does not flip it back and forth.
  */
-class AlchemyKnowledge
+struct ContainerStats
+{
+    uint64_t toIndexed;     ///< Containers that switched from scanning to a hash index
+    uint64_t toLinear;      ///< Containers that dropped their index again
+
+    ContainerStats() : toIndexed(0), toLinear(0) {}
+
+    ContainerStats &operator+=(const ContainerStats &other)
+    {
+        toIndexed += other.toIndexed;
+        toLinear += other.toLinear;
+        return *this;
+    }
+};
+
+/**
+ * @class ContainerSwitches
+ * @brief Counts the representation switches of the containers of one structure
+ * 
+ * Updated by the owner of the containers, under its write lock; read at
+ * any time.
+ */
+class ContainerSwitches
 {
 private:
-    map<string, Potion> potions;    ///< Potion name -> recipe mapping
-    map<string, Sign> signs;        ///< Sign name -> sign data mapping
+    atomic<uint64_t> toIndexed;     ///< See ContainerStats
+    atomic<uint64_t> toLinear;      ///< See ContainerStats
 
 public:
-    /**
-     * @brief Stores or updates a potion recipe
-     * @param potionName Potion identifier
-     * @param ingredients List of required ingredient names
-     * @param quantities List of required amounts (parallel to ingredients)
-     * 
-     * Side effects: Creates/updates potion entry with complete recipe
-     */
-    void addPotionFormula(const string &potionName, const vector<string> &ingredients, const vector<int> &quantities);
-    
-    /**
-     * @brief Adds a magical sign to knowledge base
-     * @param signName Sign identifier
-     * 
-     * Side effects: Creates sign entry if not already present
-     */
-    void addSign(const string &signName);
+    ContainerSwitches() : toIndexed(0), toLinear(0) {}
+    ContainerSwitches(const ContainerSwitches &) = delete;
+    ContainerSwitches &operator=(const ContainerSwitches &) = delete;
 
     /**
-     * @brief Retrieves potion data for modification
-     * @param name Potion identifier
-     * @return Pointer to Potion object or nullptr if not found
+     * @brief Counts a switch if a container's representation changed
+     * @param wasIndexed Whether it had a hash index before an update
+     * @param indexed Whether it has one after
      */
-    Potion *getPotion(const string &name);
-    
+    void record(bool wasIndexed, bool indexed)
+    {
+        if (wasIndexed != indexed)
+            (indexed ? toIndexed : toLinear).fetch_add(1, memory_order_relaxed);
+    }
+
     /**
-     * @brief Checks if potion recipe is known
-     * @param name Potion identifier
-     * @return true if potion exists in knowledge base
+     * @brief Snapshot of the counters
      */
-    bool hasPotion(const string &name) const;
-    
+    ContainerStats stats() const
+    {
+        ContainerStats snapshot;
+        snapshot.toIndexed = toIndexed.load(memory_order_relaxed);
+        snapshot.toLinear = toLinear.load(memory_order_relaxed);
+        return snapshot;
+    }
+};
+
+//========================================================================
+// WORK BUDGETS
+//========================================================================
+
+/**
+ * @struct CommandBudget
+ * @brief Work a resumable command or compaction may do in one slice
+ */
+struct CommandBudget
+{
+    size_t work;        ///< Items parsed, applied, collected, listed or moved
+    uint64_t nanos;     ///< Time limit, checked every few items
+};
+
+/**
+ * @class SliceMeter
+ * @brief Budget of the current slice
+ * 
+ * The clock is read once per METER_CLOCK_INTERVAL units so that timing
+ * does not cost more than the items themselves. The first unit of a
+ * slice is always granted, so every slice makes progress. A meter built
+ * without a budget never runs out.
+ */
+class SliceMeter
+{
+public:
+    SliceMeter() : remaining(SIZE_MAX), sinceClock(0), deadline(chrono::steady_clock::time_point::max()), spent(false)
+    {
+    }
+
+    explicit SliceMeter(const CommandBudget &budget)
+        : remaining(max<size_t>(budget.work, 1)), sinceClock(0),
+          deadline(chrono::steady_clock::now() + chrono::nanoseconds(budget.nanos)), spent(false)
+    {
+    }
+
     /**
-     * @brief Checks if sign is available
-     * @param name Sign identifier
-     * @return true if sign exists in knowledge base
+     * @brief Checks whether the slice is over
      */
-    bool hasSign(const string &name) const;
+    bool exhausted() const { return spent; }
 
     /**
-     * @brief Generates formatted recipe information
-     * @param potionName Potion to query
-     * @return String listing required ingredients and quantities
+     * @brief Claims work from the budget
+     * @param units Work about to be done
+     * @return false once the budget is spent
      */
-    string getPotionIngredients(const string &potionName) const;
+    bool take(size_t units = 1)
+    {
+        if (spent)
+            return false;
+
+        remaining = units < remaining ? remaining - units : 0;
+        sinceClock += units;
+        if (sinceClock >= METER_CLOCK_INTERVAL)
+        {
+            sinceClock = 0;
+            if (chrono::steady_clock::now() >= deadline)
+                remaining = 0;
+        }
+        spent = remaining == 0;
+        return true;
+    }
+
+private:
+    static const size_t METER_CLOCK_INTERVAL = 32;
+
+    size_t remaining;
+    size_t sinceClock;
+    chrono::steady_clock::time_point deadline;
+    bool spent;
 };
 
 //========================================================================
-// COMMAND PROCESSING
+// COMPACT STORAGE
 //========================================================================
 
 /**
- * @class CommandParser
- * @brief Static utility class for parsing and validating user commands
+ * @class FrontCodedNames
+ * @brief Immutable sorted array of names stored with front coding
  * 
- * Provides text processing methods for tokenizing input, validating
- * command formats, and determining command types without state.
+ * Names are grouped in blocks of FRONT_CODING_BLOCK. The first name of a
+ * block is stored whole; every other name stores only the length of the
+ * prefix it shares with its predecessor and the remaining suffix. Lookup
+ * binary-searches the block heads and then decodes a single block.
  */
-class CommandParser
+class FrontCodedNames
 {
+private:
+    string bytes;                   ///< Encoded names: varint shared, varint suffix length, suffix
+    vector<uint32_t> blockOffsets;  ///< Byte offset of each block head
+    size_t count;                   ///< Number of names
+
+    /**
+     * @brief Decodes the name at a byte offset given its predecessor
+     * @param offset Position of the encoded name, advanced past it
+     * @param name Predecessor on input, decoded name on output
+     */
+    void decodeNext(size_t &offset, string &name) const;
+
 public:
     /**
-     * @brief Splits input string into individual tokens
-     * @param input Raw user input string
-     * @return Vector of space-separated tokens
-     * 
-     * Handles whitespace normalization and comma separation
+     * @struct Cursor
+     * @brief Position of a walk over the names that can stop and resume
      */
-    static vector<string> tokenizeInput(const string &input);
-    
+    struct Cursor
+    {
+        size_t index;       ///< Next name to decode
+        size_t offset;      ///< Byte offset of that name
+        string name;        ///< Name decoded last, which the next one is coded against
+
+        Cursor() : index(0), offset(0) {}
+    };
+
+    FrontCodedNames() : count(0) {}
+
     /**
-     * @brief Normalizes input by removing extra whitespace
-     * @param input Raw input string
-     * @return Cleaned string with normalized spacing
+     * @brief Replaces the contents with the given names
+     * @param sortedNames Names in strictly ascending order
      */
-    static string cleanInputLine(const string &input);
-    
+    void assign(const vector<string> &sortedNames);
+
     /**
-     * @brief Validates positive integer format
-     * @param token String to validate
-     * @return true if token represents valid positive integer
+     * @brief Adds a name after the last one
+     * @param name Name greater than every name held
+     * @param previous The last name held (unused at the start of a block)
      */
-    static bool isPositiveInteger(const string &token);
-    
+    void append(const string &name, const string &previous);
+
     /**
-     * @brief Validates alphabetic-only content
-     * @param token String to validate  
-     * @return true if token contains only letters
+     * @brief Reserves room for names encoded in about the given number of bytes
      */
-    static bool isAlphabeticOnly(const string &token);
-    
+    void reserve(size_t names, size_t encodedBytes)
+    {
+        bytes.reserve(encodedBytes);
+        blockOffsets.reserve(names / FRONT_CODING_BLOCK + 1);
+    }
+
     /**
-     * @brief Detects comma spacing errors in token list
-     * @param tokens Vector of parsed tokens
-     * @return true if improper comma spacing detected
+     * @brief Decodes the name at a cursor and moves the cursor past it
+     * @param cursor Cursor starting at Cursor(), then as left by the previous call
+     * @return false once every name has been decoded
      */
-    static bool hasCommaSpacingError(const vector<string> &tokens);
+    bool next(Cursor &cursor) const
+    {
+        if (cursor.index >= count)
+            return false;
+        decodeNext(cursor.offset, cursor.name);
+        cursor.index++;
+        return true;
+    }
 
-    // Command pattern validation methods - each checks specific command format
-    
     /**
-     * @brief Validates loot action command structure
-     * @param input Command string to validate
-     * @return true if matches expected loot format
+     * @brief Finds the position of a name
+     * @param name Name to look up
+     * @return Index in sorted order, or string::npos if absent
      */
-    static bool isLootAction(const string &input);
-    
+    size_t find(const string &name) const;
+
     /**
-     * @brief Validates trade action command structure
-     * @param input Command string to validate
-     * @return true if matches expected trade format
+     * @brief Decodes the name at a position
+     * @param index Position in [0, size())
      */
-    static bool isTradeAction(const string &input);
-    
+    string at(size_t index) const;
+
     /**
-     * @brief Validates brew action command structure
-     * @param input Command string to validate
-     * @return true if matches expected brew format
+     * @brief Calls visit(index, name) for every name in ascending order
      */
-    static bool isBrewAction(const string &input);
+    template <class Visitor>
+    void forEach(Visitor visit) const
+    {
+        string name;
+        size_t offset = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            decodeNext(offset, name);
+            visit(i, name);
+        }
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
     
     /**
-     * @brief Validates effectiveness knowledge command structure
-     * @param input Command string to validate
-     * @return true if matches expected effectiveness format
+     * @brief Bytes used by the encoding and its block index
      */
-    static bool isEffectivenessKnowledge(const string &input);
-    
+    size_t byteSize() const { return bytes.size() + blockOffsets.size() * sizeof(uint32_t); }
+};
+
+/**
+ * @class TieredItemStore
+ * @brief Name -> quantity table split into a hot hash tier and a cold sorted tier
+ * 
+ * Items are promoted into the small hot table whenever they are modified.
+ * When the hot table reaches INVENTORY_HOT_CAPACITY entries, the least
+ * recently touched half is demoted into a new cold run: a front-coded
+ * name array with a parallel array of counts. Demotion drops zero
+ * quantities. Pinned items (those handed out as ItemSlots) stay hot, so
+ * their address never changes. Const lookups read both tiers without
+ * promoting, so they are safe under a shared lock.
+ * 
+ * As in LsmItemStore, COLD_MERGE_RUNS runs of one level are merged into
+ * one run of the next level, so an item is rewritten about once per
+ * level; promoted names are dropped on the way. Merges advance a few
+ * entries with every insert or promotion, so no update pays for a whole
+ * rebuild. A Bloom filter over both tiers answers most lookups of
+ * unknown items before either tier is searched; once full it is refilled
+ * at twice the size the same way, while the old one keeps answering.
+ * 
+ * A hot tier of at most ADAPTIVE_INDEX_ABOVE entries is scanned instead
+ * of hashed; compaction drops the index again once fewer than
+ * ADAPTIVE_LINEAR_BELOW entries are left. Compaction runs in slices,
+ * building the new index aside, merging every cold run into one and
+ * refilling a right-sized filter while updates keep going on.
+ */
+class TieredItemStore
+{
+private:
+    struct Compaction;
+    struct ColdRun;
+    struct ColdMerge;
+    struct FilterRefill;
+
     /**
-     * @brief Validates potion formula command structure
-     * @param input Command string to validate
-     * @return true if matches expected formula format
+     * @struct HotEntry
+     * @brief One item in the hot tier
      */
-    static bool isPotionFormulaKnowledge(const string &input);
-    
+    struct HotEntry
+    {
+        string name;            ///< Item name (empty when the entry is free)
+        NameHash hash;          ///< hashName(name)
+        int quantity;           ///< Current quantity
+        uint64_t lastAccess;    ///< Access clock value of the last update
+        bool pinned;            ///< Never demoted while true
+        bool live;              ///< false once the entry is released by demotion
+    };
+
+    deque<HotEntry> hot;            ///< Hot entries; deque keeps addresses stable
+    vector<size_t> freeEntries;     ///< Hot entries released by demotion
+    vector<uint64_t> hotIndex;      ///< (hash tag | entry number + 1), 0 = empty; empty while hot is scanned
+    size_t hotCount;                ///< Live hot entries
+    uint64_t clock;                 ///< Incremented on every update
+
+    vector<unique_ptr<ColdRun>> coldRuns;   ///< Sorted runs of the cold tier, oldest first
+    vector<unique_ptr<ColdMerge>> merges;   ///< Merges of cold runs in progress
+    size_t coldLive;                ///< Cold names not yet promoted, over every run
+    BloomFilter filter;             ///< Names held in either tier
+    unique_ptr<FilterRefill> refill;    ///< Larger filter being filled, or nullptr
+    ContainerSwitches switches;     ///< Hot index built or dropped
+    unique_ptr<Compaction> compaction;  ///< Pass in progress, or nullptr
+
+    static const int COLD_PROMOTED = -1;
+
+    HotEntry *findHot(const string &name, NameHash hash);
+    HotEntry &touch(const string &name, NameHash hash);
+    void rebuildHotIndex(size_t capacity);
+    void unindex(size_t entryIndex);
+    void reindex(size_t from, size_t to);
+    size_t indexCapacity() const;
+    void demote();
+    bool findCold(const string &name, NameHash hash, ColdRun *&run, size_t &position) const;
+    void markPromoted(ColdRun &run, size_t position, const string &name);
+    void startMerge(const vector<ColdRun *> &inputs, int level);
+    void scheduleMerges();
+    bool mergeStep(ColdMerge &merge);
+    void installMerges();
+    void startRefill(size_t expected);
+    bool refillStep();
+    void advance();
+
+public:
     /**
-     * @brief Validates encounter command structure
-     * @param input Command string to validate
-     * @return true if matches expected encounter format
+     * @struct Listing
+     * @brief Progress of an appendSorted() done in slices
      */
-    static bool isEncounterSentence(const string &input);
-    
+    struct Listing
+    {
+        bool started = false;                       ///< The hot items have been gathered
+        vector<pair<string, int>> hotItems;         ///< Hot items with a positive quantity, sorted
+        size_t hotNext = 0;                         ///< Next hot item to append
+        vector<FrontCodedNames::Cursor> cursors;    ///< Position in each cold run
+        vector<size_t> heap;                        ///< Runs whose cursor holds a name not yet appended
+    };
+
+    TieredItemStore();
+    ~TieredItemStore();
+    TieredItemStore(const TieredItemStore &) = delete;
+    TieredItemStore &operator=(const TieredItemStore &) = delete;
+
     /**
-     * @brief Validates inventory query command structure
-     * @param input Command string to validate
-     * @param isSpecific Output parameter indicating specific vs. general query
-     * @return true if matches expected inventory query format
+     * @brief Returns the quantity cell of an item for modification
+     * @param name Item name
+     * @param hash hashName(name)
+     * @return Reference valid until the next update of the store
+     * @side_effects Promotes a cold item or inserts a zero-quantity one
      */
-    static bool isInventoryQuery(const string &input, bool &isSpecific);
-    
+    int &update(const string &name, NameHash hash);
+
     /**
-     * @brief Validates bestiary query command structure
-     * @param input Command string to validate
-     * @return true if matches expected bestiary format
+     * @brief Returns a quantity cell that stays valid for the store lifetime
+     * @param name Item name
+     * @param hash hashName(name)
+     * @side_effects Same as update(), and the item is never demoted
      */
-    static bool isBestiaryQuery(const string &input);
-    
+    int &pin(const string &name, NameHash hash);
+
     /**
-     * @brief Validates alchemy query command structure
-     * @param input Command string to validate
-     * @return true if matches expected alchemy format
+     * @brief Reads an item from either tier without promoting it
+     * @param name Item name
+     * @param hash hashName(name)
+     * @return Quantity, 0 if unknown
      */
-    static bool isAlchemyQuery(const string &input);
-    
+    int quantity(const string &name, NameHash hash) const;
+
     /**
-     * @brief Validates exit command structure
-     * @param input Command string to validate
-     * @return true if matches expected exit format
-     *      */
-    static bool isExitCommand(const string &input);
-    
+     * @brief Starts loading the filter words and hot index slot quantity() reads first
+     * @param hash hashName of an item about to be read
+     */
+    void prefetch(NameHash hash) const;
+
     /**
-     * @brief Determines command type from input string
-     * @param input Command string to analyze
-     * @param cmdType Output parameter for determined command type
-     * @return true if command is valid and type successfully determined
+     * @brief Appends every item with a positive quantity, sorted by name
+     * @param items Receives (name, quantity) pairs
      * 
-     * Side effects: Sets cmdType to appropriate enum value if valid
+     * The hot items are sorted, then merged with the cold runs, which
+     * are already sorted.
      */
-    static bool isValidCommand(const string &input, CommandType &cmdType);
-    
+    void appendSorted(vector<pair<string, int>> &items) const;
+
     /**
-     * @brief Validates potion name token format
-     * @param token Token to validate as potion name
-     * @return true if token meets potion naming requirements
+     * @brief Appends the next items of a listing until done or out of budget
+     * @param listing Progress so far; start from a default-constructed one
+     * @param items Receives (name, quantity) pairs
+     * @param meter Budget of this slice, one unit per item
+     * @return true once every item has been appended
+     * 
+     * A listing done step by step equals appendSorted() if the store does
+     * not change between the steps.
      */
-    static bool isValidPotionNameToken(const string &token);
-};
+    bool appendSortedStep(Listing &listing, vector<pair<string, int>> &items, SliceMeter &meter) const;
 
-//========================================================================
-// MAIN APPLICATION CLASS
-//========================================================================
+    /**
+     * @brief Runs one slice of rebuilding both tiers into dense, right-sized storage
+     * @param meter Budget of the slice; one unit per entry visited
+     * @return true once the pass is complete
+     * 
+     * Drops zero-quantity items (unless pinned), moves unpinned hot entries
+     * down into released slots so the tail of the deque can be freed,
+     * right-sizes the hot index, merges the cold runs into one without
+     * promoted names and refills the filter. Pinned entries never move.
+     * Updates between slices are carried into the structures being
+     * rebuilt; a demotion drops the new index, since it has just rebuilt
+     * the current one.
+     */
+    bool compactStep(SliceMeter &meter);
+
+    size_t hotSize() const { return hotCount; }      ///< Items in the hot tier
+    size_t coldSize() const { return coldLive; }     ///< Items in the cold tier
+    FilterStats getFilterStats() const { return filter.stats(); }   ///< Negative lookup filter counters
+    ContainerStats getContainerStats() const { return switches.stats(); }   ///< Hot index switches
+};
 
 /**
- * @class WitcherTracker
- * @brief Primary application controller coordinating all game systems
+ * @class PackedArray
+ * @brief Array of unsigned integers stored with a fixed bit width
  * 
- * Serves as the main interface for processing user commands and managing
- * interactions between inventory, bestiary, and alchemy subsystems.
- * Handles command parsing, validation, and execution routing.
+ * The width is the number of bits needed by the largest value, so small
+ * ids and quantities take a few bits each instead of a full machine word.
+ * The values are written once, one by one, after reset().
  */
-class WitcherTracker
+class PackedArray
 {
 private:
-    Inventory inventory;        ///< Player's item management system
-    Bestiary bestiary;         ///< Beast knowledge database
-    AlchemyKnowledge alchemy;  ///< Potion and sign knowledge repository
+    vector<uint64_t> words;     ///< Values packed back to back, low bits first
+    unsigned width;             ///< Bits per value (0 when every value is 0)
+    size_t count;               ///< Number of values
 
 public:
+    PackedArray() : width(0), count(0) {}
+
     /**
-     * @brief Processes a single line of user input
-     * @param line Input command string to execute
-     * @return Execution status code (0 for success, negative for errors)
-     * 
-     * Primary entry point for command processing. Handles command validation,
-     * type determination, and routing to appropriate execution methods.
+     * @brief Replaces the contents with zeros, wide enough for the values set() will store
+     * @param size Number of values
+     * @param largest Bitwise OR of every value to be stored
      */
-    int executeLine(const string &line);
+    void reset(size_t size, uint64_t largest);
 
-private:
     /**
-     * @brief Routes validated commands to specific execution methods
-     * @param input Validated command string
-     * @param cmdType Determined command type from parsing
-     * @return Execution status code
-     * 
-     * Internal dispatcher that calls appropriate execution method based on
-     * command type. Assumes input has already been validated.
+     * @brief Stores a value at a position that still holds zero
+     * @param index Position in [0, size())
+     * @param value Value covered by the largest given to reset()
      */
-    int executeCommand(const string &input, CommandType cmdType);
+    void set(size_t index, uint64_t value)
+    {
+        if (width == 0)
+            return;
 
-    //====================================================================
-    // COMMAND EXECUTION METHODS
-    //====================================================================
+        size_t bit = index * width;
+        size_t word = bit / 64;
+        unsigned shift = bit % 64;
+        words[word] |= value << shift;
+        if (shift + width > 64)
+            words[word + 1] |= value >> (64 - shift);
+    }
 
     /**
-     * @brief Executes loot action to add items to inventory
-     * @param input Loot command string
-     * @return 0 on success, negative on error
-     * 
-     * Processes "loot" commands to add specified quantities of items
-     * to the player's inventory from environmental sources.
+     * @brief Reads the value at a position
+     * @param index Position in [0, size())
      */
-    int executeLootAction(const string &input);
-    
+    uint64_t get(size_t index) const
+    {
+        if (width == 0)
+            return 0;
+
+        size_t bit = index * width;
+        size_t word = bit / 64;
+        unsigned shift = bit % 64;
+        uint64_t value = words[word] >> shift;
+        if (shift + width > 64)
+            value |= words[word + 1] << (64 - shift);
+        return width == 64 ? value : value & ((1ULL << width) - 1);
+    }
+
+    size_t size() const { return count; }
+    size_t byteSize() const { return words.size() * sizeof(uint64_t); }
+};
+
+/**
+ * @class FrozenRelation
+ * @brief Read-only map from sorted names to lists of (name, value) links
+ * 
+ * Keys and link targets are stored as front-coded name arrays; each key's
+ * links form a CSR row (packed offsets into packed target ids and packed
+ * values). Used for the frozen part of the bestiary and of the alchemy
+ * knowledge base, where it replaces per-entry strings and vectors. A
+ * FrozenRelation::Builder fills a new one.
+ */
+class FrozenRelation
+{
+private:
+    FrontCodedNames keys;           ///< Sorted row names
+    FrontCodedNames targets;        ///< Sorted distinct link target names
+    vector<NameHash> targetHashes;  ///< hashName of each target
+    PackedArray offsets;            ///< First link of each row, plus the end
+    PackedArray linkTargets;        ///< Target id of each link
+    PackedArray linkValues;         ///< Payload of each link
+
+public:
+    class Builder;
+
     /**
-     * @brief Executes trade action to exchange items
-     * @param input Trade command string  
-     * @return 0 on success, negative on error
-     * 
-     * Processes "trade" commands to remove items from inventory
-     * in exchange for other items or services.
+     * @brief Finds a row by key
+     * @return Row index, or string::npos if absent
      */
-    int executeTradeAction(const string &input);
-    
+    size_t find(const string &key) const { return keys.find(key); }
+
+    size_t linksBegin(size_t row) const { return static_cast<size_t>(offsets.get(row)); }     ///< First link of a row
+    size_t linksEnd(size_t row) const { return static_cast<size_t>(offsets.get(row + 1)); }   ///< One past the last link
+    string linkName(size_t link) const { return targets.at(static_cast<size_t>(linkTargets.get(link))); }
+    NameHash linkHash(size_t link) const { return targetHashes[static_cast<size_t>(linkTargets.get(link))]; }
+    uint64_t linkValue(size_t link) const { return linkValues.get(link); }
+
     /**
-     * @brief Executes brew action to create potions from ingredients
-     * @param input Brew command string
-     * @return 0 on success, negative on error
-     * 
-     * Processes "brew" commands to consume ingredients and create potions
-     * according to known recipes. Validates ingredient availability.
+     * @brief Calls visit(row, key) for every row in key order
      */
-    int executeBrewAction(const string &input);
-    
+    template <class Visitor>
+    void forEachKey(Visitor visit) const { keys.forEach(visit); }
+
     /**
-     * @brief Executes effectiveness knowledge acquisition
-     * @param input Effectiveness command string
-     * @return 0 on success, negative on error
+     * @brief Decodes the key of the row at a cursor and moves the cursor past it
+     * @return false once every row has been visited; the row is cursor.index - 1
+     */
+    bool nextKey(FrontCodedNames::Cursor &cursor) const { return keys.next(cursor); }
+
+    size_t size() const { return keys.size(); }
+    size_t linkCount() const { return keys.empty() ? 0 : linksBegin(keys.size()); }   ///< Links of every row
+    size_t targetCount() const { return targets.size(); }                              ///< Distinct link targets
+
+    /**
+     * @brief Bytes used by all arrays of the relation
+     */
+    size_t byteSize() const
+    {
+        return keys.byteSize() + targets.byteSize() + targetHashes.size() * sizeof(NameHash) +
+               offsets.byteSize() + linkTargets.byteSize() + linkValues.byteSize();
+    }
+};
+
+/**
+ * @class FrozenRelation::Builder
+ * @brief Builds a FrozenRelation a bounded amount of work at a time
+ * 
+ * Rows are added in any order, each followed by its links; every distinct
+ * target is kept once. step() then sorts the rows and the targets with a
+ * bottom-up merge sort that can stop within a merge, numbers the targets
+ * and packs the rows, doing no more per call than the meter grants. Names
+ * are released as they are encoded, so no call frees more than a few. The
+ * relation being replaced keeps serving lookups until install().
+ */
+class FrozenRelation::Builder
+{
+private:
+    /**
+     * @brief What the next step() continues with
+     */
+    enum class Phase
+    {
+        ADDING,             ///< Taking rows
+        SORTING_ROWS,       ///< Ordering the rows by key
+        SORTING_TARGETS,    ///< Ordering the targets by name
+        NUMBERING,          ///< Encoding the targets in order
+        PACKING,            ///< Encoding the rows and their links in order
+        BUILT               ///< Ready for install()
+    };
+
+    /**
+     * @struct MergeSort
+     * @brief State of a bottom-up merge sort of row or target numbers
+     */
+    struct MergeSort
+    {
+        vector<uint32_t> merged;    ///< Output of the current pass
+        size_t width;               ///< Length of the sorted runs being merged
+        size_t begin;               ///< First number of the pair of runs being merged
+        size_t left;                ///< Next number of the first run
+        size_t right;               ///< Next number of the second run
+
+        MergeSort() : width(1), begin(0), left(0), right(0) {}
+    };
+
+    Phase phase;
+    vector<string> keys;                ///< Row keys in the order added
+    vector<uint32_t> rowLinks;          ///< First link of each row, plus the end once adding is over
+    vector<uint32_t> rowOrder;          ///< Row numbers, sorted by key once SORTING_ROWS is over
+    vector<uint32_t> links;             ///< Target number of each link
+    vector<uint64_t> values;            ///< Payload of each link
+    uint64_t valueBits;                 ///< Bitwise OR of every payload
+    vector<string> targets;             ///< Distinct targets in the order first linked
+    vector<NameHash> targetHashes;      ///< hashName of each target
+    vector<uint32_t> targetOrder;       ///< Target numbers, sorted by name once SORTING_TARGETS is over
+    vector<uint32_t> targetIds;         ///< Id of each target in the built relation
+    vector<uint32_t> targetIndex;       ///< Open addressing by hash: target number + 1, 0 = empty
+    MergeSort sort;                     ///< Sort in progress
+    size_t next;                        ///< Next row or target to encode
+    size_t packed;                      ///< Links packed so far
+    FrozenRelation built;               ///< Relation being filled
+
+    template <class Less>
+    bool sortStep(vector<uint32_t> &order, Less less, SliceMeter &meter);
+
+public:
+    Builder() : phase(Phase::ADDING), valueBits(0), next(0), packed(0) {}
+
+    /**
+     * @brief Sizes the buffers and the target index for the rows about to be added
+     * @param rowCount Rows expected
+     * @param linkCount Links expected
+     * @param targetCount Distinct targets expected
      * 
-     * Processes commands that teach the player which signs or potions
-     * are effective against specific beast types.
+     * Growing them while rows are added would copy a whole buffer at once.
      */
-    int executeEffectivenessKnowledge(const string &input);
-    
+    void reserve(size_t rowCount, size_t linkCount, size_t targetCount);
+
     /**
-     * @brief Executes potion formula learning
-     * @param input Formula command string
-     * @return 0 on success, negative on error
+     * @brief Starts a row; the links added next belong to it
+     * @param key Row name, different from every other row's
+     */
+    void addRow(const string &key);
+
+    /**
+     * @brief Adds a link to the row added last
+     * @param name Target name
+     * @param hash hashName(name)
+     * @param value Payload (quantity or flag)
+     */
+    void addLink(const string &name, NameHash hash, uint64_t value);
+
+    /**
+     * @brief Continues the build; adding rows is over once this is called
+     * @param meter Budget of the slice; every row, link or target handled takes a unit
+     * @return true once the relation is ready for install()
+     */
+    bool step(SliceMeter &meter);
+
+    /**
+     * @brief Replaces a relation with the built one
+     * @param relation Relation to replace
+     */
+    void install(FrozenRelation &relation) { relation = move(built); }
+};
+
+//========================================================================
+// GAME ENTITY CLASSES
+//========================================================================
+
+/**
+ * @class Ingredient
+ * @brief Represents a brewing ingredient with quantity tracking
+ * 
+ * Simple data structure for storing ingredient name and current quantity
+ * in the player's inventory.
+ */
+class Ingredient
+{
+public:
+    string name;        ///< Unique ingredient identifier
+    int quantity;       ///< Current amount owned
+
+    /**
+     * @brief Constructor with optional initialization
+     * @param n Ingredient name (default: empty)
+     * @param q Initial quantity (default: 0)
+     */
+    Ingredient(const string &n = "", int q = 0) : name(n), quantity(q) {}
+};
+
+/**
+ * @class Potion
+ * @brief Represents a magical potion with recipe and inventory data
+ * 
+ * Stores both the brewing recipe (if known) and current inventory quantity.
+ * Recipes consist of ingredient names paired with required quantities.
+ */
+class Potion
+{
+public:
+    string name;                        ///< Unique potion identifier
+    vector<string> ingredientNames;     ///< Required ingredient types
+    vector<int> ingredientQuantities;   ///< Required amounts per ingredient
+    vector<NameHash> ingredientHashes;  ///< hashName of each ingredient name
+    int quantity;                       ///< Current potions in inventory
+
+    /**
+     * @brief Constructor initializes potion with zero quantity
+     * @param n Potion name (default: empty)
+     */
+    Potion(const string &n = "") : name(n), quantity(0) {}
+
+    /**
+     * @brief Adds an ingredient requirement to the recipe
+     * @param ingredientName Name of required ingredient
+     * @param ingredientQuantity Amount needed for brewing
      * 
-     * Processes commands that teach potion recipes, storing ingredient
-     * requirements for future brewing operations.
+     * Side effects: Modifies ingredient vectors to store recipe data
      */
-    int executeFormulaKnowledge(const string &input);
+    void addIngredient(const string &ingredientName, int ingredientQuantity);
     
     /**
-     * @brief Executes beast encounter processing  
-     * @param input Encounter command string
-     * @return 0 on success, negative on error
-     * 
-     * Processes beast encounter events, potentially updating bestiary
-     * information or triggering combat-related responses.
+     * @brief Adds an ingredient requirement whose name hash is already known
+     * @param ingredientName Name of required ingredient
+     * @param ingredientHash hashName(ingredientName)
+     * @param ingredientQuantity Amount needed for brewing
      */
-    int executeEncounter(const string &input);
+    void addIngredient(const string &ingredientName, NameHash ingredientHash, int ingredientQuantity);
     
     /**
-     * @brief Executes specific inventory item queries
-     * @param input Specific inventory query string
-     * @return 0 on success, negative on error
+     * @brief Checks if brewing recipe is known
+     * @return true if recipe contains ingredients, false otherwise
      * 
-     * Processes queries for specific item quantities, returning current
-     * inventory counts for requested items.
+     * Used to determine if player can attempt brewing this potion
      */
-    int executeSpecificInventoryQuery(const string &input);
-    
+    bool hasFormula() const { return !ingredientNames.empty(); }
+};
+
+/**
+ * @class Trophy
+ * @brief Represents collectible beast trophies
+ * 
+ * Trophies serve as proof of victory and may have trade or quest value.
+ */
+class Trophy
+{
+public:
+    string name;        ///< Trophy identifier (typically beast name)
+    int quantity;       ///< Number collected
+
     /**
-     * @brief Executes complete inventory display
-     * @param input All inventory query string
-     * @return 0 on success, negative on error
+     * @brief Constructor with optional initialization
+     * @param n Trophy name (default: empty)
+     * @param q Initial quantity (default: 0)
+     */
+    Trophy(const string &n = "", int q = 0) : name(n), quantity(q) {}
+};
+
+/**
+ * @class Sign
+ * @brief Represents a magical sign ability
+ * 
+ * Signs are combat abilities that may be effective against certain beasts.
+ */
+class Sign
+{
+public:
+    string name;        ///< Unique sign identifier
+
+    /**
+     * @brief Constructor with name initialization
+     * @param n Sign name (default: empty)
+     */
+    Sign(const string &n = "") : name(n) {}
+};
+
+/**
+ * @class Beast
+ * @brief Represents a creature with known combat weaknesses
+ * 
+ * Stores tactical information about which signs and potions are
+ * effective against this beast type.
+ */
+class Beast
+{
+public:
+    string name;                    ///< Beast identifier
+    vector<string> effectiveSigns;  ///< Signs that counter this beast
+    vector<string> effectivePotions;///< Potions effective against this beast
+    vector<NameHash> signHashes;    ///< hashName of each effective sign
+    vector<NameHash> potionHashes;  ///< hashName of each effective potion
+    vector<uint32_t> signIndex;     ///< Position + 1 of each sign by hash; empty while signs are scanned
+    vector<uint32_t> potionIndex;   ///< Position + 1 of each potion by hash; empty while potions are scanned
+
+    /**
+     * @brief Constructor with name initialization
+     * @param n Beast name (default: empty)
+     */
+    Beast(const string &n = "") : name(n) {}
+
+    /**
+     * @brief Records a sign as effective against this beast
+     * @param signName Name of the effective sign
+     * @param signHash hashName(signName)
      * 
-     * Processes requests to display all inventory contents, including
-     * all categories of items with their quantities.
+     * Side effects: Adds sign to effectiveness list if not already present
      */
-    int executeAllInventoryQuery(const string &input);
+    void addEffectiveSign(const string &signName, NameHash signHash);
     
     /**
-     * @brief Executes bestiary information queries
-     * @param input Bestiary query string
-     * @return 0 on success, negative on error
+     * @brief Records a potion as effective against this beast
+     * @param potionName Name of the effective potion
+     * @param potionHash hashName(potionName)
      * 
-     * Processes requests for beast information, returning known
-     * effectiveness data for specified creatures.
+     * Side effects: Adds potion to effectiveness list if not already present
+     */
+    void addEffectivePotion(const string &potionName, NameHash potionHash);
+
+    /**
+     * @brief Checks whether a sign is recorded as effective
+     * @param signName Sign identifier
+     * @param signHash hashName(signName)
+     * @return true if present in effectiveSigns
      */
-    int executeBestiaryQuery(const string &input);
+    bool hasEffectiveSign(const string &signName, NameHash signHash) const;
     
     /**
-     * @brief Executes alchemy knowledge queries
-     * @param input Alchemy query string
-     * @return 0 on success, negative on error
+     * @brief Checks whether a potion is recorded as effective
+     * @param potionName Potion identifier
+     * @param potionHash hashName(potionName)
+     * @return true if present in effectivePotions
+     */
+    bool hasEffectivePotion(const string &potionName, NameHash potionHash) const;
+
+    /**
+     * @brief Indexes counter lists filled directly, once they outgrow a scan
      * 
-     * Processes requests for potion recipe information, returning
-     * ingredient requirements for specified potions.
+     * Lists filled through addEffectiveSign/addEffectivePotion are indexed
+     * as they grow; call this after appending to the vectors directly.
+     */
+    void indexCounters();
+
+    /**
+     * @brief Whether either counter list is looked up through an index
      */
-    int executeAlchemyQuery(const string &input);
+    bool indexed() const { return !signIndex.empty() || !potionIndex.empty(); }
+};
+
+//========================================================================
+// PERSISTENT STATE
+//========================================================================
+
+/**
+ * @enum StoredKind
+ * @brief Kinds of records kept in a state file
+ */
+enum class StoredKind : uint32_t
+{
+    INGREDIENT,    ///< Inventory ingredient (quantity)
+    POTION,        ///< Inventory potion (quantity)
+    TROPHY,        ///< Inventory trophy (quantity)
+    BEAST,         ///< Bestiary entry (links: counters, 1 = sign, 0 = potion)
+    RECIPE,        ///< Potion formula (links: ingredients with quantities)
+    SIGN           ///< Known sign
+};
+
+/**
+ * @class MappedStateStore
+ * @brief Tracker state kept directly in a memory-mapped file
+ * 
+ * Records are addressed by file offsets, never by pointers, so the file is
+ * usable as soon as it is mapped: reopening it needs no load or replay.
+ * The mapping reserves STATE_FILE_RESERVE bytes of address space up front
+ * and the file grows beneath it, so the base address (and every pointer
+ * handed out) stays fixed for the lifetime of the store.
+ * 
+ * Updates are crash consistent: before a word of committed state is
+ * changed its old value is appended to an undo log in the file header.
+ * Opening a file whose log is not empty rolls the interrupted update back.
+ * A command too large for the log commits in chunks between item updates.
+ * With durable set, log entries and committed data are also flushed with
+ * msync so that the protocol holds across power loss, not only crashes.
+ */
+class MappedStateStore
+{
+private:
+    struct Header;
+    struct Record;
+    struct Link;
+
+    char *base;             ///< Start of the mapping, null when closed
+    uint64_t fileSize;      ///< Current file length
+    int fd;                 ///< File descriptor of the state file
+    bool durable;           ///< Flush with msync at every logging step
+    int updateDepth;        ///< Nesting of beginUpdate() calls
+    uint64_t updateStart;   ///< End of the state committed before the update
+    unsigned headerLogged;  ///< Header words already logged, one bit per word
+
+    Header *header() const { return reinterpret_cast<Header *>(base); }
+    Record *record(uint64_t offset) const { return reinterpret_cast<Record *>(base + offset); }
+    Link *link(uint64_t offset) const { return reinterpret_cast<Link *>(base + offset); }
+
+    void logWord(const void *address);
+    void logHeaderWord(uint64_t *word);
+    void checkpoint();
+    void writeWord(uint64_t *address, uint64_t value);
+    uint64_t allocate(uint64_t bytes);
+    void growIndex();
+    uint64_t findRecord(StoredKind kind, const string &name, NameHash hash) const;
+    uint64_t findOrCreateRecord(StoredKind kind, const string &name, NameHash hash);
+    void flush(const void *address, size_t length) const;
+    void recover();
+
+public:
+    MappedStateStore() : base(nullptr), fileSize(0), fd(-1), durable(false), updateDepth(0), updateStart(0),
+                         headerLogged(0) {}
+    MappedStateStore(const MappedStateStore &) = delete;
+    MappedStateStore &operator=(const MappedStateStore &) = delete;
+    ~MappedStateStore() { close(); }
+
+    /**
+     * @brief Maps a state file, creating it if it does not exist
+     * @param path File to map
+     * @param durableUpdates true to msync at every step of the update protocol
+     * @return false if the file cannot be created, mapped, or is not a state file
+     * @side_effects Rolls back an update interrupted by a crash
+     */
+    bool open(const string &path, bool durableUpdates);
+
+    /**
+     * @brief Unmaps the file
+     */
+    void close();
+
+    bool isOpen() const { return base != nullptr; }
+
+    /**
+     * @brief Starts an update; nested calls join the outer update
+     */
+    void beginUpdate();
+
+    /**
+     * @brief Commits the outermost update by clearing the undo log
+     * @side_effects A nested update ending with the log nearly full commits
+     *               the outer update's changes so far
+     */
+    void commitUpdate();
+
+    /**
+     * @brief Returns the quantity cell of an inventory record
+     * @param kind INGREDIENT, POTION or TROPHY
+     * @param name Item name
+     * @param hash hashName(name)
+     * @return Cell inside the mapping, valid while the store is open;
+     *         change it only through setQuantity()
+     * @side_effects Creates a zero-quantity record if absent
+     */
+    int *quantityCell(StoredKind kind, const string &name, NameHash hash);
+
+    /**
+     * @brief Writes a quantity cell through the undo log
+     */
+    void setQuantity(int *cell, int value);
+
+    /**
+     * @brief Reads an inventory quantity
+     * @return Quantity, 0 if the record does not exist
+     */
+    int quantity(StoredKind kind, const string &name, NameHash hash) const;
+
+    /**
+     * @brief Checks whether a record exists
+     */
+    bool contains(StoredKind kind, const string &name, NameHash hash) const;
+
+    /**
+     * @brief Creates a record without links if absent
+     */
+    void addName(StoredKind kind, const string &name, NameHash hash);
+
+    /**
+     * @brief Adds a link to a record unless an equal link exists
+     * @param kind Record kind
+     * @param name Record name
+     * @param hash hashName(name)
+     * @param linkName Target name
+     * @param linkHash hashName(linkName)
+     * @param value Link payload
+     * @return true if the link was added
+     * @side_effects Creates the record if absent
+     */
+    bool addLink(StoredKind kind, const string &name, NameHash hash, const string &linkName, NameHash linkHash, int value);
+
+    /**
+     * @brief Replaces all links of a record
+     * @side_effects Creates the record if absent
+     */
+    void setLinks(StoredKind kind, const string &name, NameHash hash, const vector<string> &linkNames,
+                  const vector<NameHash> &linkHashes, const vector<int> &values);
+
+    /**
+     * @brief Reads the links of a record in the order they were added
+     * @return false if the record does not exist
+     */
+    bool getLinks(StoredKind kind, const string &name, NameHash hash, vector<string> &linkNames,
+                  vector<NameHash> &linkHashes, vector<int> &values) const;
+
+    /**
+     * @brief Appends every record of a kind with a positive quantity (unsorted)
+     */
+    void collect(StoredKind kind, vector<pair<string, int>> &items) const;
+
+    /**
+     * @brief Appends the name of every record of a kind (unsorted)
+     */
+    void collectNames(StoredKind kind, vector<string> &names) const;
+};
+
+//========================================================================
+// OUT-OF-CORE INVENTORY
+//========================================================================
+
+/**
+ * @struct LsmStats
+ * @brief Counters of an LsmItemStore
+ */
+struct LsmStats
+{
+    size_t runs;                ///< Runs on disk now
+    uint64_t runBytes;          ///< Bytes held by those runs
+    uint64_t flushes;           ///< Memtables written out as runs
+    uint64_t merges;            ///< Background merges completed
+    uint64_t bytesWritten;      ///< Bytes written by flushes and merges
+    uint64_t blockReads;        ///< Run blocks read by point lookups
+    FilterStats filter;         ///< Run filters consulted by point lookups, merged runs included
+
+    LsmStats() : runs(0), runBytes(0), flushes(0), merges(0), bytesWritten(0), blockReads(0) {}
+};
+
+/**
+ * @class LsmItemStore
+ * @brief Log-structured merge tree holding inventory quantities on disk
+ * 
+ * Updates go to a memtable; once it holds LSM_MEMTABLE_ITEMS items it is
+ * written out as an immutable run sorted by (kind, name). A run keeps only
+ * a sparse index of every LSM_INDEX_INTERVAL-th key and a Bloom filter in
+ * memory, so memory stays bounded however many items the runs hold. A
+ * point lookup reads the memtable, then the runs from newest to oldest,
+ * reading one block of each run whose filter passes. Quantity 0 is kept
+ * as a tombstone hiding older values.
+ * 
+ * A background thread merges LSM_MERGE_RUNS runs of one level into one
+ * run of the next level, so an item is rewritten about once per level;
+ * merges that include the oldest run drop tombstones. Listings merge the
+ * memtable and the runs in key order.
+ * 
+ * Run files are unlinked as soon as they are created: the directory only
+ * provides scratch space, nothing is left in it after exit and the store
+ * always opens empty. Items handed out as slots are pinned in memory,
+ * where their cells keep a fixed address.
+ * 
+ * One thread at a time may use the store; only merging runs concurrently.
+ */
+class LsmItemStore
+{
+private:
+    struct Run;
+    class RunReader;
+    class KeyMerge;
+
+    string directory;                           ///< Where run files are created; empty when closed
+    unordered_map<string, int> memtable;        ///< Newest quantities by key (kind byte + name)
+    unordered_map<string, size_t> pinnedIndex;  ///< Key -> cell in pinned
+    deque<int> pinned;                          ///< Cells of pinned items, newer than any other source
+    vector<unique_ptr<Run>> runs;               ///< Oldest first; levels never increase
+    atomic<uint64_t> nextRunNumber;             ///< Numbers run file names
+    mutable mutex runsLock;                     ///< Guards runs and counters against the merge thread
+    condition_variable mergeWake;               ///< Signalled when runs are added or the store closes
+    condition_variable mergeDone;               ///< Signalled when a merge completes
+    thread merger;                              ///< Background merge thread
+    bool stopping;                              ///< Tells the merge thread to exit
+    mutable LsmStats counters;                  ///< Cumulative counters; runs and runBytes unused
+    mutable FilterStats retiredFilters;         ///< Filter counters of runs replaced by merges
+
+    static string makeKey(StoredKind kind, const string &name);
+    unique_ptr<Run> createRun(int level, size_t expected);
+    void flush();
+    bool findMerge(size_t &first) const;
+    void mergeLoop();
+    unique_ptr<Run> mergeRuns(const vector<Run *> &inputs, int level, bool dropTombstones);
+
+public:
+    LsmItemStore();
+    LsmItemStore(const LsmItemStore &) = delete;
+    LsmItemStore &operator=(const LsmItemStore &) = delete;
+    ~LsmItemStore();
+
+    /**
+     * @brief Starts an empty store keeping its runs in a directory
+     * @param path Existing writable directory
+     * @return false if no run file can be created there
+     * @side_effects Starts the merge thread
+     */
+    bool open(const string &path);
+
+    /**
+     * @brief Stops the merge thread and discards every item
+     */
+    void close();
+
+    bool isOpen() const { return !directory.empty(); }
+
+    /**
+     * @brief Reads an item's quantity
+     * @param kind INGREDIENT, POTION or TROPHY
+     * @param name Item name
+     * @param hash hashName(name)
+     * @return Quantity, 0 if unknown
+     */
+    int quantity(StoredKind kind, const string &name, NameHash hash) const;
+
+    /**
+     * @brief Sets an item's quantity
+     * @param kind INGREDIENT, POTION or TROPHY
+     * @param name Item name
+     * @param value New quantity; 0 removes the item
+     * @side_effects May write the memtable out as a run, waiting for merges
+     *               if too many runs are waiting for one
+     */
+    void setQuantity(StoredKind kind, const string &name, int value);
+
+    /**
+     * @brief Keeps an item in memory for the lifetime of the store
+     * @param kind INGREDIENT, POTION or TROPHY
+     * @param name Item name
+     * @param hash hashName(name)
+     * @return Quantity cell at a fixed address; writing it updates the item
+     */
+    int *pin(StoredKind kind, const string &name, NameHash hash);
+
+    /**
+     * @brief Appends every item of a kind with a positive quantity, sorted by name
+     * @param kind INGREDIENT, POTION or TROPHY
+     * @param items Receives (name, quantity) pairs
+     */
+    void collect(StoredKind kind, vector<pair<string, int>> &items) const;
+
+    /**
+     * @brief Waits until no level holds enough runs to merge
+     */
+    void waitForMerges();
+
+    /**
+     * @brief Snapshot of the counters and of the runs on disk
+     */
+    LsmStats stats() const;
+
+    /**
+     * @brief Holds off the merge thread so that fork() copies a settled store
+     */
+    void beginFork() const { runsLock.lock(); }
+
+    /**
+     * @brief Releases the merge thread; called by both processes after fork()
+     */
+    void endFork() const { runsLock.unlock(); }
+};
+
+//========================================================================
+// STATE DIGEST
+//========================================================================
+
+/**
+ * @class StateDigest
+ * @brief Order-independent 128-bit digest of a set of state elements
+ * 
+ * Each element (a key and a value) is mixed into two independent 64-bit
+ * words that are added into the digest modulo 2^64. Addition commutes, so
+ * the digest depends only on which elements are present, and removing an
+ * element subtracts exactly what adding it contributed. Both are O(1),
+ * which lets every mutation keep the digest current. Elements are
+ * identified by name hashes, not names.
+ */
+class StateDigest
+{
+private:
+    uint64_t low;       ///< First lane
+    uint64_t high;      ///< Second lane
+
+public:
+    StateDigest() : low(0), high(0) {}
+
+    /**
+     * @brief Builds the key of a named element
+     * @param kind What the element is (inventory category, beast, recipe, sign)
+     * @param hash hashName of the element's name
+     * @return Key distinct for every (kind, name)
+     */
+    static uint64_t key(StoredKind kind, NameHash hash);
+
+    /**
+     * @brief Folds one more word into an ordered sequence value
+     * @param sequence Value of the sequence so far (start with 0)
+     * @param word Next word
+     * @return Value of the extended sequence
+     */
+    static uint64_t combine(uint64_t sequence, uint64_t word);
+
+    /**
+     * @brief Adds an element
+     * @param key Element key from key()
+     * @param value Element value
+     */
+    void add(uint64_t key, uint64_t value);
+
+    /**
+     * @brief Removes an element previously added with the same key and value
+     * @param key Element key from key()
+     * @param value Element value
+     */
+    void remove(uint64_t key, uint64_t value);
+
+    /**
+     * @brief Merges the elements of another digest (disjoint sets)
+     */
+    StateDigest &operator+=(const StateDigest &other)
+    {
+        low += other.low;
+        high += other.high;
+        return *this;
+    }
+
+    bool operator==(const StateDigest &other) const { return low == other.low && high == other.high; }
+    bool operator!=(const StateDigest &other) const { return !(*this == other); }
+
+    /**
+     * @brief Formats the digest as 32 lowercase hex digits
+     */
+    string toString() const;
+};
+
+//========================================================================
+// MANAGEMENT SYSTEM CLASSES
+//========================================================================
+
+/**
+ * @class Inventory
+ * @brief Centralized storage system for all player items
+ * 
+ * Manages ingredients, potions, and trophies with quantity tracking,
+ * addition/removal operations, and query capabilities. Every operation
+ * has an overload taking the precomputed hashName of the item so that
+ * names coming from the tokenizer are not hashed again. Each category is
+ * held in a TieredItemStore, so idle items are kept compact and sorted.
+ * Inventories larger than memory can be kept in an LsmItemStore instead.
+ */
+class Inventory
+{
+public:
+    /**
+     * @struct ItemCollection
+     * @brief Progress of a collectItems() done in slices
+     */
+    struct ItemCollection
+    {
+        vector<pair<string, int>> items;    ///< Every item, sorted by name, once complete
+        size_t nextSource = 0;              ///< 0 for the state file or out-of-core store, then 1 + shard index
+        TieredItemStore::Listing listing;   ///< Progress through the shard being read
+        vector<pair<string, int>> runs;     ///< Sorted items of each source read, back to back
+        vector<size_t> runEnds;             ///< End of each non-empty source's items in runs
+        vector<size_t> cursors;             ///< Next item of each source once merging
+        vector<size_t> heap;                ///< Sources with items left to merge, smallest on top
+    };
+
+private:
+    /**
+     * @struct Shard
+     * @brief One hash partition of the inventory with its own lock
+     */
+    struct Shard
+    {
+        TieredItemStore ingredients;    ///< Ingredient name -> quantity mapping
+        TieredItemStore potions;        ///< Potion name -> quantity mapping
+        TieredItemStore trophies;       ///< Trophy name -> quantity mapping
+        StateDigest digest;             ///< Items of this shard with a positive quantity
+        mutable RWLock lock;            ///< Guards the tables of this shard
+    };
+
+    vector<Shard> shards;           ///< Items partitioned by name hash
+    MappedStateStore *store;        ///< When set, items live in this state file instead
+    LsmItemStore *lsm;              ///< When set, items live in this out-of-core store instead
+    CounterJoin *join;              ///< When set, told about every quantity change
+
+    /**
+     * @brief Adds to an item of one category
+     */
+    void addItem(StoredKind kind, TieredItemStore Shard::*table, const string &name, NameHash hash, int quantity);
+
+    /**
+     * @brief Removes from an item of one category if enough is held
+     */
+    bool removeItem(StoredKind kind, TieredItemStore Shard::*table, const string &name, NameHash hash, int quantity);
+
+    /**
+     * @brief Reads the quantity of an item of one category
+     */
+    int getItemQuantity(StoredKind kind, TieredItemStore Shard::*table, const string &name, NameHash hash) const;
+
+    /**
+     * @brief Accounts for a quantity change in the shard digest and the join
+     */
+    void recordChange(size_t shard, uint64_t key, const string &name, int before, int after);
+
+public:
+    /**
+     * @brief Constructor selecting the number of shards
+     * @param shardCount Number of hash partitions (1 for single-threaded use)
+     */
+    explicit Inventory(size_t shardCount = 1);
+
+    /**
+     * @brief Keeps all items in an open state file from now on
+     * @param stateStore Open store, or nullptr to return to in-memory tables
+     * 
+     * The digest is recomputed from the items already in the file.
+     */
+    void attachStore(MappedStateStore *stateStore);
+
+    /**
+     * @brief Keeps all items in an out-of-core store from now on
+     * @param lsmStore Open store, or nullptr to return to in-memory tables
+     * 
+     * The digest is recomputed from the items already in the store.
+     */
+    void attachLsm(LsmItemStore *lsmStore);
+
+    /**
+     * @brief Reports every quantity change to a join from now on
+     * @param counterJoin Join to keep current, or nullptr
+     */
+    void attachJoin(CounterJoin *counterJoin) { join = counterJoin; }
+
+    /**
+     * @brief Maps an item name hash to the shard that stores it
+     * @param hash hashName of the item
+     * @return Shard index in [0, getShardCount())
+     */
+    size_t shardOf(NameHash hash) const { return shards.size() == 1 ? 0 : static_cast<size_t>(hash >> 32) % shards.size(); }
+    
+    /**
+     * @brief Number of shards the inventory is split into
+     */
+    size_t getShardCount() const { return shards.size(); }
+    
+    /**
+     * @brief Lock guarding a single shard
+     * @param shard Shard index
+     */
+    RWLock &shardLock(size_t shard) const { return shards[shard].lock; }
+
+    /**
+     * @brief Combined counters of the negative lookup filters of every table
+     */
+    FilterStats getFilterStats() const;
+
+    /**
+     * @brief Combines the hot index switches of every table
+     * @return Sum over shards and item categories
+     */
+    ContainerStats getContainerStats() const;
+
+    /**
+     * @brief Adds ingredients to inventory
+     * @param name Ingredient identifier
+     * @param hash hashName(name)
+     * @param quantity Amount to add (must be positive)
+     * 
+     * Side effects: Creates new entry or increases existing quantity
+     */
+    void addIngredient(const string &name, NameHash hash, int quantity);
+    void addIngredient(const string &name, int quantity) { addIngredient(name, hashName(name), quantity); }
+    
+    /**
+     * @brief Adds potions to inventory
+     * @param name Potion identifier  
+     * @param hash hashName(name)
+     * @param quantity Amount to add (must be positive)
+     * 
+     * Side effects: Creates new entry or increases existing quantity
+     */
+    void addPotion(const string &name, NameHash hash, int quantity);
+    void addPotion(const string &name, int quantity) { addPotion(name, hashName(name), quantity); }
+    
+    /**
+     * @brief Adds trophies to inventory
+     * @param name Trophy identifier
+     * @param hash hashName(name)
+     * @param quantity Amount to add (must be positive)
+     * 
+     * Side effects: Creates new entry or increases existing quantity
+     */
+    void addTrophy(const string &name, NameHash hash, int quantity);
+    void addTrophy(const string &name, int quantity) { addTrophy(name, hashName(name), quantity); }
+
+    /**
+     * @brief Attempts to remove ingredients from inventory
+     * @param name Ingredient identifier
+     * @param hash hashName(name)
+     * @param quantity Amount to remove
+     * @return true if sufficient quantity available and removed, false otherwise
+     * 
+     * Side effects: Decreases quantity if successful, no change if insufficient
+     */
+    bool removeIngredient(const string &name, NameHash hash, int quantity);
+    bool removeIngredient(const string &name, int quantity) { return removeIngredient(name, hashName(name), quantity); }
+    
+    /**
+     * @brief Attempts to remove potions from inventory
+     * @param name Potion identifier
+     * @param hash hashName(name)
+     * @param quantity Amount to remove
+     * @return true if sufficient quantity available and removed, false otherwise
+     */
+    bool removePotion(const string &name, NameHash hash, int quantity);
+    bool removePotion(const string &name, int quantity) { return removePotion(name, hashName(name), quantity); }
+    
+    /**
+     * @brief Attempts to remove trophies from inventory
+     * @param name Trophy identifier
+     * @param hash hashName(name)
+     * @param quantity Amount to remove
+     * @return true if sufficient quantity available and removed, false otherwise
+     */
+    bool removeTrophy(const string &name, NameHash hash, int quantity);
+    bool removeTrophy(const string &name, int quantity) { return removeTrophy(name, hashName(name), quantity); }
+
+    /**
+     * @brief Queries current ingredient quantity
+     * @param name Ingredient identifier
+     * @param hash hashName(name)
+     * @return Current quantity (0 if item not found)
+     */
+    int getIngredientQuantity(const string &name, NameHash hash) const;
+    int getIngredientQuantity(const string &name) const { return getIngredientQuantity(name, hashName(name)); }
+    
+    /**
+     * @brief Queries current potion quantity
+     * @param name Potion identifier
+     * @param hash hashName(name)
+     * @return Current quantity (0 if item not found)
+     */
+    int getPotionQuantity(const string &name, NameHash hash) const;
+    int getPotionQuantity(const string &name) const { return getPotionQuantity(name, hashName(name)); }
+    
+    /**
+     * @brief Queries current trophy quantity
+     * @param name Trophy identifier
+     * @param hash hashName(name)
+     * @return Current quantity (0 if item not found)
+     */
+    int getTrophyQuantity(const string &name, NameHash hash) const;
+    int getTrophyQuantity(const string &name) const { return getTrophyQuantity(name, hashName(name)); }
+
+    /**
+     * @brief Queries the quantities of several items of one category at once
+     * @param category Category of every item
+     * @param names Item identifiers
+     * @param hashes hashName of each name
+     * @param quantities Receives the quantity of each item, in the order of names
+     * 
+     * Items are probed grouped by shard and in name order, so consecutive
+     * probes share the cold tier's search path, and the filter words and
+     * index slot of the item MULTI_GET_PREFETCH places ahead are prefetched
+     * while the current one is read.
+     */
+    void getQuantities(ItemCategory category, const vector<string> &names, const vector<NameHash> &hashes,
+                       vector<int> &quantities) const;
+
+    /**
+     * @struct ItemSlot
+     * @brief Resolved storage location of one item
+     * 
+     * Obtained once (e.g. when a command is prepared) and then used to
+     * update or read the item without another name lookup. Slots stay
+     * valid for the lifetime of the inventory.
+     */
+    struct ItemSlot
+    {
+        int *quantity;      ///< Quantity cell inside the owning shard
+        size_t shard;       ///< Shard holding the item
+        uint64_t key;       ///< StateDigest key of the item
+        string name;        ///< Name of the item, which the join compares after the key
+    };
+
+    /**
+     * @brief Resolves the storage slot of an ingredient
+     * @param name Ingredient identifier
+     * @param hash hashName(name)
+     * @return Slot, creating a zero-quantity entry if the item is new
+     */
+    ItemSlot resolveIngredient(const string &name, NameHash hash);
+    
+    /**
+     * @brief Resolves the storage slot of a potion
+     * @param name Potion identifier
+     * @param hash hashName(name)
+     * @return Slot, creating a zero-quantity entry if the item is new
+     */
+    ItemSlot resolvePotion(const string &name, NameHash hash);
+    
+    /**
+     * @brief Resolves the storage slot of a trophy
+     * @param name Trophy identifier
+     * @param hash hashName(name)
+     * @return Slot, creating a zero-quantity entry if the item is new
+     */
+    ItemSlot resolveTrophy(const string &name, NameHash hash);
+
+    /**
+     * @brief Adds to the item stored in a resolved slot
+     * @param slot Slot from one of the resolve methods
+     * @param quantity Amount to add
+     */
+    void addToSlot(const ItemSlot &slot, int quantity);
+    
+    /**
+     * @brief Removes from the item stored in a resolved slot if enough is held
+     * @param slot Slot from one of the resolve methods
+     * @param quantity Amount to remove
+     * @return true if removed, false if insufficient (no change)
+     */
+    bool removeFromSlot(const ItemSlot &slot, int quantity);
+    
+    /**
+     * @brief Reads the item stored in a resolved slot
+     * @param slot Slot from one of the resolve methods
+     * @return Current quantity
+     */
+    int getSlotQuantity(const ItemSlot &slot) const;
+
+    /**
+     * @brief Collects every item of one category with a positive quantity
+     * @param category Category to collect
+     * @param items Receives (name, quantity) pairs sorted by name
+     */
+    void collectItems(ItemCategory category, vector<pair<string, int>> &items) const;
+
+    /**
+     * @brief Collects items into a collection until done or out of budget
+     * @param category Category to collect
+     * @param collection Progress so far; start from a default-constructed one
+     * @param meter Budget of this slice, one unit per item read or merged
+     * @return true once every source has been merged in
+     * 
+     * Sources are the state file or out-of-core store, read in one go,
+     * then each shard, read item by item; their sorted items are merged
+     * at the end. A collection done step by step equals collectItems() if
+     * the inventory does not change between the steps.
+     */
+    bool collectItemsStep(ItemCategory category, ItemCollection &collection, SliceMeter &meter) const;
+
+    /**
+     * @brief Generates formatted listing of all ingredients
+     * @return String containing all ingredients with quantities
+     */
+    string getAllIngredients() const;
+    
+    /**
+     * @brief Generates formatted listing of all potions
+     * @return String containing all potions with quantities
+     */
+    string getAllPotions() const;
+    
+    /**
+     * @brief Generates formatted listing of all trophies
+     * @return String containing all trophies with quantities
+     */
+    string getAllTrophies() const;
+
+    /**
+     * @brief Runs one slice of compacting one table of one shard
+     * @param shard Shard index
+     * @param category Table within the shard
+     * @param meter Budget of the slice
+     * @return true once the table is compacted
+     * 
+     * Callers in a concurrent tracker must hold the shard's write lock.
+     * Does nothing when the items live in a state file or an out-of-core
+     * store, which merges its runs by itself.
+     */
+    bool compactTable(size_t shard, ItemCategory category, SliceMeter &meter);
+
+    /**
+     * @brief Digest of every item with a positive quantity
+     * @return Sum of the shard digests
+     * 
+     * Callers in a concurrent tracker must hold every shard lock.
+     */
+    StateDigest getDigest() const;
+
+private:
+    /**
+     * @brief Resolves the slot of an item of one category
+     */
+    ItemSlot resolveItem(StoredKind kind, TieredItemStore Shard::*table, const string &name, NameHash hash);
+};
+
+/**
+ * @brief Appends part of an item listing as "quantity name, quantity name, ..."
+ * @param items Items in listing order
+ * @param begin First item to append; preceded by ", " unless it is item 0
+ * @param end One past the last item to append
+ * @param result String receiving the text
+ * 
+ * Appending consecutive ranges builds the same text as one call over all
+ * the items, so long listings can be written in pieces.
+ */
+void appendItemList(const vector<pair<string, int>> &items, size_t begin, size_t end, string &result);
+
+/**
+ * @struct StashItem
+ * @brief One line of a multi-item stash operation
+ */
+struct StashItem
+{
+    ItemCategory category;  ///< Ingredient, potion or trophy
+    string name;            ///< Item identifier
+    int quantity;           ///< Amount to add or withdraw
+
+    StashItem(ItemCategory c, const string &n, int q) : category(c), name(n), quantity(q) {}
+};
+
+/**
+ * @class SharedStash
+ * @brief Lock-free inventory shared by many concurrent player sessions
+ * 
+ * Items live in a fixed-capacity open-addressing table. Lookups never lock,
+ * new names are published with a single compare-and-swap on an empty slot,
+ * and quantities are atomic counters. Removal uses a compare-and-swap loop
+ * so that "remove only if enough" behaves like Inventory::removeIngredient.
+ * Slots are never freed, so a name keeps its slot for the stash lifetime.
+ * Single-item operations are lock-free; a multi-item transfer briefly
+ * claims the slots it touches, and operations on those slots wait for it.
+ * 
+ * The stash is a standalone building block for hosts that share one
+ * inventory among sessions; WitcherTracker keeps its own Inventory and
+ * no command reaches a stash.
+ */
+class SharedStash
+{
+private:
+    /**
+     * @struct Key
+     * @brief Immutable item identity published into a slot
+     */
+    struct Key
+    {
+        size_t hash;            ///< Hash of category and name
+        ItemCategory category;  ///< Item category
+        string name;            ///< Item identifier
+    };
+
+    /**
+     * @struct Slot
+     * @brief Table entry; empty while key is null
+     */
+    struct Slot
+    {
+        atomic<Key *> key;      ///< Published identity, null if unused
+        atomic<int> quantity;   ///< Current amount held, INT_MIN while a transfer claims the slot
+
+        Slot() : key(nullptr), quantity(0) {}
+    };
+
+    struct TransferSlot;
+
+    unique_ptr<Slot[]> slots;   ///< Open-addressing table
+    size_t capacity;            ///< Number of slots (power of two)
+
+    static size_t hashItem(ItemCategory category, const string &name);
+    Slot *findSlot(ItemCategory category, const string &name) const;
+    Slot *findOrInsertSlot(ItemCategory category, const string &name);
+    bool addItem(ItemCategory category, const string &name, int quantity);
+    bool removeItem(ItemCategory category, const string &name, int quantity);
+    int getQuantity(ItemCategory category, const string &name) const;
+    string getAll(ItemCategory category) const;
+
+public:
+    /**
+     * @brief Constructor
+     * @param slotCount Maximum number of distinct items (rounded up to a power of two)
+     */
+    explicit SharedStash(size_t slotCount = SHARED_STASH_CAPACITY);
+    SharedStash(const SharedStash &) = delete;
+    SharedStash &operator=(const SharedStash &) = delete;
+    
+    /**
+     * @brief Destructor releasing published keys
+     */
+    ~SharedStash();
+
+    /**
+     * @brief Adds ingredients to the stash
+     * @param name Ingredient identifier
+     * @param quantity Amount to add
+     * @return false only if the stash has no free slot for a new name
+     */
+    bool addIngredient(const string &name, int quantity) { return addItem(ItemCategory::INGREDIENT, name, quantity); }
+    
+    /**
+     * @brief Adds potions to the stash
+     * @param name Potion identifier
+     * @param quantity Amount to add
+     * @return false only if the stash has no free slot for a new name
+     */
+    bool addPotion(const string &name, int quantity) { return addItem(ItemCategory::POTION, name, quantity); }
+    
+    /**
+     * @brief Adds trophies to the stash
+     * @param name Trophy identifier
+     * @param quantity Amount to add
+     * @return false only if the stash has no free slot for a new name
+     */
+    bool addTrophy(const string &name, int quantity) { return addItem(ItemCategory::TROPHY, name, quantity); }
+
+    /**
+     * @brief Atomically removes ingredients if enough are held
+     * @param name Ingredient identifier
+     * @param quantity Amount to remove
+     * @return true if removed, false if insufficient (no change)
+     */
+    bool removeIngredient(const string &name, int quantity) { return removeItem(ItemCategory::INGREDIENT, name, quantity); }
+    
+    /**
+     * @brief Atomically removes potions if enough are held
+     * @param name Potion identifier
+     * @param quantity Amount to remove
+     * @return true if removed, false if insufficient (no change)
+     */
+    bool removePotion(const string &name, int quantity) { return removeItem(ItemCategory::POTION, name, quantity); }
+    
+    /**
+     * @brief Atomically removes trophies if enough are held
+     * @param name Trophy identifier
+     * @param quantity Amount to remove
+     * @return true if removed, false if insufficient (no change)
+     */
+    bool removeTrophy(const string &name, int quantity) { return removeItem(ItemCategory::TROPHY, name, quantity); }
+
+    /**
+     * @brief Queries current ingredient quantity without locking
+     */
+    int getIngredientQuantity(const string &name) const { return getQuantity(ItemCategory::INGREDIENT, name); }
+    
+    /**
+     * @brief Queries current potion quantity without locking
+     */
+    int getPotionQuantity(const string &name) const { return getQuantity(ItemCategory::POTION, name); }
+    
+    /**
+     * @brief Queries current trophy quantity without locking
+     */
+    int getTrophyQuantity(const string &name) const { return getQuantity(ItemCategory::TROPHY, name); }
+
+    /**
+     * @brief Formatted listing of all ingredients (same format as Inventory)
+     */
+    string getAllIngredients() const { return getAll(ItemCategory::INGREDIENT); }
+    
+    /**
+     * @brief Formatted listing of all potions (same format as Inventory)
+     */
+    string getAllPotions() const { return getAll(ItemCategory::POTION); }
+    
+    /**
+     * @brief Formatted listing of all trophies (same format as Inventory)
+     */
+    string getAllTrophies() const { return getAll(ItemCategory::TROPHY); }
+
+    /**
+     * @brief All-or-nothing exchange of items
+     * @param taken Items withdrawn from the stash
+     * @param given Items deposited once every withdrawal succeeded
+     * @return true if the whole exchange happened, false if nothing changed
+     * 
+     * Linearizable: every slot involved is claimed before any is checked
+     * or changed, and operations meeting a claimed slot wait until the
+     * transfer releases it, so no one observes part of an exchange or one
+     * that failed.
+     */
+    bool transfer(const vector<StashItem> &taken, const vector<StashItem> &given);
+    
+    /**
+     * @brief All-or-nothing trade of trophies for ingredients
+     * @param trophies Trophy name/quantity pairs to give up
+     * @param ingredients Ingredient name/quantity pairs received
+     * @return true if the trade happened
+     */
+    bool trade(const vector<pair<string, int>> &trophies, const vector<pair<string, int>> &ingredients);
+    
+    /**
+     * @brief All-or-nothing brew consuming a formula's ingredients
+     * @param potion Potion with known formula
+     * @return true if the ingredients were consumed and the potion added
+     */
+    bool brew(const Potion &potion);
+};
+
+/**
+ * @class Bestiary
+ * @brief Knowledge database for beast combat information
+ * 
+ * Stores and manages information about beast weaknesses, allowing
+ * players to record and query effective combat strategies. Most beasts
+ * are kept in a compact FrozenRelation; recent learns go to a small delta.
+ * While a freeze runs in slices, the delta it folds in is sealed and read
+ * between the new delta and the frozen part.
+ */
+class Bestiary
+{
+private:
+    struct Freeze;
+
+    NameTable<Beast> beasts;        ///< Recently learned or updated beasts (mutable delta)
+    NameTable<Beast> sealed;        ///< Former delta being folded into the frozen part
+    FrozenRelation frozen;          ///< Compact beasts; links carry 1 for signs, 0 for potions
+    unique_ptr<Freeze> freezing;    ///< Freeze in progress, if any
+    BloomFilter filter;             ///< Names of all known beasts
+    MappedStateStore *store;        ///< When set, beasts live in this state file instead
+    StateDigest digest;             ///< Every beast-counter pair
+    ContainerSwitches switches;     ///< Delta table and counter list index switches
+    mutable RWLock rwLock;          ///< Guards beasts in a concurrent tracker
+
+    /**
+     * @brief Decodes a frozen row into a Beast
+     */
+    void thaw(size_t row, Beast &beast) const;
+
+    /**
+     * @brief Finds a beast in the delta, then in the sealed delta
+     */
+    const Beast *findRecent(const string &name, NameHash hash) const;
+    
+    /**
+     * @brief Returns the delta copy of a beast, creating it if needed
+     */
+    Beast &deltaBeast(const string &name, NameHash hash);
+    
+    /**
+     * @brief Refills the filter from the delta and the frozen beasts
+     */
+    void rebuildFilter();
+
+public:
+    /**
+     * @brief Lock guarding the whole bestiary
+     */
+    RWLock &lock() const { return rwLock; }
+
+    Bestiary();
+    ~Bestiary();
+
+    /**
+     * @brief Keeps all beasts in an open state file from now on
+     * @param stateStore Open store, or nullptr to return to in-memory tables
+     * 
+     * The digest is recomputed from the beasts already in the file.
+     */
+    void attachStore(MappedStateStore *stateStore);
+
+    /**
+     * @brief Digest of every beast-counter pair, kept current by addEffectiveness
+     */
+    const StateDigest &getDigest() const { return digest; }
+
+    /**
+     * @brief Creates new beast entry in bestiary
+     * @param name Beast identifier
+     * @param hash hashName(name)
+     * 
+     * Side effects: Adds empty beast entry if not already present
+     */
+    void addBeast(const string &name, NameHash hash);
+    void addBeast(const string &name) { addBeast(name, hashName(name)); }
+    
+    /**
+     * @brief Records effectiveness data for a beast
+     * @param beastName Target beast identifier
+     * @param beastHash hashName(beastName)
+     * @param counter Name of effective sign or potion
+     * @param counterHash hashName(counter)
+     * @param isSign true for sign effectiveness, false for potion
+     * 
+     * Side effects: Creates beast entry if needed, adds counter to appropriate list
+     */
+    void addEffectiveness(const string &beastName, NameHash beastHash, const string &counter, NameHash counterHash, bool isSign);
+    void addEffectiveness(const string &beastName, const string &counter, bool isSign)
+    {
+        addEffectiveness(beastName, hashName(beastName), counter, hashName(counter), isSign);
+    }
+    
+    /**
+     * @brief Retrieves a copy of beast data from either representation
+     * @param name Beast identifier
+     * @param hash hashName(name)
+     * @param beast Receives the beast's counters
+     * @return true if the beast is known
+     */
+    bool getBeast(const string &name, NameHash hash, Beast &beast) const;
+    bool getBeast(const string &name, Beast &beast) const { return getBeast(name, hashName(name), beast); }
+    
+    /**
+     * @brief Moves every beast into the compact frozen representation
+     * 
+     * Called automatically once the delta outgrows KNOWLEDGE_DELTA_LIMIT
+     * or a quarter of the frozen part; may also be called on demand.
+     * Finishes a freeze in progress first.
+     */
+    void freeze();
+
+    /**
+     * @brief Runs one slice of a freeze
+     * @param meter Budget of the slice; each beast, counter or sealed entry handled takes a unit
+     * @return true once the beasts learned before the freeze began are all frozen
+     * 
+     * The first slice seals the delta; learns go to a fresh one from then
+     * on. The new frozen relation is built from the old one and the sealed
+     * beasts, replaces the old one in one step, and the sealed beasts are
+     * then released a few at a time.
+     */
+    bool freezeStep(SliceMeter &meter);
+    
+    /**
+     * @brief Counters of the filter that answers lookups of unknown beasts
+     */
+    FilterStats getFilterStats() const { return filter.stats(); }
+
+    /**
+     * @brief Index switches of the delta table and of beasts' counter lists
+     */
+    ContainerStats getContainerStats() const { return switches.stats(); }
+    
+    /**
+     * @brief Generates formatted effectiveness information
+     * @param beastName Beast to query
+     * @param beastHash hashName(beastName)
+     * @return String listing effective signs and potions for this beast
+     */
+    string getEffectiveCounters(const string &beastName, NameHash beastHash) const;
+    string getEffectiveCounters(const string &beastName) const { return getEffectiveCounters(beastName, hashName(beastName)); }
+
+    /**
+     * @brief Generates effectiveness information for several beasts at once
+     * @param beastNames Beasts to query
+     * @param beastHashes hashName of each beast
+     * @param results Receives getEffectiveCounters() of each beast, in the order of beastNames
+     * 
+     * Beasts are probed in name order, which keeps the frozen part's
+     * binary searches on a shared path, with the filter words and delta
+     * index slot of a beast a few places ahead prefetched.
+     */
+    void getEffectiveCounters(const vector<string> &beastNames, const vector<NameHash> &beastHashes,
+                              vector<string> &results) const;
+
+    /**
+     * @brief Collects the names of every known beast
+     * @param names Receives the names, sorted
+     */
+    void collectBeastNames(vector<string> &names) const;
+};
+
+/**
+ * @class AlchemyKnowledge
+ * @brief Repository for potion recipes and magical sign knowledge
+ * 
+ * Manages learned potion formulas and available magical signs,
+ * enabling brewing operations and combat planning. Most recipes are kept
+ * in a compact FrozenRelation; recent learns go to a small delta. While a
+ * freeze runs in slices, the delta it folds in is sealed and read between
+ * the new delta and the frozen part.
+ */
+class AlchemyKnowledge
+{
+private:
+    struct Freeze;
+
+    NameTable<Potion> potions;      ///< Recently learned recipes (mutable delta)
+    NameTable<Potion> sealedPotions;    ///< Former delta being folded into the frozen part
+    FrozenRelation frozenPotions;   ///< Compact recipes; links carry ingredient quantities
+    unique_ptr<Freeze> freezing;    ///< Freeze in progress, if any
+    BloomFilter potionFilter;       ///< Names of all known potions
+    NameTable<Sign> signs;          ///< Sign name -> sign data mapping
+    MappedStateStore *store;        ///< When set, recipes and signs live in this state file instead
+    StateDigest digest;             ///< Every recipe and sign
+    ContainerSwitches switches;     ///< Recipe and sign table index switches
+    mutable RWLock rwLock;          ///< Guards potions and signs in a concurrent tracker
+
+    /**
+     * @brief Refills the potion filter from the delta and the frozen recipes
+     */
+    void rebuildFilter();
+
+    /**
+     * @brief Finds a recipe in the delta, then in the sealed delta
+     */
+    const Potion *findRecent(const string &name, NameHash hash) const;
+
+public:
+    /**
+     * @brief Lock guarding the whole knowledge base
+     */
+    RWLock &lock() const { return rwLock; }
+
+    AlchemyKnowledge();
+    ~AlchemyKnowledge();
+
+    /**
+     * @brief Keeps all recipes and signs in an open state file from now on
+     * @param stateStore Open store, or nullptr to return to in-memory tables
+     * 
+     * The digest is recomputed from the recipes and signs already in the file.
+     */
+    void attachStore(MappedStateStore *stateStore);
+
+    /**
+     * @brief Digest of every recipe and sign, kept current by the add methods
+     */
+    const StateDigest &getDigest() const { return digest; }
+
+    /**
+     * @brief Stores or updates a potion recipe
+     * @param potionName Potion identifier
+     * @param potionHash hashName(potionName)
+     * @param ingredients List of required ingredient names
+     * @param quantities List of required amounts (parallel to ingredients)
+     * @param ingredientHashes hashName of each ingredient (parallel to ingredients)
+     * 
+     * Side effects: Creates/updates potion entry with complete recipe
+     */
+    void addPotionFormula(const string &potionName, NameHash potionHash, const vector<string> &ingredients,
+                          const vector<int> &quantities, const vector<NameHash> &ingredientHashes);
+    void addPotionFormula(const string &potionName, const vector<string> &ingredients, const vector<int> &quantities);
+    
+    /**
+     * @brief Adds a magical sign to knowledge base
+     * @param signName Sign identifier
+     * @param signHash hashName(signName)
+     * 
+     * Side effects: Creates sign entry if not already present
+     */
+    void addSign(const string &signName, NameHash signHash);
+    void addSign(const string &signName) { addSign(signName, hashName(signName)); }
+
+    /**
+     * @brief Retrieves a copy of a potion recipe from either representation
+     * @param name Potion identifier
+     * @param hash hashName(name)
+     * @param potion Receives the recipe
+     * @return true if the potion is known
+     */
+    bool getPotion(const string &name, NameHash hash, Potion &potion) const;
+    bool getPotion(const string &name, Potion &potion) const { return getPotion(name, hashName(name), potion); }
+    
+    /**
+     * @brief Moves every recipe into the compact frozen representation
+     * 
+     * Called automatically once the delta outgrows KNOWLEDGE_DELTA_LIMIT
+     * or a quarter of the frozen part; may also be called on demand.
+     * Finishes a freeze in progress first.
+     */
+    void freeze();
+
+    /**
+     * @brief Runs one slice of a freeze
+     * @param meter Budget of the slice; each recipe, ingredient or sealed entry handled takes a unit
+     * @return true once the recipes learned before the freeze began are all frozen
+     * 
+     * Works like Bestiary::freezeStep(): the delta is sealed, merged with
+     * the old frozen relation into a new one, and released after the swap.
+     */
+    bool freezeStep(SliceMeter &meter);
+    
+    /**
+     * @brief Counters of the filter that answers lookups of unknown potions
+     */
+    FilterStats getFilterStats() const { return potionFilter.stats(); }
+
+    /**
+     * @brief Index switches of the recipe delta and the sign table
+     */
+    ContainerStats getContainerStats() const { return switches.stats(); }
+    
+    /**
+     * @brief Checks if potion recipe is known
+     * @param name Potion identifier
+     * @param hash hashName(name)
+     * @return true if potion exists in knowledge base
+     */
+    bool hasPotion(const string &name, NameHash hash) const;
+    bool hasPotion(const string &name) const { return hasPotion(name, hashName(name)); }
+    
+    /**
+     * @brief Checks if sign is available
+     * @param name Sign identifier
+     * @param hash hashName(name)
+     * @return true if sign exists in knowledge base
+     */
+    bool hasSign(const string &name, NameHash hash) const;
+    bool hasSign(const string &name) const { return hasSign(name, hashName(name)); }
+
+    /**
+     * @brief Generates formatted recipe information
+     * @param potionName Potion to query
+     * @param potionHash hashName(potionName)
+     * @return String listing required ingredients and quantities
+     */
+    string getPotionIngredients(const string &potionName, NameHash potionHash) const;
+    string getPotionIngredients(const string &potionName) const { return getPotionIngredients(potionName, hashName(potionName)); }
+
+    /**
+     * @brief Collects the recipe of a potion in listing order
+     * @param potionName Potion to query
+     * @param potionHash hashName(potionName)
+     * @param ingredients Receives (name, quantity) pairs, highest quantity first, then by name
+     * @return false if no formula is known for the potion
+     */
+    bool collectPotionIngredients(const string &potionName, NameHash potionHash,
+                                  vector<pair<string, int>> &ingredients) const;
+
+    /**
+     * @brief Collects the names of every potion with a known recipe
+     * @param names Receives the names, sorted
+     */
+    void collectPotionNames(vector<string> &names) const;
+};
+
+//========================================================================
+// RECOMMENDATIONS
+//========================================================================
+
+/**
+ * @class CounterJoin
+ * @brief Beasts joined with the potions in stock, the potions brewable now and their signs
+ * 
+ * Maintained as knowledge and inventory change instead of being computed
+ * per query. Every potion that counters a beast or has a recipe keeps
+ * whether it is in stock and how many of its recipe ingredients are held
+ * below the required quantity; an ingredient change walks only the
+ * recipes using it. When a potion starts or stops being in stock or
+ * brewable, the sorted lists of the beasts it counters are updated, so a
+ * recommendation is read straight from its beast. Items are found by
+ * their StateDigest key, which slot updates carry as well, and then by
+ * name, so names whose hashes collide keep separate entries. In a
+ * concurrent tracker the join has its own lock, taken last, after any
+ * subsystem lock. Writers update the join while holding the subsystem
+ * locks of their command, so a reader that wants a state no command is
+ * halfway through read-locks the subsystems first.
+ */
+class CounterJoin
+{
+public:
+    /**
+     * @struct Recommendation
+     * @brief What can be used against one beast
+     */
+    struct Recommendation
+    {
+        vector<string> inStock;     ///< Effective potions held, sorted
+        vector<string> brewable;    ///< Effective potions whose ingredients are held, sorted
+        vector<string> signs;       ///< Effective signs, sorted
+    };
+
+    /**
+     * @brief Constructs an empty join
+     * @param concurrent true to guard the join with its own lock
+     */
+    explicit CounterJoin(bool concurrent);
+
+    /**
+     * @brief Forgets everything, before the join is rebuilt
+     */
+    void clear();
+
+    /**
+     * @brief Records a potion as effective against a beast
+     * @param beast Beast name
+     * @param beastHash hashName(beast)
+     * @param potion Potion name
+     * @param potionHash hashName(potion)
+     * @param held Potions held now
+     */
+    void addEffectivePotion(const string &beast, NameHash beastHash, const string &potion, NameHash potionHash,
+                            int held);
+
+    /**
+     * @brief Records a sign as effective against a beast
+     * @param beast Beast name
+     * @param beastHash hashName(beast)
+     * @param sign Sign name
+     */
+    void addEffectiveSign(const string &beast, NameHash beastHash, const string &sign);
+
+    /**
+     * @brief Records the recipe of a potion
+     * @param potion Potion name
+     * @param potionHash hashName(potion)
+     * @param ingredients Ingredient names
+     * @param ingredientHashes hashName of each ingredient
+     * @param required Quantity of each ingredient used by one brew
+     * @param held Quantity of each ingredient held now
+     */
+    void addRecipe(const string &potion, NameHash potionHash, const vector<string> &ingredients,
+                   const vector<NameHash> &ingredientHashes, const vector<int> &required, const vector<int> &held);
+
+    /**
+     * @brief Applies an inventory quantity change
+     * @param key StateDigest key of the item
+     * @param name Name of the item
+     * @param before Quantity before the change
+     * @param after Quantity after the change
+     */
+    void itemChanged(uint64_t key, const string &name, int before, int after);
+
+    /**
+     * @brief Reads the counters usable against a beast
+     * @param beast Beast name
+     * @param beastHash hashName(beast)
+     * @param result Receives the lists
+     * @return false if nothing is known to be effective against the beast
+     */
+    bool recommend(const string &beast, NameHash beastHash, Recommendation &result) const;
+
+private:
+    /**
+     * @struct PotionEntry
+     * @brief Join state of one potion
+     */
+    struct PotionEntry
+    {
+        string name;                ///< Potion name
+        bool inStock;               ///< At least one held
+        bool hasRecipe;             ///< Recipe known
+        int missing;                ///< Recipe ingredients held below the required quantity
+        vector<size_t> beasts;      ///< Beasts this potion counters
+    };
+
+    /**
+     * @struct BeastEntry
+     * @brief Join result of one beast
+     */
+    struct BeastEntry
+    {
+        string name;                ///< Beast name
+        set<string> inStock;        ///< Effective potions in stock
+        set<string> brewable;       ///< Effective potions brewable now
+        set<string> signs;          ///< Effective signs
+    };
+
+    /**
+     * @struct RecipeUse
+     * @brief One ingredient line of a recipe, indexed by ingredient
+     */
+    struct RecipeUse
+    {
+        string ingredient;          ///< Ingredient name
+        size_t potion;              ///< Potion entry
+        int required;               ///< Quantity needed by one brew
+    };
+
+    /**
+     * @brief Uses a StateDigest key, already well mixed, as its own hash
+     */
+    struct KeyHash
+    {
+        size_t operator()(uint64_t key) const { return static_cast<size_t>(key); }
+    };
+
+    bool concurrent;                                                ///< Lock on every access
+    mutable mutex lock;                                             ///< Guards everything below
+    vector<PotionEntry> potions;                                    ///< Potions by entry number
+    unordered_multimap<uint64_t, size_t, KeyHash> potionIndex;      ///< Potion item key -> entries
+    vector<BeastEntry> beasts;                                      ///< Beasts by entry number
+    unordered_multimap<uint64_t, size_t, KeyHash> beastIndex;       ///< Beast key -> entries
+    unordered_map<uint64_t, vector<RecipeUse>, KeyHash> recipeUses; ///< Ingredient item key -> recipe lines
+
+    size_t potionEntry(const string &potion, NameHash potionHash);
+    size_t beastEntry(const string &beast, NameHash beastHash);
+    bool findPotion(uint64_t key, const string &potion, size_t &entry) const;
+    bool findBeast(uint64_t key, const string &beast, size_t &entry) const;
+    static bool brewable(const PotionEntry &potion) { return potion.hasRecipe && potion.missing == 0; }
+    void setInStock(PotionEntry &potion, bool inStock);
+    void setMissing(PotionEntry &potion, int missing);
+};
+
+//========================================================================
+// COMMAND PROCESSING
+//========================================================================
+
+/**
+ * @struct TokenizedCommand
+ * @brief Tokens of one input line with the name hashes computed so far
+ * 
+ * Produced once per command and handed to validation and execution. Only
+ * the executor knows which tokens are names, so a token is hashed the
+ * first time hash() is asked for it and the result is kept: keywords,
+ * quantities and the words of multi-word names are never hashed, and a
+ * name is hashed exactly once on its way to the containers.
+ */
+struct TokenizedCommand
+{
+    vector<string> tokens;              ///< Tokens as produced by CommandParser::tokenizeInput
+    mutable vector<NameHash> hashes;    ///< hashName of each token once hashed (parallel to tokens)
+    mutable vector<bool> hashed;        ///< Whether hashes[i] has been computed
+
+    /**
+     * @brief hashName of a token, computed on first use
+     * @param index Token index
+     */
+    NameHash hash(size_t index) const
+    {
+        if (!hashed[index])
+        {
+            hashes[index] = hashName(tokens[index]);
+            hashed[index] = true;
+        }
+        return hashes[index];
+    }
+};
+
+/**
+ * @class CommandParser
+ * @brief Static utility class for parsing and validating user commands
+ * 
+ * Provides text processing methods for tokenizing input, validating
+ * command formats, and determining command types without state.
+ */
+class CommandParser
+{
+public:
+    /**
+     * @enum TokenList
+     * @brief Open-ended list left after the fixed part of a line
+     */
+    enum class TokenList
+    {
+        NONE,           ///< The whole line is tokenized
+        WORDS,          ///< Words and commas, as in loots and encounters
+        INGREDIENTS     ///< Quantity-ingredient pairs of a formula
+    };
+
+    /**
+     * @brief Splits input string into individual tokens
+     * @param input Raw user input string
+     * @return Vector of space-separated tokens
+     * 
+     * Handles whitespace normalization and comma separation
+     */
+    static vector<string> tokenizeInput(const string &input);
+    
+    /**
+     * @brief Splits input into tokens whose name hashes are computed on demand
+     * @param input Raw user input string
+     * @param command Receives the tokens
+     */
+    static void tokenizeInput(const string &input, TokenizedCommand &command);
+
+    /**
+     * @brief Tokenizes the fixed part of a line, up to any open-ended list
+     * @param input Raw user input string
+     * @param tokens Receives the tokens before the list
+     * @param position Receives the offset of the list in input
+     * @return Kind of list left for tokenizeList(), NONE if the line is done
+     * 
+     * tokenizeHead() followed by tokenizeList() until it returns true
+     * gives the tokens of tokenizeInput(), a slice at a time.
+     */
+    static TokenList tokenizeHead(const string &input, vector<string> &tokens, size_t &position);
+
+    /**
+     * @brief Tokenizes part of the list that follows tokenizeHead()
+     * @param input Raw user input string
+     * @param list Kind of list returned by tokenizeHead()
+     * @param position Offset of the next token; advanced past the tokens produced
+     * @param tokens Receives the tokens
+     * @param meter Budget, one unit per token or quantity-ingredient pair
+     * @return true once the whole input has been tokenized
+     */
+    static bool tokenizeList(const string &input, TokenList list, size_t &position, vector<string> &tokens,
+                             SliceMeter &meter);
+    
+    /**
+     * @brief Joins tokens [begin, end) with single spaces
+     * @param command Tokenized command
+     * @param begin First token index
+     * @param end One past the last token index
+     * @param hash Receives hashName of the result (shared with the token when
+     *        the range holds a single token)
+     * @return Joined name
+     */
+    static string joinTokens(const TokenizedCommand &command, size_t begin, size_t end, NameHash &hash);
+    
+    /**
+     * @brief Normalizes input by removing extra whitespace
+     * @param input Raw input string
+     * @return Cleaned string with normalized spacing
+     */
+    static string cleanInputLine(const string &input);
+    
+    /**
+     * @brief Validates positive integer format
+     * @param token String to validate
+     * @return true if token represents valid positive integer
+     */
+    static bool isPositiveInteger(const string &token);
+    
+    /**
+     * @brief Validates alphabetic-only content
+     * @param token String to validate  
+     * @return true if token contains only letters
+     */
+    static bool isAlphabeticOnly(const string &token);
+    
+    /**
+     * @brief Detects comma spacing errors in token list
+     * @param tokens Vector of parsed tokens
+     * @return true if improper comma spacing detected
+     */
+    static bool hasCommaSpacingError(const vector<string> &tokens);
+
+    /**
+     * @brief Validates part of a "quantity ingredient [, quantity ingredient]..." list
+     * @param tokens Vector of parsed tokens
+     * @param position Index of the next item; advanced past each item validated
+     * @param commaRequired true if items must be separated by commas, as in formulas
+     * @param meter Budget, one unit per item
+     * @return false as soon as the list is found malformed
+     */
+    static bool checkItemList(const vector<string> &tokens, size_t &position, bool commaRequired, SliceMeter &meter);
+
+    // Command pattern validation methods - each checks specific command format
+    
+    /**
+     * @brief Validates loot action command structure
+     * @param input Command string to validate
+     * @return true if matches expected loot format
+     */
+    static bool isLootAction(const string &input);
+    static bool isLootAction(const vector<string> &tokens);   ///< Same check on tokenizeInput(input)
+    
+    /**
+     * @brief Validates trade action command structure
+     * @param input Command string to validate
+     * @return true if matches expected trade format
+     */
+    static bool isTradeAction(const string &input);
+    static bool isTradeAction(const vector<string> &tokens);   ///< Same check on tokenizeInput(input)
+    
+    /**
+     * @brief Validates brew action command structure
+     * @param input Command string to validate
+     * @return true if matches expected brew format
+     */
+    static bool isBrewAction(const string &input);
+    static bool isBrewAction(const vector<string> &tokens);   ///< Same check on tokenizeInput(input)
+    
+    /**
+     * @brief Validates effectiveness knowledge command structure
+     * @param input Command string to validate
+     * @return true if matches expected effectiveness format
+     */
+    static bool isEffectivenessKnowledge(const string &input);
+    static bool isEffectivenessKnowledge(const vector<string> &tokens);   ///< Same check on tokenizeInput(input)
+    
+    /**
+     * @brief Validates potion formula command structure
+     * @param input Command string to validate
+     * @return true if matches expected formula format
+     */
+    static bool isPotionFormulaKnowledge(const string &input);
+    static bool isPotionFormulaKnowledge(const vector<string> &tokens);   ///< Same check on tokenizeInput(input)
+    
+    /**
+     * @brief Validates encounter command structure
+     * @param input Command string to validate
+     * @return true if matches expected encounter format
+     */
+    static bool isEncounterSentence(const string &input);
+    static bool isEncounterSentence(const vector<string> &tokens);   ///< Same check on tokenizeInput(input)
+    
+    /**
+     * @brief Validates inventory query command structure
+     * @param input Command string to validate
+     * @param isSpecific Output parameter indicating specific vs. general query
+     * @return true if matches expected inventory query format
+     */
+    static bool isInventoryQuery(const string &input, bool &isSpecific);
+    static bool isInventoryQuery(const vector<string> &tokens, bool &isSpecific);   ///< Same check on tokenizeInput(input)
+    
+    /**
+     * @brief Validates bestiary query command structure
+     * @param input Command string to validate
+     * @return true if matches expected bestiary format
+     */
+    static bool isBestiaryQuery(const string &input);
+    static bool isBestiaryQuery(const vector<string> &tokens);   ///< Same check on tokenizeInput(input)
+
+    /**
+     * @brief Validates recommendation query command structure
+     * @param tokens Tokenized input to validate
+     * @return true if matches "What can I use against <monster> ?" pattern
+     */
+    static bool isRecommendationQuery(const vector<string> &tokens);
+
+    /**
+     * @brief Validates multi-item inventory query command structure
+     * @param tokens Tokenized input to validate
+     * @return true if matches "Total <category> <item>, <item>... ?"
+     */
+    static bool isMultiInventoryQuery(const vector<string> &tokens);
+
+    /**
+     * @brief Validates multi-beast bestiary query command structure
+     * @param tokens Tokenized input to validate
+     * @return true if matches "What is effective against <monster>, <monster>... ?"
+     */
+    static bool isMultiBestiaryQuery(const vector<string> &tokens);
+
+    /**
+     * @brief Splits the comma-separated name list of a multi-item query
+     * @param token Name list, kept as one token by the tokenizer
+     * @param names Receives the names without surrounding spaces
+     * @param hashes Receives hashName of each name, or nullptr
+     * @return false unless the list holds at least two non-empty names
+     */
+    static bool splitNameList(const string &token, vector<string> &names, vector<NameHash> *hashes);
+    
+    /**
+     * @brief Validates alchemy query command structure
+     * @param input Command string to validate
+     * @return true if matches expected alchemy format
+     */
+    static bool isAlchemyQuery(const string &input);
+    static bool isAlchemyQuery(const vector<string> &tokens);   ///< Same check on tokenizeInput(input)
+    
+    /**
+     * @brief Validates state digest query command structure
+     * @param tokens Tokenized command
+     * @return true if the command is "State digest?"
+     */
+    static bool isStateDigestQuery(const vector<string> &tokens);
+    
+    /**
+     * @brief Validates exit command structure
+     * @param input Command string to validate
+     * @return true if matches expected exit format
+     *      */
+    static bool isExitCommand(const string &input);
+    
+    /**
+     * @brief Determines command type from input string
+     * @param input Command string to analyze
+     * @param cmdType Output parameter for determined command type
+     * @return true if command is valid and type successfully determined
+     * 
+     * Side effects: Sets cmdType to appropriate enum value if valid
+     */
+    static bool isValidCommand(const string &input, CommandType &cmdType);
+    
+    /**
+     * @brief Determines command type from an already tokenized input
+     * @param input Command string (used by the exit check)
+     * @param tokens tokenizeInput(input)
+     * @param cmdType Output parameter for determined command type
+     * @return true if command is valid and type successfully determined
+     */
+    static bool isValidCommand(const string &input, const vector<string> &tokens, CommandType &cmdType);
+    
+    /**
+     * @brief Validates potion name token format
+     * @param token Token to validate as potion name
+     * @return true if token meets potion naming requirements
+     */
+    static bool isValidPotionNameToken(const string &token);
+};
+
+//========================================================================
+// COMMAND LOCKING
+//========================================================================
+
+/**
+ * @class CommandLocks
+ * @brief Scoped set of subsystem locks declared by a single command
+ * 
+ * Commands acquire only the subsystems they touch, always in the fixed
+ * order alchemy -> bestiary -> inventory shards (ascending index), which
+ * rules out lock-order deadlocks between concurrent commands. Everything
+ * is released in reverse order when the object goes out of scope. When
+ * constructed disabled, every call is a no-op so the single-threaded
+ * tracker pays nothing.
+ */
+class CommandLocks
+{
+private:
+    /**
+     * @struct Held
+     * @brief A lock acquired by this command and its mode
+     */
+    struct Held
+    {
+        RWLock *lock;   ///< Acquired lock
+        bool write;     ///< true if held exclusively
+    };
+
+    bool enabled;       ///< false for single-threaded trackers
+    int stage;          ///< Last subsystem locked (enforces ordering)
+    vector<Held> held;  ///< Locks in acquisition order
+
+    void acquire(RWLock &lock, bool write);
+
+public:
+    /**
+     * @brief Constructor
+     * @param enabled Whether locks are actually taken
+     */
+    explicit CommandLocks(bool enabled) : enabled(enabled), stage(0) {}
+    CommandLocks(const CommandLocks &) = delete;
+    CommandLocks &operator=(const CommandLocks &) = delete;
+
+    /**
+     * @brief Releases all held locks in reverse acquisition order
+     */
+    ~CommandLocks();
+
+    /**
+     * @brief Locks the alchemy knowledge base
+     * @param alchemy Knowledge base to lock
+     * @param write true for exclusive access
+     */
+    void lockAlchemy(const AlchemyKnowledge &alchemy, bool write);
+    
+    /**
+     * @brief Locks the bestiary
+     * @param bestiary Bestiary to lock
+     * @param write true for exclusive access
+     */
+    void lockBestiary(const Bestiary &bestiary, bool write);
+    
+    /**
+     * @brief Locks the inventory shards holding the given items
+     * @param inventory Inventory to lock
+     * @param hashes Name hashes of the items the command reads or modifies
+     * @param write true for exclusive access
+     */
+    void lockInventory(const Inventory &inventory, const vector<NameHash> &hashes, bool write);
+    
+    /**
+     * @brief Locks the given inventory shards
+     * @param inventory Inventory to lock
+     * @param shardIndices Shards the command touches (any order, duplicates allowed)
+     * @param write true for exclusive access
+     */
+    void lockInventoryShards(const Inventory &inventory, vector<size_t> shardIndices, bool write);
+    
+    /**
+     * @brief Locks every inventory shard
+     * @param inventory Inventory to lock
+     * @param write true for exclusive access
+     */
+    void lockAllInventory(const Inventory &inventory, bool write);
+};
+
+//========================================================================
+// TRAFFIC STATISTICS
+//========================================================================
+
+/**
+ * @enum TrafficCategory
+ * @brief What a heavy-hitter sketch counts
+ */
+enum class TrafficCategory
+{
+    INGREDIENT,    ///< Ingredient names in commands
+    POTION,        ///< Potion names in commands
+    BEAST,         ///< Beast names, including traded trophies
+    SIGN,          ///< Sign names in commands
+    SHAPE          ///< Command type with its token count, e.g. "loot/8"
+};
+
+/**
+ * @class HeavyHitters
+ * @brief Count-Min sketch steering a Space-Saving list of the most frequent names
+ * 
+ * Every occurrence updates the Count-Min sketch (conservative update), whose
+ * estimate never undercounts and overcounts by a small fraction of the
+ * total. The HEAVY_HITTER_CAPACITY names with the highest estimates are
+ * kept by name, indexed by hash; a new name displaces the lowest of them
+ * only once its own estimate is higher, so beyond the sketch update a
+ * one-off name costs one index probe and one comparison with the lowest
+ * estimate. Finding the new lowest after a change to it scans the
+ * monitored names. Memory is fixed, whatever the number of distinct
+ * names. Two sketches merge by adding their counters and re-ranking the
+ * union of their names.
+ */
+class HeavyHitters
+{
+public:
+    /**
+     * @struct Hitter
+     * @brief A frequent name with its estimated count
+     */
+    struct Hitter
+    {
+        string name;        ///< Name as it appeared in the command
+        uint64_t count;     ///< Count-Min estimate (an upper bound)
+    };
+
+    HeavyHitters();
+
+    /**
+     * @brief Counts occurrences of a name
+     * @param hash hashName(name), or any stable 64-bit key
+     * @param name Name reported by top()
+     * @param count Occurrences to add
+     */
+    void add(NameHash hash, const string &name, uint64_t count = 1);
+
+    /**
+     * @brief Estimated occurrences of a key, never below the true count
+     */
+    uint64_t estimate(NameHash hash) const;
+
+    /**
+     * @brief Adds another sketch's counts to this one
+     */
+    void merge(const HeavyHitters &other);
+
+    /**
+     * @brief The most frequent names, highest estimate first
+     * @param k Names wanted (at most HEAVY_HITTER_CAPACITY are known)
+     */
+    vector<Hitter> top(size_t k) const;
+
+    /**
+     * @brief Occurrences counted so far
+     */
+    uint64_t total() const { return totalCount; }
+
+private:
+    /**
+     * @brief Uses a name hash, already well mixed, as its own hash
+     */
+    struct KeyHash
+    {
+        size_t operator()(NameHash key) const { return static_cast<size_t>(key); }
+    };
+
+    vector<uint64_t> counters;                          ///< COUNT_MIN_DEPTH rows of COUNT_MIN_WIDTH counters
+    vector<NameHash> hashes;                            ///< Keys of the monitored names
+    vector<Hitter> hitters;                             ///< Monitored names, parallel to hashes
+    unordered_map<NameHash, size_t, KeyHash> monitored; ///< Key -> index in hashes and hitters
+    size_t minIndex;                                    ///< Monitored name with the lowest estimate
+    uint64_t totalCount;                                ///< Occurrences counted
+
+    void updateMinimum();
+};
+
+/**
+ * @class TrafficSketches
+ * @brief Heavy hitters of every TrafficCategory, striped across threads
+ * 
+ * A concurrent tracker keeps TRAFFIC_STRIPES sets of sketches, each behind
+ * its own mutex, and a thread always updates the set picked by its id, so
+ * threads rarely share a lock. Reports merge the stripes. Nothing is
+ * allocated or counted until enable(), so a tracker that never reports
+ * statistics, such as each of the many sessions of a SessionHost, pays
+ * one test per name for the feature.
+ */
+class TrafficSketches
+{
+public:
+    static constexpr int CATEGORIES = 5;    ///< Number of TrafficCategory values
+
+    /**
+     * @brief Constructs disabled sketches
+     * @param concurrent true to stripe across threads and lock each stripe
+     */
+    explicit TrafficSketches(bool concurrent);
+
+    /**
+     * @brief Allocates the sketches and starts counting
+     * 
+     * Must be called before the first record(), not while names are counted.
+     */
+    void enable();
+
+    /**
+     * @brief Whether enable() has been called
+     */
+    bool isEnabled() const { return !stripes.empty(); }
+
+    /**
+     * @brief Counts one occurrence of a name
+     * @param category What the name is
+     * @param hash hashName(name)
+     * @param name The name
+     */
+    void record(TrafficCategory category, NameHash hash, const string &name);
+
+    /**
+     * @brief Counts one validated command by type and token count
+     * @param type Command type
+     * @param tokens Tokens in the command
+     */
+    void recordShape(CommandType type, size_t tokens);
+
+    /**
+     * @brief Merges the stripes of one category
+     */
+    HeavyHitters merged(TrafficCategory category) const;
+
+    /**
+     * @brief Writes "top <category>: name count, ... (total N)" for every category
+     * @param out Stream receiving the lines
+     */
+    void writeStats(ostream &out) const;
+
+private:
+    /**
+     * @struct Stripe
+     * @brief One set of sketches with the lock guarding it
+     */
+    struct Stripe
+    {
+        mutable mutex lock;
+        HeavyHitters sketches[CATEGORIES];
+    };
+
+    bool concurrent;                        ///< Lock stripes and pick them by thread
+    vector<unique_ptr<Stripe>> stripes;     ///< None until enable(), then one or TRAFFIC_STRIPES
+
+    Stripe &stripeOfThisThread();
+};
+
+//========================================================================
+// RESUMABLE COMMANDS
+//========================================================================
+
+/**
+ * @class CommandTask
+ * @brief One command line executed in budgeted slices
+ * 
+ * The item lists of loots and formulas are tokenized and validated item
+ * by item before any of them is applied, so a malformed line still
+ * changes nothing. Loots, formula learning, whole-inventory listings and
+ * formula queries then work item by item as well, a listing reading each
+ * table through its cold runs and hot entries. Every phase stops when a
+ * slice's budget is spent and resumes where it left off on the next
+ * step(); every other command is executed in a single slice once tokenized.
+ * Output is written in order as it is produced. The tracker must not run
+ * other commands between the slices of a task, so that the result is
+ * that of running the line at once.
+ */
+class CommandTask
+{
+public:
+    /**
+     * @brief Prepares a line for execution; nothing runs until step()
+     * @param tracker Tracker executing the line
+     * @param line Input command string
+     */
+    CommandTask(WitcherTracker &tracker, const string &line);
+
+    /**
+     * @brief Runs the command until it finishes or the budget is spent
+     * @param out Stream receiving the next part of the response
+     * @param budget Work and time allowed for this slice
+     * @return true once the command has finished
+     */
+    bool step(ostream &out, const CommandBudget &budget);
+
+    /**
+     * @brief Checks whether the command has finished
+     */
+    bool isFinished() const { return phase == Phase::FINISHED; }
+
+    /**
+     * @brief Checks whether a slice has run, so the tracker may show part of the command
+     */
+    bool isStarted() const { return phase != Phase::START; }
+
+    /**
+     * @brief Status as returned by executeLine, valid once finished
+     */
+    int getStatus() const { return status; }
+
+private:
+    /**
+     * @brief What the next slice continues with
+     */
+    enum class Phase
+    {
+        START,      ///< Not yet tokenized
+        TOKENIZE,   ///< Tokenizing the list that ends the line
+        VALIDATE,   ///< Validating the items of a loot or formula
+        LOOT,       ///< Adding looted ingredients
+        FORMULA,    ///< Parsing the ingredients of a formula being learned
+        COLLECT,    ///< Gathering inventory items to list
+        LIST,       ///< Writing the collected items
+        FINISHED    ///< Done; status is set
+    };
+
+    WitcherTracker &tracker;
+    string line;                            ///< Line as given, then cleaned
+    Phase phase;
+    int status;
+    TokenizedCommand command;               ///< Tokens of the line
+    CommandParser::TokenList tokenList;     ///< List left to tokenize
+    size_t position;                        ///< Offset in line of the next token
+    CommandType cmdType;                    ///< Type of the validated line
+    size_t tokenIndex;                      ///< Next token of a loot or formula
+    string potionName;                      ///< Potion being learned
+    NameHash potionHash;
+    vector<string> ingredients;             ///< Formula parsed so far
+    vector<NameHash> ingredientHashes;
+    vector<int> quantities;
+    ItemCategory category;                  ///< Category being collected
+    Inventory::ItemCollection collection;   ///< Inventory items gathered so far
+    vector<pair<string, int>> items;        ///< Listing being written
+    size_t listed;                          ///< Items of the listing already written
+
+    void start(ostream &out);
+    void tokenize(ostream &out, SliceMeter &meter);
+    void validate(ostream &out, SliceMeter &meter);
+    void begin(ostream &out);
+    void loot(ostream &out, SliceMeter &meter);
+    void learnFormula(ostream &out, SliceMeter &meter);
+    void collect(ostream &out, SliceMeter &meter);
+    void list(ostream &out, SliceMeter &meter);
+    void finish(int result);
+};
+
+//========================================================================
+// LOG COMPRESSION
+//========================================================================
+
+/**
+ * @class LogCodec
+ * @brief Dictionary LZ compression of command logs
+ * 
+ * Frame layout: the magic "WTZ2", the varint length of the log, the name
+ * dictionary as a block compressed against the command keywords, then
+ * the log in blocks of at most LOG_CODEC_BLOCK bytes. A block is written
+ * as its varint raw length, varint compressed length, the compressed
+ * bytes and a 4-byte little-endian checksum of its decoded bytes; a
+ * block decoding to other bytes fails the frame.
+ * 
+ * Matches reach back up to 64 KiB over the log, the names and the
+ * keywords, so the start of a log, where plain LZ has nothing to refer
+ * to yet, gets names and phrases as matches. A block is a sequence of
+ * (literals, match) pairs in the LZ4 layout: a token byte whose high
+ * nibble is the literal count and low nibble the match length minus
+ * LOG_CODEC_MIN_MATCH (15 continues in extra bytes of up to 255 each),
+ * the literals, and a 2-byte little-endian match offset. The last
+ * sequence of a block has literals only.
+ */
+class LogCodec
+{
+public:
+    /**
+     * @brief Prepares a compressor seeded with names
+     * @param names Names likely to occur in the text, most useful first;
+     *        those past LOG_CODEC_DICTIONARY bytes are left out
+     */
+    explicit LogCodec(const vector<string> &names);
+
+    /**
+     * @brief Compresses a command log
+     * @param text Log text
+     * @param out Receives the frame
+     * @return void
+     * 
+     * The names are left out of the frame when they do not pay for the
+     * bytes they take, as in a long log that spells them out early.
+     */
+    void compress(const string &text, string &out) const;
+
+    /**
+     * @brief Checks whether data starts with the frame magic
+     * @param data File contents
+     * @return true if the data is a compressed frame; decompress() rejects
+     *         frames of other versions
+     */
+    static bool isCompressed(const string &data);
+
+    /**
+     * @brief Decompresses a frame
+     * @param data Frame written by compress()
+     * @param text Receives the log text
+     * @return false if the frame is truncated, corrupt or of another version
+     */
+    static bool decompress(const string &data, string &text);
+
+private:
+    string names;   ///< Name dictionary, space separated
+
+    static void compressFrame(const string &text, const string &names, string &out);
+    static void compressBlock(const string &history, size_t begin, size_t end, vector<size_t> &table, string &out);
+    static bool decompressBlock(const char *in, size_t length, const char *dictionary, size_t dictionarySize,
+                                char *out, size_t begin, size_t raw);
+};
+
+//========================================================================
+// SNAPSHOTS
+//========================================================================
+
+/**
+ * @struct SnapshotStats
+ * @brief Counters of the snapshots taken by a SnapshotWriter
+ */
+struct SnapshotStats
+{
+    uint64_t taken;             ///< Snapshots written successfully
+    uint64_t failed;            ///< Snapshots whose child reported or hit an error
+    double longestForkMicros;   ///< Longest pause of the parent in fork()
+    double totalForkMicros;     ///< Sum of the fork() pauses
+    uint64_t mostCopiedPages;   ///< Most parent page faults during one snapshot
+    uint64_t totalCopiedPages;  ///< Sum of the parent page faults during snapshots
+
+    SnapshotStats()
+        : taken(0), failed(0), longestForkMicros(0), totalForkMicros(0), mostCopiedPages(0), totalCopiedPages(0)
+    {
+    }
+};
+
+/**
+ * @class SnapshotWriter
+ * @brief Consistent snapshots written by a forked child
+ * 
+ * start() forks the process; the child writes the tracker's equivalent
+ * command log (compressed with LogCodec if asked) from its copy-on-write
+ * view of memory, renames it over the target and reports through a pipe,
+ * while the parent keeps executing commands. The parent only pauses for
+ * the fork itself: in a concurrent tracker every subsystem is read-locked
+ * across the fork so the copy is consistent, and an out-of-core store
+ * holds off its merge thread. Snapshots restore with --restore.
+ * 
+ * Pages the parent writes while a child is alive are copied by the
+ * kernel; the parent's minor page faults over the snapshot measure that
+ * growth (pages first touched by the parent count too, so it is an upper
+ * bound).
+ */
+class SnapshotWriter
+{
+private:
+    int child;                  ///< Process id of the running child, 0 if none
+    int resultPipe;             ///< Read end of the child's report, -1 if none
+    string target;              ///< File the running child writes
+    long faultsBefore;          ///< Parent minor faults when the child started
+    double forkMicros;          ///< Pause of the running snapshot's fork()
+    SnapshotStats totals;       ///< Counters over every finished snapshot
+
+    struct Result;
+    static bool writeSnapshot(WitcherTracker &tracker, const string &path, bool compress, Result &result);
+    void finish(bool reported, const Result &result, ostream &report);
+
+public:
+    SnapshotWriter();
+    SnapshotWriter(const SnapshotWriter &) = delete;
+    SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+
+    /**
+     * @brief Waits for a running snapshot without reporting it
+     */
+    ~SnapshotWriter();
+
+    /**
+     * @brief Forks a child that writes a snapshot of the tracker
+     * @param tracker Tracker to snapshot
+     * @param path File the snapshot replaces once complete
+     * @param compress true to write a LogCodec frame instead of plain text
+     * @return false if a snapshot is still running, the tracker keeps its
+     *         state in a file (openStateFile) or fork() fails
+     */
+    bool start(WitcherTracker &tracker, const string &path, bool compress);
+
+    /**
+     * @brief true while a child is writing a snapshot
+     */
+    bool running() const { return child > 0; }
+
+    /**
+     * @brief Collects the running snapshot if it has finished, without blocking
+     * @param report Stream receiving one line about the finished snapshot
+     * @return true if a snapshot finished
+     */
+    bool poll(ostream &report);
+
+    /**
+     * @brief Blocks until the running snapshot, if any, finishes
+     * @param report Stream receiving one line about the finished snapshot
+     */
+    void wait(ostream &report);
+
+    /**
+     * @brief Counters over every finished snapshot
+     */
+    SnapshotStats stats() const { return totals; }
+
+    /**
+     * @brief Writes the counters as one "snapshots: ..." line
+     */
+    void writeStats(ostream &out) const;
+};
+
+//========================================================================
+// MAIN APPLICATION CLASS
+//========================================================================
+
+/**
+ * @class WitcherTracker
+ * @brief Primary application controller coordinating all game systems
+ * 
+ * Serves as the main interface for processing user commands and managing
+ * interactions between inventory, bestiary, and alchemy subsystems.
+ * Handles command parsing, validation, and execution routing.
+ */
+class WitcherTracker
+{
+    friend class CommandTask;
+    friend class SnapshotWriter;
+
+private:
+    /**
+     * @struct PreparedItem
+     * @brief One resolved item of a prepared command
+     */
+    struct PreparedItem
+    {
+        Inventory::ItemSlot slot;   ///< Resolved inventory location
+        int quantity;               ///< Fixed quantity when paramIndex < 0
+        int paramIndex;             ///< Parameter supplying the quantity, or -1
+    };
+
+    /**
+     * @struct PreparedCommand
+     * @brief Command template parsed and resolved once by prepare()
+     */
+    struct PreparedCommand
+    {
+        CommandType type;               ///< Validated command type
+        string text;                    ///< Cleaned template ("#" marks parameters)
+        size_t paramCount;              ///< Number of "#" parameters
+        vector<PreparedItem> taken;     ///< Trophies traded away / ingredients brewed
+        vector<PreparedItem> given;     ///< Ingredients looted or received / brewed potion
+        vector<size_t> shards;          ///< Inventory shards touched by the fast path
+        string itemName;                ///< Potion brewed or item queried
+        bool resolved;                  ///< false until a fast path is available
+    };
+
+    bool concurrent;            ///< true if commands may run from several threads
+    Inventory inventory;        ///< Player's item management system
+    Bestiary bestiary;         ///< Beast knowledge database
+    AlchemyKnowledge alchemy;  ///< Potion and sign knowledge repository
+    MappedStateStore stateStore;    ///< Optional file holding the live state
+    LsmItemStore lsmStore;          ///< Optional out-of-core store holding the inventory
+    size_t compactCursor;           ///< Next structure compactStep() rebuilds
+    TrafficSketches traffic;        ///< Most frequent names and command shapes
+    CounterJoin counters;           ///< Beasts joined with usable potions and signs
+    vector<PreparedCommand> preparedCommands;   ///< Templates indexed by handle
+    mutable RWLock preparedLock;                ///< Guards preparedCommands in a concurrent tracker
+    TraceRecorder *trace;                       ///< Receives every executed line while capturing, else nullptr
+
+public:
+    /**
+     * @brief Constructor
+     * @param concurrent Enables per-subsystem locking so executeLine may be
+     *        called from several threads at once (default: single-threaded)
+     */
+    explicit WitcherTracker(bool concurrent = false);
+
+    /**
+     * @brief Keeps the live state in a memory-mapped file
+     * @param path State file, created if it does not exist
+     * @param durable true to msync at every step of each update
+     * @return false for a concurrent tracker or if the file cannot be used
+     * 
+     * Must be called before the first command. State already in the file
+     * is available immediately, without loading or replay.
+     */
+    bool openStateFile(const string &path, bool durable = false);
+
+    /**
+     * @brief Keeps the inventory in an out-of-core store
+     * @param directory Directory receiving the store's scratch run files
+     * @return false for a concurrent tracker, with a state file open or if
+     *         no run file can be created in the directory
+     * 
+     * Must be called before the first command. Bestiary and alchemy
+     * knowledge stay in memory; the store starts empty.
+     */
+    bool openLsmStore(const string &directory);
+
+    /**
+     * @brief Processes a single line of user input
+     * @param line Input command string to execute
+     * @return Execution status code (0 for success, negative for errors)
+     * 
+     * Primary entry point for command processing. Handles command validation,
+     * type determination, and routing to appropriate execution methods.
+     */
+    int executeLine(const string &line);
+    
+    /**
+     * @brief Processes a single line, writing the response to a given stream
+     * @param line Input command string to execute
+     * @param out Stream receiving the command's response
+     * @return Execution status code (0 for success, negative for errors)
+     * 
+     * Concurrent callers should each pass their own stream.
+     */
+    int executeLine(const string &line, ostream &out) { return executeLine(line, out, 0); }
+
+    /**
+     * @brief Processes a single line received from a given session
+     * @param line Input command string to execute
+     * @param out Stream receiving the command's response
+     * @param session Connection or client the line came from, 0 for standard input
+     * @return Execution status code (0 for success, negative for errors)
+     * 
+     * The session is only recorded by an attached TraceRecorder.
+     */
+    int executeLine(const string &line, ostream &out, uint32_t session);
+
+    /**
+     * @brief Records every line executed from now on
+     * @param recorder Open recorder, or nullptr to stop capturing
+     * 
+     * Must not change while commands are running.
+     */
+    void attachTrace(TraceRecorder *recorder) { trace = recorder; }
+
+    /**
+     * @brief Counts the most frequent names and command shapes from now on
+     * 
+     * Must be called before the first command. Without it writeStats()
+     * reports no heavy hitters and the sketches take no memory.
+     */
+    void enableTrafficStats() { traffic.enable(); }
+
+    /**
+     * @brief Starts a line as a command that runs in budgeted slices
+     * @param line Input command string to execute
+     * @return Task to step until it finishes
+     * 
+     * See CommandTask. Concurrent trackers and trackers with a state file
+     * run the whole line in the task's first slice.
+     */
+    unique_ptr<CommandTask> startLine(const string &line);
+    
+    /**
+     * @brief Checks whether the tracker was created for concurrent use
+     */
+    bool isConcurrent() const { return concurrent; }
+
+    /**
+     * @brief Writes runtime statistics, one "name: values" line each
+     * @param out Stream receiving the statistics
+     * 
+     * Reports the negative lookup filters of the inventory, bestiary and
+     * alchemy knowledge with their false-positive rates, how often their
+     * containers switched between linear scans and hash indexes, then the
+     * most frequent names of each category and the most frequent command
+     * shapes.
+     */
+    void writeStats(ostream &out) const;
+
+    /**
+     * @brief Order-independent digest of all inventory, bestiary and alchemy state
+     * @return 128-bit digest; equal state gives an equal digest
+     * 
+     * Maintained incrementally, so this is cheap enough to call after every
+     * command when comparing a replica or a replay against its source.
+     */
+    StateDigest getStateDigest() const;
+
+    /**
+     * @brief Quantity of one item held
+     * @param category Ingredient, potion or trophy
+     * @param name Item name
+     * @param hash hashName(name), so callers asking many trackers hash once
+     * @return Quantity, 0 if not held
+     */
+    int getItemQuantity(ItemCategory category, const string &name, NameHash hash) const;
+
+    /**
+     * @brief Checks whether the recipe of a potion is known
+     * @param name Potion name
+     * @param hash hashName(name)
+     */
+    bool knowsFormula(const string &name, NameHash hash) const;
+
+    /**
+     * @brief Runs one slice of online compaction
+     * @param budget Work and time the slice may take
+     * @return true when this slice completed a pass over every structure
+     * 
+     * A pass rebuilds every structure into dense, right-sized storage:
+     * each inventory table of each shard (dropping zero-quantity items),
+     * then the bestiary, then the alchemy knowledge (folding their mutable
+     * delta into the frozen form). A slice moves on through the pass until
+     * its budget is spent, then stops wherever it is; the next call resumes
+     * there. Only the structure being stepped is locked, so in a concurrent
+     * tracker other commands keep running. Intended to be called between
+     * commands by a single housekeeping thread.
+     */
+    bool compactStep(const CommandBudget &budget = CommandBudget{COMPACT_WORK_BUDGET, COMPACT_TIME_BUDGET_NANOS});
+
+    /**
+     * @brief Writes a short command log that rebuilds the current state
+     * @param out Stream receiving one command per line
+     * @return Number of commands written
+     * 
+     * Replaying the log through executeLine on an empty tracker yields the
+     * same inventory, bestiary and alchemy knowledge (and state digest),
+     * with queries, rejected lines and superseded quantities gone.
+     */
+    size_t writeEquivalentLog(ostream &out) const;
+
+    /**
+     * @brief Lists every name the tracker knows, to seed a LogCodec
+     * @param names Receives item, beast, sign and potion names, most
+     *        frequently logged kinds first
+     * @return void
+     */
+    void collectKnownNames(vector<string> &names) const;
+
+    /**
+     * @brief Registers a command template for repeated execution
+     * @param templateLine Command in which "#" stands for a quantity parameter,
+     *        e.g. "Geralt loots # Rebis, # Vitriol"
+     * @return Handle for executePrepared, or -1 if the template is invalid
+     * 
+     * Parsing, validation, item resolution and formula lookup happen here
+     * once; executions only substitute quantities.
+     */
+    int prepare(const string &templateLine);
+    
+    /**
+     * @brief Executes a prepared template with the given quantities
+     * @param handle Handle returned by prepare
+     * @param params One positive quantity per "#" in the template, in order
+     * @param out Stream receiving the command's response
+     * @return 0 on success, -1 for an unknown handle or bad parameters
+     */
+    int executePrepared(int handle, const vector<int> &params, ostream &out);
+    
+    /**
+     * @brief Executes a prepared template, writing the response to standard output
+     * @param handle Handle returned by prepare
+     * @param params One positive quantity per "#" in the template, in order
+     * @return 0 on success, -1 for an unknown handle or bad parameters
+     */
+    int executePrepared(int handle, const vector<int> &params);
+
+private:
+    /**
+     * @brief Routes validated commands to specific execution methods
+     * @param command Validated command, tokenized with token hashes
+     * @param cmdType Determined command type from parsing
+     * @param out Stream receiving the response
+     * @return Execution status code
+     * 
+     * Internal dispatcher that calls appropriate execution method based on
+     * command type. Assumes input has already been validated.
+     */
+    int executeCommand(const TokenizedCommand &command, CommandType cmdType, ostream &out);
+
+    /**
+     * @brief Runs a command under EXPLAIN and reports what it cost
+     * @param line Command line without the "EXPLAIN " prefix
+     * @param out Stream receiving the command's response, then the report
+     * @return 0; a rejected command is reported rather than returned
+     * 
+     * The command runs for real, so an explained update changes the state
+     * like any other.
+     */
+    int explainLine(const string &line, ostream &out);
+
+    /**
+     * @brief Adds a newly learned recipe to the counter join
+     * @param locks Locks of the learning command; ingredient shards are read-locked
+     * @param potionName Potion whose recipe was learned
+     * @param potionHash hashName(potionName)
+     * @param ingredients Ingredient names
+     * @param ingredientHashes hashName of each ingredient
+     * @param quantities Quantity of each ingredient
+     */
+    void joinRecipe(CommandLocks &locks, const string &potionName, NameHash potionHash,
+                    const vector<string> &ingredients, const vector<NameHash> &ingredientHashes,
+                    const vector<int> &quantities);
+
+    /**
+     * @brief Rebuilds the counter join from the current knowledge and inventory
+     */
+    void rebuildJoin();
+
+    /**
+     * @brief Resolves the inventory slots of a prepared command
+     * @param command Prepared command to resolve
+     * 
+     * Brews stay unresolved while their formula is unknown and are retried
+     * on later executions.
+     */
+    void resolvePrepared(PreparedCommand &command);
+    
+    /**
+     * @brief Runs a resolved prepared command through its slots
+     * @param command Resolved prepared command
+     * @param params Quantities substituted for the template parameters
+     * @param out Stream receiving the response
+     * @return 0 on success
+     */
+    int runPrepared(const PreparedCommand &command, const vector<int> &params, ostream &out);
+
+    //====================================================================
+    // COMMAND EXECUTION METHODS
+    //====================================================================
+
+    /**
+     * @brief Executes loot action to add items to inventory
+     * @param command Loot command tokens
+     * @param out Stream receiving the response
+     * @return 0 on success, negative on error
+     * 
+     * Processes "loot" commands to add specified quantities of items
+     * to the player's inventory from environmental sources.
+     */
+    int executeLootAction(const TokenizedCommand &command, ostream &out);
+    
+    /**
+     * @brief Executes trade action to exchange items
+     * @param command Trade command tokens
+     * @param out Stream receiving the response
+     * @return 0 on success, negative on error
+     * 
+     * Processes "trade" commands to remove items from inventory
+     * in exchange for other items or services.
+     */
+    int executeTradeAction(const TokenizedCommand &command, ostream &out);
+    
+    /**
+     * @brief Executes brew action to create potions from ingredients
+     * @param command Brew command tokens
+     * @param out Stream receiving the response
+     * @return 0 on success, negative on error
+     * 
+     * Processes "brew" commands to consume ingredients and create potions
+     * according to known recipes. Validates ingredient availability.
+     */
+    int executeBrewAction(const TokenizedCommand &command, ostream &out);
+    
+    /**
+     * @brief Executes effectiveness knowledge acquisition
+     * @param command Effectiveness command tokens
+     * @param out Stream receiving the response
+     * @return 0 on success, negative on error
+     * 
+     * Processes commands that teach the player which signs or potions
+     * are effective against specific beast types.
+     */
+    int executeEffectivenessKnowledge(const TokenizedCommand &command, ostream &out);
+    
+    /**
+     * @brief Executes potion formula learning
+     * @param command Formula command tokens
+     * @param out Stream receiving the response
+     * @return 0 on success, negative on error
+     * 
+     * Processes commands that teach potion recipes, storing ingredient
+     * requirements for future brewing operations.
+     */
+    int executeFormulaKnowledge(const TokenizedCommand &command, ostream &out);
+    
+    /**
+     * @brief Executes beast encounter processing  
+     * @param command Encounter command tokens
+     * @param out Stream receiving the response
+     * @return 0 on success, negative on error
+     * 
+     * Processes beast encounter events, potentially updating bestiary
+     * information or triggering combat-related responses.
+     */
+    int executeEncounter(const TokenizedCommand &command, ostream &out);
+    
+    /**
+     * @brief Executes specific inventory item queries
+     * @param command Specific inventory query tokens
+     * @param out Stream receiving the response
+     * @return 0 on success, negative on error
+     * 
+     * Processes queries for specific item quantities, returning current
+     * inventory counts for requested items.
+     */
+    int executeSpecificInventoryQuery(const TokenizedCommand &command, ostream &out);
+    
+    /**
+     * @brief Executes complete inventory display
+     * @param command All inventory query tokens
+     * @param out Stream receiving the response
+     * @return 0 on success, negative on error
+     * 
+     * Processes requests to display all inventory contents, including
+     * all categories of items with their quantities.
+     */
+    int executeAllInventoryQuery(const TokenizedCommand &command, ostream &out);
+    
+    /**
+     * @brief Executes bestiary information queries
+     * @param command Bestiary query tokens
+     * @param out Stream receiving the response
+     * @return 0 on success, negative on error
+     * 
+     * Processes requests for beast information, returning known
+     * effectiveness data for specified creatures.
+     */
+    int executeBestiaryQuery(const TokenizedCommand &command, ostream &out);
+    
+    /**
+     * @brief Executes alchemy knowledge queries
+     * @param command Alchemy query tokens
+     * @param out Stream receiving the response
+     * @return 0 on success, negative on error
+     * 
+     * Processes requests for potion recipe information, returning
+     * ingredient requirements for specified potions.
+     */
+    int executeAlchemyQuery(const TokenizedCommand &command, ostream &out);
+    
+    /**
+     * @brief Executes state digest queries
+     * @param command State digest query tokens
+     * @param out Stream receiving the response
+     * @return 0 on success
+     * 
+     * Reports the digest returned by getStateDigest().
+     */
+    int executeStateDigestQuery(const TokenizedCommand &command, ostream &out);
+
+    /**
+     * @brief Executes recommendation queries
+     * @param command Recommendation query tokens
+     * @param out Stream receiving the response
+     * @return 0 on success
+     * 
+     * Reads the counter join: effective potions in stock, effective
+     * potions brewable from the ingredients held, and effective signs.
+     */
+    int executeRecommendationQuery(const TokenizedCommand &command, ostream &out);
+
+    /**
+     * @brief Executes multi-item inventory queries
+     * @param command Multi-item inventory query tokens
+     * @param out Stream receiving the response
+     * @return 0 on success
+     * 
+     * Reads every listed item under one lock set and answers on one line,
+     * "<quantity> <item>" per item in the order asked.
+     */
+    int executeMultiInventoryQuery(const TokenizedCommand &command, ostream &out);
+
+    /**
+     * @brief Executes multi-beast bestiary queries
+     * @param command Multi-beast bestiary query tokens
+     * @param out Stream receiving the response
+     * @return 0 on success
+     * 
+     * Reads every listed beast under one bestiary lock and answers on one
+     * line, "<beast>: <counters>" per beast separated by "; ".
+     */
+    int executeMultiBestiaryQuery(const TokenizedCommand &command, ostream &out);
+};
+
+//========================================================================
+// MULTI-SESSION HOSTING
+//========================================================================
+
+/**
+ * @class SessionHost
+ * @brief Hosts many single-threaded player sessions on a few worker threads
+ * 
+ * Sessions are spread round-robin over shards; each shard has one worker
+ * thread that owns its sessions outright and runs their commands in
+ * arrival order, so sessions need no locking. Commands run as CommandTask
+ * slices within the host's budget: a command that is not finished goes to
+ * the back of the shard's queue, and later commands of its session wait
+ * behind it, so a large listing or loot delays other sessions by one
+ * slice instead of its whole run. Aggregate queries fan out
+ * to every shard as tasks in the same queues: each worker folds
+ * HOST_AGGREGATE_SLICE of its sessions into a partial result, then
+ * requeues the rest behind the commands that arrived meanwhile, so a
+ * query over many sessions delays any command by one slice at most.
+ * Sessions still running a command queued before the query, or between
+ * the slices of any command, are requeued too and read once it is done.
+ * The partial results are merged once every shard has finished.
+ */
+class SessionHost
+{
+public:
+    /**
+     * @brief Starts the shard workers
+     * @param shards Worker threads (at least one)
+     * @param budget Work and time of one command slice
+     */
+    explicit SessionHost(int shards,
+                         CommandBudget budget = CommandBudget{COMMAND_WORK_BUDGET, COMMAND_TIME_BUDGET_NANOS});
+
+    /**
+     * @brief Stops the workers after their queued tasks
+     */
+    ~SessionHost();
+
+    /**
+     * @brief Creates a session with an empty tracker
+     * @return Session id for execute()
+     */
+    int addSession();
+
+    /**
+     * @brief Number of sessions created
+     */
+    int sessionCount() const;
+
+    /**
+     * @brief Queues a command for a session
+     * @param session Id from addSession()
+     * @param line Command line
+     * @return Future output, "INVALID\n" for rejected commands, as at the prompt
+     */
+    future<string> execute(int session, const string &line);
+
+    /**
+     * @brief Sums a per-session value over every session, in parallel over the shards
+     * @param partial Value of one session; runs on that session's worker
+     * @return Sum over all sessions
+     * 
+     * Commands queued before the query are counted; a session whose
+     * oldest command is between slices is read once that command is done,
+     * so no command is seen partly done.
+     */
+    int64_t aggregate(const function<int64_t(const WitcherTracker &)> &partial);
+
+    /**
+     * @brief Total quantity of an item across all sessions
+     * @param category Ingredient, potion or trophy
+     * @param name Item name
+     */
+    int64_t totalQuantity(ItemCategory category, const string &name);
+
+    /**
+     * @brief Number of sessions that know the recipe of a potion
+     * @param potion Potion name
+     */
+    int64_t sessionsKnowingFormula(const string &potion);
+
+private:
+    struct PendingCommand;
+    struct Session;
+    struct Shard;
+    struct Aggregation;
+
+    vector<unique_ptr<Shard>> shards;   ///< Workers with their sessions and task queues
+    CommandBudget budget;               ///< Budget of one command slice
+    mutable mutex sessionsLock;         ///< Orders session creation across callers
+    int sessions;                       ///< Sessions created
+
+    SessionHost(const SessionHost &) = delete;
+    SessionHost &operator=(const SessionHost &) = delete;
+
+    void post(Shard &shard, function<void()> task);
+    void runWorker(Shard &shard);
+    void runSession(Shard &shard, Session &session);
+    void aggregateSlice(Shard &shard, size_t begin, uint64_t cutoff, const vector<Session *> &waiting,
+                        const shared_ptr<Aggregation> &aggregation);
+};
+
+//========================================================================
+// SERVER MODE
+//========================================================================
+
+/**
+ * @class LatencyHistogram
+ * @brief Log-linear histogram of latencies in nanoseconds
+ * 
+ * Values below 128 are counted exactly; above that every power-of-two
+ * range is split into 64 buckets, so any recorded value is reported within
+ * 1/64 (about 1.6%) of its true value. Recording is an index computation
+ * and an increment, with no allocation.
+ */
+class LatencyHistogram
+{
+private:
+    vector<uint64_t> counts;    ///< Count per bucket
+    uint64_t total;             ///< Values recorded
+    uint64_t maxValue;          ///< Largest value recorded
+
+public:
+    LatencyHistogram();
+
+    /**
+     * @brief Counts one value
+     * @param value Latency in nanoseconds
+     */
+    void record(uint64_t value);
+
+    /**
+     * @brief Adds every value counted by another histogram
+     */
+    void merge(const LatencyHistogram &other);
+
+    uint64_t count() const { return total; }
+    uint64_t max() const { return maxValue; }
+
+    /**
+     * @brief Smallest value such that the given fraction of values are at or below it
+     * @param fraction Quantile in [0, 1], e.g. 0.999 for p99.9
+     * @return Upper bound of the bucket holding that quantile, 0 if empty
+     */
+    uint64_t percentile(double fraction) const;
+
+    /**
+     * @brief Writes "latency <name>: <count> requests, p50 ..., p99.9 ..., max ..." in microseconds
+     */
+    void writeReport(ostream &out, const string &name) const;
+
+    /**
+     * @brief Writes the percentile distribution in HdrHistogram's text layout
+     * @param out Stream receiving the table
+     * 
+     * One row per percentile step, each step halving the distance to 100%,
+     * with the value in microseconds, the percentile, the count at or below
+     * it and 1/(1-percentile), so the tail can be plotted on a log axis.
+     */
+    void writeDistribution(ostream &out) const;
+};
+
+/**
+ * @struct ServerOptions
+ * @brief Configuration of a PollingServer
+ */
+struct ServerOptions
+{
+    int port;               ///< TCP port every worker listens on
+    int workers;            ///< Worker threads, each with its own listening socket
+    vector<int> cpus;       ///< Core per worker (cycled); empty pins worker i to core i
+    bool lockMemory;        ///< mlockall the process so the hot path never page faults
+
+    ServerOptions() : port(0), workers(1), lockMemory(true) {}
+};
+
+/**
+ * @class PollingServer
+ * @brief Line-oriented TCP front end that busy-polls from pinned threads
+ * 
+ * Each worker is pinned to one core and owns a SO_REUSEPORT listening
+ * socket, so the kernel spreads connections over workers and no two
+ * workers share a socket. Workers never block: they spin over accept and
+ * recv on non-blocking sockets, trading a busy core for the wakeup and
+ * migration jitter of epoll. Each request line is answered with exactly
+ * the line main would print for it ("INVALID" for rejected input); "Exit"
+ * closes the connection.
+ * 
+ * Latency is measured per request from the moment its bytes are received
+ * until its response has been handed to the kernel.
+ */
+class PollingServer
+{
+private:
+    /**
+     * @struct Connection
+     * @brief One client socket with its pending input and output
+     */
+    struct Connection
+    {
+        int fd;             ///< Non-blocking client socket
+        string input;       ///< Received bytes not yet forming a complete line
+        string output;      ///< Responses not yet accepted by the kernel
+        uint32_t session;   ///< Session id passed to executeLine, unique per server
+    };
+
+    /**
+     * @struct Worker
+     * @brief One pinned polling thread and everything it owns
+     */
+    struct Worker
+    {
+        int listenFd;                       ///< This worker's listening socket
+        int cpu;                            ///< Core the thread is pinned to
+        bool pinned;                        ///< false if pinning failed
+        vector<Connection> connections;     ///< Open client connections
+        LatencyHistogram latency;           ///< Per-request latency of this worker
+        atomic<uint64_t> served;            ///< Requests executed, read by requestsServed()
+        thread runner;                      ///< Polling thread
+    };
+
+    WitcherTracker &tracker;                ///< Executes the requests
+    ServerOptions options;                  ///< Configuration
+    atomic<bool> stopping;                  ///< Set by stop(); polled by every worker
+    atomic<uint32_t> nextSession;           ///< Session id of the next accepted connection
+    bool memoryLocked;                      ///< true if mlockall succeeded
+    vector<unique_ptr<Worker>> workers;     ///< Running workers
+
+    /**
+     * @brief Polling loop of one worker
+     */
+    void runWorker(Worker &worker);
+
+    /**
+     * @brief Reads, executes and answers what one connection has sent
+     * @return false if the connection must be closed
+     */
+    bool serviceConnection(Worker &worker, Connection &connection, char *buffer, ostringstream &response, bool &active);
+
+public:
+    /**
+     * @brief Constructor
+     * @param tracker Tracker executing the requests; must be concurrent if
+     *        options.workers > 1
+     * @param options Server configuration
+     */
+    PollingServer(WitcherTracker &tracker, const ServerOptions &options);
+    PollingServer(const PollingServer &) = delete;
+    PollingServer &operator=(const PollingServer &) = delete;
+
+    /**
+     * @brief Stops the workers if still running
+     */
+    ~PollingServer();
+
+    /**
+     * @brief Locks memory, opens the listening sockets and starts the workers
+     * @param error Receives a description when starting fails
+     * @return false if a socket could not be set up (nothing is left running)
+     */
+    bool start(string &error);
+
+    /**
+     * @brief Stops and joins the workers and closes every socket
+     */
+    void stop();
+
+    /**
+     * @brief Whether mlockall succeeded when the server started
+     */
+    bool isMemoryLocked() const { return memoryLocked; }
+
+    /**
+     * @brief Requests executed so far by every worker
+     * 
+     * Safe to call while the workers run; each count may lag by a read.
+     */
+    uint64_t requestsServed() const;
+
+    /**
+     * @brief Writes the latency percentiles over all workers, plus one line per
+     *        worker with its core, after stop()
+     */
+    void writeReport(ostream &out) const;
+};
+
+//========================================================================
+// SHARED-MEMORY IPC
+//========================================================================
+
+/**
+ * @class IpcRing
+ * @brief Single-producer single-consumer ring of records in shared memory
+ * 
+ * The ring lives entirely in caller-provided memory (typically a shared
+ * segment mapped by two processes) and holds no pointers, only positions.
+ * Each record is an 8-byte header (length, type) and its payload, padded
+ * to 8 bytes; a record that would wrap is preceded by a padding record.
+ * Producer and consumer positions are on separate cache lines. A side
+ * that finds the ring empty (or full) spins IPC_SPIN_LIMIT times, then
+ * sleeps on a futex that the other side only touches when a sleeper has
+ * announced itself, so a busy ring never makes a system call.
+ */
+class IpcRing
+{
+private:
+    struct Control;
+
+    Control *control;       ///< Positions and futex words (start of the region)
+    char *data;             ///< Record area following the control block
+    uint64_t capacity;      ///< Bytes in the record area (power of two)
+    bool failed;            ///< A malformed record was found; kept out of shared memory
+
+public:
+    /**
+     * @brief Bytes of shared memory needed for a ring
+     * @param dataBytes Record area size (power of two, at least 4096)
+     */
+    static size_t regionBytes(size_t dataBytes);
+
+    /**
+     * @brief Uses a region as a ring
+     * @param region regionBytes(dataBytes) bytes, 64-byte aligned
+     * @param dataBytes Record area size given to regionBytes
+     * @param initialize true for the side that creates the segment
+     */
+    IpcRing(void *region, size_t dataBytes, bool initialize);
+
+    /**
+     * @brief Appends a record, sleeping while the ring is full
+     * @param type Record type (non-zero)
+     * @param payload Record bytes
+     * @param length Bytes of payload (at most a quarter of the ring)
+     * @return false if the record can never fit
+     */
+    bool push(uint32_t type, const char *payload, size_t length);
+
+    /**
+     * @brief Removes the oldest record, sleeping while the ring is empty
+     * @param type Receives the record type
+     * @param payload Receives the record bytes
+     * @param timeoutMillis Longest time to sleep; negative waits forever
+     * @return false if no record arrived in time, or if the next record
+     *         overruns the area or what was published (the ring then fails)
+     */
+    bool pop(uint32_t &type, string &payload, int timeoutMillis = -1);
+
+    /**
+     * @brief Whether pop() has found a malformed record; a failed ring pops nothing more
+     */
+    bool isFailed() const { return failed; }
+};
+
+/**
+ * @class IpcChannel
+ * @brief Request and response rings in a named shared-memory segment
+ * 
+ * The tracker process creates the channel and serves it; a co-located
+ * game server attaches by name and exchanges records without any copy
+ * through the kernel. Requests are command lines, command templates to
+ * prepare, or executions of prepared templates (a handle and quantities),
+ * so a client can skip parsing entirely. Every request is answered, in
+ * order, by one response record holding a status and the output text.
+ * A channel has one client at a time.
+ */
+class IpcChannel
+{
+public:
+    /**
+     * @enum Record
+     * @brief Types of records carried by the rings
+     */
+    enum Record : uint32_t
+    {
+        LINE = 1,           ///< Command line; status as executeLine
+        PREPARE = 2,        ///< Command template; status is the handle or -1
+        EXECUTE = 3,        ///< int32 handle, then int32 quantities; status as executePrepared
+        RESPONSE = 4        ///< int32 status (-2 if the output did not fit), then the output text
+    };
+
+private:
+    struct Header;
+
+    char *memory;                   ///< Mapped segment
+    size_t size;                    ///< Bytes mapped
+    string name;                    ///< shm_open name
+    bool owner;                     ///< true if this side created (and unlinks) the segment
+    unique_ptr<IpcRing> requests;   ///< Client -> tracker
+    unique_ptr<IpcRing> responses;  ///< Tracker -> client
+    bool failed;                    ///< The other side sent a record of an unknown type
+
+    bool map(int fd, size_t bytes);
+
+public:
+    IpcChannel() : memory(nullptr), size(0), owner(false), failed(false) {}
+    IpcChannel(const IpcChannel &) = delete;
+    IpcChannel &operator=(const IpcChannel &) = delete;
+    ~IpcChannel() { close(); }
+
+    /**
+     * @brief Creates a segment, replacing any stale one with the same name
+     * @param segmentName shm_open name, e.g. "/witchertracker"
+     * @param ringBytes Record area of each ring (power of two)
+     * @return false if the segment cannot be created or mapped
+     */
+    bool create(const string &segmentName, size_t ringBytes = IPC_RING_BYTES);
+
+    /**
+     * @brief Attaches to a segment created by create()
+     * @param segmentName shm_open name used by the creator
+     * @return false if no valid segment exists under that name
+     */
+    bool attach(const string &segmentName);
+
+    /**
+     * @brief Unmaps the segment; the creator also unlinks its name
+     */
+    void close();
+
+    /**
+     * @brief Sends a command line (client side)
+     */
+    void sendLine(const string &line);
+
+    /**
+     * @brief Sends a command template to prepare (client side)
+     */
+    void sendPrepare(const string &templateLine);
+
+    /**
+     * @brief Sends the execution of a prepared template (client side)
+     */
+    void sendExecute(int handle, const vector<int> &params);
+
+    /**
+     * @brief Waits for the next response (client side)
+     * @param status Receives the status of the request
+     * @param output Receives the output text
+     * @throws runtime_error if the response ring holds a malformed record
+     */
+    void receive(int &status, string &output);
+
+    /**
+     * @brief Executes one request and answers it (tracker side)
+     * @param tracker Tracker executing the request
+     * @param timeoutMillis Longest time to wait for a request
+     * @return false if no request arrived in time or the channel has failed
+     */
+    bool serveOne(WitcherTracker &tracker, int timeoutMillis);
+
+    /**
+     * @brief Whether a malformed record has been received; a failed channel serves nothing more
+     */
+    bool isFailed() const
+    {
+        return failed || (requests && requests->isFailed()) || (responses && responses->isFailed());
+    }
+};
+
+//========================================================================
+// TRAFFIC CAPTURE
+//========================================================================
+
+/**
+ * @struct TraceEvent
+ * @brief One captured line
+ */
+struct TraceEvent
+{
+    uint64_t nanos;     ///< Time since the capture was opened
+    uint32_t session;   ///< Connection or client the line came from, 0 for standard input
+    string line;        ///< Line as received
+};
+
+/**
+ * @class TraceRecorder
+ * @brief Compact binary capture of every line a tracker executes
+ * 
+ * File layout: the magic "WTT1", then blocks. A block is a 16-byte header
+ * (uint32 frame bytes, uint32 record count, uint64 time of its first
+ * record) followed by its records compressed as one LogCodec frame. A
+ * record is the varint nanoseconds since the previous record of the
+ * block, varint session, varint line length and the line.
+ * 
+ * Recording reads the clock and appends to the buffer of the calling
+ * thread's stripe, striped and locked as in TrafficSketches, inside
+ * that stripe's lock so its times never go backwards. A buffer reaching
+ * TRACE_BLOCK_BYTES is sealed into a block and queued for a writer
+ * thread, which compresses and writes it, so executeLine neither
+ * compresses nor waits for the disk. Blocks of different stripes may
+ * overlap in time; load() merges them.
+ */
+class TraceRecorder
+{
+public:
+    /**
+     * @brief Constructs a closed recorder
+     * @param concurrent true if lines may be recorded from several threads
+     */
+    explicit TraceRecorder(bool concurrent);
+
+    /**
+     * @brief Writes what is buffered and closes the file
+     */
+    ~TraceRecorder();
+
+    /**
+     * @brief Creates the trace file and starts the writer thread
+     * @param path File to create or truncate
+     * @return false if the file cannot be created
+     * 
+     * Event times count from this call.
+     */
+    bool open(const string &path);
+
+    /**
+     * @brief Whether open() succeeded and close() has not been called
+     */
+    bool isOpen() const { return fd >= 0; }
+
+    /**
+     * @brief Captures one line
+     * @param session Connection or client the line came from
+     * @param line Line as received
+     */
+    void record(uint32_t session, const string &line);
+
+    /**
+     * @brief Seals every buffer, waits for the writer and closes the file
+     * @return false if a write failed at any point
+     */
+    bool close();
+
+    /**
+     * @brief Writes "trace: <lines> lines, <bytes> bytes (<per line> per line, <ratio>% of the
+     *        records), <blocks> blocks"
+     * @param out Stream receiving the line
+     */
+    void writeStats(ostream &out) const;
+
+    /**
+     * @brief Reads a whole trace
+     * @param path File written by a recorder
+     * @param events Receives the events in time order (stable for equal times)
+     * @param truncated Set if the file ends inside a block; events then holds the complete blocks before it
+     * @return false if the file cannot be read, is not a trace or has a damaged block
+     */
+    static bool load(const string &path, vector<TraceEvent> &events, bool &truncated);
+
+private:
+    /**
+     * @struct Stripe
+     * @brief Records not yet sealed into a block, with the lock guarding them
+     */
+    struct Stripe
+    {
+        mutex lock;
+        string records;         ///< Encoded records of the open block
+        uint32_t count;         ///< Records in the open block
+        uint64_t first;         ///< Time of the block's first record
+        uint64_t last;          ///< Time of the block's latest record
+
+        Stripe() : count(0), first(0), last(0) {}
+    };
+
+    bool concurrent;                        ///< Lock stripes and pick them by thread
+    vector<unique_ptr<Stripe>> stripes;     ///< None until enable(), then one or TRAFFIC_STRIPES
+    int fd;                                 ///< Trace file, -1 when closed
+    uint64_t origin;                        ///< Clock reading at open()
+
+    mutex queueLock;                        ///< Guards sealed and stopping
+    condition_variable queueReady;          ///< Wakes the writer
+    deque<string> sealed;                   ///< Blocks waiting to be written
+    bool stopping;                          ///< Set by close() once the stripes are sealed
+    thread writer;                          ///< Writes sealed blocks in order
+
+    atomic<uint64_t> lines;                 ///< Lines recorded
+    atomic<uint64_t> rawBytes;              ///< Record bytes before compression
+    atomic<uint64_t> bytes;                 ///< Bytes written, magic included
+    atomic<uint64_t> blocks;                ///< Blocks written
+    atomic<bool> failed;                    ///< A write failed
+
+    TraceRecorder(const TraceRecorder &) = delete;
+    TraceRecorder &operator=(const TraceRecorder &) = delete;
+
+    Stripe &stripeOfThisThread();
+    void seal(Stripe &stripe);
+    void runWriter();
+};
+
+/**
+ * @struct ReplayOptions
+ * @brief How a TraceReplayer paces a trace
+ */
+struct ReplayOptions
+{
+    double speed;       ///< Multiple of the captured pace; 0 replays as fast as possible
+    int threads;        ///< Threads issuing lines; a session always maps to the same thread
+
+    ReplayOptions() : speed(1.0), threads(1) {}
+};
+
+/**
+ * @class TraceReplayer
+ * @brief Re-drives a tracker with a captured trace at its original pacing
+ * 
+ * Each line is due at its captured time, measured from the first line
+ * and divided by the speed. Threads own whole sessions, so the lines of
+ * a session keep their order; each thread sleeps, then spins for the
+ * last TRACE_SPIN_NANOS, until its next line is due, and never waits
+ * to catch up. As in the load generator, response latency runs from the
+ * time a line was due, so a stall also counts against every line that
+ * was due during it; service latency is executeLine alone.
+ */
+class TraceReplayer
+{
+public:
+    /**
+     * @brief Constructor
+     * @param tracker Tracker receiving the lines; must be concurrent if
+     *        options.threads > 1
+     * @param options Pacing and threads
+     */
+    TraceReplayer(WitcherTracker &tracker, const ReplayOptions &options);
+
+    /**
+     * @brief Replays every event and returns when the last line has run
+     * @param events Events in time order, as load() returns them
+     */
+    void run(const vector<TraceEvent> &events);
+
+    /**
+     * @brief Writes a summary line and the response and service latency percentiles
+     * @param out Stream receiving the report
+     */
+    void writeReport(ostream &out) const;
+
+private:
+    struct Lane;
+
+    WitcherTracker &tracker;        ///< Receives the lines
+    ReplayOptions options;          ///< Pacing and threads
+    LatencyHistogram response;      ///< Due time to completion, over all threads
+    LatencyHistogram service;       ///< executeLine time, over all threads
+    uint64_t lines;                 ///< Lines replayed
+    uint64_t invalid;               ///< Lines the tracker rejected
+    uint64_t maxLagNanos;           ///< Longest a line started after it was due
+    double elapsedMillis;           ///< Wall time of the replay
+
+    void runLane(Lane &lane, const vector<TraceEvent> &events, uint64_t start);
 };
 
-#endif // WITCHER_TRACKER_H
\ No newline at end of file
+#endif // WITCHER_TRACKER_H
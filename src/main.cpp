@@ -1,5 +1,10 @@
 #include <iostream>
 #include <string>
+#include <csignal>
+#include <chrono>
+#include <fstream>
+#include <cstdlib>
+#include <unistd.h>
 #include "WitcherTracker.h"
 
 using namespace std;
@@ -13,18 +18,488 @@ using namespace std;
  * and knowledge acquisition.
  */
 
+static volatile sig_atomic_t stopRequested = 0;
+
+/**
+ * @brief SIGINT/SIGTERM handler asking the server to shut down
+ */
+static void requestStop(int)
+{
+    stopRequested = 1;
+}
+
+/**
+ * @brief Resident set size of this process
+ * @return Bytes, 0 if /proc is unavailable
+ */
+static size_t residentBytes()
+{
+    ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    if (!(statm >> pages >> resident))
+        return 0;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+/**
+ * @struct OnlineCompaction
+ * @brief Online compaction passes, run one slice at a time between commands
+ */
+struct OnlineCompaction
+{
+    long interval;          ///< Lines between the starts of two passes, 0 for none
+    long nextStart;         ///< Line count at which the next pass starts
+    bool running;           ///< A pass is in progress
+    size_t rssBefore;       ///< Resident bytes when the pass started
+    long slices;            ///< Slices of the pass so far
+    double longestSlice;    ///< Longest slice of the pass, in microseconds
+
+    explicit OnlineCompaction(long interval)
+        : interval(interval), nextStart(interval), running(false), rssBefore(0), slices(0), longestSlice(0)
+    {
+    }
+
+    /**
+     * @brief Runs one slice if a pass is due or in progress
+     * @param tracker Tracker to compact
+     * @param lines Lines executed so far
+     * @return true if a slice ran
+     * @side_effects Reports the RSS and the slices to stderr when a pass ends
+     */
+    bool poll(WitcherTracker &tracker, long lines)
+    {
+        if (interval > 0 && !running && lines >= nextStart)
+        {
+            running = true;
+            rssBefore = residentBytes();
+            slices = 0;
+            longestSlice = 0;
+        }
+        if (!running)
+            return false;
+
+        auto start = chrono::steady_clock::now();
+        bool done = tracker.compactStep();
+        chrono::duration<double, micro> elapsed = chrono::steady_clock::now() - start;
+        longestSlice = max(longestSlice, elapsed.count());
+        slices++;
+
+        // Starts that fall within a pass are skipped
+        if (done)
+        {
+            running = false;
+            nextStart = (lines / interval + 1) * interval;
+            cerr << fixed << setprecision(1) << "compaction at line " << lines << ": RSS " << rssBefore / 1048576.0
+                 << " MiB -> " << residentBytes() / 1048576.0 << " MiB, " << slices << " slices, longest "
+                 << longestSlice << "us\n";
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief Parses a comma-separated core list such as "2,3,6"
+ * @param list Text to parse
+ * @return Core numbers in order
+ */
+static vector<int> parseCpuList(const string &list)
+{
+    vector<int> cpus;
+    stringstream stream(list);
+    string item;
+    while (getline(stream, item, ','))
+    {
+        if (!item.empty())
+            cpus.push_back(atoi(item.c_str()));
+    }
+    return cpus;
+}
+
+/**
+ * @brief Serves commands over TCP until SIGINT or SIGTERM
+ * @param tracker Tracker executing the requests; concurrent if compaction runs
+ * @param options Server configuration
+ * @param compaction Passes started by the number of requests served
+ * @return 0 after a clean shutdown, 1 if the server cannot start
+ * @side_effects Writes the latency report to stderr on shutdown
+ */
+static int runServer(WitcherTracker &tracker, const ServerOptions &options, OnlineCompaction &compaction)
+{
+    signal(SIGINT, requestStop);
+    signal(SIGTERM, requestStop);
+
+    PollingServer server(tracker, options);
+    string error;
+    if (!server.start(error))
+    {
+        cerr << "Cannot start server: " << error << "\n";
+        return 1;
+    }
+    if (options.lockMemory && !server.isMemoryLocked())
+    {
+        cerr << "Warning: memory could not be locked; page faults may reach the request path\n";
+    }
+
+    // The workers do all the polling; this thread waits for a signal and
+    // runs the compaction slices, pausing between them to let commands in
+    while (!stopRequested)
+    {
+        bool sliced = compaction.poll(tracker, static_cast<long>(server.requestsServed()));
+        usleep(sliced ? SERVER_COMPACT_PAUSE_MICROS : 100000);
+    }
+
+    server.stop();
+    server.writeReport(cerr);
+    return 0;
+}
+
+/**
+ * @brief Serves commands over a shared-memory channel until SIGINT or SIGTERM
+ * @param tracker Tracker executing the requests
+ * @param segmentName shm_open name clients attach to
+ * @param compaction Passes run between requests
+ * @return 0 after a clean shutdown, 1 if the segment cannot be created or a client corrupts it
+ */
+static int runIpc(WitcherTracker &tracker, const string &segmentName, OnlineCompaction &compaction)
+{
+    signal(SIGINT, requestStop);
+    signal(SIGTERM, requestStop);
+
+    IpcChannel channel;
+    if (!channel.create(segmentName))
+    {
+        cerr << "Cannot create shared-memory segment " << segmentName << "\n";
+        return 1;
+    }
+
+    // The timeout only bounds how long a stop request goes unnoticed; a
+    // pass in progress gets the idle time instead
+    long served = 0;
+    while (!stopRequested && !channel.isFailed())
+    {
+        if (channel.serveOne(tracker, compaction.running ? 0 : 100))
+            served++;
+        compaction.poll(tracker, served);
+    }
+    if (channel.isFailed())
+    {
+        cerr << "Malformed record on " << segmentName << ", closing the channel\n";
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Replays a command log into a tracker, as the prompt loop would
+ * @param tracker Tracker receiving the commands
+ * @param in Log, one command per line, ending at EOF or "Exit"
+ * @return Number of lines replayed
+ */
+static long replayLog(WitcherTracker &tracker, istream &in)
+{
+    ostringstream sink;
+    string line;
+    long lines = 0;
+    while (getline(in, line) && line != "Exit")
+    {
+        tracker.executeLine(line, sink);
+        sink.str("");
+        lines++;
+    }
+    return lines;
+}
+
+/**
+ * @brief Reads a command log, decompressing it if it is a LogCodec frame
+ * @param path Log to read
+ * @param text Receives the log text
+ * @return false if the file cannot be read or its frame is corrupt
+ */
+static bool readLog(const string &path, string &text)
+{
+    ifstream in(path, ios::binary);
+    if (!in)
+    {
+        cerr << "Cannot read " << path << "\n";
+        return false;
+    }
+    text.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    if (!LogCodec::isCompressed(text))
+        return true;
+
+    string frame;
+    frame.swap(text);
+    if (!LogCodec::decompress(frame, text))
+    {
+        cerr << "Corrupt compressed log " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Writes the compacted form of a command log to standard output
+ * @param path Log to compact, plain or compressed
+ * @param compress true to write the compacted log as a LogCodec frame
+ *        seeded with the names of the rebuilt state
+ * @return 0 if the compacted log rebuilds the same state, 1 otherwise
+ * 
+ * The compacted log is replayed into a fresh tracker and the state digests
+ * of both runs are compared; the line counts, the replay times and the
+ * outcome are reported on standard error. A compressed log is decoded
+ * back before that replay, and the decode time and sizes are reported too.
+ */
+static int compactLog(const string &path, bool compress)
+{
+    string text;
+    if (!readLog(path, text))
+        return 1;
+
+    WitcherTracker original;
+    istringstream in(text);
+    auto start = chrono::steady_clock::now();
+    long before = replayLog(original, in);
+    chrono::duration<double, milli> originalTime = chrono::steady_clock::now() - start;
+
+    ostringstream compacted;
+    size_t after = original.writeEquivalentLog(compacted);
+    string output = compacted.str();
+
+    string frame;
+    chrono::duration<double, milli> decodeTime(0);
+    if (compress)
+    {
+        vector<string> names;
+        original.collectKnownNames(names);
+        LogCodec(names).compress(output, frame);
+
+        start = chrono::steady_clock::now();
+        bool decoded = LogCodec::decompress(frame, output);
+        decodeTime = chrono::steady_clock::now() - start;
+        if (!decoded)
+        {
+            cerr << "compressed log does not decode\n";
+            return 1;
+        }
+    }
+
+    WitcherTracker rebuilt;
+    istringstream replay(output);
+    start = chrono::steady_clock::now();
+    replayLog(rebuilt, replay);
+    chrono::duration<double, milli> compactedTime = chrono::steady_clock::now() - start;
+
+    bool equivalent = rebuilt.getStateDigest() == original.getStateDigest();
+    cout << (compress ? frame : output);
+    cerr << fixed << setprecision(2) << "compacted " << before << " lines to " << after << " lines, replay "
+         << originalTime.count() << "ms -> " << compactedTime.count() << "ms, state "
+         << (equivalent ? "identical" : "DIFFERENT") << "\n";
+    if (compress)
+    {
+        cerr << "compressed " << output.size() << " bytes to " << frame.size() << " bytes, decoded in "
+             << decodeTime.count() << "ms\n";
+    }
+    return equivalent ? 0 : 1;
+}
+
+/**
+ * @brief Re-drives a tracker with a captured trace
+ * @param tracker Tracker receiving the lines
+ * @param path Trace written with "--capture"
+ * @param options Pacing and threads
+ * @return 0 after the replay, 1 if the trace cannot be read
+ * @side_effects Writes the replay report and the resulting state digest to stderr
+ */
+static int replayTrace(WitcherTracker &tracker, const string &path, const ReplayOptions &options)
+{
+    vector<TraceEvent> events;
+    bool truncated;
+    if (!TraceRecorder::load(path, events, truncated))
+    {
+        cerr << "Cannot read trace " << path << "\n";
+        return 1;
+    }
+    if (truncated)
+    {
+        cerr << "Trace " << path << " ends inside a block, replaying the " << events.size()
+             << " lines before it\n";
+    }
+
+    TraceReplayer replayer(tracker, options);
+    replayer.run(events);
+    replayer.writeReport(cerr);
+    cerr << "replay state digest: " << tracker.getStateDigest().toString() << "\n";
+    return 0;
+}
+
 /**
  * @brief Main program entry point - runs the Witcher tracking system command loop
- * @return 0 on successful program termination
+ * @param argc Argument count
+ * @param argv Arguments; "--stats" writes runtime statistics to stderr on exit,
+ *             "--state FILE" keeps the state in a memory-mapped file and
+ *             "--durable" flushes that file at every update;
+ *             "--lsm DIR" keeps the inventory in an out-of-core store
+ *             whose scratch runs go to DIR;
+ *             "--checkpoint N" writes the state digest to stderr every N lines;
+ *             "--serve PORT" answers commands over TCP instead of stdin, with
+ *             "--workers N" pinned busy-polling threads on the cores given by
+ *             "--cpus LIST" and "--no-mlock" to skip locking memory;
+ *             "--ipc NAME" serves a shared-memory channel instead;
+ *             "--compact N" starts an online compaction pass every N lines
+ *             or requests, running one slice after each line (between
+ *             requests over IPC, from the main thread with TCP) and
+ *             reporting RSS to stderr;
+ *             "--compact-log FILE" writes an equivalent, compacted version
+ *             of a command log to stdout and exits, as a compressed frame
+ *             with "--compress";
+ *             "--restore FILE" replays a plain or compressed command log
+ *             before serving or reading commands;
+ *             "--snapshot FILE" writes the state to FILE from a forked
+ *             child when stdin ends, and every N lines with
+ *             "--snapshot-every N", compressed with "--compress" (not
+ *             together with "--state");
+ *             "--capture FILE" records every line received, from stdin,
+ *             TCP or IPC, with its time and session into a binary trace;
+ *             "--replay FILE" re-drives the tracker with a trace instead of
+ *             reading commands, at "--speed X" times the captured pace
+ *             (0 for as fast as possible) on "--workers N" threads
+ * @return 0 on successful program termination, 1 if the state file or
+ *         the out-of-core store cannot be used, snapshots are asked of a
+ *         state file, a log or trace cannot be
+ *         read or written, the server cannot start or a compacted log
+ *         does not rebuild the same state
  * 
  * Initializes the WitcherTracker system and enters an interactive command loop
  * that processes user input until EOF or "Exit" command is received.
  */
-int main()
+int main(int argc, char *argv[])
 {
-    // Initialize the main tracking system
-    WitcherTracker tracker;
+    bool printStats = false;
+    bool durable = false;
+    long checkpointInterval = 0;
+    long compactInterval = 0;
+    string statePath;
+    string lsmPath;
+    ServerOptions serverOptions;
+    string ipcName;
+    string compactPath;
+    bool compress = false;
+    string restorePath;
+    string snapshotPath;
+    long snapshotInterval = 0;
+    string capturePath;
+    string replayPath;
+    ReplayOptions replayOptions;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--stats")
+            printStats = true;
+        else if (arg == "--durable")
+            durable = true;
+        else if (arg == "--state" && i + 1 < argc)
+            statePath = argv[++i];
+        else if (arg == "--lsm" && i + 1 < argc)
+            lsmPath = argv[++i];
+        else if (arg == "--checkpoint" && i + 1 < argc)
+            checkpointInterval = atol(argv[++i]);
+        else if (arg == "--serve" && i + 1 < argc)
+            serverOptions.port = atoi(argv[++i]);
+        else if (arg == "--workers" && i + 1 < argc)
+            serverOptions.workers = atoi(argv[++i]);
+        else if (arg == "--cpus" && i + 1 < argc)
+            serverOptions.cpus = parseCpuList(argv[++i]);
+        else if (arg == "--no-mlock")
+            serverOptions.lockMemory = false;
+        else if (arg == "--ipc" && i + 1 < argc)
+            ipcName = argv[++i];
+        else if (arg == "--compact" && i + 1 < argc)
+            compactInterval = atol(argv[++i]);
+        else if (arg == "--compact-log" && i + 1 < argc)
+            compactPath = argv[++i];
+        else if (arg == "--compress")
+            compress = true;
+        else if (arg == "--restore" && i + 1 < argc)
+            restorePath = argv[++i];
+        else if (arg == "--snapshot" && i + 1 < argc)
+            snapshotPath = argv[++i];
+        else if (arg == "--snapshot-every" && i + 1 < argc)
+            snapshotInterval = atol(argv[++i]);
+        else if (arg == "--capture" && i + 1 < argc)
+            capturePath = argv[++i];
+        else if (arg == "--replay" && i + 1 < argc)
+            replayPath = argv[++i];
+        else if (arg == "--speed" && i + 1 < argc)
+            replayOptions.speed = atof(argv[++i]);
+    }
+
+    if (!compactPath.empty())
+        return compactLog(compactPath, compress);
+
+    // Initialize the main tracking system; several server or replay workers share it
+    replayOptions.threads = serverOptions.workers;
+    // A server compacts from its main thread, beside the workers
+    WitcherTracker tracker(((serverOptions.port > 0 || !replayPath.empty()) && serverOptions.workers > 1) ||
+                           (serverOptions.port > 0 && compactInterval > 0));
+    if (printStats)
+        tracker.enableTrafficStats();
+    if (!statePath.empty() && !tracker.openStateFile(statePath, durable))
+    {
+        cerr << "Cannot open state file " << statePath << "\n";
+        return 1;
+    }
+    // The child would read the shared mapping while the parent changes it
+    if (!statePath.empty() && !snapshotPath.empty())
+    {
+        cerr << "Cannot snapshot state file " << statePath << "\n";
+        return 1;
+    }
+    if (!lsmPath.empty() && !tracker.openLsmStore(lsmPath))
+    {
+        cerr << "Cannot keep the inventory in " << lsmPath << "\n";
+        return 1;
+    }
+
+    if (!restorePath.empty())
+    {
+        string text;
+        if (!readLog(restorePath, text))
+            return 1;
+        istringstream in(text);
+        replayLog(tracker, in);
+    }
+
+    // Restored lines are not part of the capture
+    TraceRecorder recorder(tracker.isConcurrent());
+    if (!capturePath.empty())
+    {
+        if (!recorder.open(capturePath))
+        {
+            cerr << "Cannot create trace " << capturePath << "\n";
+            return 1;
+        }
+        tracker.attachTrace(&recorder);
+    }
+
+    OnlineCompaction compaction(compactInterval);
+    if (serverOptions.port > 0 || !ipcName.empty() || !replayPath.empty())
+    {
+        int status = !replayPath.empty()      ? replayTrace(tracker, replayPath, replayOptions)
+                     : serverOptions.port > 0 ? runServer(tracker, serverOptions, compaction)
+                                              : runIpc(tracker, ipcName, compaction);
+        if (!recorder.close())
+            cerr << "Trace " << capturePath << " is incomplete\n";
+        if (printStats)
+        {
+            tracker.writeStats(cerr);
+            if (!capturePath.empty())
+                recorder.writeStats(cerr);
+        }
+        return status;
+    }
     string line;
+    long lineNumber = 0;
+    SnapshotWriter snapshots;
 
     // Main command processing loop
     while (true)
@@ -45,6 +520,45 @@ int main()
         {
             cout << "INVALID\n";
         }
+
+        // Checkpoints of two runs over the same input line up, so the
+        // first differing digest pinpoints where they diverged
+        lineNumber++;
+        if (checkpointInterval > 0 && lineNumber % checkpointInterval == 0)
+        {
+            cerr << "checkpoint " << lineNumber << ": " << tracker.getStateDigest().toString() << "\n";
+        }
+
+        // A snapshot still being written when the next one is due is not interrupted
+        if (!snapshotPath.empty())
+        {
+            snapshots.poll(cerr);
+            if (snapshotInterval > 0 && lineNumber % snapshotInterval == 0 && !snapshots.running())
+                snapshots.start(tracker, snapshotPath, compress);
+        }
+
+        // One compaction slice between commands keeps every pause short
+        compaction.poll(tracker, lineNumber);
+    }
+
+    if (!snapshotPath.empty())
+    {
+        snapshots.wait(cerr);
+        if (!snapshots.start(tracker, snapshotPath, compress))
+            cerr << "Cannot start a snapshot\n";
+        snapshots.wait(cerr);
+    }
+
+    if (!recorder.close())
+        cerr << "Trace " << capturePath << " is incomplete\n";
+
+    if (printStats)
+    {
+        tracker.writeStats(cerr);
+        if (!snapshotPath.empty())
+            snapshots.writeStats(cerr);
+        if (!capturePath.empty())
+            recorder.writeStats(cerr);
     }
 
     return 0;